@@ -89,12 +89,255 @@
     code_len = TINFL_FAST_LOOKUP_BITS; do { temp = (pHuff)->m_tree[~temp + ((bit_buf >> code_len++) & 1)]; } while (temp < 0); \
   } sym = temp; bit_buf >>= code_len; num_bits -= code_len; } MZ_MACRO_END
 
+static const int s_length_base[31] = { 3,4,5,6,7,8,9,10,11,13, 15,17,19,23,27,31,35,43,51,59, 67,83,99,115,131,163,195,227,258,0,0 };
+static const int s_length_extra[31]= { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0,0,0 };
+static const int s_dist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193, 257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577,0,0};
+static const int s_dist_extra[32] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+// Fast decode loop.
+// tinfl_decode_fast() is used for the bulk of each Huffman block. It runs while there are at least TINFL_FAST_INPUT_MIN bytes of input and TINFL_FAST_OUTPUT_MIN bytes
+// of output space remaining, so it never needs to check for the end of either buffer within a symbol. Near the end of the buffers it returns and the state machine
+// in tinfl_decompress() carries on byte by byte. The bit buffer is refilled a whole word at a time (on 64-bit targets a single refill covers an entire
+// length/distance pair), literals are decoded in pairs using m_lit_look_up, and matches are copied 8 or 16 bytes at a time.
+#define TINFL_FAST_INPUT_MIN 16
+#define TINFL_FAST_OUTPUT_MIN (258 + 16)
+
+// The loop is kept out of line, inlining it into the coroutine makes the compiler spill its state on every symbol.
+#ifdef __GNUC__
+  #define TINFL_NOINLINE __attribute__((noinline))
+#else
+  #define TINFL_NOINLINE
+#endif
+
+// Entries in m_lit_look_up and m_dist_look_up: the number of bits to consume in bits 0-4 and the code length in bits 5-8. Literal/length entries then hold
+// either TINFL_FAST_LITERAL with one literal in bits 16-23 (and TINFL_FAST_PAIR with a second one in bits 24-31), TINFL_FAST_END_OF_BLOCK, or a match length
+// base in bits 16-24; distance entries hold a distance base in bits 16-31. For lengths and distances the bits to consume include the extra bits. An entry of 0
+// means the code is longer than TINFL_FAST_LOOKUP_BITS (or invalid) and must be decoded with m_look_up/m_tree.
+#define TINFL_FAST_LITERAL 0x200
+#define TINFL_FAST_PAIR 0x400
+#define TINFL_FAST_END_OF_BLOCK 0x800
+
+#if MINIZ_USE_UNALIGNED_LOADS_AND_STORES && MINIZ_LITTLE_ENDIAN
+  #define MZ_READ_LE64(p) *((const mz_uint64 *)(p))
+#else
+  #define MZ_READ_LE64(p) ((mz_uint64)MZ_READ_LE32(p) | ((mz_uint64)MZ_READ_LE32((const mz_uint8 *)(p) + 4) << 32U))
+#endif
+
+// Refills the bit buffer with as many whole bytes as will fit. This loads a full word from the input and advances past however many bytes were consumed; the bits
+// of the following partial byte are also loaded, but as they are the same bits that the next refill will load, they don't need to be cleared until the loop exits.
+#if TINFL_USE_64BIT_BITBUF
+  #define TINFL_FAST_REFILL() do { bit_buf |= ((tinfl_bit_buf_t)MZ_READ_LE64(pIn_buf_cur)) << num_bits; pIn_buf_cur += (63 - num_bits) >> 3; num_bits |= 56; } MZ_MACRO_END
+#else
+  #define TINFL_FAST_REFILL() do { bit_buf |= ((tinfl_bit_buf_t)MZ_READ_LE32(pIn_buf_cur)) << num_bits; pIn_buf_cur += (31 - num_bits) >> 3; num_bits |= 24; } MZ_MACRO_END
+#endif
+
+#define TINFL_FAST_DECODE(sym, pHuff) do { \
+  int temp; mz_uint code_len; \
+  if ((temp = (pHuff)->m_look_up[bit_buf & (TINFL_FAST_LOOKUP_SIZE - 1)]) >= 0) \
+    code_len = temp >> 9, temp &= 511; \
+  else { \
+    code_len = TINFL_FAST_LOOKUP_BITS; do { temp = (pHuff)->m_tree[~temp + ((bit_buf >> code_len++) & 1)]; } while (temp < 0); \
+  } sym = temp; bit_buf >>= code_len; num_bits -= code_len; } MZ_MACRO_END
+
+#define TINFL_FAST_CONSUME(n) do { bit_buf >>= (n); num_bits -= (n); } MZ_MACRO_END
+
+// Builds the fast loop lookup tables from the literal/length and distance tables. A literal whose code leaves enough bits in the index for the following code
+// is paired with the literal that those bits decode to.
+static void tinfl_build_fast_look_up(tinfl_decompressor *r)
+{
+  const tinfl_huff_table *pTable = &r->m_tables[0], *pDist_table = &r->m_tables[1]; mz_uint i;
+  for (i = 0; i < TINFL_FAST_LOOKUP_SIZE; ++i)
+  {
+    int sym = pTable->m_look_up[i], sym2; mz_uint code_len, code_len2; mz_uint32 entry = 0;
+    if ((sym >= 0) && ((code_len = sym >> 9) != 0))
+    {
+      sym &= 511;
+      if (sym < 256)
+      {
+        entry = TINFL_FAST_LITERAL | (code_len << 5) | code_len | ((mz_uint32)sym << 16);
+        if (((sym2 = pTable->m_look_up[i >> code_len]) >= 0) && ((code_len2 = sym2 >> 9) != 0) && (code_len + code_len2 <= TINFL_FAST_LOOKUP_BITS) && ((sym2 & 511) < 256))
+          entry += TINFL_FAST_PAIR + code_len2 + ((mz_uint32)(sym2 & 255) << 24);
+      }
+      else if (sym == 256)
+        entry = TINFL_FAST_END_OF_BLOCK | (code_len << 5) | code_len;
+      else
+        entry = ((mz_uint32)s_length_base[sym - 257] << 16) | (code_len << 5) | (code_len + s_length_extra[sym - 257]);
+    }
+    r->m_lit_look_up[i] = entry;
+
+    entry = 0; sym = pDist_table->m_look_up[i];
+    if ((sym >= 0) && ((code_len = sym >> 9) != 0) && ((sym &= 511) < 30))
+      entry = ((mz_uint32)s_dist_base[sym] << 16) | (code_len << 5) | (code_len + s_dist_extra[sym]);
+    r->m_dist_look_up[i] = entry;
+  }
+}
+
+// Decodes symbols from the current Huffman block until the end of the block (returns 1), until the input or output buffer is nearly exhausted (returns 0), or
+// until an invalid distance is found (returns -1).
+static TINFL_NOINLINE int tinfl_decode_fast(tinfl_decompressor *r, const mz_uint8 **ppIn_buf_cur, const mz_uint8 *pIn_buf_end, mz_uint8 *pOut_buf_start, mz_uint8 **ppOut_buf_cur, mz_uint8 *pOut_buf_end, size_t out_buf_size_mask, tinfl_bit_buf_t *pBit_buf, mz_uint32 *pNum_bits, const mz_uint32 decomp_flags)
+{
+  const mz_uint8 *pIn_buf_cur = *ppIn_buf_cur, *const pIn_buf_fast_end = pIn_buf_end - TINFL_FAST_INPUT_MIN;
+  mz_uint8 *pOut_buf_cur = *ppOut_buf_cur, *const pOut_buf_fast_end = pOut_buf_end - TINFL_FAST_OUTPUT_MIN;
+  tinfl_bit_buf_t bit_buf = *pBit_buf; mz_uint32 num_bits = *pNum_bits;
+  const int non_wrapping = (decomp_flags & TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF) != 0;
+  const mz_uint32 *pLit_look_up = r->m_lit_look_up; mz_uint32 entry;
+  int result = 0;
+
+  // The bit buffer is refilled and the entry for the next symbol loaded at the end of each iteration, so that the lookup overlaps with the copy of a match.
+  TINFL_FAST_REFILL();
+  entry = pLit_look_up[bit_buf & (TINFL_FAST_LOOKUP_SIZE - 1)];
+  while ((pIn_buf_cur <= pIn_buf_fast_end) && (pOut_buf_cur <= pOut_buf_fast_end))
+  {
+    mz_uint32 counter, dist, num_extra; size_t dist_from_out_buf_start; const mz_uint8 *pSrc;
+
+    if (entry & TINFL_FAST_LITERAL)
+    {
+      TINFL_FAST_CONSUME(entry & 31);
+      pOut_buf_cur[0] = (mz_uint8)(entry >> 16);
+      if (entry & TINFL_FAST_PAIR) { pOut_buf_cur[1] = (mz_uint8)(entry >> 24); pOut_buf_cur += 2; } else pOut_buf_cur++;
+      TINFL_FAST_REFILL();
+      entry = pLit_look_up[bit_buf & (TINFL_FAST_LOOKUP_SIZE - 1)];
+      continue;
+    }
+    else if (entry & TINFL_FAST_END_OF_BLOCK)
+    {
+      TINFL_FAST_CONSUME(entry & 31);
+      result = 1; break;
+    }
+    else if (entry)
+    {
+      mz_uint code_len = (entry >> 5) & 15; num_extra = entry & 31;
+      counter = (entry >> 16) + ((mz_uint32)(bit_buf >> code_len) & ((1U << (num_extra - code_len)) - 1));
+      TINFL_FAST_CONSUME(num_extra);
+    }
+    else
+    {
+      mz_uint32 sym;
+      TINFL_FAST_DECODE(sym, &r->m_tables[0]);
+      if (sym < 256)
+      {
+        *pOut_buf_cur++ = (mz_uint8)sym;
+        TINFL_FAST_REFILL();
+        entry = pLit_look_up[bit_buf & (TINFL_FAST_LOOKUP_SIZE - 1)];
+        continue;
+      }
+      if (sym == 256) { result = 1; break; }
+      num_extra = s_length_extra[sym - 257]; counter = s_length_base[sym - 257];
+      if (num_extra) { counter += (mz_uint32)bit_buf & ((1U << num_extra) - 1); TINFL_FAST_CONSUME(num_extra); }
+    }
+
+#if !TINFL_USE_64BIT_BITBUF
+    TINFL_FAST_REFILL();
+#endif
+    if ((entry = r->m_dist_look_up[bit_buf & (TINFL_FAST_LOOKUP_SIZE - 1)]) != 0)
+    {
+      mz_uint code_len = (entry >> 5) & 15; num_extra = entry & 31;
+#if !TINFL_USE_64BIT_BITBUF
+      // The extra bits may not all be in the buffer yet, refill after the code.
+      TINFL_FAST_CONSUME(code_len); TINFL_FAST_REFILL(); num_extra -= code_len; code_len = 0;
+#endif
+      dist = (entry >> 16) + ((mz_uint32)(bit_buf >> code_len) & ((1U << (num_extra - code_len)) - 1));
+      TINFL_FAST_CONSUME(num_extra);
+    }
+    else
+    {
+      TINFL_FAST_DECODE(dist, &r->m_tables[1]);
+#if !TINFL_USE_64BIT_BITBUF
+      TINFL_FAST_REFILL();
+#endif
+      num_extra = s_dist_extra[dist]; dist = s_dist_base[dist];
+      if (num_extra) { dist += (mz_uint32)bit_buf & ((1U << num_extra) - 1); TINFL_FAST_CONSUME(num_extra); }
+    }
+    TINFL_FAST_REFILL();
+    entry = pLit_look_up[bit_buf & (TINFL_FAST_LOOKUP_SIZE - 1)];
+
+    dist_from_out_buf_start = pOut_buf_cur - pOut_buf_start;
+    if (dist > dist_from_out_buf_start)
+    {
+      // Matches reaching back past the start of the buffer are only valid in a wrapping dictionary, copy them the slow way.
+      if (non_wrapping) { result = -1; break; }
+      while (counter--) *pOut_buf_cur++ = pOut_buf_start[(dist_from_out_buf_start++ - dist) & out_buf_size_mask];
+      continue;
+    }
+
+    // When the output buffer is not a wrapping dictionary, copies may write up to 15 bytes past the end of the match; the space is checked for above, and the
+    // bytes are overwritten by the following output. In a wrapping dictionary those bytes still hold the oldest part of the window, so copies must be exact.
+    pSrc = pOut_buf_cur - dist;
+#if MINIZ_USE_UNALIGNED_LOADS_AND_STORES
+    if (dist >= 8)
+    {
+      mz_uint8 *pOut_match_end = pOut_buf_cur + counter;
+      if (non_wrapping)
+      {
+        if (dist >= 16)
+        {
+          do
+          {
+            ((mz_uint64 *)pOut_buf_cur)[0] = ((const mz_uint64 *)pSrc)[0];
+            ((mz_uint64 *)pOut_buf_cur)[1] = ((const mz_uint64 *)pSrc)[1];
+            pSrc += 16;
+          } while ((pOut_buf_cur += 16) < pOut_match_end);
+        }
+        else
+        {
+          do
+          {
+            ((mz_uint64 *)pOut_buf_cur)[0] = ((const mz_uint64 *)pSrc)[0];
+            pSrc += 8;
+          } while ((pOut_buf_cur += 8) < pOut_match_end);
+        }
+      }
+      else if (counter >= 8)
+      {
+        // Copy whole words, then finish with a word ending exactly at the end of the match.
+        const mz_uint8 *pSrc_end = pSrc + counter;
+        for ( ; counter >= 8; counter -= 8, pSrc += 8, pOut_buf_cur += 8)
+          ((mz_uint64 *)pOut_buf_cur)[0] = ((const mz_uint64 *)pSrc)[0];
+        if (counter)
+          ((mz_uint64 *)pOut_match_end)[-1] = ((const mz_uint64 *)pSrc_end)[-1];
+      }
+      else if (counter >= 4)
+      {
+        ((mz_uint32 *)pOut_buf_cur)[0] = ((const mz_uint32 *)pSrc)[0];
+        ((mz_uint32 *)pOut_match_end)[-1] = ((const mz_uint32 *)(pSrc + counter))[-1];
+      }
+      else
+      {
+        while (counter--) *pOut_buf_cur++ = *pSrc++;
+      }
+      pOut_buf_cur = pOut_match_end;
+      continue;
+    }
+    else if ((dist == 1) && (non_wrapping))
+    {
+      mz_uint64 pattern = pSrc[0] * 0x0101010101010101ULL; mz_uint8 *pOut_match_end = pOut_buf_cur + counter;
+      do
+      {
+        ((mz_uint64 *)pOut_buf_cur)[0] = pattern;
+        ((mz_uint64 *)pOut_buf_cur)[1] = pattern;
+      } while ((pOut_buf_cur += 16) < pOut_match_end);
+      pOut_buf_cur = pOut_match_end;
+      continue;
+    }
+#endif
+    while (counter >= 3)
+    {
+      pOut_buf_cur[0] = pSrc[0];
+      pOut_buf_cur[1] = pSrc[1];
+      pOut_buf_cur[2] = pSrc[2];
+      pOut_buf_cur += 3; pSrc += 3; counter -= 3;
+    }
+    while (counter--) *pOut_buf_cur++ = *pSrc++;
+  }
+
+  // Clear the bits of the partial byte that the refills loaded past num_bits, the state machine expects everything above num_bits to be 0.
+  bit_buf &= (((tinfl_bit_buf_t)1) << num_bits) - 1;
+  *ppIn_buf_cur = pIn_buf_cur; *ppOut_buf_cur = pOut_buf_cur; *pBit_buf = bit_buf; *pNum_bits = num_bits;
+  return result;
+}
+
 tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_next, size_t *pIn_buf_size, mz_uint8 *pOut_buf_start, mz_uint8 *pOut_buf_next, size_t *pOut_buf_size, const mz_uint32 decomp_flags)
 {
-  static const int s_length_base[31] = { 3,4,5,6,7,8,9,10,11,13, 15,17,19,23,27,31,35,43,51,59, 67,83,99,115,131,163,195,227,258,0,0 };
-  static const int s_length_extra[31]= { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0,0,0 };
-  static const int s_dist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193, 257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577,0,0};
-  static const int s_dist_extra[32] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
   static const mz_uint8 s_length_dezigzag[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
   static const int s_min_table_sizes[3] = { 257, 1, 4 };
 
@@ -213,9 +456,20 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
           TINFL_MEMCPY(r->m_tables[0].m_code_size, r->m_len_codes, r->m_table_sizes[0]); TINFL_MEMCPY(r->m_tables[1].m_code_size, r->m_len_codes + r->m_table_sizes[0], r->m_table_sizes[1]);
         }
       }
+      tinfl_build_fast_look_up(r);
       for ( ; ; )
       {
         mz_uint8 *pSrc;
+        if (((pIn_buf_end - pIn_buf_cur) >= TINFL_FAST_INPUT_MIN) && ((pOut_buf_end - pOut_buf_cur) >= TINFL_FAST_OUTPUT_MIN))
+        {
+          int result = tinfl_decode_fast(r, &pIn_buf_cur, pIn_buf_end, pOut_buf_start, &pOut_buf_cur, pOut_buf_end, out_buf_size_mask, &bit_buf, &num_bits, decomp_flags);
+          if (result < 0)
+          {
+            TINFL_CR_RETURN_FOREVER(54, TINFL_STATUS_FAILED);
+          }
+          else if (result > 0)
+            break;
+        }
         for ( ; ; )
         {
           if (((pIn_buf_end - pIn_buf_cur) < 4) || ((pOut_buf_end - pOut_buf_cur) < 2))
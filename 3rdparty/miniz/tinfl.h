@@ -125,6 +125,8 @@ struct tinfl_decompressor_tag
   size_t m_dist_from_out_buf_start;
   tinfl_huff_table m_tables[TINFL_MAX_HUFF_TABLES];
   mz_uint8 m_raw_header[4], m_len_codes[TINFL_MAX_HUFF_SYMBOLS_0 + TINFL_MAX_HUFF_SYMBOLS_1 + 137];
+  // Lookup tables used by the fast decode loop, built from m_tables[0] and m_tables[1] for each block. Entries hold up to two literals or a decoded length/distance base.
+  mz_uint32 m_lit_look_up[TINFL_FAST_LOOKUP_SIZE], m_dist_look_up[TINFL_FAST_LOOKUP_SIZE];
 };
 
 #endif // #ifdef TINFL_HEADER_INCLUDED
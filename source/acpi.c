@@ -0,0 +1,178 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               ACPI table lookup.
+ *
+ * The platform locates the RSDP (see target_acpi_rsdp()), and tables are then
+ * found through the XSDT, or the RSDT on ACPI 1.0 systems. Tables are only
+ * read, never copied, so pointers returned are to firmware memory.
+ */
+
+#include <lib/string.h>
+#include <lib/utility.h>
+
+#include <acpi.h>
+#include <loader.h>
+
+/** Cached RSDP pointer. */
+static acpi_rsdp_t *acpi_rsdp;
+static bool acpi_probed;
+
+/** Check the checksum of an ACPI structure.
+ * @param data          Structure to check.
+ * @param size          Size of the structure.
+ * @return              Whether the checksum is valid. */
+static bool acpi_checksum(const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    uint8_t sum = 0;
+
+    for (size_t i = 0; i < size; i++)
+        sum += bytes[i];
+
+    return sum == 0;
+}
+
+/** Check whether an RSDP is valid.
+ * @param rsdp          RSDP to check.
+ * @return              Whether the RSDP is valid. */
+static bool is_valid_rsdp(acpi_rsdp_t *rsdp) {
+    if (memcmp(rsdp->signature, ACPI_RSDP_SIGNATURE, sizeof(rsdp->signature)) != 0)
+        return false;
+
+    if (!acpi_checksum(rsdp, ACPI_RSDP_V1_SIZE))
+        return false;
+
+    if (rsdp->revision >= 2 && !acpi_checksum(rsdp, rsdp->length))
+        return false;
+
+    return true;
+}
+
+/**
+ * Search a memory range for the RSDP.
+ *
+ * Searches for a valid RSDP on a 16 byte boundary in the given range. This is
+ * used by platforms that have to scan memory for the RSDP.
+ *
+ * @param start         Start of the range to search.
+ * @param size          Size of the range to search.
+ *
+ * @return              Pointer to RSDP if found, NULL if not.
+ */
+acpi_rsdp_t *acpi_scan_rsdp(phys_ptr_t start, phys_size_t size) {
+    for (phys_ptr_t addr = round_up(start, 16); addr + sizeof(acpi_rsdp_t) <= start + size; addr += 16) {
+        acpi_rsdp_t *rsdp = (acpi_rsdp_t *)phys_to_virt(addr);
+
+        if (is_valid_rsdp(rsdp))
+            return rsdp;
+    }
+
+    return NULL;
+}
+
+/** Map an ACPI table and check that it is valid.
+ * @param addr          Physical address of the table.
+ * @param signature     Expected signature (NULL to not check).
+ * @return              Pointer to table if valid, NULL if not. */
+static acpi_header_t *get_table(phys_ptr_t addr, const char *signature) {
+    acpi_header_t *header;
+
+    if (!addr || addr > TARGET_PHYS_MAX)
+        return NULL;
+
+    header = (acpi_header_t *)phys_to_virt(addr);
+
+    if (signature && memcmp(header->signature, signature, sizeof(header->signature)) != 0)
+        return NULL;
+
+    if (header->length < sizeof(*header) || !acpi_checksum(header, header->length))
+        return NULL;
+
+    return header;
+}
+
+/**
+ * Find an ACPI table.
+ *
+ * @param signature     Signature of the table to find.
+ *
+ * @return              Pointer to table if found, NULL if not (or if ACPI is
+ *                      not available).
+ */
+void *acpi_find_table(const char *signature) {
+    acpi_header_t *root;
+    size_t entry_size, count;
+
+    if (!acpi_probed) {
+        acpi_rsdp = target_acpi_rsdp();
+        acpi_probed = true;
+
+        if (acpi_rsdp)
+            dprintf("acpi: RSDP at %p (revision %u)\n", acpi_rsdp, acpi_rsdp->revision);
+    }
+
+    if (!acpi_rsdp)
+        return NULL;
+
+    /* Prefer the XSDT, which can reference tables above 4GB. */
+    root = NULL;
+    if (acpi_rsdp->revision >= 2) {
+        root = get_table(acpi_rsdp->xsdt_address, ACPI_XSDT_SIGNATURE);
+        entry_size = sizeof(uint64_t);
+    }
+
+    if (!root) {
+        root = get_table(acpi_rsdp->rsdt_address, ACPI_RSDT_SIGNATURE);
+        entry_size = sizeof(uint32_t);
+
+        if (!root)
+            return NULL;
+    }
+
+    count = (root->length - sizeof(*root)) / entry_size;
+    for (size_t i = 0; i < count; i++) {
+        uint8_t *entry = (uint8_t *)(root + 1) + (i * entry_size);
+        phys_ptr_t addr;
+        acpi_header_t *table;
+
+        /* Entries are not necessarily naturally aligned. */
+        if (entry_size == sizeof(uint64_t)) {
+            uint64_t val;
+            memcpy(&val, entry, sizeof(val));
+            addr = val;
+        } else {
+            uint32_t val;
+            memcpy(&val, entry, sizeof(val));
+            addr = val;
+        }
+
+        table = get_table(addr, signature);
+        if (table)
+            return table;
+    }
+
+    return NULL;
+}
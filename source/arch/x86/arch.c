@@ -29,6 +29,7 @@
 
 #include <x86/cpu.h>
 #include <x86/descriptor.h>
+#include <x86/string.h>
 #include <x86/time.h>
 
 #include <loader.h>
@@ -46,6 +47,9 @@ void arch_init(void) {
     boot_error("CPU does not support CPUID");
   }
 
+  // Select string function implementations
+  x86_string_init();
+
   // Init descriptor table
   x86_descriptor_init();
 
@@ -53,6 +57,27 @@ void arch_init(void) {
   x86_time_init();
 }
 
+/**
+ * Get the ID of the current CPU.
+ *
+ * @return      x2APIC ID if supported, otherwise the initial local APIC ID.
+ */
+uint32_t arch_cpu_id(void) {
+  x86_cpuid_t cpuid;
+
+  x86_cpuid(X86_CPUID_VENDOR_ID, &cpuid);
+  if (cpuid.eax >= X86_CPUID_X2APIC) {
+    x86_cpuid(X86_CPUID_X2APIC, &cpuid);
+
+    // EBX is zero if the leaf is not really supported.
+    if (cpuid.ebx)
+      return cpuid.edx;
+  }
+
+  x86_cpuid(X86_CPUID_FEATURE_INFO, &cpuid);
+  return cpuid.ebx >> 24;
+}
+
 /**
  * Halt the system.
  */
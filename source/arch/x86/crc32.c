@@ -0,0 +1,118 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               x86 CRC acceleration.
+ *
+ * CRC32C is calculated with the SSE4.2 CRC32 instruction. This operates on
+ * general purpose registers so can be used on all targets.
+ *
+ * CRC32 is calculated by folding the input with PCLMULQDQ (see x86_crc32_fold()
+ * in crc32.S). This requires SSE to be enabled, which is only guaranteed on
+ * 64-bit targets, so on 32-bit targets CRC32 is left to the generic code.
+ */
+
+#include <arch/crc32.h>
+
+#include <x86/cpu.h>
+
+/** Features detected from CPUID. */
+static uint32_t crc_features;
+static bool crc_features_detected;
+
+#ifdef CONFIG_64BIT
+extern uint32_t x86_crc32_fold(uint32_t crc, const void *buf, size_t size);
+#endif
+
+/** Get CPU features used for CRC calculation.
+ * @return              ECX value of the CPUID feature information leaf. */
+static uint32_t get_crc_features(void) {
+    if (!crc_features_detected) {
+        x86_cpuid_t cpuid;
+
+        x86_cpuid(X86_CPUID_FEATURE_INFO, &cpuid);
+        crc_features = cpuid.ecx;
+        crc_features_detected = true;
+    }
+
+    return crc_features;
+}
+
+/** Calculate a CRC32 using CPU instructions.
+ * @param crc           CRC register value to update.
+ * @param buf           Buffer to calculate over.
+ * @param size          Size of the buffer.
+ * @return              Number of bytes processed from the start of the buffer,
+ *                      the remainder must be processed by the caller. */
+size_t arch_crc32(uint32_t *crc, const void *buf, size_t size) {
+#ifdef CONFIG_64BIT
+    /* Folding works on 16 byte chunks, and needs at least 64 bytes. */
+    if (size >= 64 && get_crc_features() & X86_FEATURE_PCLMULQDQ) {
+        size &= ~(size_t)15;
+        *crc = x86_crc32_fold(*crc, buf, size);
+        return size;
+    }
+#endif
+
+    return 0;
+}
+
+/** Calculate a CRC32C using CPU instructions.
+ * @param crc           CRC register value to update.
+ * @param buf           Buffer to calculate over.
+ * @param size          Size of the buffer.
+ * @return              Number of bytes processed from the start of the buffer,
+ *                      the remainder must be processed by the caller. */
+size_t arch_crc32c(uint32_t *crc, const void *buf, size_t size) {
+    const uint8_t *ptr = buf;
+    unsigned long value = *crc;
+
+    if (!(get_crc_features() & X86_FEATURE_SSE4_2))
+        return 0;
+
+    while (size && ((ptr_t)ptr & (sizeof(unsigned long) - 1))) {
+        __asm__("crc32b %1, %k0" : "+r"(value) : "rm"(*ptr));
+        ptr++;
+        size--;
+    }
+
+    while (size >= sizeof(unsigned long)) {
+#ifdef CONFIG_64BIT
+        __asm__("crc32q %1, %0" : "+r"(value) : "rm"(*(const unsigned long *)ptr));
+#else
+        __asm__("crc32l %1, %0" : "+r"(value) : "rm"(*(const unsigned long *)ptr));
+#endif
+        ptr += sizeof(unsigned long);
+        size -= sizeof(unsigned long);
+    }
+
+    while (size--) {
+        __asm__("crc32b %1, %k0" : "+r"(value) : "rm"(*ptr));
+        ptr++;
+    }
+
+    *crc = value;
+    return (const uint8_t *)ptr - (const uint8_t *)buf;
+}
@@ -32,6 +32,11 @@
 
 #include <types.h>
 
+/** The architecture provides optimized memory copy and fill functions. */
+#define TARGET_HAS_MEMCPY   1
+#define TARGET_HAS_MEMSET   1
+#define TARGET_HAS_MEMMOVE  1
+
 /**
  * Spin loop hint.
  */
@@ -40,5 +45,6 @@ static inline void arch_pause(void) {
 }
 
 extern void arch_init(void);
+extern uint32_t arch_cpu_id(void);
 
 #endif // __ARCH__LOADER_H
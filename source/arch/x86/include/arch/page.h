@@ -35,5 +35,6 @@
 #define PAGE_SIZE           0x1000          /**< Size of a page. */
 #define LARGE_PAGE_SIZE_32  0x400000        /**< 32-bit large page size. */
 #define LARGE_PAGE_SIZE_64  0x200000        /**< 64-bit large page size. */
+#define HUGE_PAGE_SIZE_64   0x40000000      /**< 64-bit huge (1GB) page size. */
 
 #endif /* __ARCH_PAGE_H */
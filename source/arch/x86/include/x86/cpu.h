@@ -91,6 +91,7 @@
 #define X86_CPUID_CACHE_PARMS	0x4		/**< Deterministic Cache Parameters. */
 #define X86_CPUID_MONITOR_MWAIT	0x5		/**< MONITOR/MWAIT Parameters. */
 #define X86_CPUID_DTS_POWER	0x6		/**< Digital Thermal Sensor and Power Management Parameters. */
+#define X86_CPUID_EXT_FEATURES	0x7		/**< Structured Extended Feature Flags. */
 #define X86_CPUID_DCA		0x9		/**< Direct Cache Access (DCA) Parameters. */
 #define X86_CPUID_PERFMON	0xa		/**< Architectural Performance Monitor Features. */
 #define X86_CPUID_X2APIC	0xb		/**< x2APIC Features/Processor Topology. */
@@ -110,7 +111,18 @@
 #define X86_FEATURE_PSE			(1<<3)		/**< Page Size Extension. */
 #define X86_FEATURE_TSC 		(1<<4) 		/**< Time Stamp Counter. */
 
+/** CPUID feature bits (ECX). */
+#define X86_FEATURE_PCLMULQDQ		(1<<1)		/**< Carry-less Multiplication. */
+#define X86_FEATURE_SSE4_2		(1<<20)		/**< SSE4.2 (includes CRC32 instruction). */
+
+/** CPUID structured extended feature bits (EBX). */
+#define X86_FEATURE_ERMS		(1<<9)		/**< Enhanced REP MOVSB/STOSB. */
+
+/** CPUID structured extended feature bits (EDX). */
+#define X86_FEATURE_FSRM		(1<<4)		/**< Fast Short REP MOVSB. */
+
 /** CPUID extended feature bits. */
+#define X86_EXT_FEATURE_PDPE1GB		(1<<26)		/**< 1GB pages. */
 #define X86_EXT_FEATURE_LM 		(1<<29) 	/**< Long mode. */
 
 #ifndef __ASM__
@@ -199,6 +211,17 @@ static inline void x86_cpuid(uint32_t level, x86_cpuid_t *cpuid) {
 		: "0"(level));
 }
 
+/** Execute the CPUID instruction for a level with sub-leaves.
+ * @param level		CPUID level.
+ * @param subleaf	Sub-leaf index.
+ * @param cpuid		Where to store result of instruction. */
+static inline void x86_cpuid_subleaf(uint32_t level, uint32_t subleaf, x86_cpuid_t *cpuid) {
+	__asm__ __volatile__(
+		"cpuid"
+		: "=a"(cpuid->eax), "=b"(cpuid->ebx), "=c"(cpuid->ecx), "=d"(cpuid->edx)
+		: "0"(level), "2"(subleaf));
+}
+
 /**
  * Read the Time Stamp Counter.
  * @return  		Value of the TSC.
@@ -85,6 +85,10 @@ void initium_arch_check_kernel(initium_loader_t *loader) {
  * @param load          Load image tag.
  */
 void initium_arch_check_load_params(initium_loader_t *loader, initium_itag_load_t *load) {
+    /* Virtual allocations are placed to match the large page offset of their
+     * physical address where possible, see initium_alloc_virtual(). */
+    loader->large_page_size = (loader->mode == LOAD_MODE_64BIT) ? LARGE_PAGE_SIZE_64 : LARGE_PAGE_SIZE_32;
+
     if (!(load->flags & INITIUM_LOAD_FIXED) && !load->alignment) {
 	    /* Set default alignment parameters. Try to align to the large page size
 	     * so we can map using large pages, but fall back to 1MB if we're tight
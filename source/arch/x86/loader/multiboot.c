@@ -129,12 +129,42 @@ static void load_kernel_kludge(multiboot_loader_t *loader)
 	loader->kernel_end = alloc_base + alloc_size;
 }
 
+/** Maximum amount of image data to buffer for loading ELF sections. */
+#define SECTION_BUF_MAX (16 * 1024 * 1024)
+
+/** Copy section data out of the buffered image, or add a range to read it in.
+ * @param ranges        Ranges read from the image if it was buffered,
+ *                      otherwise array to add a range to.
+ * @param _count        Number of entries in the array, updated if a range is
+ *                      added.
+ * @param buffered      Whether the whole image is in the ranges.
+ * @param buf           Buffer to read into.
+ * @param size          Size of the data.
+ * @param offset        Offset of the data in the image. */
+static void read_section_data(
+	fs_read_range_t *ranges, size_t *_count, bool buffered, void *buf,
+	size_t size, offset_t offset)
+{
+	if (buffered) {
+		if (!fs_copy_from_ranges(ranges, *_count, buf, size, offset))
+			boot_error("Kernel section data is outside the image");
+	} else {
+		ranges[*_count].buf = buf;
+		ranges[*_count].count = size;
+		ranges[*_count].offset = offset;
+		(*_count)++;
+	}
+}
+
 /** Load an ELF Multiboot kernel.
  * @param loader        Loader internal data. */
 static void load_kernel_elf(multiboot_loader_t *loader)
 {
 	multiboot_elf_phdr_t *phdrs __cleanup_free;
-	size_t size;
+	fs_read_range_t *ranges __cleanup_free;
+	size_t size, count, buf_size = 0;
+	bool buffered = false;
+	void *buf = NULL;
 	status_t ret;
 
 	if (loader->ehdr.e_phentsize != sizeof(*phdrs))
@@ -147,7 +177,13 @@ static void load_kernel_elf(multiboot_loader_t *loader)
 	if (ret != STATUS_SUCCESS)
 		boot_error("Error reading kernel image: %pS", ret);
 
-	/* Load in the image data. */
+	/* Allocate space for each segment and work out what needs to be read. The
+	 * data is read afterwards in order of file offset, so that a compressed
+	 * image only needs to be decompressed once. Leave space for a range for
+	 * each gap between the segments as well, or for each section if they have
+	 * to be read separately. */
+	ranges = malloc((max(loader->ehdr.e_phnum * 2, loader->ehdr.e_shnum) + 1) * sizeof(*ranges));
+	count = 0;
 	loader->kernel_end = 0;
 	for (size_t i = 0; i < loader->ehdr.e_phnum; i++) {
 		if (phdrs[i].p_type == ELF_PT_LOAD) {
@@ -171,11 +207,11 @@ static void load_kernel_elf(multiboot_loader_t *loader)
 			/* Save highest address. */
 			loader->kernel_end = max(loader->kernel_end, alloc_base + alloc_size);
 
-			/* Read it in. */
 			if (phdrs[i].p_filesz) {
-				ret = fs_read(loader->handle, dest, phdrs[i].p_filesz, phdrs[i].p_offset);
-				if (ret != STATUS_SUCCESS)
-					boot_error("Error reading kernel image: %pS", ret);
+				ranges[count].buf = dest;
+				ranges[count].count = phdrs[i].p_filesz;
+				ranges[count].offset = phdrs[i].p_offset;
+				count++;
 			}
 
 			/* Clear zero-initialized sections. */
@@ -183,13 +219,37 @@ static void load_kernel_elf(multiboot_loader_t *loader)
 		}
 	}
 
+	/* The section headers are normally at the end of the image, after the
+	 * unloaded section data that they describe. So that the image is still
+	 * read in one pass, everything that is not part of a segment is read into
+	 * a temporary buffer as well, and the sections are copied out of the
+	 * ranges afterwards. If the buffer would be unreasonably large or cannot
+	 * be allocated, the sections are read separately instead. */
+	if (loader->ehdr.e_shnum) {
+		if (loader->ehdr.e_shentsize != sizeof(multiboot_elf_shdr_t))
+			boot_error("Invalid ELF section header size");
+
+		buf_size = fs_add_gap_ranges(ranges, &count, loader->handle->size, NULL);
+		if (buf_size && buf_size <= SECTION_BUF_MAX) {
+			buf = memory_alloc(
+				round_up(buf_size, PAGE_SIZE), 0, 0, 0, MEMORY_TYPE_INTERNAL,
+				MEMORY_ALLOC_HIGH | MEMORY_ALLOC_CAN_FAIL, NULL);
+		}
+
+		if (!buf_size || buf) {
+			fs_add_gap_ranges(ranges, &count, loader->handle->size, buf);
+			buffered = true;
+		}
+	}
+
+	ret = fs_read_ranges(loader->handle, ranges, count);
+	if (ret != STATUS_SUCCESS)
+		boot_error("Error reading kernel image: %pS", ret);
+
 	/* Load section headers. */
 	if (loader->ehdr.e_shnum) {
 		multiboot_elf_shdr_t *shdrs;
 
-		if (loader->ehdr.e_shentsize != sizeof(*shdrs))
-			boot_error("Invalid ELF section header size");
-
 		/* Allocate information area space, we pass them to the kernel. */
 		size = loader->ehdr.e_shnum * loader->ehdr.e_shentsize;
 		shdrs = multiboot_alloc_info(loader, size, &loader->info->elf.addr);
@@ -198,9 +258,17 @@ static void load_kernel_elf(multiboot_loader_t *loader)
 		loader->info->elf.size = loader->ehdr.e_shentsize;
 		loader->info->elf.shndx = loader->ehdr.e_shstrndx;
 
-		ret = fs_read(loader->handle, shdrs, size, loader->ehdr.e_shoff);
-		if (ret != STATUS_SUCCESS)
-			boot_error("Error reading kernel image: %pS", ret);
+		if (!buffered)
+			count = 0;
+
+		read_section_data(ranges, &count, buffered, shdrs, size, loader->ehdr.e_shoff);
+		if (!buffered) {
+			ret = fs_read_ranges(loader->handle, ranges, count);
+			if (ret != STATUS_SUCCESS)
+				boot_error("Error reading kernel image: %pS", ret);
+
+			count = 0;
+		}
 
 		/* Load in all unloaded sections. */
 		for (size_t i = 0; i < loader->ehdr.e_shnum; i++) {
@@ -225,13 +293,20 @@ static void load_kernel_elf(multiboot_loader_t *loader)
 			if (shdrs[i].sh_type == ELF_SHT_NOBITS) {
 				memset(dest, 0, shdrs[i].sh_size);
 			} else {
-				ret = fs_read(loader->handle, dest, shdrs[i].sh_size, shdrs[i].sh_offset);
-				if (ret != STATUS_SUCCESS)
-					boot_error("Error reading kernel image: %pS", ret);
+				read_section_data(ranges, &count, buffered, dest, shdrs[i].sh_size, shdrs[i].sh_offset);
 			}
 
 			shdrs[i].sh_addr = phys;
 		}
+
+		if (!buffered) {
+			ret = fs_read_ranges(loader->handle, ranges, count);
+			if (ret != STATUS_SUCCESS)
+				boot_error("Error reading kernel image: %pS", ret);
+		}
+
+		if (buf)
+			memory_free(buf, round_up(buf_size, PAGE_SIZE));
 	}
 
 	/* Save entry point address. */
@@ -49,28 +49,74 @@
 /** Whether large pages are supported. */
 static bool large_pages_supported = false;
 
+/** Whether huge (1GB) pages are supported (64-bit only). */
+static bool huge_pages_supported = false;
+
+/** Maximum number of paging structures to allocate at once. */
+#define MMU_POOL_PAGES      32
+
+/**
+ * Pool of preallocated paging structures for a memory type.
+ *
+ * On BIOS, memory_free() can take part of an allocation, so the unused tail
+ * of the last batch is returned by mmu_finalize(). The EFI memory_free() only
+ * takes whole allocations, as firmware need not support freeing part of a
+ * FreePages() allocation, so there the tail stays in the memory map typed as
+ * the pool's memory type. Batch sizes start small to limit that waste.
+ */
+typedef struct mmu_pool {
+    phys_ptr_t next;                /**< Next unused page. */
+    phys_ptr_t end;                 /**< End of the current batch. */
+    size_t batch_pages;             /**< Size of the last batch allocated. */
+} mmu_pool_t;
+
+/** Pools of paging structures, indexed by memory type. */
+static mmu_pool_t mmu_pools[MEMORY_TYPE_INTERNAL + 1];
+
 /** Allocate a paging structure.
  * @param ctx           Context to allocate for.
  * @return              Physical address allocated. */
 static phys_ptr_t allocate_structure(mmu_context_t *ctx) {
+    mmu_pool_t *pool;
     phys_ptr_t phys;
-    void *virt;
 
-    /* Allocate high to try to avoid any fixed kernel load location. */
-    virt = memory_alloc(PAGE_SIZE, PAGE_SIZE, 0, 0, ctx->phys_type, MEMORY_ALLOC_HIGH, &phys);
-    memset(virt, 0, PAGE_SIZE);
+    assert(ctx->phys_type < array_size(mmu_pools));
+    pool = &mmu_pools[ctx->phys_type];
+
+    /* Take structures from a contiguous batch so that we don't need to go to
+     * the memory allocator for each one, and so that they end up as a few
+     * large ranges in the memory map rather than one range per page. Allocate
+     * high to try to avoid any fixed kernel load location. Each batch is
+     * twice the size of the previous up to MMU_POOL_PAGES, which keeps the
+     * unused part of the last batch smaller than what is actually in use
+     * where it cannot be returned (see mmu_pool_t). */
+    if (pool->next == pool->end) {
+        pool->batch_pages = (pool->batch_pages)
+            ? min(pool->batch_pages * 2, MMU_POOL_PAGES)
+            : 1;
+
+        memory_alloc(
+            pool->batch_pages * PAGE_SIZE, PAGE_SIZE, 0, 0, ctx->phys_type,
+            MEMORY_ALLOC_HIGH, &pool->next);
+        pool->end = pool->next + (pool->batch_pages * PAGE_SIZE);
+    }
+
+    phys = pool->next;
+    pool->next += PAGE_SIZE;
+
+    memset((void *)phys_to_virt(phys), 0, PAGE_SIZE);
     return phys;
 }
 
-/** Get a page directory from a 64-bit context.
+/** Get a page directory pointer table from a 64-bit context.
  * @param ctx           Context to get from.
  * @param virt          Virtual address to get for (can be non-aligned).
  * @param alloc         Whether to allocate if not found.
- * @return              Address of page directory, or NULL if not found. */
-static uint64_t *get_pdir_64(mmu_context_t *ctx, uint64_t virt, bool alloc) {
-    uint64_t *pml4, *pdpt;
+ * @return              Address of PDPT, or NULL if not found. */
+static uint64_t *get_pdpt_64(mmu_context_t *ctx, uint64_t virt, bool alloc) {
+    uint64_t *pml4;
     phys_ptr_t addr;
-    unsigned pml4e, pdpte;
+    unsigned pml4e;
 
     pml4 = (uint64_t *)phys_to_virt(ctx->cr3);
 
@@ -84,8 +130,23 @@ static uint64_t *get_pdir_64(mmu_context_t *ctx, uint64_t virt, bool alloc) {
 	    pml4[pml4e] = addr | X86_PTE_PRESENT | X86_PTE_WRITE;
 	}
 
-    /* Get the PDPT from the PML4. */
-    pdpt = (uint64_t *)phys_to_virt((ptr_t)(pml4[pml4e] & X86_PTE_ADDR_MASK_64));
+    /* Return the PDPT address. */
+    return (uint64_t *)phys_to_virt((ptr_t)(pml4[pml4e] & X86_PTE_ADDR_MASK_64));
+}
+
+/** Get a page directory from a 64-bit context.
+ * @param ctx           Context to get from.
+ * @param virt          Virtual address to get for (can be non-aligned).
+ * @param alloc         Whether to allocate if not found.
+ * @return              Address of page directory, or NULL if not found. */
+static uint64_t *get_pdir_64(mmu_context_t *ctx, uint64_t virt, bool alloc) {
+    uint64_t *pdpt;
+    phys_ptr_t addr;
+    unsigned pdpte;
+
+    pdpt = get_pdpt_64(ctx, virt, alloc);
+    if (!pdpt)
+	return NULL;
 
     /* Get the page directory number. */
     pdpte = (virt % X86_PDPT_RANGE_64) / X86_PDIR_RANGE_64;
@@ -97,10 +158,33 @@ static uint64_t *get_pdir_64(mmu_context_t *ctx, uint64_t virt, bool alloc) {
 	    pdpt[pdpte] = addr | X86_PTE_PRESENT | X86_PTE_WRITE;
 	}
 
+    assert(!(pdpt[pdpte] & X86_PTE_LARGE));
+
     /* Return the page directory address. */
     return (uint64_t *)phys_to_virt((ptr_t)(pdpt[pdpte] & X86_PTE_ADDR_MASK_64));
 }
 
+/** Map a huge (1GB) page in a 64-bit context.
+ * @param ctx           Context to map in.
+ * @param virt          Virtual address to map.
+ * @param phys          Physical address to map to. */
+static void map_huge_64(mmu_context_t *ctx, uint64_t virt, uint64_t phys) {
+    uint64_t *pdpt;
+    unsigned pdpte;
+
+    assert(!(virt % HUGE_PAGE_SIZE_64));
+    assert(!(phys % HUGE_PAGE_SIZE_64));
+
+    pdpt = get_pdpt_64(ctx, virt, true);
+    pdpte = (virt % X86_PDPT_RANGE_64) / HUGE_PAGE_SIZE_64;
+
+    /* Nothing else can be mapped within the page, so there should not be a
+     * page directory here already. */
+    assert(!(pdpt[pdpte] & X86_PTE_PRESENT));
+
+    pdpt[pdpte] = phys | X86_PTE_PRESENT | X86_PTE_WRITE | X86_PTE_LARGE;
+}
+
 /** Map a large page in a 64-bit context.
  * @param ctx           Context to map in.
  * @param virt          Virtual address to map.
@@ -152,7 +236,8 @@ static void mmu_map_64(mmu_context_t *ctx, uint64_t virt, uint64_t phys, uint64_
      * this, align up to a 2MB boundary using small pages, map anything possible
      * with large pages, then do the rest using small pages. If virtual and
      * physical addresses are at different offsets from a large page boundary,
-     * we cannot map using large pages. */
+     * we cannot map using large pages. Huge pages are used in the same way
+     * within the large page mapped part if the CPU supports them. */
     if ((virt % LARGE_PAGE_SIZE_64) == (phys % LARGE_PAGE_SIZE_64)) {
 	    while (virt % LARGE_PAGE_SIZE_64 && size) {
 		    map_small_64(ctx, virt, phys);
@@ -160,6 +245,20 @@ static void mmu_map_64(mmu_context_t *ctx, uint64_t virt, uint64_t phys, uint64_
 		    phys += PAGE_SIZE;
 		    size -= PAGE_SIZE;
 		}
+	    if (huge_pages_supported && (virt % HUGE_PAGE_SIZE_64) == (phys % HUGE_PAGE_SIZE_64)) {
+		    while (virt % HUGE_PAGE_SIZE_64 && size / LARGE_PAGE_SIZE_64) {
+			    map_large_64(ctx, virt, phys);
+			    virt += LARGE_PAGE_SIZE_64;
+			    phys += LARGE_PAGE_SIZE_64;
+			    size -= LARGE_PAGE_SIZE_64;
+			}
+		    while (size / HUGE_PAGE_SIZE_64) {
+			    map_huge_64(ctx, virt, phys);
+			    virt += HUGE_PAGE_SIZE_64;
+			    phys += HUGE_PAGE_SIZE_64;
+			    size -= HUGE_PAGE_SIZE_64;
+			}
+		}
 	    while (size / LARGE_PAGE_SIZE_64) {
 		    map_large_64(ctx, virt, phys);
 		    virt += LARGE_PAGE_SIZE_64;
@@ -319,13 +418,23 @@ static bool mmu_mem_op_64(mmu_context_t *ctx, uint64_t addr, uint64_t size, unsi
 
 	    /* If we have crossed a page directory boundary, get new directory. */
 	    if (!pdir || !(addr % X86_PDIR_RANGE_64)) {
-		    pdir = get_pdir_64(ctx, addr, false);
-		    if (!pdir)
+		    uint64_t *pdpt = get_pdpt_64(ctx, addr, false);
+		    unsigned pdpte = (addr % X86_PDPT_RANGE_64) / X86_PDIR_RANGE_64;
+		    if (!pdpt || !(pdpt[pdpte] & X86_PTE_PRESENT))
 			return false;
+
+		    if (pdpt[pdpte] & X86_PTE_LARGE) {
+			    page = (pdpt[pdpte] & X86_PTE_ADDR_MASK_64) + (addr % HUGE_PAGE_SIZE_64);
+			    page_size = HUGE_PAGE_SIZE_64 - (addr % HUGE_PAGE_SIZE_64);
+			    pdir = ptbl = NULL;
+			} else {
+			    pdir = (uint64_t *)phys_to_virt((ptr_t)(pdpt[pdpte] & X86_PTE_ADDR_MASK_64));
+			    ptbl = NULL;
+			}
 		}
 
 	    /* Same for page table. */
-	    if (!ptbl || !(addr % X86_PTBL_RANGE_64)) {
+	    if (pdir && (!ptbl || !(addr % X86_PTBL_RANGE_64))) {
 		    unsigned pde = (addr % X86_PDIR_RANGE_64) / X86_PTBL_RANGE_64;
 		    if (!(pdir[pde] & X86_PTE_PRESENT))
 			return false;
@@ -486,6 +595,11 @@ mmu_context_t *mmu_context_create(load_mode_t mode, unsigned phys_type) {
         if (large_pages_supported) {
             x86_write_cr4(x86_read_cr4() | X86_CR4_PSE);
         }
+	} else {
+	    /* Check for 1GB page support. The extended function is known to be
+	     * present as we've already checked for long mode. */
+	    x86_cpuid(X86_CPUID_EXT_FEATURE, &cpuid);
+	    huge_pages_supported = cpuid.edx & X86_EXT_FEATURE_PDPE1GB;
 	}
 
     ctx = malloc(sizeof(*ctx));
@@ -494,3 +608,23 @@ mmu_context_t *mmu_context_create(load_mode_t mode, unsigned phys_type) {
     ctx->cr3 = allocate_structure(ctx);
     return ctx;
 }
+
+#ifndef TARGET_HAS_MM
+
+/** Release unused preallocated paging structures.
+ *
+ * Called when the memory map is finalized, after which no more paging
+ * structures can be allocated.
+ */
+void mmu_finalize(void) {
+    for (size_t i = 0; i < array_size(mmu_pools); i++) {
+        mmu_pool_t *pool = &mmu_pools[i];
+
+        if (pool->next != pool->end)
+            memory_free((void *)phys_to_virt(pool->next), pool->end - pool->next);
+
+        pool->next = pool->end = 0;
+    }
+}
+
+#endif /* TARGET_HAS_MM */
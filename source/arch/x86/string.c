@@ -0,0 +1,303 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * @file
+ * @brief               x86 memory copy and fill functions.
+ *
+ * These replace the generic versions in lib/string.c. Copies and fills use the
+ * string instructions, with the variant chosen from the CPU features detected
+ * by x86_string_init():
+ *
+ *  - With ERMS, REP MOVSB/STOSB are at least as fast as the wider forms, so
+ *    they are used directly. They have a startup cost which makes them slow for
+ *    short lengths unless FSRM is also present.
+ *  - Otherwise the bulk is moved a word at a time and the rest by bytes.
+ *  - Overlapping backward moves go a word at a time. The string instructions
+ *    are slow when run backwards.
+ *  - Large copies and fills on 64-bit targets use SSE2 non-temporal stores (see
+ *    string.S), which avoid evicting the whole cache for data the loader will
+ *    not touch again, and are much faster when writing to a write-combining
+ *    framebuffer. SSE is only guaranteed to be enabled on 64-bit targets.
+ *
+ * Until x86_string_init() is called only the baseline word copy is used, so
+ * these are safe to use from the earliest point.
+ */
+
+#include <x86/cpu.h>
+#include <x86/string.h>
+
+#include <lib/string.h>
+
+#ifdef __x86_64__
+# define STRING_MOVS        "movsq"
+# define STRING_STOS        "stosq"
+#else
+# define STRING_MOVS        "movsl"
+# define STRING_STOS        "stosl"
+#endif
+
+/** Minimum size to use REP MOVSB/STOSB for without FSRM. */
+#define STRING_ERMS_MIN     128
+
+/** Minimum size to use non-temporal stores for. */
+#define STRING_NT_MIN       0x40000
+
+/** Features detected by x86_string_init(). */
+static bool string_erms;
+static bool string_fsrm;
+
+#ifdef __x86_64__
+static bool string_nt;
+
+extern void x86_memcpy_nt(void *dest, const void *src, size_t count);
+extern void x86_memset_nt(void *dest, unsigned long val, size_t count);
+#endif
+
+/** Copy forwards using string instructions.
+ * @param dest          Destination.
+ * @param src           Source.
+ * @param count         Number of bytes to copy. */
+static inline void copy_forward(void *dest, const void *src, size_t count) {
+    size_t bytes;
+
+    if (string_fsrm || (string_erms && count >= STRING_ERMS_MIN)) {
+        __asm__ __volatile__(
+            "rep movsb"
+            : "+D"(dest), "+S"(src), "+c"(count)
+            :: "memory");
+    } else {
+        bytes = count % sizeof(unsigned long);
+        count /= sizeof(unsigned long);
+
+        __asm__ __volatile__(
+            "rep " STRING_MOVS "\n\t"
+            "mov %[bytes], %[count]\n\t"
+            "rep movsb"
+            : "+D"(dest), "+S"(src), [count] "+c"(count)
+            : [bytes] "r"(bytes)
+            : "memory");
+    }
+}
+
+/** Copy backwards a word at a time.
+ * @param dest          Destination.
+ * @param src           Source.
+ * @param count         Number of bytes to copy. */
+static inline void copy_backward(void *dest, const void *src, size_t count) {
+    size_t words = count / sizeof(unsigned long);
+    size_t bytes = count % sizeof(unsigned long);
+    unsigned long tmp, tmp2;
+
+    dest = (char *)dest + count;
+    src = (const char *)src + count;
+
+    /* Backward string instructions (with DF set) do not get the fast string
+     * microcode and are very slow, so use a simple loop. This is written in
+     * assembly so that the compiler cannot turn it back into a memmove() call.
+     * The odd bytes at the top go first, then blocks of 4 words, then the
+     * remaining words. */
+    if (bytes) {
+        __asm__ __volatile__(
+            "1:\n\t"
+            "dec %[src]\n\t"
+            "dec %[dest]\n\t"
+            "movb (%[src]), %b[tmp]\n\t"
+            "movb %b[tmp], (%[dest])\n\t"
+            "dec %[count]\n\t"
+            "jnz 1b"
+            : [dest] "+r"(dest), [src] "+r"(src), [count] "+r"(bytes), [tmp] "=&q"(tmp)
+            :: "memory");
+    }
+
+    if (words) {
+        size_t blocks = words / 4;
+
+        words %= 4;
+
+        if (blocks) {
+            __asm__ __volatile__(
+                "1:\n\t"
+                "sub %[size], %[src]\n\t"
+                "sub %[size], %[dest]\n\t"
+                "mov %c[w3](%[src]), %[a]\n\t"
+                "mov %c[w2](%[src]), %[b]\n\t"
+                "mov %[a], %c[w3](%[dest])\n\t"
+                "mov %[b], %c[w2](%[dest])\n\t"
+                "mov %c[w1](%[src]), %[a]\n\t"
+                "mov (%[src]), %[b]\n\t"
+                "mov %[a], %c[w1](%[dest])\n\t"
+                "mov %[b], (%[dest])\n\t"
+                "dec %[count]\n\t"
+                "jnz 1b"
+                : [dest] "+r"(dest), [src] "+r"(src), [count] "+r"(blocks),
+                  [a] "=&r"(tmp), [b] "=&r"(tmp2)
+                : [size] "i"(sizeof(unsigned long) * 4), [w1] "i"(sizeof(unsigned long)),
+                  [w2] "i"(sizeof(unsigned long) * 2), [w3] "i"(sizeof(unsigned long) * 3)
+                : "memory");
+        }
+
+        if (words) {
+            __asm__ __volatile__(
+                "1:\n\t"
+                "sub %[size], %[src]\n\t"
+                "sub %[size], %[dest]\n\t"
+                "mov (%[src]), %[tmp]\n\t"
+                "mov %[tmp], (%[dest])\n\t"
+                "dec %[count]\n\t"
+                "jnz 1b"
+                : [dest] "+r"(dest), [src] "+r"(src), [count] "+r"(words), [tmp] "=&r"(tmp)
+                : [size] "i"(sizeof(unsigned long))
+                : "memory");
+        }
+    }
+}
+
+/**
+ * Copy data in memory.
+ *
+ * Copies bytes from a source memory area to a destination memory area,
+ * where both areas may not overlap.
+ *
+ * @param dest          The memory area to copy to.
+ * @param src           The memory area to copy from.
+ * @param count         The number of bytes to copy.
+ *
+ * @return              Destination location.
+ */
+void *memcpy(void *__restrict dest, const void *__restrict src, size_t count) {
+#ifdef __x86_64__
+    if (string_nt && count >= STRING_NT_MIN) {
+        size_t head = -(ptr_t)dest & 15;
+        size_t bulk = (count - head) & ~(size_t)63;
+
+        /* Non-temporal stores need an aligned destination. */
+        copy_forward(dest, src, head);
+        x86_memcpy_nt((char *)dest + head, (const char *)src + head, bulk);
+        copy_forward((char *)dest + head + bulk, (const char *)src + head + bulk, count - head - bulk);
+        return dest;
+    }
+#endif
+
+    copy_forward(dest, src, count);
+    return dest;
+}
+
+/**
+ * Fill a memory area.
+ *
+ * @param dest          The memory area to fill.
+ * @param val           The value to fill with (converted to an unsigned char).
+ * @param count         The number of bytes to fill.
+ *
+ * @return              Destination location.
+ */
+void *memset(void *dest, int val, size_t count) {
+    unsigned long word = (unsigned char)val * (~0ul / 0xff);
+    void *d = dest;
+    size_t bytes;
+
+#ifdef __x86_64__
+    if (string_nt && count >= STRING_NT_MIN) {
+        size_t head = -(ptr_t)dest & 15;
+        size_t bulk = (count - head) & ~(size_t)63;
+
+        memset(d, val, head);
+        x86_memset_nt((char *)d + head, word, bulk);
+        d = (char *)d + head + bulk;
+        count -= head + bulk;
+    }
+#endif
+
+    if (string_fsrm || (string_erms && count >= STRING_ERMS_MIN)) {
+        __asm__ __volatile__(
+            "rep stosb"
+            : "+D"(d), "+c"(count)
+            : "a"(word)
+            : "memory");
+    } else {
+        bytes = count % sizeof(unsigned long);
+        count /= sizeof(unsigned long);
+
+        __asm__ __volatile__(
+            "rep " STRING_STOS "\n\t"
+            "mov %[bytes], %[count]\n\t"
+            "rep stosb"
+            : "+D"(d), [count] "+c"(count)
+            : "a"(word), [bytes] "r"(bytes)
+            : "memory");
+    }
+
+    return dest;
+}
+
+/**
+ * Copy overlapping data in memory.
+ *
+ * Copies bytes from a source memory area to a destination memory area,
+ * where both areas may overlap.
+ *
+ * @param dest          The memory area to copy to.
+ * @param src           The memory area to copy from.
+ * @param count         The number of bytes to copy.
+ *
+ * @return              Destination location.
+ */
+void *memmove(void *dest, const void *src, size_t count) {
+    if (dest == src || !count)
+        return dest;
+
+    /* A forward copy is safe unless the destination starts inside the source.
+     * Overlapping moves (e.g. console scrolling) always stay in the cache, as
+     * the result is normally read straight back. */
+    if ((ptr_t)dest - (ptr_t)src >= count) {
+        if ((ptr_t)src - (ptr_t)dest >= count) {
+            memcpy(dest, src, count);
+        } else {
+            copy_forward(dest, src, count);
+        }
+    } else {
+        copy_backward(dest, src, count);
+    }
+
+    return dest;
+}
+
+/** Select string function implementations for the CPU. */
+void x86_string_init(void) {
+    x86_cpuid_t cpuid;
+
+    x86_cpuid(X86_CPUID_VENDOR_ID, &cpuid);
+    if (cpuid.eax >= X86_CPUID_EXT_FEATURES) {
+        x86_cpuid_subleaf(X86_CPUID_EXT_FEATURES, 0, &cpuid);
+        string_erms = cpuid.ebx & X86_FEATURE_ERMS;
+        string_fsrm = string_erms && (cpuid.edx & X86_FEATURE_FSRM);
+    }
+
+#ifdef __x86_64__
+    /* SSE2 is architectural on 64-bit CPUs, and enabled by the firmware. */
+    string_nt = true;
+#endif
+}
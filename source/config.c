@@ -123,6 +123,8 @@ static int current_line;                /**< Current line in the file. */
 static int current_col;                 /**< Current column in the file (minus 1). */
 static unsigned current_nest_count;     /**< Current nesting count. */
 static int returned_char;               /**< Character returned with return_char() (0 is no char). */
+static arena_t *current_arena;          /**< Arena being parsed into. */
+static arena_t *prev_arena;             /**< Arena that was current before parsing. */
 
 /** Current file state used by config_load(). */
 static char *current_file;              /**< Pointer to data for current file. */
@@ -177,6 +179,13 @@ void config_error(const char *fmt, ...) {
   cmd = current_command;
   current_command = NULL;
 
+  /* The handler may not return, stop allocating from the parser's arena so
+   * that anything done from here on (e.g. in the shell) uses the heap. */
+  if (current_arena) {
+    arena_set_current(prev_arena);
+    current_arena = NULL;
+  }
+
   if (current_error_handler) {
     current_error_handler(cmd, fmt, args);
   } else {
@@ -578,6 +587,7 @@ bool command_list_exec(command_list_t *list, environ_t *env) {
      * other commands from being run if we have a loader set. */
     if (current_environ->loader) {
       config_error("Loader command must be final command");
+      current_environ = prev;
       return false;
     }
 
@@ -602,13 +612,20 @@ bool command_list_exec(command_list_t *list, environ_t *env) {
 
 /** Create a new environment.
  * @param parent        Parent environment.
+ * @param arena         If not NULL, arena to allocate the environment and its
+ *                      entries from. Loaders also allocate their private
+ *                      data from this, so it should not be destroyed until
+ *                      after environ_destroy() unless the environment is
+ *                      being discarded entirely.
  * @return              Pointer to created environment. */
-environ_t *environ_create(environ_t *parent) {
+environ_t *environ_create(environ_t *parent, arena_t *arena) {
+  arena_t *prev = arena_set_current(arena);
   environ_t *env = malloc(sizeof(*env));
 
   list_init(&env->entries);
   env->loader = NULL;
   env->loader_private = NULL;
+  env->arena = arena;
 
   if (parent) {
     env->device = parent->device;
@@ -631,6 +648,7 @@ environ_t *environ_create(environ_t *parent) {
     env->directory = NULL;
   }
 
+  arena_set_current(prev);
   return env;
 }
 
@@ -671,6 +689,9 @@ value_t *environ_lookup(environ_t *env, const char *name) {
  * @return              Pointer to inserted value. */
 value_t *environ_insert(environ_t *env, const char *name, const value_t *value) {
   environ_entry_t *entry;
+  arena_t *prev;
+
+  prev = arena_set_current(env->arena);
 
   /* Look for an existing entry with the same name. */
   list_foreach(&env->entries, iter) {
@@ -679,7 +700,7 @@ value_t *environ_insert(environ_t *env, const char *name, const value_t *value)
     if (strcmp(entry->name, name) == 0) {
       value_destroy(&entry->value);
       value_copy(value, &entry->value);
-      return &entry->value;
+      goto out;
     }
   }
 
@@ -690,6 +711,8 @@ value_t *environ_insert(environ_t *env, const char *name, const value_t *value)
   value_copy(value, &entry->value);
   list_append(&env->entries, &entry->header);
 
+out:
+  arena_set_current(prev);
   return &entry->value;
 }
 
@@ -1060,8 +1083,12 @@ static command_list_t *parse_command_list(void) {
 /** Parse configuration data.
  * @param path          Path of the file (used in error output).
  * @param helper        Helper to read from the file.
+ * @param arena         If not NULL, arena to allocate the command list from.
+ *                      The list should still be destroyed with
+ *                      command_list_destroy() before destroying the arena,
+ *                      as executing it can replace values with heap copies.
  * @return              Pointer to parsed command list on success, NULL on failure. */
-command_list_t *config_parse(const char *path, config_read_helper_t helper) {
+command_list_t *config_parse(const char *path, config_read_helper_t helper, arena_t *arena) {
   command_list_t *list;
 
   current_helper = helper;
@@ -1071,8 +1098,19 @@ command_list_t *config_parse(const char *path, config_read_helper_t helper) {
   current_nest_count = 0;
   returned_char = 0;
 
+  if (arena) {
+    current_arena = arena;
+    prev_arena = arena_set_current(arena);
+  }
+
   list = parse_command_list();
   assert(!current_nest_count);
+
+  if (current_arena) {
+    arena_set_current(prev_arena);
+    current_arena = NULL;
+  }
+
   return list;
 }
 
@@ -1314,6 +1352,7 @@ static int load_read_helper(unsigned nest) {
 static bool load_config_file(const char *path) {
   fs_handle_t *handle __cleanup_close = NULL;
   command_list_t *list;
+  arena_t *arena;
   status_t ret;
 
   ret = fs_open(path, NULL, FILE_TYPE_REGULAR, &handle);
@@ -1324,7 +1363,11 @@ static bool load_config_file(const char *path) {
 
   dprintf("config: loading configuration file '%s'\n", path);
 
-  current_file = malloc(handle->size + 1);
+  /* The file data and the parsed command list are only needed until it has
+   * been executed, so allocate them from an arena to free it all at once
+   * afterwards. */
+  arena = arena_create();
+  current_file = arena_alloc(arena, handle->size + 1);
 
   ret = fs_read(handle, current_file, handle->size, 0);
   if (ret != STATUS_SUCCESS) {
@@ -1339,7 +1382,7 @@ static bool load_config_file(const char *path) {
   current_file_offset = 0;
 
   /* Should always succeed here, as config_error() will not return on error. */
-  list = config_parse(path, load_read_helper);
+  list = config_parse(path, load_read_helper, arena);
   assert(list);
 
   if (!command_list_exec(list, root_environ)) {
@@ -1350,13 +1393,19 @@ static bool load_config_file(const char *path) {
   }
 
   command_list_destroy(list);
+  arena_destroy(arena);
+
+  /* The file data was allocated from the arena. */
+  current_file = NULL;
+  current_file_size = 0;
+  current_file_offset = 0;
   return true;
 }
 
 /** Set up the configuration system. */
 void config_init(void) {
   /* Create the root environment. */
-  root_environ = environ_create(NULL);
+  root_environ = environ_create(NULL, NULL);
   current_environ = root_environ;
 
   /* We can now use the shell. */
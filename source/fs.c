@@ -293,6 +293,147 @@ status_t fs_read(fs_handle_t *handle, void *buf, size_t count, offset_t offset)
 	}
 }
 
+/** Compare two read ranges by offset.
+ * @param a             First range.
+ * @param b             Second range.
+ * @return              Comparison result. */
+static int compare_read_ranges(const void *a, const void *b)
+{
+	const fs_read_range_t *first = a, *second = b;
+
+	if (first->offset < second->offset) {
+		return -1;
+	} else if (first->offset > second->offset) {
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+/** Read a set of ranges from a file in a single pass.
+ *
+ * The ranges are read in order of offset rather than the order they are given
+ * in. Compressed files can only be decompressed forwards, so reading them
+ * piecemeal at scattered offsets can mean decompressing the same data many
+ * times over, whereas this decompresses it at most once. Ranges may overlap,
+ * in which case the overlapping part is copied from the range that was read
+ * earlier instead of being read again.
+ *
+ * @param handle        Handle to the file.
+ * @param ranges        Array of ranges to read (will be sorted by offset).
+ * @param count         Number of ranges.
+ * @return              Status code describing the result of the operation. */
+status_t fs_read_ranges(fs_handle_t *handle, fs_read_range_t *ranges, size_t count)
+{
+	const fs_read_range_t *prev = NULL;
+	status_t ret;
+
+	qsort(ranges, count, sizeof(*ranges), compare_read_ranges);
+
+	for (size_t i = 0; i < count; i++) {
+		const fs_read_range_t *range = &ranges[i];
+		size_t done = 0;
+
+		/* prev is the range read so far that extends furthest, it covers any
+		 * overlap with this one as it cannot start after it. */
+		if (prev && range->offset < prev->offset + prev->count) {
+			done = min(range->count, prev->offset + prev->count - range->offset);
+			memcpy(range->buf, prev->buf + (range->offset - prev->offset), done);
+		}
+
+		if (done < range->count) {
+			ret = fs_read(handle, range->buf + done, range->count - done, range->offset + done);
+			if (ret != STATUS_SUCCESS)
+				return ret;
+		}
+
+		if (!prev || range->offset + range->count > prev->offset + prev->count)
+			prev = range;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+/**
+ * Add ranges covering the parts of a file not in a set of ranges.
+ *
+ * This is for when some of the data that will be needed from a file is not
+ * known until after it has been read, for example ELF section data described
+ * by section headers at the end of the file. A range is added for each part
+ * of the file up to the given end that none of the existing ranges cover,
+ * reading into consecutive parts of a buffer. The whole file can then be read
+ * in a single pass with fs_read_ranges(), and anything needed afterwards is
+ * found with fs_copy_from_ranges().
+ *
+ * @param ranges        Array of ranges (will be sorted by offset). There must
+ *                      be space after the existing entries for count + 1 more.
+ * @param _count        Number of ranges, updated to include the added ones.
+ * @param end           Offset to cover the file up to.
+ * @param buf           Buffer to read the uncovered data into. If NULL, no
+ *                      ranges are added and only the size is calculated.
+ * @return              Total size of the uncovered data.
+ */
+size_t fs_add_gap_ranges(fs_read_range_t *ranges, size_t *_count, offset_t end, void *buf)
+{
+	size_t count = *_count;
+	size_t total = 0;
+	offset_t pos = 0;
+
+	qsort(ranges, count, sizeof(*ranges), compare_read_ranges);
+
+	for (size_t i = 0; i <= count; i++) {
+		offset_t next = (i < count) ? min(ranges[i].offset, end) : end;
+
+		if (next > pos) {
+			if (buf) {
+				fs_read_range_t *gap = &ranges[(*_count)++];
+
+				gap->buf = buf + total;
+				gap->count = next - pos;
+				gap->offset = pos;
+			}
+
+			total += next - pos;
+		}
+
+		if (i < count)
+			pos = max(pos, ranges[i].offset + ranges[i].count);
+	}
+
+	return total;
+}
+
+/** Copy data that has been read by fs_read_ranges() out of the ranges.
+ * @param ranges        Ranges that have been read (sorted by offset).
+ * @param count         Number of ranges.
+ * @param buf           Buffer to copy to.
+ * @param size          Number of bytes to copy.
+ * @param offset        Offset in the file to copy from.
+ * @return              Whether the ranges covered all of the data. */
+bool fs_copy_from_ranges(const fs_read_range_t *ranges, size_t count, void *buf, size_t size, offset_t offset)
+{
+	/* Ranges are sorted, so if one starts after the current position then
+	 * nothing that follows covers it either. */
+	for (size_t i = 0; i < count && size; i++) {
+		const fs_read_range_t *range = &ranges[i];
+		size_t done;
+
+		if (offset < range->offset) {
+			break;
+		} else if (offset >= range->offset + range->count) {
+			continue;
+		}
+
+		done = min(size, range->offset + range->count - offset);
+		memcpy(buf, range->buf + (offset - range->offset), done);
+		buf += done;
+		offset += done;
+		size -= done;
+	}
+
+	return size == 0;
+}
+
 /** Iterate over entries in a directory.
  * @param handle        Handle to directory.
  * @param cb            Callback to call on each entry.
@@ -309,6 +450,107 @@ status_t fs_iterate(fs_handle_t *handle, fs_iterate_cb_t cb, void *arg)
 	return handle->mount->ops->iterate(handle, cb, arg);
 }
 
+/** Pack a directory record into a fs_read_dir() buffer.
+ * @param _buf          Current buffer position, updated on success.
+ * @param _size         Space remaining in the buffer, updated on success.
+ * @param name          Name of the entry (need not be null-terminated).
+ * @param name_len      Length of the name.
+ * @param type          Type of the entry, or FILE_TYPE_NONE if unknown.
+ * @param size          Size of the entry.
+ * @param cookie        Filesystem-specific cookie to open the entry with.
+ * @return              Whether the record fitted in the buffer. */
+bool fs_dir_record_pack(
+	void **_buf, size_t *_size, const char *name, size_t name_len, file_type_t type,
+	offset_t size, uint64_t cookie)
+{
+	fs_dir_record_t *record = *_buf;
+	size_t len;
+
+	len = round_up(sizeof(*record) + name_len + 1, 8);
+	if (len > *_size)
+		return false;
+
+	record->cookie = cookie;
+	record->size = size;
+	record->rec_len = len;
+	record->type = type;
+	memcpy(record->name, name, name_len);
+	record->name[name_len] = 0;
+
+	*_buf += len;
+	*_size -= len;
+	return true;
+}
+
+/**
+ * Read a batch of directory entries.
+ *
+ * Fills a buffer with packed fs_dir_record_t structures describing entries in
+ * a directory, giving the name, type and size of each entry without having to
+ * open it. This is considerably cheaper than fs_iterate() followed by
+ * fs_open_entry() for large directories. Records can be walked with
+ * fs_dir_record_next(), and opened with fs_open_cookie().
+ *
+ * @param handle        Handle to directory.
+ * @param cursor        Position to continue from. Should be set to 0 before
+ *                      the first call, and is updated on return.
+ * @param buf           Buffer to pack records into.
+ * @param size          Size of the buffer (at least FS_READ_DIR_MIN_SIZE).
+ * @param _count        Where to store number of records returned. This will
+ *                      be 0 once the end of the directory is reached.
+ *
+ * @return              Status code describing the result of the operation.
+ *                      STATUS_NOT_SUPPORTED is returned if the filesystem does
+ *                      not support batched reads, in which case fs_iterate()
+ *                      must be used instead.
+ */
+status_t fs_read_dir(fs_handle_t *handle, offset_t *cursor, void *buf, size_t size, size_t *_count)
+{
+	if (handle->type != FILE_TYPE_DIR) {
+		return STATUS_NOT_DIR;
+	} else if (!handle->mount->ops->read_dir) {
+		return STATUS_NOT_SUPPORTED;
+	} else if (size < FS_READ_DIR_MIN_SIZE) {
+		return STATUS_INVALID_ARG;
+	}
+
+	return handle->mount->ops->read_dir(handle, cursor, buf, size, _count);
+}
+
+/**
+ * Open a handle to a directory record.
+ *
+ * Opens an entry described by a record returned by fs_read_dir(). The
+ * filesystem uses the cookie in the record to open the entry directly, without
+ * having to search the directory again.
+ *
+ * @param owner         Directory that the record was read from.
+ * @param record        Record to open.
+ * @param type          Required type of the entry, or FILE_TYPE_NONE for any.
+ * @param _handle       Where to store pointer to opened handle.
+ *
+ * @return              Status code describing the result of the operation.
+ */
+status_t fs_open_cookie(fs_handle_t *owner, const fs_dir_record_t *record, file_type_t type, fs_handle_t **_handle)
+{
+	fs_ops_t *ops = owner->mount->ops;
+	fs_handle_t *handle;
+	status_t ret;
+
+	if (!ops->open_cookie)
+		return STATUS_NOT_SUPPORTED;
+
+	/* Check the type up front if we know it to avoid opening the entry. */
+	if (type != FILE_TYPE_NONE && record->type != FILE_TYPE_NONE && record->type != type)
+		return (type == FILE_TYPE_DIR) ? STATUS_NOT_DIR : STATUS_NOT_FILE;
+
+	ret = ops->open_cookie(owner, record, &handle);
+	if (ret != STATUS_SUCCESS)
+		return ret;
+
+	return post_open(handle, type, _handle);
+}
+
 /** Probe a device for filesystems.
  * @param device        Device to probe.
  * @return              Pointer to mount if found, NULL if not. */
@@ -18,6 +18,11 @@
  * @file
  * @brief               Ext2 filesystem support.
  *
+ * On ext4 filesystems with the metadata_csum feature, the CRC32C checksums of
+ * the superblock, group descriptors, inodes, extent tree blocks and directory
+ * blocks are verified as they are read. Data blocks are not checksummed by the
+ * filesystem.
+ *
  * TODO:
  *  - Triple indirect block support. Not urgent though, because it's unlikely
  *    a file so large will be read during boot.
@@ -25,6 +30,7 @@
 
  #include <fs/ext2.h>
 
+ #include <lib/crc32.h>
  #include <lib/string.h>
  #include <lib/utility.h>
 
@@ -43,13 +49,16 @@ typedef struct ext2_mount {
 	fs_mount_t mount;                       /**< Mount header. */
 
 	ext2_superblock_t sb;                   /**< Superblock of the filesystem. */
-	ext2_group_desc_t *group_tbl;           /**< Pointer to block group descriptor table. */
+	void *group_tbl;                        /**< Pointer to block group descriptor table. */
+	size_t group_desc_size;                 /**< Size of a group descriptor. */
 	uint32_t inodes_per_group;              /**< Inodes per group. */
 	uint32_t inodes_count;                  /**< Inodes count. */
 	size_t block_size;                      /**< Size of a block on the filesystem. */
 	size_t block_groups;                    /**< Number of block groups. */
 	size_t inode_size;                      /**< Size of an inode. */
 	size_t symlink_count;                   /**< Current symbolic link recursion count. */
+	bool metadata_csum;                     /**< Whether metadata checksums are enabled. */
+	uint32_t csum_seed;                     /**< Checksum seed for the filesystem. */
 } ext2_mount_t;
 
 /** Open ext2 file structure. */
@@ -58,6 +67,7 @@ typedef struct ext2_handle {
 
 	uint32_t num;                           /**< Inode number. */
 	ext2_inode_t inode;                     /**< Inode the handle refers to. */
+	uint32_t csum_seed;                     /**< Checksum seed for the inode's metadata. */
 } ext2_handle_t;
 
 /** Information about an ext2 directory entry. */
@@ -86,17 +96,175 @@ static status_t read_raw_block(ext2_mount_t *mount, void *buf, uint32_t num, siz
 	return device_read(mount->mount.device, buf, count, disk_offset);
 }
 
+/** Get a block group descriptor.
+ * @param mount         Mount to get from.
+ * @param group         Group number.
+ * @return              Pointer to group descriptor. */
+static inline ext2_group_desc_t *get_group_desc(ext2_mount_t *mount, size_t group)
+{
+	return (ext2_group_desc_t*)(mount->group_tbl + (group * mount->group_desc_size));
+}
+
+/** Check the checksum of a group descriptor.
+ * @param mount         Mount the descriptor is from.
+ * @param group         Group number.
+ * @return              Whether the checksum is correct. */
+static bool check_group_desc(ext2_mount_t *mount, uint32_t group)
+{
+	ext2_group_desc_t *desc = get_group_desc(mount, group);
+	size_t offset = offsetof(ext2_group_desc_t, bg_checksum);
+	uint16_t zero = 0;
+	uint32_t le_group, crc;
+
+	le_group = cpu_to_le32(group);
+	crc = crc32c(mount->csum_seed, &le_group, sizeof(le_group));
+	crc = crc32c(crc, desc, offset);
+	crc = crc32c(crc, &zero, sizeof(zero));
+	offset += sizeof(zero);
+	crc = crc32c(crc, (void *)desc + offset, mount->group_desc_size - offset);
+
+	return (crc & 0xffff) == le16_to_cpu(desc->bg_checksum);
+}
+
+/** Check the checksum of an inode.
+ * @param mount         Mount the inode is from.
+ * @param inode         Raw inode data (the full on-disk inode size).
+ * @param seed          Checksum seed for the inode.
+ * @return              Whether the checksum is correct. */
+static bool check_inode(ext2_mount_t *mount, const uint8_t *inode, uint32_t seed)
+{
+	size_t offset = EXT4_INODE_OFF_CHECKSUM_LO;
+	uint16_t zero = 0;
+	uint32_t crc, expected;
+	bool has_hi = false;
+
+	expected = le16_to_cpu(*(const uint16_t *)&inode[EXT4_INODE_OFF_CHECKSUM_LO]);
+
+	/* The checksum fields are treated as zero. The high half is only present
+	 * if the extra inode fields include it. */
+	crc = crc32c(seed, inode, offset);
+	crc = crc32c(crc, &zero, sizeof(zero));
+	offset += sizeof(zero);
+	crc = crc32c(crc, inode + offset, EXT2_INODE_SIZE - offset);
+
+	if (mount->inode_size > EXT2_INODE_SIZE) {
+		size_t extra = le16_to_cpu(*(const uint16_t *)&inode[EXT4_INODE_OFF_EXTRA_ISIZE]);
+
+		offset = EXT4_INODE_OFF_CHECKSUM_HI;
+		crc = crc32c(crc, inode + EXT2_INODE_SIZE, offset - EXT2_INODE_SIZE);
+
+		if (EXT2_INODE_SIZE + extra >= EXT4_INODE_OFF_CHECKSUM_HI + sizeof(uint16_t)) {
+			expected |= (uint32_t)le16_to_cpu(*(const uint16_t *)&inode[EXT4_INODE_OFF_CHECKSUM_HI]) << 16;
+			crc = crc32c(crc, &zero, sizeof(zero));
+			offset += sizeof(zero);
+			has_hi = true;
+		}
+
+		crc = crc32c(crc, inode + offset, mount->inode_size - offset);
+	}
+
+	if (!has_hi)
+		crc &= 0xffff;
+
+	return crc == expected;
+}
+
+/** Verify an inode read from disk.
+ * @param mount         Mount the inode is from.
+ * @param id            ID of the inode.
+ * @param raw           Raw inode data (the full on-disk inode size).
+ * @param _seed         Where to store the checksum seed for the inode's
+ *                      metadata (optional).
+ * @return              Status code describing the result of the operation. */
+static status_t verify_inode(ext2_mount_t *mount, uint32_t id, const uint8_t *raw, uint32_t *_seed)
+{
+	const ext2_inode_t *inode = (const ext2_inode_t *)raw;
+	uint32_t le_id, seed;
+
+	if (!mount->metadata_csum)
+		return STATUS_SUCCESS;
+
+	le_id = cpu_to_le32(id);
+	seed = crc32c(mount->csum_seed, &le_id, sizeof(le_id));
+	seed = crc32c(seed, &inode->i_generation, sizeof(inode->i_generation));
+
+	if (!check_inode(mount, raw, seed)) {
+		dprintf("ext2: checksum mismatch in inode %" PRIu32 "\n", id);
+		return STATUS_CORRUPT_FS;
+	}
+
+	if (_seed)
+		*_seed = seed;
+
+	return STATUS_SUCCESS;
+}
+
+/** Check the checksum of an extent tree block.
+ * @param handle        Handle to the inode the block belongs to.
+ * @param header        Extent header at the start of the block.
+ * @return              Whether the checksum is correct. */
+static bool check_extent_block(ext2_handle_t *handle, ext4_extent_header_t *header)
+{
+	ext2_mount_t *mount = (ext2_mount_t*)handle->handle.mount;
+	size_t offset;
+
+	if (!mount->metadata_csum)
+		return true;
+
+	/* The checksum follows the maximum number of entries. */
+	offset = sizeof(*header) + (le16_to_cpu(header->eh_max) * sizeof(ext4_extent_t));
+	if (offset + sizeof(uint32_t) > mount->block_size)
+		return false;
+
+	return crc32c(handle->csum_seed, header, offset) == le32_to_cpu(*(uint32_t *)((void *)header + offset));
+}
+
+/** Check the checksum of a directory block.
+ * @param handle        Handle to the directory.
+ * @param buf           Block data.
+ * @return              Status code describing the result of the operation. */
+static status_t check_dir_block(ext2_handle_t *handle, void *buf)
+{
+	ext2_mount_t *mount = (ext2_mount_t*)handle->handle.mount;
+	ext4_dir_entry_tail_t *tail;
+	size_t offset;
+
+	if (!mount->metadata_csum)
+		return STATUS_SUCCESS;
+
+	/* Hashed directory index blocks store their checksum elsewhere, only
+	 * check blocks that end with a checksum entry. */
+	offset = mount->block_size - sizeof(*tail);
+	tail = buf + offset;
+	if (tail->det_reserved_zero1
+		|| le16_to_cpu(tail->det_rec_len) != sizeof(*tail)
+		|| tail->det_reserved_zero2
+		|| tail->det_reserved_ft != EXT4_FT_DIR_CSUM)
+	{
+		return STATUS_SUCCESS;
+	}
+
+	if (crc32c(handle->csum_seed, buf, offset) != le32_to_cpu(tail->det_checksum)) {
+		dprintf("ext2: checksum mismatch in directory inode %" PRIu32 "\n", handle->num);
+		return STATUS_CORRUPT_FS;
+	}
+
+	return STATUS_SUCCESS;
+}
+
 /** Recurse through the extent index tree to find a leaf.
- * @param mount         Mount being read from.
+ * @param handle        Handle to inode being read.
  * @param header        Extent header to start at.
  * @param block         Block number to get.
  * @param buf           Temporary buffer to use.
  * @param _header       Where to store pointer to header for leaf.
  * @return              Status code describing the result of the operation. */
 static status_t find_leaf_extent(
-	ext2_mount_t *mount, ext4_extent_header_t *header, uint32_t block, void *buf,
+	ext2_handle_t *handle, ext4_extent_header_t *header, uint32_t block, void *buf,
 	ext4_extent_header_t **_header)
 {
+	ext2_mount_t *mount = (ext2_mount_t*)handle->handle.mount;
+
 	while (true) {
 		ext4_extent_idx_t *index = (ext4_extent_idx_t*)&header[1];
 		uint16_t i;
@@ -122,6 +290,11 @@ static status_t find_leaf_extent(
 			return ret;
 
 		header = (ext4_extent_header_t*)buf;
+
+		if (le16_to_cpu(header->eh_magic) == EXT4_EXT_MAGIC && !check_extent_block(handle, header)) {
+			dprintf("ext2: checksum mismatch in extent block for inode %" PRIu32 "\n", handle->num);
+			return STATUS_CORRUPT_FS;
+		}
 	}
 }
 
@@ -144,7 +317,7 @@ static status_t inode_block_to_raw(ext2_handle_t *handle, uint32_t block, uint32
 
 		buf = malloc(mount->block_size);
 		header = (ext4_extent_header_t*)inode->i_block;
-		ret = find_leaf_extent(mount, header, block, buf, &header);
+		ret = find_leaf_extent(handle, header, block, buf, &header);
 		if (ret != STATUS_SUCCESS)
 			return ret;
 
@@ -295,6 +468,29 @@ static status_t ext2_read(fs_handle_t *_handle, void *buf, size_t count, offset_
 	return STATUS_SUCCESS;
 }
 
+/** Get the location of an inode on disk.
+ * @param mount         Mount the inode is on.
+ * @param id            ID of the inode.
+ * @param _offset       Where to store byte offset of the inode.
+ * @return              Status code describing the result of the operation. */
+static status_t get_inode_offset(ext2_mount_t *mount, uint32_t id, offset_t *_offset)
+{
+	size_t group;
+
+	/* Get the group descriptor table containing the inode. */
+	group = (id - 1) / mount->inodes_per_group;
+	if (group >= mount->block_groups) {
+		dprintf("ext2: bad inode number %" PRIu32 "\n", id);
+		return STATUS_CORRUPT_FS;
+	}
+
+	/* Get the offset of the inode in the group's inode table. */
+	*_offset =
+		((offset_t)le32_to_cpu(get_group_desc(mount, group)->bg_inode_table) * mount->block_size) +
+		((offset_t)((id - 1) % mount->inodes_per_group) * mount->inode_size);
+	return STATUS_SUCCESS;
+}
+
 /**
  * Open an inode from the filesystem.
  *
@@ -307,33 +503,33 @@ static status_t ext2_read(fs_handle_t *_handle, void *buf, size_t count, offset_
  */
 static status_t open_inode(ext2_mount_t *mount, uint32_t id, ext2_handle_t *owner, fs_handle_t **_handle)
 {
-	size_t group, inode_size;
+	uint8_t *raw __cleanup_free = NULL;
 	offset_t inode_offset, size;
 	uint16_t type;
 	ext2_handle_t *handle;
 	status_t ret;
 
-	/* Get the group descriptor table containing the inode. */
-	group = (id - 1) / mount->inodes_per_group;
-	if (group >= mount->block_groups) {
-		dprintf("ext2: bad inode number %" PRIu32 "\n", id);
-		return STATUS_CORRUPT_FS;
-	}
+	ret = get_inode_offset(mount, id, &inode_offset);
+	if (ret != STATUS_SUCCESS)
+		return ret;
 
-	/* Get the size of the inode and its offset in the group's inode table. */
-	inode_size = min(mount->inode_size, sizeof(ext2_inode_t));
-	inode_offset =
-		((offset_t)le32_to_cpu(mount->group_tbl[group].bg_inode_table) * mount->block_size) +
-		((offset_t)((id - 1) % mount->inodes_per_group) * mount->inode_size);
+	/* Read the whole on-disk inode, the checksum covers all of it. */
+	raw = malloc(mount->inode_size);
+
+	ret = device_read(mount->mount.device, raw, mount->inode_size, inode_offset);
+	if (ret != STATUS_SUCCESS) {
+		dprintf("ext2: failed to read inode %" PRIu32 ": %pS\n", id, ret);
+		return ret;
+	}
 
 	handle = malloc(sizeof(*handle));
 	handle->num = id;
+	memcpy(&handle->inode, raw, min(mount->inode_size, sizeof(ext2_inode_t)));
 
-	ret = device_read(mount->mount.device, &handle->inode, inode_size, inode_offset);
+	ret = verify_inode(mount, id, raw, &handle->csum_seed);
 	if (ret != STATUS_SUCCESS) {
-		dprintf("ext2: failed to read inode %" PRIu32 ": %pS\n", id, ret);
 		free(handle);
-		return false;
+		return ret;
 	}
 
 	type = le16_to_cpu(handle->inode.i_mode) & EXT2_S_IFMT;
@@ -408,55 +604,255 @@ static status_t ext2_open_entry(const fs_entry_t *_entry, fs_handle_t **_handle)
 	return open_inode(mount, entry->num, owner, _handle);
 }
 
-/** Iterate over ext2 directory entries.
- * @param _handle       Handle to directory.
+/** Callback for walk_dir().
+ * @param entry         Directory entry (always in use and named).
+ * @param arg           Data passed to walk_dir().
+ * @return              Whether to continue walking. The cursor is not moved
+ *                      past the entry if this returns false. */
+typedef bool (*dir_walk_cb_t)(ext2_dir_entry_t *entry, void *arg);
+
+/**
+ * Walk through the entries of an ext2 directory.
+ *
+ * Directories can be far larger than the heap, so only one block of the
+ * directory is held at a time. Entries never cross a block boundary. Each
+ * block's checksum is verified before any of its entries are returned.
+ *
+ * @param handle        Handle to directory.
+ * @param cursor        Byte offset in the directory to start from, updated
+ *                      to the offset of the next entry to return.
  * @param cb            Callback to call on each entry.
  * @param arg           Data to pass to callback.
- * @return              Status code describing the result of the operation. */
-static status_t ext2_iterate(fs_handle_t *_handle, fs_iterate_cb_t cb, void *arg)
+ *
+ * @return              Status code describing the result of the operation.
+ */
+static status_t walk_dir(ext2_handle_t *handle, offset_t *cursor, dir_walk_cb_t cb, void *arg)
 {
-	ext2_handle_t *handle = (ext2_handle_t*)_handle;
+	ext2_mount_t *mount = (ext2_mount_t*)handle->handle.mount;
 	char *buf __cleanup_free;
-	char *name __cleanup_free;
-	bool cont;
-	offset_t offset;
 	status_t ret;
 
-	/* Allocate buffers to read the data into. */
-	buf = malloc(handle->handle.size);
-	name = malloc(EXT2_NAME_MAX + 1);
+	buf = malloc(mount->block_size);
 
-	/* Read in all the directory entries. */
-	ret = ext2_read(_handle, buf, handle->handle.size, 0);
-	if (ret != STATUS_SUCCESS)
-		return ret;
+	while (*cursor < handle->handle.size) {
+		size_t offset = *cursor % mount->block_size;
+
+		ret = read_inode_block(handle, buf, *cursor / mount->block_size, 0, 0);
+		if (ret != STATUS_SUCCESS)
+			return ret;
 
-	cont = true;
-	offset = 0;
-	while (cont && offset < handle->handle.size) {
-		ext2_dir_entry_t *entry = (ext2_dir_entry_t*)(buf + offset);
+		ret = check_dir_block(handle, buf);
+		if (ret != STATUS_SUCCESS)
+			return ret;
 
-		if (entry->file_type != EXT2_FT_UNKNOWN && entry->name_len != 0) {
-			ext2_entry_t child;
+		while (offset < mount->block_size) {
+			ext2_dir_entry_t *entry = (ext2_dir_entry_t*)(buf + offset);
+			uint16_t rec_len = le16_to_cpu(entry->rec_len);
 
-			strncpy(name, entry->name, entry->name_len);
-			name[entry->name_len] = 0;
+			if (!rec_len) {
+				*cursor = handle->handle.size;
+				return STATUS_SUCCESS;
+			} else if (rec_len < sizeof(*entry)
+				|| offset + rec_len > mount->block_size
+				|| entry->name_len > rec_len - sizeof(*entry))
+			{
+				return STATUS_CORRUPT_FS;
+			}
 
-			child.entry.owner = &handle->handle;
-			child.entry.name = name;
-			child.num = le32_to_cpu(entry->inode);
+			if (entry->inode && entry->name_len) {
+				if (!cb(entry, arg))
+					return STATUS_SUCCESS;
+			}
 
-			cont = cb(&child.entry, arg);
-		} else if (!le16_to_cpu(entry->rec_len)) {
-			cont = false;
+			offset += rec_len;
+			*cursor += rec_len;
 		}
+	}
+
+	return STATUS_SUCCESS;
+}
+
+/** Data for ext2_iterate(). */
+typedef struct ext2_iterate_data {
+	ext2_handle_t *handle;                  /**< Directory being iterated. */
+	fs_iterate_cb_t cb;                     /**< Callback to call on each entry. */
+	void *arg;                              /**< Data to pass to callback. */
+	char name[EXT2_NAME_MAX + 1];           /**< Buffer for entry names. */
+} ext2_iterate_data_t;
+
+/** Directory walk callback for ext2_iterate().
+ * @param entry         Directory entry.
+ * @param _data         Iteration state.
+ * @return              Whether to continue walking. */
+static bool iterate_walk_cb(ext2_dir_entry_t *entry, void *_data)
+{
+	ext2_iterate_data_t *data = _data;
+	ext2_entry_t child;
+
+	if (entry->file_type == EXT2_FT_UNKNOWN)
+		return true;
 
-		offset += le16_to_cpu(entry->rec_len);
+	memcpy(data->name, entry->name, entry->name_len);
+	data->name[entry->name_len] = 0;
+
+	child.entry.owner = &data->handle->handle;
+	child.entry.name = data->name;
+	child.num = le32_to_cpu(entry->inode);
+
+	return data->cb(&child.entry, data->arg);
+}
+
+/** Iterate over ext2 directory entries.
+ * @param _handle       Handle to directory.
+ * @param cb            Callback to call on each entry.
+ * @param arg           Data to pass to callback.
+ * @return              Status code describing the result of the operation. */
+static status_t ext2_iterate(fs_handle_t *_handle, fs_iterate_cb_t cb, void *arg)
+{
+	ext2_iterate_data_t *data __cleanup_free;
+	offset_t cursor = 0;
+
+	data = malloc(sizeof(*data));
+	data->handle = (ext2_handle_t*)_handle;
+	data->cb = cb;
+	data->arg = arg;
+
+	return walk_dir(data->handle, &cursor, iterate_walk_cb, data);
+}
+
+/** Data for ext2_read_dir(). */
+typedef struct ext2_read_dir_data {
+	ext2_mount_t *mount;                    /**< Mount the directory is on. */
+	void *buf;                              /**< Position in the record buffer. */
+	size_t size;                            /**< Space left in the record buffer. */
+	size_t count;                           /**< Number of records packed. */
+	status_t ret;                           /**< Error from reading an inode. */
+
+	/** Entries in a directory tend to have neighbouring inode numbers, so
+	 * the last inode table block read is kept around rather than reading
+	 * each inode individually. Block 0 is never part of an inode table. */
+	uint8_t *itable;
+	uint32_t itable_num;                    /**< Block number held in itable. */
+} ext2_read_dir_data_t;
+
+/** Directory walk callback for ext2_read_dir().
+ * @param entry         Directory entry.
+ * @param _data         Read state.
+ * @return              Whether to continue walking. */
+static bool read_dir_walk_cb(ext2_dir_entry_t *entry, void *_data)
+{
+	ext2_read_dir_data_t *data = _data;
+	ext2_mount_t *mount = data->mount;
+	uint32_t id = le32_to_cpu(entry->inode);
+	offset_t inode_offset, entry_size;
+	ext2_inode_t *inode;
+	file_type_t type;
+
+	data->ret = get_inode_offset(mount, id, &inode_offset);
+	if (data->ret != STATUS_SUCCESS)
+		return false;
+
+	if (inode_offset / mount->block_size != data->itable_num) {
+		data->itable_num = inode_offset / mount->block_size;
+
+		data->ret = read_raw_block(mount, data->itable, data->itable_num, 0, 0);
+		if (data->ret != STATUS_SUCCESS) {
+			data->itable_num = 0;
+			return false;
+		}
 	}
 
+	/* Returned sizes and types come straight from the inode, so check it the
+	 * same way opening it would. */
+	inode = (ext2_inode_t*)(data->itable + (inode_offset % mount->block_size));
+	data->ret = verify_inode(mount, id, (const uint8_t *)inode, NULL);
+	if (data->ret != STATUS_SUCCESS)
+		return false;
+
+	entry_size = le32_to_cpu(inode->i_size);
+
+	switch (le16_to_cpu(inode->i_mode) & EXT2_S_IFMT) {
+	case EXT2_S_IFREG:
+		entry_size |= (offset_t)le32_to_cpu(inode->i_size_high) << 32;
+		type = FILE_TYPE_REGULAR;
+		break;
+	case EXT2_S_IFDIR:
+		type = FILE_TYPE_DIR;
+		break;
+	case EXT2_S_IFLNK:
+		/* Type depends on the link target. */
+		entry_size = 0;
+		type = FILE_TYPE_NONE;
+		break;
+	default:
+		/* Cannot be opened, don't bother returning it. */
+		return true;
+	}
+
+	if (!fs_dir_record_pack(&data->buf, &data->size, entry->name, entry->name_len, type, entry_size, id))
+		return false;
+
+	data->count++;
+	return true;
+}
+
+/** Read a batch of ext2 directory entries.
+ * @param _handle       Handle to directory.
+ * @param cursor        Byte offset in the directory to continue from.
+ * @param buf           Buffer to pack records into.
+ * @param size          Size of the buffer.
+ * @param _count        Where to store number of records returned.
+ * @return              Status code describing the result of the operation. */
+static status_t ext2_read_dir(fs_handle_t *_handle, offset_t *cursor, void *buf, size_t size, size_t *_count)
+{
+	ext2_mount_t *mount = (ext2_mount_t*)_handle->mount;
+	uint8_t *itable __cleanup_free;
+	ext2_read_dir_data_t data;
+	status_t ret;
+
+	itable = malloc(mount->block_size);
+
+	data.mount = mount;
+	data.buf = buf;
+	data.size = size;
+	data.count = 0;
+	data.ret = STATUS_SUCCESS;
+	data.itable = itable;
+	data.itable_num = 0;
+
+	ret = walk_dir((ext2_handle_t*)_handle, cursor, read_dir_walk_cb, &data);
+	if (ret != STATUS_SUCCESS)
+		return ret;
+	if (data.ret != STATUS_SUCCESS)
+		return data.ret;
+
+	*_count = data.count;
 	return STATUS_SUCCESS;
 }
 
+/** Open an entry from an ext2 directory record.
+ * @param _owner        Directory that the record was read from.
+ * @param record        Record for the entry (cookie is the inode number).
+ * @param _handle       Where to store pointer to opened handle.
+ * @return              Status code describing the result of the operation. */
+static status_t ext2_open_cookie(fs_handle_t *_owner, const fs_dir_record_t *record, fs_handle_t **_handle)
+{
+	ext2_handle_t *owner = (ext2_handle_t*)_owner;
+	ext2_mount_t *mount = (ext2_mount_t*)_owner->mount;
+
+	if (record->cookie == owner->num) {
+		fs_retain(&owner->handle);
+		*_handle = &owner->handle;
+		return STATUS_SUCCESS;
+	} else if (record->cookie == EXT2_ROOT_INO) {
+		fs_retain(mount->mount.root);
+		*_handle = mount->mount.root;
+		return STATUS_SUCCESS;
+	}
+
+	return open_inode(mount, record->cookie, owner, _handle);
+}
+
 /** Mount an ext2 filesystem.
  * @param device        Device to mount.
  * @param _mount        Where to store pointer to mount structure.
@@ -490,6 +886,25 @@ static status_t ext2_mount(device_t *device, fs_mount_t **_mount)
 		goto err;
 	}
 
+	mount->metadata_csum = le32_to_cpu(mount->sb.s_feature_ro_compat) & EXT4_FEATURE_RO_COMPAT_METADATA_CSUM;
+	if (mount->metadata_csum) {
+		if (mount->sb.s_checksum_type != EXT4_CRC32C_CHKSUM) {
+			dprintf("ext2: device %s has unknown checksum type %u\n", device->name, mount->sb.s_checksum_type);
+			ret = STATUS_NOT_SUPPORTED;
+			goto err;
+		}
+
+		if (crc32c(0xffffffff, &mount->sb, offsetof(ext2_superblock_t, s_checksum)) != le32_to_cpu(mount->sb.s_checksum)) {
+			dprintf("ext2: checksum mismatch in superblock on %s\n", device->name);
+			ret = STATUS_CORRUPT_FS;
+			goto err;
+		}
+
+		mount->csum_seed = (le32_to_cpu(mount->sb.s_feature_incompat) & EXT4_FEATURE_INCOMPAT_CSUM_SEED)
+			? le32_to_cpu(mount->sb.s_checksum_seed)
+			: crc32c(0xffffffff, mount->sb.s_uuid, sizeof(mount->sb.s_uuid));
+	}
+
 	/* Get useful information out of the superblock. */
 	mount->inodes_per_group = le32_to_cpu(mount->sb.s_inodes_per_group);
 	mount->inodes_count = le32_to_cpu(mount->sb.s_inodes_count);
@@ -497,14 +912,42 @@ static status_t ext2_mount(device_t *device, fs_mount_t **_mount)
 	mount->block_groups = mount->inodes_count / mount->inodes_per_group;
 	mount->inode_size = le16_to_cpu(mount->sb.s_inode_size);
 
+	/* Group descriptors can be larger than the ext2 structure on 64-bit
+	 * filesystems, we only use the part that is common to both. */
+	mount->group_desc_size = sizeof(ext2_group_desc_t);
+	if (le32_to_cpu(mount->sb.s_feature_incompat) & EXT4_FEATURE_INCOMPAT_64BIT) {
+		mount->group_desc_size = le16_to_cpu(mount->sb.s_desc_size);
+		if (mount->group_desc_size < sizeof(ext2_group_desc_t) || !is_pow2(mount->group_desc_size)) {
+			dprintf("ext2: device %s has invalid group descriptor size\n", device->name);
+			ret = STATUS_CORRUPT_FS;
+			goto err;
+		}
+	}
+
+	if (mount->inode_size < EXT2_INODE_SIZE || mount->inode_size > mount->block_size) {
+		dprintf("ext2: device %s has invalid inode size\n", device->name);
+		ret = STATUS_CORRUPT_FS;
+		goto err;
+	}
+
 	/* Read in the group descriptor table. */
 	offset = mount->block_size * (le32_to_cpu(mount->sb.s_first_data_block) + 1);
-	size = round_up(mount->block_groups * sizeof(ext2_group_desc_t), mount->block_size);
+	size = round_up(mount->block_groups * mount->group_desc_size, mount->block_size);
 	mount->group_tbl = malloc(size);
 	ret = device_read(device, mount->group_tbl, size, offset);
 	if (ret != STATUS_SUCCESS)
 		goto err;
 
+	if (mount->metadata_csum) {
+		for (size_t i = 0; i < mount->block_groups; i++) {
+			if (!check_group_desc(mount, i)) {
+				dprintf("ext2: checksum mismatch in group descriptor %zu on %s\n", i, device->name);
+				ret = STATUS_CORRUPT_FS;
+				goto err;
+			}
+		}
+	}
+
 	/* Get a handle to the root inode. */
 	ret = open_inode(mount, EXT2_ROOT_INO, NULL, &mount->mount.root);
 	if (ret != STATUS_SUCCESS)
@@ -530,5 +973,7 @@ BUILTIN_FS_OPS(ext2_fs_ops) = {
 	.read		= ext2_read,
 	.open_entry	= ext2_open_entry,
 	.iterate	= ext2_iterate,
+	.read_dir	= ext2_read_dir,
+	.open_cookie	= ext2_open_cookie,
 	.mount		= ext2_mount,
 };
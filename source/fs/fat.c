@@ -195,23 +195,26 @@ static status_t fat_open_entry(const fs_entry_t *_entry, fs_handle_t **_handle)
 	fat_handle_t *owner = (fat_handle_t*)_entry->owner;
 	fat_handle_t *root = (fat_handle_t*)_entry->owner->mount->root;
 	uint32_t cluster_high, cluster_low, cluster;
+	file_type_t type;
 
 	cluster_high = le16_to_cpu(state->entry.first_cluster_high);
 	cluster_low = le16_to_cpu(state->entry.first_cluster_low);
 	cluster = (cluster_high << 16) | cluster_low;
+	type = (state->entry.attributes & FAT_ATTRIBUTE_DIRECTORY) ? FILE_TYPE_DIR : FILE_TYPE_REGULAR;
 
-	if (cluster == owner->cluster) {
+	/* Empty files have cluster 0, so only match up directories. A '..' entry
+	 * referring to the root directory also has cluster 0, even on FAT32. */
+	if (type == FILE_TYPE_DIR && cluster == owner->cluster) {
 		fs_retain(&owner->handle);
 		*_handle = &owner->handle;
-	} else if (cluster == root->cluster) {
+	} else if (type == FILE_TYPE_DIR && (cluster == root->cluster || !cluster)) {
 		fs_retain(&root->handle);
 		*_handle = &root->handle;
 	} else {
 		fat_handle_t *handle = malloc(sizeof(*handle));
 
 		fs_handle_init(
-			&handle->handle, _entry->owner->mount,
-			(state->entry.attributes & FAT_ATTRIBUTE_DIRECTORY) ? FILE_TYPE_DIR : FILE_TYPE_REGULAR,
+			&handle->handle, _entry->owner->mount, type,
 			le32_to_cpu(state->entry.file_size));
 
 		handle->cluster = cluster;
@@ -461,6 +464,90 @@ static status_t fat_iterate(fs_handle_t *_handle, fs_iterate_cb_t cb, void *arg)
 	return ret;
 }
 
+/** Read a batch of FAT directory entries.
+ * @param _handle       Handle to directory.
+ * @param cursor        Directory entry index to continue from.
+ * @param buf           Buffer to pack records into.
+ * @param size          Size of the buffer.
+ * @param _count        Where to store number of records returned.
+ * @return              Status code describing the result of the operation. */
+static status_t fat_read_dir(fs_handle_t *_handle, offset_t *cursor, void *buf, size_t size, size_t *_count)
+{
+	fat_handle_t *handle = (fat_handle_t*)_handle;
+	fat_iterate_state_t state;
+	size_t count;
+	status_t ret;
+
+	init_iterate_state(&state, handle);
+	state.idx = *cursor;
+
+	count = 0;
+	while (true) {
+		file_type_t type;
+
+		ret = next_dir_entry(&state);
+		if (ret == STATUS_END_OF_FILE) {
+			ret = STATUS_SUCCESS;
+			break;
+		} else if (ret != STATUS_SUCCESS) {
+			break;
+		}
+
+		/* Don't care about volume labels here. */
+		if (!(state.entry.attributes & FAT_ATTRIBUTE_VOLUME_ID)) {
+			type = (state.entry.attributes & FAT_ATTRIBUTE_DIRECTORY)
+			       ? FILE_TYPE_DIR
+			       : FILE_TYPE_REGULAR;
+
+			/* If this doesn't fit, the cursor is left after the previous
+			 * entry, i.e. before this entry's LFN entries. */
+			if (!fs_dir_record_pack(
+					&buf, &size, state.name, strlen(state.name), type,
+					le32_to_cpu(state.entry.file_size), state.idx - 1))
+				break;
+
+			count++;
+		}
+
+		*cursor = state.idx;
+	}
+
+	destroy_iterate_state(&state);
+	*_count = count;
+	return ret;
+}
+
+/** Open an entry from a FAT directory record.
+ * @param _owner        Directory that the record was read from.
+ * @param record        Record for the entry (cookie is the index of its short
+ *                      name directory entry).
+ * @param _handle       Where to store pointer to opened handle.
+ * @return              Status code describing the result of the operation. */
+static status_t fat_open_cookie(fs_handle_t *_owner, const fs_dir_record_t *record, fs_handle_t **_handle)
+{
+	fat_iterate_state_t state;
+	status_t ret;
+
+	/* Read back just the short name entry, and open it the same way as when
+	 * iterating. */
+	init_iterate_state(&state, (fat_handle_t*)_owner);
+	state.idx = record->cookie;
+
+	ret = next_dir_entry(&state);
+	if (ret == STATUS_SUCCESS) {
+		if (state.idx != record->cookie + 1 || state.entry.attributes & FAT_ATTRIBUTE_VOLUME_ID) {
+			ret = STATUS_CORRUPT_FS;
+		} else {
+			ret = fat_open_entry(&state.header, _handle);
+		}
+	} else if (ret == STATUS_END_OF_FILE) {
+		ret = STATUS_CORRUPT_FS;
+	}
+
+	destroy_iterate_state(&state);
+	return ret;
+}
+
 /** Get the label for a FAT filesystem.
  * @param handle        Handle to root directory.
  * @param _label        Where to store label string.
@@ -604,5 +691,7 @@ BUILTIN_FS_OPS(fat_fs_ops) = {
 	.read		= fat_read,
 	.open_entry	= fat_open_entry,
 	.iterate	= fat_iterate,
+	.read_dir	= fat_read_dir,
+	.open_cookie	= fat_open_cookie,
 	.mount		= fat_mount
 };
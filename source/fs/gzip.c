@@ -0,0 +1,623 @@
+/*
+ * Copyright (C) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               gzip decompression codec.
+ *
+ * This file implements support for transparent decompression of gzip-compressed
+ * files. We use the miniz/tinfl library for decompressing the DEFLATE stream.
+ * Note that we do not support files with a decompressed size greater than 4GB,
+ * as the ISIZE field in the gzip header is 32 bits and defined to be the
+ * decompressed size mod 2^32. Since we rely on being able to get the total
+ * size of a file in various places, we cannot correctly handle files that are
+ * larger than 4GB unless we decompress the entire file when opening it to get
+ * its size.
+ *
+ * tinfl requires a large (32K) dictionary buffer to work on, which is too much
+ * to allocate per-handle from the heap. Instead, decompression state is kept
+ * in a small pool of contexts which are allocated from physical memory and
+ * assigned to handles on demand. When the pool is exhausted, the least
+ * recently used context is taken from its handle, which will then have to
+ * restart from the beginning of the file if it is read again. The typical
+ * access pattern in the loader is to work on a few files at a time, so this
+ * allows switching between them without losing progress.
+ *
+ * DEFLATE streams cannot be entered at an arbitrary point, so seeking backwards
+ * would normally mean decompressing again from the start of the stream. To
+ * avoid this, a checkpoint of the decompression state is recorded every
+ * CHECKPOINT_INTERVAL bytes of output the first time that a file is
+ * decompressed. A checkpoint holds the tinfl state (which includes the bit
+ * buffer, i.e. the position within the current input byte), the input offset
+ * and a copy of the 32K window, which is all that is needed to resume from that
+ * point. Seeks then resume from the nearest checkpoint before the requested
+ * offset. Checkpoints are stored in physical memory, as they are far too large
+ * for the heap.
+ *
+ * The most common operation is reading an entire file into its final location
+ * in one go. In that case the destination buffer can serve as the dictionary,
+ * so we decompress directly into it rather than going through the wrapping
+ * dictionary buffer and copying out of it.
+ *
+ * The CRC32 of the output is accumulated as it is decompressed and checked
+ * against the trailer once the end of the stream is reached. Checkpoints
+ * include the CRC of the data before them, so this works for any access
+ * pattern that eventually decompresses up to the end of the file.
+ *
+ * Compressed input is read into a large buffer in each context. Reads of the
+ * source file are aligned to the block size of the disk it is on, rather than
+ * relative to the start of the payload. Filesystems place file data on block
+ * boundaries, so the reads are made up of whole device blocks regardless of
+ * where the header ends, and do not need to go through a bounce buffer. Files
+ * not on a disk fall back to INPUT_ALIGN.
+ */
+
+ #include <arch/page.h>
+
+ #include <fs/decompress.h>
+
+ #include <lib/crc32.h>
+ #include <lib/list.h>
+ #include <lib/string.h>
+ #include <lib/tinfl.h>
+ #include <lib/utility.h>
+
+ #include <assert.h>
+ #include <disk.h>
+ #include <endian.h>
+ #include <memory.h>
+ #include <fs.h>
+ #include <loader.h>
+
+/** Fixed part of the header of a gzip file. */
+typedef struct gzip_header {
+	uint8_t magic[2];                       /**< Magic number. */
+	uint8_t method;                         /**< Compression method. */
+	uint8_t flags;                          /**< Flags. */
+	uint32_t time;                          /**< Modification time. */
+	uint8_t xflags;                         /**< Extra flags. */
+	uint8_t os;                             /**< OS type. */
+} __packed gzip_header_t;
+
+/** Magic numbers for a gzip file. */
+ #define GZIP_MAGIC0             0x1f
+ #define GZIP_MAGIC1             0x8b
+
+/** Flags in a gzip header. */
+ #define GZIP_ASCII              (1 << 0)
+ #define GZIP_HEADER_CRC         (1 << 1)
+ #define GZIP_EXTRA_FIELD        (1 << 2)
+ #define GZIP_ORIG_NAME          (1 << 3)
+ #define GZIP_COMMENT            (1 << 4)
+ #define GZIP_ENCRYPTED          (1 << 5)
+
+/** Compression methods. */
+ #define GZIP_METHOD_DEFLATE     8
+
+/** Maximum header size. */
+ #define MAX_HEADER_SIZE         DECOMPRESS_PROBE_SIZE
+
+/** Size of the dictionary buffer. */
+ #define DICT_BUFFER_SIZE        TINFL_LZ_DICT_SIZE
+
+/** Size of the input buffer. */
+ #define INPUT_BUFFER_SIZE       (256 * 1024)
+
+/** Default alignment of input reads (a multiple of common block sizes). */
+ #define INPUT_ALIGN             4096
+
+/** Number of decompression contexts to keep. */
+ #define GZIP_CONTEXT_COUNT 4
+
+/** Interval (in output bytes) between decompression checkpoints. */
+ #define CHECKPOINT_INTERVAL     (4 * 1024 * 1024)
+
+/** Decompression state (saved as a checkpoint). */
+typedef struct gzip_state {
+	uint32_t payload_offset;                /**< Current offset in the payload. */
+	uint32_t dict_offset;                   /**< Current offset in dictionary buffer. */
+	uint32_t dict_avail;                    /**< Available data in dictionary buffer. */
+	uint32_t output_offset;                 /**< Current offset in the output file. */
+	uint32_t crc;                           /**< CRC of output so far. */
+	tinfl_decompressor decompressor;        /**< Decompression state. */
+
+	/** Buffer to decompress to, tinfl requires a large buffer. */
+	uint8_t dict_buffer[DICT_BUFFER_SIZE];
+} gzip_state_t;
+
+/** Decompression context. */
+typedef struct gzip_context {
+	list_t header;                          /**< Link to context list. */
+	struct gzip_handle *handle;             /**< Handle using the context (NULL if unused). */
+
+	gzip_state_t state;                     /**< Decompression state. */
+
+	uint32_t input_start;                   /**< File offset of the data in the input buffer. */
+	uint32_t input_size;                    /**< Amount of data in the input buffer. */
+
+	/** Compressed input buffer. */
+	uint8_t input_buffer[INPUT_BUFFER_SIZE] __aligned(8);
+} gzip_context_t;
+
+/** gzip file handle structure. */
+typedef struct gzip_handle {
+	decompress_handle_t handle;             /**< Decompression handle header. */
+
+	uint32_t payload_start;                 /**< Start of the payload in the file. */
+	uint32_t payload_size;                  /**< Total payload size. */
+	uint32_t crc;                           /**< Expected CRC of the output. */
+	uint32_t input_align;                   /**< Alignment of input reads in the file. */
+	gzip_context_t *context;                /**< Decompression context (NULL if none). */
+
+	gzip_state_t **checkpoints;             /**< Checkpoints, in order of output offset. */
+	size_t checkpoint_count;                /**< Number of checkpoints. */
+} gzip_handle_t;
+
+/** List of decompression contexts, most recently used first. */
+static LIST_DECLARE(gzip_contexts);
+
+/** Number of decompression contexts allocated. */
+static size_t gzip_context_count;
+
+/** Skip a variable-length field in the gzip header.
+ * @param handle        Compressed file handle.
+ * @param buf           Buffer containing the start of the file.
+ * @param size          Size of the data in the buffer.
+ * @return              Whether successfully skipped. */
+static inline bool skip_variable_field(gzip_handle_t *handle, const uint8_t *buf, size_t size)
+{
+	do {
+		if (handle->payload_start >= size) {
+			dprintf("fs: warning: gzip header is too large\n");
+			return false;
+		}
+	} while (buf[handle->payload_start++]);
+
+	return true;
+}
+
+/** Reset a decompression context to the start of the file.
+ * @param context       Context to reset. */
+static void reset_context(gzip_context_t *context)
+{
+	context->state.payload_offset = context->state.dict_offset = 0;
+	context->state.dict_avail = context->state.output_offset = 0;
+	context->state.crc = 0xffffffff;
+	tinfl_init(&context->state.decompressor);
+}
+
+/** Get the decompression context for a handle.
+ * @param handle        Handle to get context for.
+ * @return              Context for the handle. If the handle did not have a
+ *                      context, it will be positioned at the start of the
+ *                      file. */
+static gzip_context_t *get_context(gzip_handle_t *handle)
+{
+	gzip_context_t *context = handle->context;
+
+	if (!context) {
+		/* Unused contexts are kept at the end of the list, otherwise the last
+		 * entry is the least recently used. Only take that from its handle if
+		 * we cannot allocate a new context. */
+		context = (!list_empty(&gzip_contexts))
+			? list_last(&gzip_contexts, gzip_context_t, header)
+			: NULL;
+
+		if (!context || (context->handle && gzip_context_count < GZIP_CONTEXT_COUNT)) {
+			context = memory_alloc(
+				round_up(sizeof(*context), PAGE_SIZE), 0, 0, 0,
+				MEMORY_TYPE_INTERNAL, MEMORY_ALLOC_HIGH, NULL);
+			list_init(&context->header);
+			gzip_context_count++;
+		} else if (context->handle) {
+			context->handle->context = NULL;
+		}
+
+		context->handle = handle;
+		handle->context = context;
+		context->input_size = 0;
+		reset_context(context);
+	}
+
+	list_prepend(&gzip_contexts, &context->header);
+	return context;
+}
+
+/** Release the decompression context for a handle.
+ * @param handle        Handle to release context from. */
+static void put_context(gzip_handle_t *handle)
+{
+	gzip_context_t *context = handle->context;
+
+	if (context) {
+		context->handle = NULL;
+		handle->context = NULL;
+		list_append(&gzip_contexts, &context->header);
+	}
+}
+
+/** Record a checkpoint if one is due.
+ * @param handle        Handle being decompressed.
+ * @param context       Current context for the handle. */
+static void save_checkpoint(gzip_handle_t *handle, gzip_context_t *context)
+{
+	gzip_state_t *checkpoint;
+
+	/* Checkpoints are only recorded the first time we pass through each
+	 * interval, so they are always in order. */
+	if (context->state.output_offset < (handle->checkpoint_count + 1) * (offset_t)CHECKPOINT_INTERVAL)
+		return;
+
+	checkpoint = memory_alloc(
+		round_up(sizeof(*checkpoint), PAGE_SIZE), 0, 0, 0,
+		MEMORY_TYPE_INTERNAL, MEMORY_ALLOC_HIGH | MEMORY_ALLOC_CAN_FAIL, NULL);
+	if (!checkpoint)
+		return;
+
+	memcpy(checkpoint, &context->state, sizeof(*checkpoint));
+
+	handle->checkpoints = realloc(
+		handle->checkpoints, (handle->checkpoint_count + 1) * sizeof(*handle->checkpoints));
+	handle->checkpoints[handle->checkpoint_count++] = checkpoint;
+}
+
+/** Find the closest checkpoint at or before an offset.
+ * @param handle        Handle to search.
+ * @param offset        Output offset to find.
+ * @return              Pointer to checkpoint, or NULL if none before offset. */
+static gzip_state_t *find_checkpoint(gzip_handle_t *handle, uint32_t offset)
+{
+	size_t low = 0, high = handle->checkpoint_count;
+
+	while (low < high) {
+		size_t mid = (low + high) / 2;
+
+		if (handle->checkpoints[mid]->output_offset <= offset) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return (low) ? handle->checkpoints[low - 1] : NULL;
+}
+
+/** Get compressed input at the current position, reading more if needed.
+ * @param handle        Handle being decompressed.
+ * @param context       Current context for the handle.
+ * @param _buf          Where to store pointer to input data.
+ * @param _size         Where to store amount of input data available.
+ * @return              Status code describing the result of the operation. */
+static status_t get_input(
+	gzip_handle_t *handle, gzip_context_t *context, const uint8_t **_buf,
+	size_t *_size)
+{
+	uint32_t pos = handle->payload_start + context->state.payload_offset;
+	uint32_t end = handle->payload_start + handle->payload_size;
+	status_t ret;
+
+	if (pos < context->input_start || pos >= context->input_start + context->input_size) {
+		context->input_start = round_down(pos, handle->input_align);
+		context->input_size = min(end - context->input_start, INPUT_BUFFER_SIZE);
+
+		ret = fs_read(
+			handle->handle.source, context->input_buffer, context->input_size,
+			context->input_start);
+		if (ret != STATUS_SUCCESS) {
+			context->input_size = 0;
+			return ret;
+		}
+	}
+
+	*_buf = &context->input_buffer[pos - context->input_start];
+	*_size = context->input_start + context->input_size - pos;
+	return STATUS_SUCCESS;
+}
+
+/** Check the CRC of the output once the end of the stream has been reached.
+ * @param handle        Handle being decompressed.
+ * @param state         Decompression state.
+ * @return              Whether the CRC matches. */
+static bool check_crc(gzip_handle_t *handle, gzip_state_t *state)
+{
+	if (~state->crc != handle->crc) {
+		dprintf(
+			"fs: warning: gzip CRC mismatch (expected 0x%" PRIx32 ", got 0x%" PRIx32 ")\n",
+			handle->crc, ~state->crc);
+		return false;
+	}
+
+	return true;
+}
+
+/** Decompress an entire file directly into a buffer.
+ * @param handle        Handle to read from.
+ * @param context       Current context for the handle.
+ * @param buf           Buffer to read into (must be the size of the file).
+ * @return              Status code describing the result of the operation. */
+static status_t decompress_whole(gzip_handle_t *handle, gzip_context_t *context, void *buf)
+{
+	gzip_state_t *state = &context->state;
+	size_t out_offset = 0;
+	tinfl_status status;
+	status_t ret;
+
+	reset_context(context);
+
+	do {
+		const uint8_t *in_buf;
+		size_t out_size, in_size;
+
+		ret = get_input(handle, context, &in_buf, &in_size);
+		if (ret != STATUS_SUCCESS)
+			goto out;
+
+		out_size = handle->handle.handle.size - out_offset;
+
+		status = tinfl_decompress(
+			&state->decompressor, in_buf, &in_size, buf, buf + out_offset, &out_size,
+			TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF |
+				((in_size < handle->payload_size - state->payload_offset) ? TINFL_FLAG_HAS_MORE_INPUT : 0));
+
+		state->payload_offset += in_size;
+		state->crc = crc32(state->crc, buf + out_offset, out_size);
+		out_offset += out_size;
+
+		/* The output buffer being full before the end of the stream means the
+		 * size in the trailer is wrong. */
+		if (status < TINFL_STATUS_DONE || (status == TINFL_STATUS_HAS_MORE_OUTPUT && out_offset == handle->handle.handle.size)) {
+			dprintf("fs: warning: error %d decompressing data\n", status);
+			ret = STATUS_DEVICE_ERROR;
+			goto out;
+		}
+	} while (status != TINFL_STATUS_DONE);
+
+	ret = (out_offset == handle->handle.handle.size && check_crc(handle, state))
+		? STATUS_SUCCESS
+		: STATUS_DEVICE_ERROR;
+
+out:
+	/* The dictionary buffer does not hold the window, start again next time. */
+	reset_context(context);
+	return ret;
+}
+
+/** Check whether a file is gzip-compressed.
+ * @param buf           Start of the file.
+ * @param size          Size of the data in the buffer.
+ * @return              Whether the file is gzip-compressed. */
+static bool gzip_probe(const uint8_t *buf, size_t size)
+{
+	const gzip_header_t *header = (const gzip_header_t *)buf;
+
+	return size >= sizeof(*header) && header->magic[0] == GZIP_MAGIC0 && header->magic[1] == GZIP_MAGIC1;
+}
+
+/** Get the alignment to use for input reads from a file.
+ * @param source        Handle to the source file.
+ * @return              Alignment of input reads. */
+static uint32_t get_input_align(fs_handle_t *source)
+{
+#ifdef CONFIG_TARGET_HAS_DISK
+	device_t *device = source->mount->device;
+
+	if (device->type == DEVICE_TYPE_DISK) {
+		disk_device_t *disk = (disk_device_t *)device;
+
+		/* Leave most of the buffer for data past the current position. */
+		if (is_pow2(disk->block_size) && disk->block_size <= INPUT_BUFFER_SIZE / 4)
+			return disk->block_size;
+	}
+#endif
+
+	return INPUT_ALIGN;
+}
+
+/** Open a gzip-compressed file.
+ * @param source        Handle to the source file.
+ * @param buf           Start of the file.
+ * @param size          Size of the data in the buffer.
+ * @param _handle       Where to store pointer to handle.
+ * @param _size         Where to store the decompressed size of the file.
+ * @return              Status code describing the result of the operation. */
+static status_t gzip_open(
+	fs_handle_t *source, const uint8_t *buf, size_t size,
+	decompress_handle_t **_handle, offset_t *_size)
+{
+	const gzip_header_t *header = (const gzip_header_t *)buf;
+	gzip_handle_t *handle;
+	uint32_t trailer[2];
+	status_t ret;
+
+	if (header->method != GZIP_METHOD_DEFLATE) {
+		dprintf("fs: warning: cannot handle gzip compression method %u\n", header->method);
+		return STATUS_NOT_SUPPORTED;
+	} else if (header->flags & GZIP_ENCRYPTED) {
+		dprintf("fs: warning: cannot handle encrypted gzip files\n");
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	handle = malloc(sizeof(*handle));
+	handle->context = NULL;
+	handle->checkpoints = NULL;
+	handle->checkpoint_count = 0;
+	handle->input_align = get_input_align(source);
+
+	/* Find the beginning of the payload in the file. */
+	handle->payload_start = sizeof(gzip_header_t);
+
+	if (header->flags & GZIP_EXTRA_FIELD) {
+		uint16_t xlen;
+
+		/* Read length. */
+		ret = fs_read(source, &xlen, sizeof(xlen), handle->payload_start);
+		if (ret != STATUS_SUCCESS)
+			goto err_free;
+
+		handle->payload_start += 2 + le16_to_cpu(xlen);
+	}
+
+	ret = STATUS_CORRUPT_FS;
+
+	if (header->flags & GZIP_ORIG_NAME) {
+		if (!skip_variable_field(handle, buf, size))
+			goto err_free;
+	}
+
+	if (header->flags & GZIP_COMMENT) {
+		if (!skip_variable_field(handle, buf, size))
+			goto err_free;
+	}
+
+	if (header->flags & GZIP_HEADER_CRC)
+		handle->payload_start += 2;
+
+	/* There is a CRC32 and size at the end of the payload. */
+	if (source->size < handle->payload_start + 8)
+		goto err_free;
+
+	handle->payload_size = source->size - handle->payload_start - 8;
+
+	/* Read in the CRC and decompressed file size. */
+	ret = fs_read(source, trailer, sizeof(trailer), source->size - 8);
+	if (ret != STATUS_SUCCESS)
+		goto err_free;
+
+	handle->crc = le32_to_cpu(trailer[0]);
+
+	*_handle = &handle->handle;
+	*_size = le32_to_cpu(trailer[1]);
+	return STATUS_SUCCESS;
+
+err_free:
+	free(handle);
+	return ret;
+}
+
+/** Free gzip decompression state for a file.
+ * @param _handle       Handle being closed. */
+static void gzip_close(decompress_handle_t *_handle)
+{
+	gzip_handle_t *handle = (gzip_handle_t *)_handle;
+
+	put_context(handle);
+
+	for (size_t i = 0; i < handle->checkpoint_count; i++)
+		memory_free(handle->checkpoints[i], round_up(sizeof(gzip_state_t), PAGE_SIZE));
+
+	free(handle->checkpoints);
+}
+
+/** Read from a gzip-compressed file.
+ * @param _handle       Handle to read from.
+ * @param buf           Buffer to read into.
+ * @param count         Number of bytes to read.
+ * @param _offset       Offset to read from.
+ * @return              Status code describing the result of the operation. */
+static status_t gzip_read(decompress_handle_t *_handle, void *buf, size_t count, offset_t _offset)
+{
+	gzip_handle_t *handle = (gzip_handle_t *)_handle;
+	gzip_context_t *context;
+	gzip_state_t *state, *checkpoint;
+	uint32_t offset = _offset;
+	status_t ret;
+
+	context = get_context(handle);
+	state = &context->state;
+
+	if (!offset && count == handle->handle.handle.size)
+		return decompress_whole(handle, context, buf);
+
+	/* Resume from a checkpoint if we need to go backwards, or if there is one
+	 * between the current position and the requested offset. */
+	checkpoint = find_checkpoint(handle, offset);
+	if (checkpoint && (offset < state->output_offset || checkpoint->output_offset > state->output_offset)) {
+		memcpy(state, checkpoint, sizeof(*state));
+	} else if (offset < state->output_offset) {
+		reset_context(context);
+	}
+
+	while (true) {
+		uint32_t skip, size;
+		const uint8_t *in_buf;
+		size_t out_size, in_size;
+		tinfl_status status;
+
+		/* Return available data. Do this first in the loop in case we have any
+		 * remaining data left from a previous call. */
+		if (state->dict_avail) {
+			skip = min(state->dict_avail, offset - state->output_offset);
+			size = min(state->dict_avail - skip, count);
+
+			if (size) {
+				memcpy(buf, &state->dict_buffer[state->dict_offset + skip], size);
+				buf += size;
+				offset += size;
+				count -= size;
+			}
+
+			state->dict_offset = (state->dict_offset + skip + size) % DICT_BUFFER_SIZE;
+			state->output_offset += skip + size;
+			state->dict_avail -= skip + size;
+		}
+
+		if (!count)
+			break;
+
+		assert(state->payload_offset < handle->payload_size);
+
+		ret = get_input(handle, context, &in_buf, &in_size);
+		if (ret != STATUS_SUCCESS)
+			return ret;
+
+		/* Decompress the data. */
+		out_size = DICT_BUFFER_SIZE - state->dict_offset;
+		status = tinfl_decompress(
+			&state->decompressor, in_buf, &in_size, state->dict_buffer,
+			&state->dict_buffer[state->dict_offset],
+			&out_size,
+			(in_size < handle->payload_size - state->payload_offset) ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+		if (status < TINFL_STATUS_DONE) {
+			dprintf("fs: warning: error %d decompressing data\n", status);
+
+			/* Don't know what state things are in, reset everything. */
+			put_context(handle);
+			return STATUS_DEVICE_ERROR;
+		}
+
+		state->payload_offset += in_size;
+		state->dict_avail = out_size;
+		state->crc = crc32(state->crc, &state->dict_buffer[state->dict_offset], out_size);
+
+		if (status == TINFL_STATUS_DONE && !check_crc(handle, state)) {
+			put_context(handle);
+			return STATUS_DEVICE_ERROR;
+		}
+
+		save_checkpoint(handle, context);
+	}
+
+	return STATUS_SUCCESS;
+}
+
+/** gzip decompression codec. */
+BUILTIN_DECOMPRESS_CODEC(gzip_codec) = {
+	.name = "gzip",
+	.probe = gzip_probe,
+	.open = gzip_open,
+	.read = gzip_read,
+	.close = gzip_close,
+};
@@ -169,7 +169,6 @@ static status_t iso9660_iterate(fs_handle_t *_handle, fs_iterate_cb_t cb, void *
 	char *name __cleanup_free;
 	char *buf __cleanup_free;
 	uint32_t offset;
-	bool cont;
 	status_t ret;
 
 	/* Allocate a temporary buffer for names. */
@@ -178,56 +177,166 @@ static status_t iso9660_iterate(fs_handle_t *_handle, fs_iterate_cb_t cb, void *
 		   : ISO9660_MAX_NAME_LEN;
 	name = malloc(name_len);
 
-	/* Read in all the directory data. */
-	buf = malloc(handle->handle.size);
-	ret = iso9660_read(_handle, buf, handle->handle.size, 0);
-	if (ret != STATUS_SUCCESS)
-		return ret;
+	/* Only hold one block of the directory at a time, records never cross a
+	 * block boundary. */
+	buf = malloc(ISO9660_BLOCK_SIZE);
 
-	/* Iterate through each entry. */
-	cont = true;
-	offset = 0;
-	while (cont && offset < handle->handle.size) {
-		iso9660_directory_record_t *record = (iso9660_directory_record_t*)(buf + offset);
-		iso9660_entry_t entry;
+	for (offset = 0; offset < handle->handle.size; offset += ISO9660_BLOCK_SIZE) {
+		uint32_t block_size = min(handle->handle.size - offset, ISO9660_BLOCK_SIZE);
+		uint32_t block_offset = 0;
 
-		if (record->rec_len) {
-			offset += record->rec_len;
-		} else {
-			/* A zero record length means we should move on to the next block.
-			 * If this is the end, this will cause us to break out of the while
-			 * loop if offset becomes >= size. */
-			offset = round_up(offset, ISO9660_BLOCK_SIZE);
-			continue;
-		}
+		ret = iso9660_read(_handle, buf, block_size, offset);
+		if (ret != STATUS_SUCCESS)
+			return ret;
+
+		/* Iterate through each entry. A zero record length means we should
+		 * move on to the next block. */
+		while (block_offset < block_size) {
+			iso9660_directory_record_t *record = (iso9660_directory_record_t*)(buf + block_offset);
+			iso9660_entry_t entry;
 
-		/* Bit 0 indicates that this is not a user-visible record. */
-		if (record->file_flags & (1 << 0))
-			continue;
-
-		/* If this is a directory, check for '.' and '..'. */
-		name[0] = 0;
-		if (record->file_flags & (1 << 1) && record->file_ident_len == 1) {
-			if (record->file_ident[0] == 0) {
-				snprintf(name, name_len, ".");
-			} else if (record->file_ident[0] == 1) {
-				snprintf(name, name_len, "..");
+			if (!record->rec_len) {
+				break;
+			} else if (block_offset + record->rec_len > block_size) {
+				return STATUS_CORRUPT_FS;
 			}
+
+			block_offset += record->rec_len;
+
+			/* Bit 0 indicates that this is not a user-visible record. */
+			if (record->file_flags & (1 << 0))
+				continue;
+
+			/* If this is a directory, check for '.' and '..'. */
+			name[0] = 0;
+			if (record->file_flags & (1 << 1) && record->file_ident_len == 1) {
+				if (record->file_ident[0] == 0) {
+					snprintf(name, name_len, ".");
+				} else if (record->file_ident[0] == 1) {
+					snprintf(name, name_len, "..");
+				}
+			}
+
+			if (!name[0])
+				parse_name(record, name, mount->joliet_level);
+
+			entry.entry.owner = &handle->handle;
+			entry.entry.name = name;
+			entry.record = record;
+
+			if (!cb(&entry.entry, arg))
+				return STATUS_SUCCESS;
 		}
+	}
+
+	return STATUS_SUCCESS;
+}
+
+/** Read a batch of ISO9660 directory entries.
+ * @param _handle       Handle to directory.
+ * @param cursor        Byte offset in the directory to continue from.
+ * @param buf           Buffer to pack records into.
+ * @param size          Size of the buffer.
+ * @param _count        Where to store number of records returned.
+ * @return              Status code describing the result of the operation. */
+static status_t iso9660_read_dir(fs_handle_t *_handle, offset_t *cursor, void *buf, size_t size, size_t *_count)
+{
+	iso9660_handle_t *handle = (iso9660_handle_t*)_handle;
+	iso9660_mount_t *mount = (iso9660_mount_t*)_handle->mount;
+	char name[ISO9660_JOLIET_MAX_NAME_LEN * MAX_UTF8_PER_UTF16 + 1];
+	char *block __cleanup_free;
+	size_t count;
+	status_t ret;
 
-		if (!name[0])
-			parse_name(record, name, mount->joliet_level);
+	block = malloc(ISO9660_BLOCK_SIZE);
 
-		entry.entry.owner = &handle->handle;
-		entry.entry.name = name;
-		entry.record = record;
+	/* Records never cross a block boundary, so we can work a block at a time.
+	 * The last block is only read up to the end of the directory extent. */
+	count = 0;
+	while (*cursor < handle->handle.size) {
+		offset_t start = round_down(*cursor, ISO9660_BLOCK_SIZE);
+		size_t block_size = min(handle->handle.size - start, ISO9660_BLOCK_SIZE);
+		size_t offset = *cursor - start;
 
-		cont = cb(&entry.entry, arg);
+		ret = iso9660_read(_handle, block, block_size, start);
+		if (ret != STATUS_SUCCESS)
+			return ret;
+
+		while (offset < block_size) {
+			iso9660_directory_record_t *record = (iso9660_directory_record_t*)(block + offset);
+
+			/* A zero record length means we should move on to the next block. */
+			if (!record->rec_len) {
+				*cursor = start + ISO9660_BLOCK_SIZE;
+				break;
+			} else if (offset + record->rec_len > block_size) {
+				return STATUS_CORRUPT_FS;
+			}
+
+			/* Bit 0 indicates that this is not a user-visible record. */
+			if (!(record->file_flags & (1 << 0))) {
+				name[0] = 0;
+				if (record->file_flags & (1 << 1) && record->file_ident_len == 1) {
+					if (record->file_ident[0] == 0) {
+						strcpy(name, ".");
+					} else if (record->file_ident[0] == 1) {
+						strcpy(name, "..");
+					}
+				}
+
+				if (!name[0])
+					parse_name(record, name, mount->joliet_level);
+
+				if (!fs_dir_record_pack(
+						&buf, &size, name, strlen(name),
+						(record->file_flags & (1 << 1)) ? FILE_TYPE_DIR : FILE_TYPE_REGULAR,
+						le32_to_cpu(record->data_len_le), *cursor))
+					goto out;
+
+				count++;
+			}
+
+			offset += record->rec_len;
+			*cursor += record->rec_len;
+		}
 	}
 
+out:
+	*_count = count;
 	return STATUS_SUCCESS;
 }
 
+/** Open an entry from an ISO9660 directory record.
+ * @param _owner        Directory that the record was read from.
+ * @param record        Record for the entry (cookie is the byte offset of its
+ *                      directory record).
+ * @param _handle       Where to store pointer to opened handle.
+ * @return              Status code describing the result of the operation. */
+static status_t iso9660_open_cookie(fs_handle_t *_owner, const fs_dir_record_t *record, fs_handle_t **_handle)
+{
+	iso9660_directory_record_t dir_record;
+	iso9660_entry_t entry;
+	status_t ret;
+
+	/* Only the fixed part of the record is needed to open the entry, which
+	 * never crosses a block boundary. */
+	if (record->cookie + sizeof(dir_record) > _owner->size)
+		return STATUS_CORRUPT_FS;
+
+	ret = iso9660_read(_owner, &dir_record, sizeof(dir_record), record->cookie);
+	if (ret != STATUS_SUCCESS)
+		return ret;
+
+	if (dir_record.rec_len < sizeof(dir_record))
+		return STATUS_CORRUPT_FS;
+
+	entry.entry.owner = _owner;
+	entry.entry.name = NULL;
+	entry.record = &dir_record;
+
+	return iso9660_open_entry(&entry.entry, _handle);
+}
+
 /** Generate a UUID.
  * @param pri           Primary volume descriptor.
  * @return              Pointer to allocated string for UUID. */
@@ -347,5 +456,7 @@ BUILTIN_FS_OPS(iso9660_fs_ops) = {
 	.read		= iso9660_read,
 	.open_entry	= iso9660_open_entry,
 	.iterate	= iso9660_iterate,
+	.read_dir	= iso9660_read_dir,
+	.open_cookie	= iso9660_open_cookie,
 	.mount		= iso9660_mount,
 };
@@ -0,0 +1,577 @@
+/*
+ * Copyright (C) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               LZ4 decompression codec.
+ *
+ * This file implements support for transparent decompression of files in the
+ * LZ4 frame format. A frame is a header followed by a series of blocks, each of
+ * which decompresses to at most the maximum block size given in the header.
+ * Blocks are either independent, or linked, in which case matches may refer to
+ * up to 64K of the output of previous blocks.
+ *
+ * The decompressed size of the file is taken from the content size field of
+ * the frame header if present. Otherwise, we have to scan through all blocks
+ * when opening the file to work out the size. This does not require actually
+ * decompressing the data, only parsing the sequence headers.
+ *
+ * LZ4 blocks are decompressed whole. For partial reads, each handle has a
+ * buffer which holds the current block, preceded by the 64K window of previous
+ * output for linked blocks. An index of block positions is recorded as the
+ * file is read (or scanned on open), so that seeks can resume from the nearest
+ * indexed block rather than the start of the file. For linked blocks, index
+ * entries also need a copy of the window, so they are recorded less often.
+ *
+ * Reads of an entire file decompress directly into the destination buffer,
+ * which also serves as the window for linked blocks.
+ */
+
+ #include <arch/page.h>
+
+ #include <fs/decompress.h>
+
+ #include <lib/lz4.h>
+ #include <lib/string.h>
+ #include <lib/utility.h>
+ #include <lib/xxhash.h>
+
+ #include <assert.h>
+ #include <endian.h>
+ #include <memory.h>
+ #include <fs.h>
+ #include <loader.h>
+
+/** Fixed part of the LZ4 frame header. */
+typedef struct lz4_header {
+	uint32_t magic;                         /**< Magic number. */
+	uint8_t flags;                          /**< Frame flags. */
+	uint8_t block_desc;                     /**< Block descriptor. */
+} __packed lz4_header_t;
+
+/** Magic number for an LZ4 frame. */
+ #define LZ4_MAGIC               0x184d2204
+
+/** Frame flags. */
+ #define LZ4_DICT_ID             (1 << 0)
+ #define LZ4_CONTENT_CHECKSUM    (1 << 2)
+ #define LZ4_CONTENT_SIZE        (1 << 3)
+ #define LZ4_BLOCK_CHECKSUM      (1 << 4)
+ #define LZ4_BLOCK_INDEPENDENT   (1 << 5)
+ #define LZ4_VERSION_MASK        (3 << 6)
+ #define LZ4_VERSION             (1 << 6)
+
+/** Get the maximum block size from the block descriptor. */
+ #define LZ4_BLOCK_MAX_SHIFT     4
+ #define LZ4_BLOCK_MAX_MASK      7
+
+/** Block header bit indicating that the block is not compressed. */
+ #define LZ4_BLOCK_UNCOMPRESSED  (1u << 31)
+
+/** Size of the window for linked blocks. */
+ #define WINDOW_SIZE             65536
+
+/** Interval (in output bytes) between index entries for independent blocks. */
+ #define INDEX_INTERVAL          (1 * 1024 * 1024)
+
+/** Interval (in output bytes) between index entries for linked blocks. */
+ #define LINKED_INDEX_INTERVAL   (4 * 1024 * 1024)
+
+/** Index entry for a block. */
+typedef struct lz4_index {
+	offset_t in_offset;                     /**< Offset of the block header in the file. */
+	offset_t out_offset;                    /**< Output offset of the block. */
+	uint8_t *window;                        /**< Copy of the window (linked blocks only). */
+} lz4_index_t;
+
+/** LZ4 file handle structure. */
+typedef struct lz4_handle {
+	decompress_handle_t handle;             /**< Decompression handle header. */
+
+	uint8_t flags;                          /**< Frame flags. */
+	uint32_t block_max;                     /**< Maximum block size. */
+	offset_t data_start;                    /**< Offset of the first block. */
+
+	uint8_t *in_buf;                        /**< Compressed block buffer (block_max). */
+	uint8_t *out_buf;                       /**< Window and current block buffer. */
+	offset_t in_offset;                     /**< Offset of the next block header. */
+	offset_t out_offset;                    /**< Output offset of the current block. */
+	size_t out_size;                        /**< Size of the current block. */
+
+	lz4_index_t *index;                     /**< Index entries, in order of output offset. */
+	size_t index_count;                     /**< Number of index entries. */
+} lz4_handle_t;
+
+/** Get whether a frame has linked blocks.
+ * @param handle        Handle to check.
+ * @return              Whether the frame has linked blocks. */
+static inline bool is_linked(lz4_handle_t *handle)
+{
+	return !(handle->flags & LZ4_BLOCK_INDEPENDENT);
+}
+
+/** Get the size of the window available before an output offset.
+ * @param handle        Handle being decompressed.
+ * @param offset        Output offset.
+ * @return              Size of window. */
+static inline size_t window_size(lz4_handle_t *handle, offset_t offset)
+{
+	return (is_linked(handle)) ? min(offset, WINDOW_SIZE) : 0;
+}
+
+/** Record an index entry if one is due.
+ * @param handle        Handle being decompressed.
+ * @param in_offset     Offset of the block header in the file.
+ * @param out_offset    Output offset of the block.
+ * @param window        End of the window preceding the block. */
+static void save_index(lz4_handle_t *handle, offset_t in_offset, offset_t out_offset, const uint8_t *window)
+{
+	offset_t last = (handle->index_count) ? handle->index[handle->index_count - 1].out_offset : 0;
+	size_t interval = (is_linked(handle)) ? LINKED_INDEX_INTERVAL : INDEX_INTERVAL;
+	uint8_t *copy = NULL;
+
+	/* Entries are only added past the end of the existing ones, so they are
+	 * always in order. */
+	if (out_offset < last + interval)
+		return;
+
+	if (is_linked(handle)) {
+		copy = memory_alloc(
+			WINDOW_SIZE, 0, 0, 0, MEMORY_TYPE_INTERNAL,
+			MEMORY_ALLOC_HIGH | MEMORY_ALLOC_CAN_FAIL, NULL);
+		if (!copy)
+			return;
+
+		memcpy(copy, window - WINDOW_SIZE, WINDOW_SIZE);
+	}
+
+	handle->index = realloc(handle->index, (handle->index_count + 1) * sizeof(*handle->index));
+	handle->index[handle->index_count].in_offset = in_offset;
+	handle->index[handle->index_count].out_offset = out_offset;
+	handle->index[handle->index_count].window = copy;
+	handle->index_count++;
+}
+
+/** Find the closest index entry at or before an offset.
+ * @param handle        Handle to search.
+ * @param offset        Output offset to find.
+ * @return              Pointer to index entry, or NULL if none before offset. */
+static lz4_index_t *find_index(lz4_handle_t *handle, offset_t offset)
+{
+	size_t low = 0, high = handle->index_count;
+
+	while (low < high) {
+		size_t mid = (low + high) / 2;
+
+		if (handle->index[mid].out_offset <= offset) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return (low) ? &handle->index[low - 1] : NULL;
+}
+
+/** Read the header of the next block.
+ * @param handle        Handle being decompressed.
+ * @param _header       Where to store block header.
+ * @return              Status code describing the result of the operation. */
+static status_t read_block_header(lz4_handle_t *handle, uint32_t *_header)
+{
+	uint32_t header;
+	status_t ret;
+
+	ret = fs_read(handle->handle.source, &header, sizeof(header), handle->in_offset);
+	if (ret != STATUS_SUCCESS)
+		return ret;
+
+	header = le32_to_cpu(header);
+
+	if ((header & ~LZ4_BLOCK_UNCOMPRESSED) > handle->block_max) {
+		dprintf("fs: warning: LZ4 block size %u is too large\n", header & ~LZ4_BLOCK_UNCOMPRESSED);
+		return STATUS_CORRUPT_FS;
+	}
+
+	*_header = header;
+	return STATUS_SUCCESS;
+}
+
+/** Read the compressed data for a block and move past it.
+ * @param handle        Handle being decompressed.
+ * @param buf           Buffer to read into.
+ * @param size          Size of the block data.
+ * @return              Status code describing the result of the operation. */
+static status_t read_block_data(lz4_handle_t *handle, void *buf, size_t size)
+{
+	status_t ret;
+
+	ret = fs_read(handle->handle.source, buf, size, handle->in_offset + sizeof(uint32_t));
+	if (ret != STATUS_SUCCESS)
+		return ret;
+
+	handle->in_offset += sizeof(uint32_t) + size;
+	if (handle->flags & LZ4_BLOCK_CHECKSUM)
+		handle->in_offset += sizeof(uint32_t);
+
+	return STATUS_SUCCESS;
+}
+
+/** Decompress the next block.
+ * @param handle        Handle being decompressed.
+ * @param dest          Buffer to decompress into.
+ * @param dest_size     Size of the buffer.
+ * @param prefix_size   Size of the window preceding the buffer.
+ * @param _size         Where to store decompressed size of the block.
+ * @return              Status code describing the result of the operation. */
+static status_t decompress_block(
+	lz4_handle_t *handle, uint8_t *dest, size_t dest_size, size_t prefix_size,
+	size_t *_size)
+{
+	uint32_t header, size;
+	status_t ret;
+
+	ret = read_block_header(handle, &header);
+	if (ret != STATUS_SUCCESS)
+		return ret;
+
+	/* We only decompress blocks that must exist given the file size, so the end
+	 * of the frame here means the size is wrong. */
+	if (!header)
+		return STATUS_CORRUPT_FS;
+
+	size = header & ~LZ4_BLOCK_UNCOMPRESSED;
+
+	if (header & LZ4_BLOCK_UNCOMPRESSED) {
+		if (size > dest_size)
+			return STATUS_CORRUPT_FS;
+
+		*_size = size;
+		return read_block_data(handle, dest, size);
+	}
+
+	if (!handle->in_buf) {
+		handle->in_buf = memory_alloc(
+			handle->block_max, 0, 0, 0, MEMORY_TYPE_INTERNAL,
+			MEMORY_ALLOC_HIGH, NULL);
+	}
+
+	ret = read_block_data(handle, handle->in_buf, size);
+	if (ret != STATUS_SUCCESS)
+		return ret;
+
+	if (!lz4_decompress(handle->in_buf, size, dest, prefix_size, dest_size, _size)) {
+		dprintf("fs: warning: error decompressing LZ4 block\n");
+		return STATUS_CORRUPT_FS;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+/** Reset a handle to the start of the file.
+ * @param handle        Handle to reset. */
+static void reset_position(lz4_handle_t *handle)
+{
+	handle->in_offset = handle->data_start;
+	handle->out_offset = handle->out_size = 0;
+}
+
+/** Get the size of a frame without a content size by scanning its blocks.
+ * @param handle        Handle to scan.
+ * @param _size         Where to store decompressed size.
+ * @return              Status code describing the result of the operation. */
+static status_t scan_size(lz4_handle_t *handle, offset_t *_size)
+{
+	offset_t size = 0;
+	status_t ret;
+
+	reset_position(handle);
+
+	while (true) {
+		uint32_t header;
+		size_t block_size;
+
+		ret = read_block_header(handle, &header);
+		if (ret != STATUS_SUCCESS)
+			return ret;
+
+		if (!header)
+			break;
+
+		/* No window is available here, so only independent blocks can be
+		 * indexed. */
+		if (!is_linked(handle))
+			save_index(handle, handle->in_offset, size, NULL);
+
+		block_size = header & ~LZ4_BLOCK_UNCOMPRESSED;
+
+		if (header & LZ4_BLOCK_UNCOMPRESSED) {
+			handle->in_offset += sizeof(uint32_t) + block_size;
+			if (handle->flags & LZ4_BLOCK_CHECKSUM)
+				handle->in_offset += sizeof(uint32_t);
+		} else {
+			if (!handle->in_buf) {
+				handle->in_buf = memory_alloc(
+					handle->block_max, 0, 0, 0, MEMORY_TYPE_INTERNAL,
+					MEMORY_ALLOC_HIGH, NULL);
+			}
+
+			ret = read_block_data(handle, handle->in_buf, block_size);
+			if (ret != STATUS_SUCCESS)
+				return ret;
+
+			if (!lz4_decompressed_size(handle->in_buf, block_size, &block_size)
+				|| block_size > handle->block_max)
+			{
+				return STATUS_CORRUPT_FS;
+			}
+		}
+
+		size += block_size;
+	}
+
+	reset_position(handle);
+	*_size = size;
+	return STATUS_SUCCESS;
+}
+
+/** Check whether a file is an LZ4 frame.
+ * @param buf           Start of the file.
+ * @param size          Size of the data in the buffer.
+ * @return              Whether the file is an LZ4 frame. */
+static bool lz4_probe(const uint8_t *buf, size_t size)
+{
+	const lz4_header_t *header = (const lz4_header_t *)buf;
+
+	return size >= sizeof(*header) && le32_to_cpu(header->magic) == LZ4_MAGIC;
+}
+
+/** Free LZ4 decompression state for a file.
+ * @param _handle       Handle being closed. */
+static void lz4_close(decompress_handle_t *_handle)
+{
+	lz4_handle_t *handle = (lz4_handle_t *)_handle;
+
+	for (size_t i = 0; i < handle->index_count; i++) {
+		if (handle->index[i].window)
+			memory_free(handle->index[i].window, WINDOW_SIZE);
+	}
+
+	free(handle->index);
+
+	if (handle->in_buf)
+		memory_free(handle->in_buf, handle->block_max);
+	if (handle->out_buf)
+		memory_free(handle->out_buf, WINDOW_SIZE + handle->block_max);
+}
+
+/** Open an LZ4-compressed file.
+ * @param source        Handle to the source file.
+ * @param buf           Start of the file.
+ * @param size          Size of the data in the buffer.
+ * @param _handle       Where to store pointer to handle.
+ * @param _size         Where to store the decompressed size of the file.
+ * @return              Status code describing the result of the operation. */
+static status_t lz4_open(
+	fs_handle_t *source, const uint8_t *buf, size_t size,
+	decompress_handle_t **_handle, offset_t *_size)
+{
+	const lz4_header_t *header = (const lz4_header_t *)buf;
+	lz4_handle_t *handle;
+	unsigned block_max;
+	offset_t header_size;
+	uint32_t checksum;
+	status_t ret;
+
+	if ((header->flags & LZ4_VERSION_MASK) != LZ4_VERSION) {
+		dprintf("fs: warning: unknown LZ4 frame version\n");
+		return STATUS_NOT_SUPPORTED;
+	} else if (header->flags & LZ4_DICT_ID) {
+		dprintf("fs: warning: cannot handle LZ4 frames with a dictionary\n");
+		return STATUS_NOT_SUPPORTED;
+	}
+
+	block_max = (header->block_desc >> LZ4_BLOCK_MAX_SHIFT) & LZ4_BLOCK_MAX_MASK;
+	if (block_max < 4) {
+		dprintf("fs: warning: invalid LZ4 block size %u\n", block_max);
+		return STATUS_CORRUPT_FS;
+	}
+
+	/* Header is followed by the optional content size and a header checksum. */
+	header_size = sizeof(*header) + 1;
+	if (header->flags & LZ4_CONTENT_SIZE)
+		header_size += sizeof(uint64_t);
+
+	if (header_size > size)
+		return STATUS_CORRUPT_FS;
+
+	/* The header checksum is the second byte of the xxHash32 of the
+	 * descriptor (everything between the magic number and the checksum). */
+	checksum = xxh32(buf + sizeof(header->magic), header_size - sizeof(header->magic) - 1, 0) >> 8;
+	if ((uint8_t)checksum != buf[header_size - 1]) {
+		dprintf("fs: warning: LZ4 frame header checksum mismatch\n");
+		return STATUS_CORRUPT_FS;
+	}
+
+	handle = malloc(sizeof(*handle));
+	handle->handle.source = source;
+	handle->flags = header->flags;
+	handle->block_max = 1 << (8 + (2 * block_max));
+	handle->data_start = header_size;
+	handle->in_buf = handle->out_buf = NULL;
+	handle->index = NULL;
+	handle->index_count = 0;
+
+	reset_position(handle);
+
+	if (header->flags & LZ4_CONTENT_SIZE) {
+		uint64_t content_size;
+
+		memcpy(&content_size, buf + sizeof(*header), sizeof(content_size));
+		*_size = le64_to_cpu(content_size);
+	} else {
+		ret = scan_size(handle, _size);
+		if (ret != STATUS_SUCCESS) {
+			lz4_close(&handle->handle);
+			free(handle);
+			return ret;
+		}
+	}
+
+	*_handle = &handle->handle;
+	return STATUS_SUCCESS;
+}
+
+/** Decompress an entire file directly into a buffer.
+ * @param handle        Handle to read from.
+ * @param buf           Buffer to read into (must be the size of the file).
+ * @return              Status code describing the result of the operation. */
+static status_t decompress_whole(lz4_handle_t *handle, uint8_t *buf)
+{
+	offset_t total = handle->handle.handle.size;
+	offset_t offset = 0;
+	status_t ret = STATUS_SUCCESS;
+
+	reset_position(handle);
+
+	while (offset < total) {
+		size_t size;
+
+		save_index(handle, handle->in_offset, offset, buf + offset);
+
+		ret = decompress_block(
+			handle, buf + offset, total - offset, window_size(handle, offset),
+			&size);
+		if (ret != STATUS_SUCCESS)
+			break;
+
+		offset += size;
+	}
+
+	/* The block buffer does not hold the current block, start again next time. */
+	reset_position(handle);
+	return ret;
+}
+
+/** Read from an LZ4-compressed file.
+ * @param _handle       Handle to read from.
+ * @param buf           Buffer to read into.
+ * @param count         Number of bytes to read.
+ * @param offset        Offset to read from.
+ * @return              Status code describing the result of the operation. */
+static status_t lz4_read(decompress_handle_t *_handle, void *buf, size_t count, offset_t offset)
+{
+	lz4_handle_t *handle = (lz4_handle_t *)_handle;
+	lz4_index_t *entry;
+	uint8_t *block;
+	status_t ret;
+
+	if (!offset && count == handle->handle.handle.size)
+		return decompress_whole(handle, buf);
+
+	if (!handle->out_buf) {
+		handle->out_buf = memory_alloc(
+			WINDOW_SIZE + handle->block_max, 0, 0, 0, MEMORY_TYPE_INTERNAL,
+			MEMORY_ALLOC_HIGH, NULL);
+	}
+
+	/* The current block is stored after the window. */
+	block = handle->out_buf + WINDOW_SIZE;
+
+	/* Resume from an index entry if we need to go backwards, or if there is one
+	 * past the current position. */
+	entry = find_index(handle, offset);
+	if (entry && (offset < handle->out_offset || entry->out_offset > handle->out_offset + handle->out_size)) {
+		handle->in_offset = entry->in_offset;
+		handle->out_offset = entry->out_offset;
+		handle->out_size = 0;
+
+		if (entry->window)
+			memcpy(handle->out_buf, entry->window, WINDOW_SIZE);
+	} else if (offset < handle->out_offset) {
+		reset_position(handle);
+	}
+
+	while (true) {
+		size_t skip, size;
+
+		/* Return available data from the current block. */
+		if (offset < handle->out_offset + handle->out_size) {
+			skip = offset - handle->out_offset;
+			size = min(handle->out_size - skip, count);
+
+			memcpy(buf, block + skip, size);
+			buf += size;
+			offset += size;
+			count -= size;
+		}
+
+		if (!count)
+			break;
+
+		/* Move on to the next block, keeping the end of the current one as the
+		 * window for linked blocks. */
+		if (is_linked(handle)) {
+			size = window_size(handle, handle->out_offset + handle->out_size);
+			memmove(block - size, block + handle->out_size - size, size);
+		}
+
+		handle->out_offset += handle->out_size;
+		handle->out_size = 0;
+
+		save_index(handle, handle->in_offset, handle->out_offset, block);
+
+		ret = decompress_block(
+			handle, block, handle->block_max,
+			window_size(handle, handle->out_offset), &handle->out_size);
+		if (ret != STATUS_SUCCESS) {
+			/* Don't know what state things are in, start again next time. */
+			reset_position(handle);
+			return ret;
+		}
+	}
+
+	return STATUS_SUCCESS;
+}
+
+/** LZ4 decompression codec. */
+BUILTIN_DECOMPRESS_CODEC(lz4_codec) = {
+	.name = "LZ4",
+	.probe = lz4_probe,
+	.open = lz4_open,
+	.read = lz4_read,
+	.close = lz4_close,
+};
@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               Zstandard decompression codec.
+ *
+ * This file implements support for transparent decompression of files in the
+ * Zstandard format, using the decoder in lib/zstd.c. Unlike gzip, the frame
+ * header can give the full 64-bit decompressed size. If it is not present
+ * (e.g. the file was compressed from a pipe), we have to scan through all
+ * blocks when opening the file to work out the size. This requires decoding
+ * the sequences, but not the literals or the output.
+ *
+ * Matches can refer back anywhere within the window size given by the frame,
+ * which can be up to WINDOW_MAX. For partial reads, each handle has an output
+ * buffer of twice the window size (or the file size if that is smaller). Blocks
+ * are decompressed onto the end of the buffer, and when it fills up the last
+ * window's worth of output is moved back to the start, so that each byte of
+ * output is copied at most once more on average. Entropy tables carry over
+ * between blocks, so there is no cheap way to resume from the middle of a
+ * frame. Seeking back past the start of the buffer restarts from the
+ * beginning of the file.
+ *
+ * Reads of an entire file decompress directly into the destination buffer,
+ * which also serves as the window, so do not need the output buffer.
+ */
+
+ #include <arch/page.h>
+
+ #include <fs/decompress.h>
+
+ #include <lib/string.h>
+ #include <lib/utility.h>
+ #include <lib/zstd.h>
+
+ #include <assert.h>
+ #include <endian.h>
+ #include <memory.h>
+ #include <fs.h>
+ #include <loader.h>
+
+/**
+ * Maximum window size.
+ *
+ * The window size comes straight from the frame header, and the output buffer
+ * for partial reads is twice that, so it must be limited to something the
+ * loader can reasonably allocate. This is the size that the format recommends
+ * all decoders support, and covers every standard compression level up to 19.
+ * Larger windows are only used by the --ultra levels and long distance mode.
+ */
+ #define WINDOW_MAX              (8 * 1024 * 1024)
+
+/** Decompression state, allocated from physical memory. */
+typedef struct zstd_state {
+	zstd_context_t context;                 /**< Decompression context. */
+	uint8_t input[ZSTD_BLOCK_MAX];          /**< Compressed block buffer. */
+} zstd_state_t;
+
+/** Zstandard file handle structure. */
+typedef struct zstd_handle {
+	decompress_handle_t handle;             /**< Decompression handle header. */
+
+	zstd_frame_t frame;                     /**< Frame information. */
+	size_t block_max;                       /**< Maximum block size. */
+	zstd_state_t *state;                    /**< Decompression state (NULL if not allocated). */
+
+	uint8_t *out_buf;                       /**< Output buffer (NULL if not allocated). */
+	size_t out_buf_size;                    /**< Size of output buffer. */
+	offset_t out_offset;                    /**< Output offset of the start of the buffer. */
+	size_t out_fill;                        /**< Amount of data in the buffer. */
+
+	offset_t in_offset;                     /**< Offset of the next block header. */
+	bool done;                              /**< Whether the last block has been decompressed. */
+} zstd_handle_t;
+
+/** Reset a handle to the start of the frame.
+ * @param handle        Handle to reset. */
+static void reset_position(zstd_handle_t *handle)
+{
+	if (!handle->state) {
+		handle->state = memory_alloc(
+			round_up(sizeof(*handle->state), PAGE_SIZE), 0, 0, 0,
+			MEMORY_TYPE_INTERNAL, MEMORY_ALLOC_HIGH, NULL);
+	}
+
+	zstd_init(&handle->state->context);
+	handle->in_offset = handle->frame.header_size;
+	handle->out_offset = handle->out_fill = 0;
+	handle->done = false;
+}
+
+/** Decompress the next block.
+ * @param handle        Handle being decompressed.
+ * @param dest          Buffer to decompress into, or NULL to only get size.
+ * @param dest_size     Size of the buffer.
+ * @param prefix_size   Size of the window preceding the buffer.
+ * @param _size         Where to store decompressed size of the block.
+ * @return              Status code describing the result of the operation. */
+static status_t decompress_block(
+	zstd_handle_t *handle, uint8_t *dest, size_t dest_size, size_t prefix_size,
+	size_t *_size)
+{
+	uint8_t header[ZSTD_BLOCK_HEADER_SIZE];
+	zstd_block_t block;
+	size_t data_size;
+	status_t ret;
+
+	/* We only decompress blocks that must exist given the file size, so the end
+	 * of the frame here means the size is wrong. */
+	if (handle->done)
+		return STATUS_CORRUPT_FS;
+
+	ret = fs_read(handle->handle.source, header, sizeof(header), handle->in_offset);
+	if (ret != STATUS_SUCCESS)
+		return ret;
+
+	if (!zstd_block_header(header, &block) || block.size > handle->block_max) {
+		dprintf("fs: warning: invalid zstd block header\n");
+		return STATUS_CORRUPT_FS;
+	}
+
+	data_size = (block.type == ZSTD_BLOCK_RLE) ? 1 : block.size;
+
+	if (block.type == ZSTD_BLOCK_RAW) {
+		/* Read uncompressed data straight into place. */
+		if (dest) {
+			if (block.size > dest_size)
+				return STATUS_CORRUPT_FS;
+
+			ret = fs_read(handle->handle.source, dest, block.size, handle->in_offset + sizeof(header));
+			if (ret != STATUS_SUCCESS)
+				return ret;
+		}
+
+		*_size = block.size;
+	} else {
+		ret = fs_read(
+			handle->handle.source, handle->state->input, data_size,
+			handle->in_offset + sizeof(header));
+		if (ret != STATUS_SUCCESS)
+			return ret;
+
+		if (!zstd_decompress_block(
+			&handle->state->context, &block, handle->state->input, dest,
+			prefix_size, dest_size, _size))
+		{
+			dprintf("fs: warning: error decompressing zstd block\n");
+			return STATUS_CORRUPT_FS;
+		}
+	}
+
+	handle->in_offset += sizeof(header) + data_size;
+	handle->done = block.last;
+	return STATUS_SUCCESS;
+}
+
+/** Get the size of a frame without a content size by scanning its blocks.
+ * @param handle        Handle to scan.
+ * @param _size         Where to store decompressed size.
+ * @return              Status code describing the result of the operation. */
+static status_t scan_size(zstd_handle_t *handle, offset_t *_size)
+{
+	offset_t size = 0;
+	status_t ret;
+
+	reset_position(handle);
+
+	while (!handle->done) {
+		size_t block_size;
+
+		ret = decompress_block(handle, NULL, 0, 0, &block_size);
+		if (ret != STATUS_SUCCESS)
+			return ret;
+
+		size += block_size;
+	}
+
+	reset_position(handle);
+	*_size = size;
+	return STATUS_SUCCESS;
+}
+
+/** Check whether a file is a Zstandard frame.
+ * @param buf           Start of the file.
+ * @param size          Size of the data in the buffer.
+ * @return              Whether the file is a Zstandard frame. */
+static bool zstd_probe(const uint8_t *buf, size_t size)
+{
+	uint32_t magic;
+
+	if (size < sizeof(magic))
+		return false;
+
+	memcpy(&magic, buf, sizeof(magic));
+	return le32_to_cpu(magic) == ZSTD_MAGIC;
+}
+
+/** Free Zstandard decompression state for a file.
+ * @param _handle       Handle being closed. */
+static void zstd_close(decompress_handle_t *_handle)
+{
+	zstd_handle_t *handle = (zstd_handle_t *)_handle;
+
+	if (handle->state)
+		memory_free(handle->state, round_up(sizeof(*handle->state), PAGE_SIZE));
+	if (handle->out_buf)
+		memory_free(handle->out_buf, round_up(handle->out_buf_size, PAGE_SIZE));
+}
+
+/** Open a Zstandard-compressed file.
+ * @param source        Handle to the source file.
+ * @param buf           Start of the file.
+ * @param size          Size of the data in the buffer.
+ * @param _handle       Where to store pointer to handle.
+ * @param _size         Where to store the decompressed size of the file.
+ * @return              Status code describing the result of the operation. */
+static status_t zstd_open(
+	fs_handle_t *source, const uint8_t *buf, size_t size,
+	decompress_handle_t **_handle, offset_t *_size)
+{
+	zstd_handle_t *handle;
+	zstd_frame_t frame;
+	status_t ret;
+
+	if (!zstd_frame_header(buf, size, &frame)) {
+		dprintf("fs: warning: invalid zstd frame header\n");
+		return STATUS_CORRUPT_FS;
+	} else if (frame.dict_id) {
+		dprintf("fs: warning: cannot handle zstd frames with a dictionary\n");
+		return STATUS_NOT_SUPPORTED;
+	} else if (frame.window_size > WINDOW_MAX) {
+		dprintf("fs: warning: zstd window size %llu is too large\n", frame.window_size);
+		return STATUS_CORRUPT_FS;
+	}
+
+	handle = malloc(sizeof(*handle));
+	handle->handle.source = source;
+	handle->frame = frame;
+	handle->block_max = min(frame.window_size, ZSTD_BLOCK_MAX);
+	handle->state = NULL;
+	handle->out_buf = NULL;
+
+	if (frame.content_size != ZSTD_CONTENT_SIZE_UNKNOWN) {
+		*_size = frame.content_size;
+	} else {
+		ret = scan_size(handle, _size);
+		if (ret != STATUS_SUCCESS) {
+			zstd_close(&handle->handle);
+			free(handle);
+			return ret;
+		}
+	}
+
+	/* Window never needs to be bigger than the file. */
+	handle->frame.window_size = min(handle->frame.window_size, *_size);
+
+	*_handle = &handle->handle;
+	return STATUS_SUCCESS;
+}
+
+/** Decompress an entire file directly into a buffer.
+ * @param handle        Handle to read from.
+ * @param buf           Buffer to read into (must be the size of the file).
+ * @return              Status code describing the result of the operation. */
+static status_t decompress_whole(zstd_handle_t *handle, uint8_t *buf)
+{
+	offset_t total = handle->handle.handle.size;
+	offset_t offset = 0;
+	status_t ret = STATUS_SUCCESS;
+
+	reset_position(handle);
+
+	while (offset < total) {
+		size_t size;
+
+		ret = decompress_block(handle, buf + offset, total - offset, offset, &size);
+		if (ret != STATUS_SUCCESS)
+			break;
+
+		offset += size;
+	}
+
+	/* The output buffer does not hold the window, start again next time. */
+	reset_position(handle);
+	return ret;
+}
+
+/** Read from a Zstandard-compressed file.
+ * @param _handle       Handle to read from.
+ * @param buf           Buffer to read into.
+ * @param count         Number of bytes to read.
+ * @param offset        Offset to read from.
+ * @return              Status code describing the result of the operation. */
+static status_t zstd_read(decompress_handle_t *_handle, void *buf, size_t count, offset_t offset)
+{
+	zstd_handle_t *handle = (zstd_handle_t *)_handle;
+	status_t ret;
+
+	if (!offset && count == handle->handle.handle.size)
+		return decompress_whole(handle, buf);
+
+	if (!handle->out_buf) {
+		handle->out_buf_size = min(
+			handle->handle.handle.size,
+			(2 * handle->frame.window_size) + handle->block_max);
+		handle->out_buf = memory_alloc(
+			round_up(handle->out_buf_size, PAGE_SIZE), 0, 0, 0,
+			MEMORY_TYPE_INTERNAL, MEMORY_ALLOC_HIGH | MEMORY_ALLOC_CAN_FAIL, NULL);
+		if (!handle->out_buf) {
+			dprintf("fs: warning: cannot allocate zstd window\n");
+			return STATUS_NO_MEMORY;
+		}
+
+		reset_position(handle);
+	}
+
+	if (offset < handle->out_offset)
+		reset_position(handle);
+
+	while (true) {
+		size_t skip, size;
+
+		/* Return available data from the buffer. */
+		if (offset < handle->out_offset + handle->out_fill) {
+			skip = offset - handle->out_offset;
+			size = min(handle->out_fill - skip, count);
+
+			memcpy(buf, handle->out_buf + skip, size);
+			buf += size;
+			offset += size;
+			count -= size;
+		}
+
+		if (!count)
+			break;
+
+		/* Make room for the next block, keeping the window. */
+		if (handle->out_fill + handle->block_max > handle->out_buf_size) {
+			size = min(handle->frame.window_size, handle->out_fill);
+
+			memmove(handle->out_buf, handle->out_buf + handle->out_fill - size, size);
+			handle->out_offset += handle->out_fill - size;
+			handle->out_fill = size;
+		}
+
+		ret = decompress_block(
+			handle, handle->out_buf + handle->out_fill,
+			handle->out_buf_size - handle->out_fill, handle->out_fill, &size);
+		if (ret != STATUS_SUCCESS) {
+			/* Don't know what state things are in, start again next time. */
+			reset_position(handle);
+			return ret;
+		}
+
+		handle->out_fill += size;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+/** Zstandard decompression codec. */
+BUILTIN_DECOMPRESS_CODEC(zstd_codec) = {
+	.name = "zstd",
+	.probe = zstd_probe,
+	.open = zstd_open,
+	.read = zstd_read,
+	.close = zstd_close,
+};
@@ -0,0 +1,136 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               ACPI table definitions.
+ */
+
+#ifndef __ACPI_H
+#define __ACPI_H
+
+#include <types.h>
+
+/** Signature of the RSDP. */
+#define ACPI_RSDP_SIGNATURE     "RSD PTR "
+
+/** Root System Description Pointer. */
+typedef struct acpi_rsdp {
+    char signature[8];                  /**< "RSD PTR ". */
+    uint8_t checksum;                   /**< Checksum of the first 20 bytes. */
+    char oem_id[6];                     /**< OEM identifier. */
+    uint8_t revision;                   /**< Revision (0 for ACPI 1.0). */
+    uint32_t rsdt_address;              /**< Physical address of the RSDT. */
+
+    /** Fields only present from ACPI 2.0. */
+    uint32_t length;                    /**< Length of the whole structure. */
+    uint64_t xsdt_address;              /**< Physical address of the XSDT. */
+    uint8_t ext_checksum;               /**< Checksum of the whole structure. */
+    uint8_t reserved[3];
+} __packed acpi_rsdp_t;
+
+/** Size of the ACPI 1.0 part of the RSDP. */
+#define ACPI_RSDP_V1_SIZE       20
+
+/** Header common to all system description tables. */
+typedef struct acpi_header {
+    char signature[4];                  /**< Table signature. */
+    uint32_t length;                    /**< Length of the whole table. */
+    uint8_t revision;                   /**< Table revision. */
+    uint8_t checksum;                   /**< Checksum of the whole table. */
+    char oem_id[6];                     /**< OEM identifier. */
+    char oem_table_id[8];               /**< OEM table identifier. */
+    uint32_t oem_revision;              /**< OEM revision. */
+    uint32_t creator_id;                /**< Creator identifier. */
+    uint32_t creator_revision;          /**< Creator revision. */
+} __packed acpi_header_t;
+
+/** Signatures of tables that are used. */
+#define ACPI_RSDT_SIGNATURE     "RSDT"
+#define ACPI_XSDT_SIGNATURE     "XSDT"
+#define ACPI_SRAT_SIGNATURE     "SRAT"
+
+/** System Resource Affinity Table. */
+typedef struct acpi_srat {
+    acpi_header_t header;               /**< Table header. */
+    uint32_t reserved1;
+    uint64_t reserved2;
+    uint8_t entries[];                  /**< Affinity structures. */
+} __packed acpi_srat_t;
+
+/** Header of an SRAT affinity structure. */
+typedef struct acpi_srat_entry {
+    uint8_t type;                       /**< Type of the structure. */
+    uint8_t length;                     /**< Length of the structure. */
+} __packed acpi_srat_entry_t;
+
+/** SRAT affinity structure types. */
+#define ACPI_SRAT_CPU           0       /**< Processor Local APIC affinity. */
+#define ACPI_SRAT_MEMORY        1       /**< Memory affinity. */
+#define ACPI_SRAT_X2APIC        2       /**< Processor Local x2APIC affinity. */
+
+/** SRAT Processor Local APIC affinity structure. */
+typedef struct acpi_srat_cpu {
+    acpi_srat_entry_t header;           /**< Structure header. */
+    uint8_t domain_low;                 /**< Bits 0-7 of the proximity domain. */
+    uint8_t apic_id;                    /**< Local APIC ID. */
+    uint32_t flags;                     /**< Flags. */
+    uint8_t sapic_eid;                  /**< Local SAPIC EID. */
+    uint8_t domain_high[3];             /**< Bits 8-31 of the proximity domain. */
+    uint32_t clock_domain;              /**< Clock domain. */
+} __packed acpi_srat_cpu_t;
+
+/** SRAT Memory affinity structure. */
+typedef struct acpi_srat_memory {
+    acpi_srat_entry_t header;           /**< Structure header. */
+    uint32_t domain;                    /**< Proximity domain. */
+    uint16_t reserved1;
+    uint64_t base;                      /**< Base address of the range. */
+    uint64_t length;                    /**< Length of the range. */
+    uint32_t reserved2;
+    uint32_t flags;                     /**< Flags. */
+    uint64_t reserved3;
+} __packed acpi_srat_memory_t;
+
+/** SRAT Processor Local x2APIC affinity structure. */
+typedef struct acpi_srat_x2apic {
+    acpi_srat_entry_t header;           /**< Structure header. */
+    uint16_t reserved1;
+    uint32_t domain;                    /**< Proximity domain. */
+    uint32_t x2apic_id;                 /**< Local x2APIC ID. */
+    uint32_t flags;                     /**< Flags. */
+    uint32_t clock_domain;              /**< Clock domain. */
+    uint32_t reserved2;
+} __packed acpi_srat_x2apic_t;
+
+/** SRAT affinity structure flags. */
+#define ACPI_SRAT_ENABLED       (1<<0)  /**< Structure is enabled. */
+#define ACPI_SRAT_HOT_PLUGGABLE (1<<1)  /**< Memory is hot pluggable. */
+
+extern acpi_rsdp_t *acpi_scan_rsdp(phys_ptr_t start, phys_size_t size);
+extern void *acpi_find_table(const char *signature);
+
+extern acpi_rsdp_t *target_acpi_rsdp(void);
+
+#endif /* __ACPI_H */
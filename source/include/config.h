@@ -32,6 +32,8 @@
 
 #include <lib/list.h>
 
+struct arena;
+
 /** Structure defining operations for an OS loader */
 typedef struct loader_ops {
   /**
@@ -63,6 +65,7 @@ typedef struct environ {
   struct fs_handle *directory;        /**< Current directory. */
   loader_ops_t *loader;               /**< Operating system loader operations. */
   void *loader_private;               /**< Data used by the loader. */
+  struct arena *arena;                /**< Arena to allocate from (NULL for heap). */
 } environ_t;
 
 /** Structure containing a list of commands. */
@@ -157,7 +160,7 @@ extern void command_list_destroy(command_list_t *list);
 extern command_list_t *command_list_copy(const command_list_t *source);
 extern bool command_list_exec(command_list_t *list, environ_t *env);
 
-extern environ_t *environ_create(environ_t *parent);
+extern environ_t *environ_create(environ_t *parent, struct arena *arena);
 extern void environ_destroy(environ_t *env);
 extern value_t *environ_lookup(environ_t *env, const char *name);
 extern value_t *environ_insert(environ_t *env, const char *name, const value_t *value);
@@ -165,7 +168,7 @@ extern void environ_remove(environ_t *env, const char *name);
 extern void environ_set_loader(environ_t *env, struct loader_ops *ops, void *private);
 extern void environ_boot(environ_t *env) __noreturn;
 
-extern command_list_t *config_parse(const char *path, config_read_helper_t helper);
+extern command_list_t *config_parse(const char *path, config_read_helper_t helper, struct arena *arena);
 
 extern void config_init(void);
 extern void config_load(void);
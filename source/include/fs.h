@@ -33,6 +33,7 @@
 #include <loader.h>
 
 struct device;
+struct fs_dir_record;
 struct fs_entry;
 struct fs_handle;
 struct fs_mount;
@@ -100,6 +101,27 @@ typedef struct fs_ops {
 	 * @param arg           Data to pass to callback.
 	 * @return              Status code describing the result of the operation. */
 	status_t (*iterate)(struct fs_handle *handle, fs_iterate_cb_t cb, void *arg);
+
+	/** Read a batch of directory entries (optional).
+	 * @note                Records should be packed with fs_dir_record_pack().
+	 *                      Entries which cannot be opened (e.g. device nodes)
+	 *                      may be omitted.
+	 * @param handle        Handle to directory.
+	 * @param cursor        Position to continue from (0 for the first call),
+	 *                      updated to point after the last record returned.
+	 * @param buf           Buffer to pack records into.
+	 * @param size          Size of the buffer (at least FS_READ_DIR_MIN_SIZE).
+	 * @param _count        Where to store number of records returned, 0 when
+	 *                      the end of the directory has been reached.
+	 * @return              Status code describing the result of the operation. */
+	status_t (*read_dir)(struct fs_handle *handle, offset_t *cursor, void *buf, size_t size, size_t *_count);
+
+	/** Open an entry from a record returned by read_dir().
+	 * @param owner         Directory that the record was read from.
+	 * @param record        Record for the entry.
+	 * @param _handle       Where to store pointer to opened handle.
+	 * @return              Status code describing the result of the operation. */
+	status_t (*open_cookie)(struct fs_handle *owner, const struct fs_dir_record *record, struct fs_handle **_handle);
 } fs_ops_t;
 
 /** Define a builtin filesystem operations structure. */
@@ -140,6 +162,31 @@ typedef struct fs_entry {
 	const char *name;               /**< Name of the entry. */
 } fs_entry_t;
 
+/**
+ * Packed directory entry record.
+ *
+ * Records are returned back to back by fs_read_dir(), each one aligned to 8
+ * bytes. The cookie is private to the filesystem and is only meaningful to
+ * fs_open_cookie() on the directory that the record was read from.
+ */
+typedef struct fs_dir_record {
+	uint64_t cookie;                /**< Filesystem-specific cookie to open the entry. */
+	offset_t size;                  /**< Size of the entry (0 if the type is unknown). */
+	uint16_t rec_len;               /**< Total length of the record. */
+	uint8_t type;                   /**< Type of the entry (FILE_TYPE_NONE if unknown). */
+	char name[];                    /**< Null-terminated name of the entry. */
+} fs_dir_record_t;
+
+/** Minimum buffer size for fs_read_dir(), enough for any single record. */
+#define FS_READ_DIR_MIN_SIZE    2048
+
+/** Range of a file to read with fs_read_ranges(). */
+typedef struct fs_read_range {
+	void *buf;                      /**< Buffer to read into. */
+	size_t count;                   /**< Number of bytes to read. */
+	offset_t offset;                /**< Offset into the file. */
+} fs_read_range_t;
+
 /** Behaviour flags for a handle. */
 #define FS_HANDLE_COMPRESSED    (1 << 0)  /**< Handle is a compressed wrapper. */
 
@@ -159,8 +206,26 @@ extern status_t fs_open(const char *path, fs_handle_t *from, file_type_t type, f
 extern void fs_close(fs_handle_t *handle);
 
 extern status_t fs_read(fs_handle_t *handle, void *buf, size_t count, offset_t offset);
+extern status_t fs_read_ranges(fs_handle_t *handle, fs_read_range_t *ranges, size_t count);
+extern size_t fs_add_gap_ranges(fs_read_range_t *ranges, size_t *_count, offset_t end, void *buf);
+extern bool fs_copy_from_ranges(
+	const fs_read_range_t *ranges, size_t count, void *buf, size_t size, offset_t offset);
 extern status_t fs_iterate(fs_handle_t *handle, fs_iterate_cb_t cb, void *arg);
 
+extern bool fs_dir_record_pack(
+	void **_buf, size_t *_size, const char *name, size_t name_len, file_type_t type,
+	offset_t size, uint64_t cookie);
+extern status_t fs_read_dir(fs_handle_t *handle, offset_t *cursor, void *buf, size_t size, size_t *_count);
+extern status_t fs_open_cookie(fs_handle_t *owner, const fs_dir_record_t *record, file_type_t type, fs_handle_t **_handle);
+
+/** Get the record following another in a fs_read_dir() buffer.
+ * @param record        Current record.
+ * @return              Pointer to next record. */
+static inline fs_dir_record_t *fs_dir_record_next(const fs_dir_record_t *record)
+{
+	return (fs_dir_record_t*)((char*)record + record->rec_len);
+}
+
 extern fs_mount_t *fs_probe(struct device *device);
 
 /** Helper for __cleanup_close. */
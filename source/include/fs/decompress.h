@@ -32,8 +32,71 @@
 
 #include <fs.h>
 
+struct decompress_handle;
+
+/** Size of the start of a file that is passed to codec open functions. */
+#define DECOMPRESS_PROBE_SIZE   512
+
+/** Structure containing operations for a decompression codec. */
+typedef struct decompress_codec {
+	const char *name;               /**< Name of the compression format. */
+
+	/** Check whether a file is in this format.
+	 * @param buf           Start of the file.
+	 * @param size          Size of the data in the buffer (at most
+	 *                      DECOMPRESS_PROBE_SIZE, may be less if the file is
+	 *                      smaller than that).
+	 * @return              Whether the file is in this format. */
+	bool (*probe)(const uint8_t *buf, size_t size);
+
+	/** Open a handle to decompress a file.
+	 * @param source        Handle to the source file.
+	 * @param buf           Start of the file, as passed to probe().
+	 * @param size          Size of the data in the buffer.
+	 * @param _handle       Where to store pointer to the handle, which must
+	 *                      be allocated by malloc() and begin with a
+	 *                      decompress_handle_t. The handle header and the
+	 *                      codec and source fields will be initialized by
+	 *                      the caller upon return, the codec should store the
+	 *                      decompressed size of the file in _size.
+	 * @param _size         Where to store the decompressed size of the file.
+	 * @return              Status code describing the result of the operation.
+	 *                      Returning an error causes the file to be treated
+	 *                      as uncompressed. */
+	status_t (*open)(
+		fs_handle_t *source, const uint8_t *buf, size_t size,
+		struct decompress_handle **_handle, offset_t *_size);
+
+	/** Read from a compressed file.
+	 * @param handle        Handle to read from.
+	 * @param buf           Buffer to read into.
+	 * @param count         Number of bytes to read (non-zero, and the read is
+	 *                      within the file).
+	 * @param offset        Offset to read from.
+	 * @return              Status code describing the result of the operation. */
+	status_t (*read)(struct decompress_handle *handle, void *buf, size_t count, offset_t offset);
+
+	/** Free codec state for a handle (the handle itself is freed by the caller).
+	 * @param handle        Handle being closed. */
+	void (*close)(struct decompress_handle *handle);
+} decompress_codec_t;
+
+/** Define a builtin decompression codec. */
+#define BUILTIN_DECOMPRESS_CODEC(name) \
+	static decompress_codec_t name; \
+	DEFINE_BUILTIN(BUILTIN_TYPE_DECOMPRESS, name); \
+	static decompress_codec_t name
+
+/** Header of a decompression wrapper handle. */
+typedef struct decompress_handle {
+	fs_handle_t handle;                     /**< Handle header structure. */
+
+	const decompress_codec_t *codec;        /**< Codec for the file. */
+	fs_handle_t *source;                    /**< Source handle. */
+} decompress_handle_t;
+
 extern bool decompress_open(fs_handle_t *source, fs_handle_t **_handle);
 extern void decompress_close(fs_handle_t *handle);
-extern status_t decompress_read(fs_handle_t *handle, void *buf, uint32_t count, uint32_t offset);
+extern status_t decompress_read(fs_handle_t *handle, void *buf, size_t count, offset_t offset);
 
 #endif /* __FS_DECOMPRESS_H */
@@ -39,6 +39,14 @@
 #define EXT2_GOOD_OLD_REV       0
 #define EXT2_DYNAMIC_REV        1
 
+/** Feature flags. */
+#define EXT4_FEATURE_INCOMPAT_64BIT             0x80        /**< 64-bit block numbers. */
+#define EXT4_FEATURE_INCOMPAT_CSUM_SEED         0x2000      /**< Checksum seed in superblock. */
+#define EXT4_FEATURE_RO_COMPAT_METADATA_CSUM    0x400       /**< Metadata checksums. */
+
+/** Metadata checksum types. */
+#define EXT4_CRC32C_CHKSUM      1
+
 /** Filesystem status flags. */
 #define EXT2_ERROR_FS           0
 #define EXT2_VALID_FS           1
@@ -81,6 +89,9 @@
 #define EXT2_FT_SYMLINK         7
 #define EXT2_FT_MAX             8
 
+/** File type of the fake directory entry holding a directory block checksum. */
+#define EXT4_FT_DIR_CSUM        0xde
+
 /** Reserved inode numbers. */
 #define EXT2_BAD_INO            0x1         /**< Bad blocks inode. */
 #define EXT2_ROOT_INO           0x2         /**< Root directory inode. */
@@ -123,6 +134,11 @@
 #define EXT4_EXTENT_OFF_LEN                     4
 #define EXT4_EXTENT_OFF_START                   8
 
+/** Offsets of ext4 inode fields beyond the ext2 inode structure. */
+#define EXT4_INODE_OFF_CHECKSUM_LO              124
+#define EXT4_INODE_OFF_EXTRA_ISIZE              128
+#define EXT4_INODE_OFF_CHECKSUM_HI              130
+
 #ifndef __ASM__
 
 #include <types.h>
@@ -180,12 +196,21 @@ typedef struct ext2_superblock {
     uint32_t s_hash_seed[4];                /**< HTREE hash seed. */
     uint8_t  s_def_hash_version;            /**< Default hash version to use. */
     uint8_t  s_jnl_backup_type;
-    uint16_t s_reserved_word_pad;
+    uint16_t s_desc_size;                   /**< Size of group descriptors (64-bit only). */
     uint32_t s_default_mount_opts;
     uint32_t s_first_meta_bg;               /**< First metablock block group. */
     uint32_t s_mkfs_time;                   /**< When the filesystem was created. */
     uint32_t s_jnl_blocks[17];              /**< Backup of the journal inode. */
-    uint32_t s_reserved[172];               /**< Padding to the end of the block. */
+
+    /** Ext4 fields. */
+    uint32_t s_reserved1[9];
+    uint8_t  s_log_groups_per_flex;         /**< Size of a flexible block group. */
+    uint8_t  s_checksum_type;               /**< Metadata checksum algorithm. */
+    uint16_t s_reserved_pad;
+    uint32_t s_reserved2[62];
+    uint32_t s_checksum_seed;               /**< Metadata checksum seed. */
+    uint32_t s_reserved3[98];               /**< Padding to the end of the block. */
+    uint32_t s_checksum;                    /**< Superblock checksum. */
 } __packed ext2_superblock_t;
 
 /** Group descriptor table. */
@@ -197,7 +222,9 @@ typedef struct ext2_group_desc {
     uint16_t bg_free_inodes_count;          /**< Number of free inodes. */
     uint16_t bg_used_dirs_count;            /**< Number of used directories. */
     uint16_t bg_pad;
-    uint32_t bg_reserved[3];
+    uint32_t bg_reserved[2];
+    uint16_t bg_itable_unused;              /**< Number of unused inodes. */
+    uint16_t bg_checksum;                   /**< Group descriptor checksum. */
 } __packed ext2_group_desc_t;
 
 /** Ext2 inode structure. */
@@ -257,6 +284,15 @@ typedef struct ext2_dir_entry {
     char name[];                            /**< Name of the file. */
 } __packed ext2_dir_entry_t;
 
+/** Ext4 directory block checksum (fake directory entry at end of block). */
+typedef struct ext4_dir_entry_tail {
+    uint32_t det_reserved_zero1;            /**< Inode number (always 0). */
+    uint16_t det_rec_len;                   /**< Length of the structure (12). */
+    uint8_t det_reserved_zero2;             /**< Name length (always 0). */
+    uint8_t det_reserved_ft;                /**< File type (EXT4_FT_DIR_CSUM). */
+    uint32_t det_checksum;                  /**< Checksum of the directory block. */
+} __packed ext4_dir_entry_tail_t;
+
 /* Ext4 on-disk extent structure. */
 typedef struct ext4_extent {
     uint32_t ee_block;                      /**< First logical block extent covers. */
@@ -68,6 +68,7 @@ typedef struct initium_tag
 #define INITIUM_TAG_SECTIONS        10  // ELF section information.
 #define INITIUM_TAG_BIOS_E820       11  // BIOS address range descriptor (PC-specific).
 #define INITIUM_TAG_EFI             12  // EFI friwmware information
+#define INITIUM_TAG_NUMA            13  // NUMA memory affinity information.
 
 // Tag containing core information for the kernel.
 typedef struct initium_tag_core
@@ -305,6 +306,24 @@ typedef struct initium_tag_sections
         uint8_t sections[0];    // Section data.
 } initium_tag_sections_t;
 
+/** Structure describing the node that a physical memory range belongs to. */
+typedef struct initium_numa_range {
+        initium_paddr_t start;                /**< Start of the memory range. */
+        initium_paddr_t size;                 /**< Size of the memory range. */
+        uint32_t node;                        /**< Proximity domain of the range. */
+        uint32_t _pad;
+} initium_numa_range_t;
+
+/** Tag containing NUMA memory affinity information. */
+typedef struct initium_tag_numa {
+        initium_tag_t header;                 /**< Tag header. */
+
+        uint32_t boot_node;                   /**< Proximity domain of the boot CPU. */
+        uint32_t num_ranges;                  /**< Number of memory ranges. */
+
+        initium_numa_range_t ranges[0];       /**< Memory affinity ranges. */
+} initium_tag_numa_t;
+
 /** Tag containing page table information (IA32). */
 typedef struct initium_tag_pagetables_ia32 {
         initium_tag_t header;                 /**< Tag header. */
@@ -386,6 +405,7 @@ typedef struct initium_tag_efi {
 #define INITIUM_ITAG_OPTION 	2   // Option description.
 #define INITIUM_ITAG_MAPPING    3   // Virtual memory mapping description.
 #define INITIUM_ITAG_VIDEO      4   // Requested video mode.
+#define INITIUM_ITAG_PHYSMAP    5   // Direct map of physical memory.
 
 // Image tag containing basic image information.
 typedef struct initium_itag_image
@@ -567,5 +587,24 @@ typedef struct initium_itag_video
                 "   .p2align 2\n" \
                 "3: .popsection\n")
 
+// Image tag requesting a direct map of all physical memory.
+typedef struct initium_itag_physmap
+{
+        initium_vaddr_t base;       // Virtual address that physical address 0 maps to.
+} initium_itag_physmap_t;
+
+// Macro to declare a physical memory map itag.
+#define INITIUM_PHYSMAP(base) \
+        __asm__( \
+                "   .pushsection \".note.initium.physmap\", \"a\", " INITIUM_SECTION_TYPE "\n" \
+                "   .long 1f - 0f\n" \
+                "   .long 3f - 2f\n" \
+                "   .long " XSTRINGIFY(INITIUM_ITAG_PHYSMAP) "\n" \
+                "0: .asciz \"" INITIUM_NOTE_NAME "\"\n" \
+                "1: .p2align 2\n" \
+                "2: .quad " STRINGIFY(base) "\n" \
+                "   .p2align 2\n" \
+                "3: .popsection\n")
+
 #endif // __ASM__
 #endif // __INITIUM_H
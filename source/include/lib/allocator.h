@@ -30,7 +30,7 @@
  #ifndef __LIB_ALLOCATOR_H
  #define __LIB_ALLOCATOR_H
 
- #include <lib/list.h>
+ #include <lib/avl_tree.h>
 
  #include <loader.h>
 
@@ -38,10 +38,13 @@
 typedef struct allocator {
         load_ptr_t start;            /**< Start of the region that the allocator manages. */
         load_size_t size;            /**< Size of the region that the allocator manages. */
-        list_t regions;              /**< List of regions. */
+        avl_tree_t gaps;             /**< Tree of free ranges. */
 } allocator_t;
 
 extern bool allocator_alloc(allocator_t *alloc, load_size_t size, load_size_t align, load_ptr_t *_addr);
+extern bool allocator_alloc_offset(
+        allocator_t *alloc, load_size_t size, load_size_t align, load_ptr_t offset,
+        load_ptr_t *_addr);
 extern bool allocator_insert(allocator_t *alloc, load_ptr_t addr, load_size_t size);
 extern void allocator_reserve(allocator_t *alloc, load_ptr_t addr, load_size_t size);
 
@@ -0,0 +1,102 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               AVL tree implementation.
+ */
+
+#ifndef __LIB_AVL_TREE_H
+#define __LIB_AVL_TREE_H
+
+#include <types.h>
+
+struct avl_tree_node;
+
+/** Callback to recompute augmented data for a node from its children.
+ * @param node          Node to update (children are already up to date). */
+typedef void (*avl_tree_augment_t)(struct avl_tree_node *node);
+
+/** AVL tree node structure. */
+typedef struct avl_tree_node {
+    struct avl_tree_node *parent;   /**< Parent node. */
+    struct avl_tree_node *left;     /**< Left child (lower keys). */
+    struct avl_tree_node *right;    /**< Right child (higher keys). */
+    int height;                     /**< Height of the subtree. */
+} avl_tree_node_t;
+
+/** AVL tree structure. */
+typedef struct avl_tree {
+    avl_tree_node_t *root;          /**< Root of the tree. */
+    avl_tree_augment_t augment;     /**< Augmented data callback (can be NULL). */
+} avl_tree_t;
+
+/** Initializes a statically declared AVL tree. */
+#define AVL_TREE_INITIALIZER(_augment) \
+    { \
+        .root = NULL, \
+        .augment = _augment, \
+    }
+
+/** Statically declares a new AVL tree. */
+#define AVL_TREE_DECLARE(_var, _augment) \
+    avl_tree_t _var = AVL_TREE_INITIALIZER(_augment)
+
+/** Get a pointer to the structure containing a tree node.
+ * @param node          Tree node pointer (can be NULL).
+ * @param type          Type of the structure.
+ * @param member        Name of the tree node member in the structure.
+ * @return              Pointer to the structure, or NULL if node is NULL. */
+#define avl_tree_entry(node, type, member) \
+    ({ \
+        avl_tree_node_t *__node = node; \
+        (__node) ? (type *)((char *)__node - offsetof(type, member)) : NULL; \
+    })
+
+/** Initialize an AVL tree.
+ * @param tree          Tree to initialize.
+ * @param augment       Augmented data callback (can be NULL). */
+static inline void avl_tree_init(avl_tree_t *tree, avl_tree_augment_t augment) {
+    tree->root = NULL;
+    tree->augment = augment;
+}
+
+/** Check whether an AVL tree is empty.
+ * @param tree          Tree to check. */
+static inline bool avl_tree_empty(const avl_tree_t *tree) {
+    return !tree->root;
+}
+
+extern void avl_tree_insert(
+    avl_tree_t *tree, avl_tree_node_t *node, avl_tree_node_t *parent,
+    avl_tree_node_t **link);
+extern void avl_tree_remove(avl_tree_t *tree, avl_tree_node_t *node);
+extern void avl_tree_update(avl_tree_t *tree, avl_tree_node_t *node);
+
+extern avl_tree_node_t *avl_tree_first(avl_tree_t *tree);
+extern avl_tree_node_t *avl_tree_last(avl_tree_t *tree);
+extern avl_tree_node_t *avl_tree_next(avl_tree_node_t *node);
+extern avl_tree_node_t *avl_tree_prev(avl_tree_node_t *node);
+
+#endif /* __LIB_AVL_TREE_H */
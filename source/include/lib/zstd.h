@@ -0,0 +1,126 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               Zstandard decompression.
+ */
+
+#ifndef __LIB_ZSTD_H
+#define __LIB_ZSTD_H
+
+#include <types.h>
+
+/** Magic number for a Zstandard frame. */
+#define ZSTD_MAGIC                  0xfd2fb528
+
+/** Maximum size of a frame header (including the magic number). */
+#define ZSTD_FRAME_HEADER_MAX       18
+
+/** Size of a block header. */
+#define ZSTD_BLOCK_HEADER_SIZE      3
+
+/** Maximum decompressed size of a block. */
+#define ZSTD_BLOCK_MAX              (128 * 1024)
+
+/** Value of content_size if the frame does not specify it. */
+#define ZSTD_CONTENT_SIZE_UNKNOWN   ((uint64_t)-1)
+
+/** Block types. */
+#define ZSTD_BLOCK_RAW              0   /**< Uncompressed data. */
+#define ZSTD_BLOCK_RLE              1   /**< Single byte repeated. */
+#define ZSTD_BLOCK_COMPRESSED       2   /**< Compressed data. */
+
+/** Maximum accuracy logs for the entropy tables. */
+#define ZSTD_HUFFMAN_LOG_MAX        11
+#define ZSTD_SEQUENCE_LOG_MAX       9
+#define ZSTD_WEIGHT_LOG_MAX         6
+
+/** Information from a frame header. */
+typedef struct zstd_frame {
+	size_t header_size;                     /**< Size of the frame header. */
+	uint64_t content_size;                  /**< Decompressed size (or ZSTD_CONTENT_SIZE_UNKNOWN). */
+	uint64_t window_size;                   /**< Window size required to decompress. */
+	uint32_t dict_id;                       /**< Dictionary ID (0 if none). */
+	bool checksum;                          /**< Whether a content checksum follows the frame. */
+} zstd_frame_t;
+
+/** Information from a block header. */
+typedef struct zstd_block {
+	unsigned type;                          /**< Type of the block. */
+	uint32_t size;                          /**< Size of the block (decompressed size for RLE). */
+	bool last;                              /**< Whether this is the last block in the frame. */
+} zstd_block_t;
+
+/** FSE decoding table entry. */
+typedef struct zstd_fse_entry {
+	uint16_t base;                          /**< Base of the next state. */
+	uint8_t symbol;                         /**< Decoded symbol. */
+	uint8_t bits;                           /**< Number of bits to add to the base. */
+} zstd_fse_entry_t;
+
+/** Huffman decoding table entry. */
+typedef struct zstd_huffman_entry {
+	uint8_t symbol;                         /**< Decoded symbol. */
+	uint8_t bits;                           /**< Length of the code. */
+} zstd_huffman_entry_t;
+
+/**
+ * Decompression context.
+ *
+ * Holds state which is carried between the blocks of a frame. This is fairly
+ * large (mostly due to the literals buffer), so should not be allocated on
+ * the heap.
+ */
+typedef struct zstd_context {
+	uint32_t rep[3];                        /**< Repeat offsets. */
+	unsigned huffman_log;                   /**< Huffman table log (0 if no table). */
+	unsigned seq_log[3];                    /**< Sequence table logs. */
+	bool seq_valid[3];                      /**< Whether sequence tables are valid. */
+
+	/** Huffman decoding table for literals. */
+	zstd_huffman_entry_t huffman_table[1 << ZSTD_HUFFMAN_LOG_MAX];
+
+	/** Decoding tables for literal lengths, offsets and match lengths. */
+	zstd_fse_entry_t seq_table[3][1 << ZSTD_SEQUENCE_LOG_MAX];
+
+	/** Working space for building tables. */
+	zstd_fse_entry_t weight_table[1 << ZSTD_WEIGHT_LOG_MAX];
+	int16_t norm[64];
+	uint16_t next[64];
+	uint8_t weights[256];
+
+	/** Decoded literals for the current block. */
+	uint8_t literals[ZSTD_BLOCK_MAX];
+} zstd_context_t;
+
+extern bool zstd_frame_header(const void *buf, size_t size, zstd_frame_t *frame);
+extern bool zstd_block_header(const void *buf, zstd_block_t *block);
+
+extern void zstd_init(zstd_context_t *ctx);
+extern bool zstd_decompress_block(
+	zstd_context_t *ctx, const zstd_block_t *block, const void *src,
+	void *dest, size_t prefix_size, size_t dest_size, size_t *_size);
+
+#endif /* __LIB_ZSTD_H */
@@ -70,6 +70,7 @@ typedef struct builtin {
     BUILTIN_TYPE_PARTITION,
     BUILTIN_TYPE_FS,
     BUILTIN_TYPE_COMMAND,
+    BUILTIN_TYPE_DECOMPRESS,
   } type;
 
   /** Pointer to object */
@@ -31,12 +31,14 @@
 #define __LOADER_INITIUM_H
 
 #include <lib/allocator.h>
+#include <lib/avl_tree.h>
 #include <lib/list.h>
 
 #include <fs.h>
 #include <mmu.h>
 #include <initium.h>
 #include <config.h>
+#include <memory.h>
 
 /** Image tag header structure. */
 typedef struct initium_itag {
@@ -56,7 +58,7 @@ typedef struct initium_module {
 
 /** Structure describing a virtual memory mapping. */
 typedef struct initium_mapping {
-  list_t header;                         /**< Link to virtual mapping list. */
+  avl_tree_node_t link;               /**< Link to virtual mapping tree. */
 
   initium_vaddr_t start;                /**< Start of the virtual memory range. */
   initium_vaddr_t size;                 /**< Size of the virtual memory range. */
@@ -66,6 +68,7 @@ typedef struct initium_mapping {
 /** Structure containing Initium loader data. */
 typedef struct initium_loader {
   /** Details obtained by configuration command. */
+  arena_t *arena;                     /**< Arena that loader data is allocated from. */
   fs_handle_t *handle;                /**< Handle to kernel image. */
   void *ehdr;                         /**< ELF header. */
   void *phdrs;                        /**< ELF program headers. */
@@ -81,12 +84,17 @@ typedef struct initium_loader {
   initium_itag_load_t *load;          /**< Load image tag. */
   mmu_context_t *mmu;                 /**< MMU context for the kernel. */
   allocator_t allocator;              /**< Virtual address space allocator. */
-  list_t mappings;                    /**< Virtual mapping information. */
+  load_size_t large_page_size;        /**< Large page size to align allocations to (0 if none). */
+  avl_tree_t mappings;                /**< Virtual mapping information, sorted by address. */
   load_ptr_t entry;                   /**< Kernel entry point address. */
   load_ptr_t tags_virt;               /**< Virtual address of tag list. */
   mmu_context_t *trampoline_mmu;      /**< Kernel trampoline address space. */
   phys_ptr_t trampoline_phys;         /**< Page containing kernel entry trampoline. */
   load_ptr_t trampoline_virt;         /**< Virtual address of trampoline page. */
+  fs_read_range_t *image_ranges;      /**< Ranges read from the kernel image, if buffered (see load_kernel()). */
+  size_t image_range_count;           /**< Number of ranges read from the kernel image. */
+  void *section_buf;                  /**< Image data outside of the segments. */
+  size_t section_buf_size;            /**< Size of the buffered data. */
 } initium_loader_t;
 
 extern void *initium_find_itag(initium_loader_t *loader, uint32_t type);
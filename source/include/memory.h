@@ -32,6 +32,7 @@
 
 #include <arch/page.h>
 
+#include <lib/avl_tree.h>
 #include <lib/list.h>
 
 // Physical memory range descriptor
@@ -41,6 +42,10 @@ typedef struct memory_range {
        phys_ptr_t start;               /**< Start of range. */
        phys_size_t size;               /**< Size of range. */
        uint8_t type;                   /**< Type of the range. */
+
+       /** Used by the physical memory manager to index its ranges. */
+       avl_tree_node_t tree_link;      /**< Link to range tree. */
+       phys_size_t max_free;           /**< Largest free range in subtree. */
 } memory_range_t;
 
 /**
@@ -64,6 +69,17 @@ typedef struct memory_range {
 extern void *malloc(size_t size);
 extern void *realloc(void *addr, size_t size);
 extern void free(void *addr);
+extern void heap_finalize(void);
+extern bool heap_is_area(const void *addr);
+
+/** Arena allocator. */
+typedef struct arena arena_t;
+
+extern arena_t *arena_create(void);
+extern void *arena_alloc(arena_t *arena, size_t size);
+extern void arena_reset(arena_t *arena);
+extern void arena_destroy(arena_t *arena);
+extern arena_t *arena_set_current(arena_t *arena);
 
 /**
  * Helper for __cleanup_free.
@@ -84,6 +100,9 @@ extern void *memory_alloc(phys_size_t size, phys_size_t align,
        phys_ptr_t *_phys);
 extern void memory_free(void *addr, phys_size_t size);
 
+extern void memory_stats_alloc(phys_size_t size, uint8_t type);
+extern void memory_stats_free(phys_size_t size, uint8_t type);
+
 extern void memory_snapshot(list_t *map);
 extern void memory_finalize(list_t *map);
 
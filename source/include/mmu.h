@@ -43,4 +43,10 @@ extern bool mmu_memcpy_from(mmu_context_t *ctx, void *dest, load_ptr_t src, load
 
 extern mmu_context_t *mmu_context_create(load_mode_t mode, unsigned phys_type);
 
+#ifndef TARGET_HAS_MM
+
+extern void mmu_finalize(void);
+
+#endif /* TARGET_HAS_MM */
+
 #endif /* __MMU_H */
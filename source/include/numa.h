@@ -0,0 +1,46 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               NUMA topology functions.
+ */
+
+#ifndef __NUMA_H
+#define __NUMA_H
+
+#include <types.h>
+
+/** Structure describing the node that a physical memory range belongs to. */
+typedef struct numa_range {
+    phys_ptr_t start;                   /**< Start of the range. */
+    phys_size_t size;                   /**< Size of the range. */
+    uint32_t node;                      /**< Proximity domain of the range. */
+} numa_range_t;
+
+extern size_t numa_get_ranges(const numa_range_t **_ranges);
+extern uint32_t numa_boot_node(void);
+extern bool numa_preferred_range(size_t index, unsigned flags, phys_ptr_t *_start, phys_ptr_t *_end);
+
+#endif /* __NUMA_H */
@@ -25,6 +25,15 @@
 /**
  * @file
  * @brief               Virtual memory region allocator.
+ *
+ * The allocator only records the free ranges (gaps) in the address space
+ * that it manages; everything else is allocated. Gaps are kept in an AVL tree
+ * sorted by address, and each node records the largest gap in its subtree,
+ * so that allocations can skip over subtrees which have no gap big enough.
+ * Gaps are never adjacent, since allocated space is never freed.
+ *
+ * Gaps store their last address rather than their size, as a gap covering
+ * the whole address space would have a size that cannot be represented.
  */
 
  #include <lib/allocator.h>
@@ -34,139 +43,206 @@
  #include <loader.h>
  #include <memory.h>
 
-/** Structure of a region. */
-typedef struct allocator_region {
-    list_t header;                   /**< List header. */
+/** Structure of a free range. */
+typedef struct allocator_gap {
+    avl_tree_node_t link;            /**< Link to gap tree. */
 
-    load_ptr_t start;                /**< Start of the region. */
-    load_size_t size;                /**< Size of the region. */
-    bool allocated;                  /**< Whether the region is allocated. */
-} allocator_region_t;
+    load_ptr_t start;                /**< Start of the gap. */
+    load_ptr_t end;                  /**< Last address in the gap. */
+    load_size_t max_span;            /**< Largest (end - start) in the subtree. */
+} allocator_gap_t;
 
-/** Insert a region into the allocator.
- * @param alloc         Allocator to insert into.
- * @param start         Start of the region.
- * @param size          Size of the region.
- * @param allocated     Whether the region is allocated.
- * @param location      Where to insert before, or NULL to find insertion point. */
-static void insert_region(
-    allocator_t *alloc, load_ptr_t start, load_size_t size, bool allocated,
-    allocator_region_t *location)
-{
-    allocator_region_t *region, *exist, *split;
-    load_ptr_t end, exist_end;
-
-    region = malloc(sizeof(*region));
-    region->start = start;
-    region->size = size;
-    region->allocated = allocated;
-
-    /* We need to deal with the case where start + size wraps to 0, i.e. if
-     * we are allocating from the whole address space. */
-    end = region->start + region->size - 1;
-
-    if (!location) {
-	    /* Try to find where to insert the region in the list. */
-	    list_foreach(&alloc->regions, iter) {
-		exist = list_entry(iter, allocator_region_t, header);
-
-		if (region->start <= exist->start) {
-			location = exist;
-			break;
-		    }
-	    }
-	}
-
-    /* Insert the region. */
-    list_init(&region->header);
-    if (location) {
-	    if (region->start <= location->start) {
-		    list_add_before(&location->header, &region->header);
-		} else {
-		    /* May go after if we've been passed a location in the middle of
-		     * the region. */
-		    list_add_after(&location->header, &region->header);
-		}
-	} else {
-	    /* Must go at the end of the list if there is still no location. */
-	    list_append(&alloc->regions, &region->header);
-	}
-
-    /* Check if the new region has overlapped part of the previous. */
-    if (region != list_first(&alloc->regions, allocator_region_t, header)) {
-	    exist = list_prev(region, header);
-	    exist_end = exist->start + exist->size - 1;
-
-	    if (region->start <= exist_end) {
-		    if (exist_end > end) {
-			    /* Must split the region. */
-			    split = malloc(sizeof(*split));
-			    split->start = end + 1;
-			    split->size = exist_end - end;
-			    split->allocated = exist->allocated;
-
-			    list_init(&split->header);
-			    list_add_after(&region->header, &split->header);
-			}
-
-		    exist->size = region->start - exist->start;
-		}
-	}
-
-    /* Swallow up any following ranges that the new range overlaps. */
-    list_foreach_safe(&region->header, iter) {
-	if (iter == &alloc->regions)
-	    break;
-
-	exist = list_entry(iter, allocator_region_t, header);
-	exist_end = exist->start + exist->size - 1;
-
-	if (exist->start > end) {
-		break;
-	    } else if (exist_end > end) {
-		/* Resize the range and finish. */
-		exist->start = end + 1;
-		exist->size = exist_end - end;
-		break;
-	    } else {
-		/* Completely remove the range. */
-		list_remove(&exist->header);
-		free(exist);
-	    }
+/** Get the gap structure from a tree node (NULL if node is NULL). */
+#define gap_entry(node) avl_tree_entry(node, allocator_gap_t, link)
+
+/** Recompute the largest gap in a subtree.
+ * @param node          Node to update. */
+static void gap_augment(avl_tree_node_t *node) {
+    allocator_gap_t *gap = gap_entry(node);
+    allocator_gap_t *child;
+
+    gap->max_span = gap->end - gap->start;
+
+    child = gap_entry(node->left);
+    if (child)
+        gap->max_span = max(gap->max_span, child->max_span);
+
+    child = gap_entry(node->right);
+    if (child)
+        gap->max_span = max(gap->max_span, child->max_span);
+}
+
+/** Add a gap to an allocator.
+ * @param alloc         Allocator to add to.
+ * @param start         Start of the gap.
+ * @param end           Last address in the gap. */
+static void insert_gap(allocator_t *alloc, load_ptr_t start, load_ptr_t end) {
+    avl_tree_node_t **link = &alloc->gaps.root, *parent = NULL;
+    allocator_gap_t *gap;
+
+    gap = malloc(sizeof(*gap));
+    gap->start = start;
+    gap->end = end;
+
+    while (*link) {
+        parent = *link;
+        link = (start < gap_entry(parent)->start) ? &parent->left : &parent->right;
     }
+
+    avl_tree_insert(&alloc->gaps, &gap->link, parent, link);
 }
 
-/** Allocate a region from an allocator.
+/** Find the gap containing an address.
+ * @param alloc         Allocator to search.
+ * @param addr          Address to find.
+ * @return              Gap containing the address, or NULL if allocated. */
+static allocator_gap_t *find_gap(allocator_t *alloc, load_ptr_t addr) {
+    avl_tree_node_t *node = alloc->gaps.root;
+
+    while (node) {
+        allocator_gap_t *gap = gap_entry(node);
+
+        if (addr < gap->start) {
+            node = node->left;
+        } else if (addr > gap->end) {
+            node = node->right;
+        } else {
+            return gap;
+        }
+    }
+
+    return NULL;
+}
+
+/** Mark part of a gap as allocated.
+ * @param alloc         Allocator the gap is in.
+ * @param gap           Gap to allocate from.
+ * @param start         Start of the range to allocate.
+ * @param end           Last address of the range to allocate. */
+static void carve_gap(allocator_t *alloc, allocator_gap_t *gap, load_ptr_t start, load_ptr_t end) {
+    assert(start >= gap->start && end <= gap->end);
+
+    if (start == gap->start && end == gap->end) {
+        avl_tree_remove(&alloc->gaps, &gap->link);
+        free(gap);
+    } else if (start == gap->start) {
+        gap->start = end + 1;
+        avl_tree_update(&alloc->gaps, &gap->link);
+    } else if (end == gap->end) {
+        gap->end = start - 1;
+        avl_tree_update(&alloc->gaps, &gap->link);
+    } else {
+        load_ptr_t gap_end = gap->end;
+
+        gap->end = start - 1;
+        avl_tree_update(&alloc->gaps, &gap->link);
+        insert_gap(alloc, end + 1, gap_end);
+    }
+}
+
+/** Check whether a gap can satisfy an allocation.
+ * @param gap           Gap to check.
+ * @param size          Size of the allocation.
+ * @param align         Alignment of the allocation.
+ * @param offset        Offset from the alignment.
+ * @param _addr         Where to store address of allocation.
+ * @return              Whether the gap can satisfy the allocation. */
+static bool gap_fits(allocator_gap_t *gap, load_size_t size, load_size_t align, load_ptr_t offset, load_ptr_t *_addr) {
+    load_ptr_t base = gap->start & ~(align - 1);
+    load_ptr_t start = base + offset;
+
+    if (start < gap->start) {
+        start += align;
+
+        /* Check for wrapping past the end of the address space. */
+        if (start < base)
+            return false;
+    }
+
+    if (start > gap->end || gap->end - start < size - 1)
+        return false;
+
+    *_addr = start;
+    return true;
+}
+
+/** Find the lowest gap in a subtree that can satisfy an allocation.
+ * @param node          Root of the subtree.
+ * @param size          Size of the allocation.
+ * @param align         Alignment of the allocation.
+ * @param offset        Offset from the alignment.
+ * @param _addr         Where to store address of allocation.
+ * @return              Gap found, or NULL if none suitable. */
+static allocator_gap_t *find_free_gap(
+    avl_tree_node_t *node, load_size_t size, load_size_t align, load_ptr_t offset,
+    load_ptr_t *_addr)
+{
+    allocator_gap_t *gap = gap_entry(node), *ret;
+
+    if (!gap || gap->max_span < size - 1)
+        return NULL;
+
+    ret = find_free_gap(node->left, size, align, offset, _addr);
+    if (ret)
+        return ret;
+
+    if (gap_fits(gap, size, align, offset, _addr))
+        return gap;
+
+    return find_free_gap(node->right, size, align, offset, _addr);
+}
+
+/**
+ * Allocate a region at an offset from an alignment boundary.
+ *
+ * Allocates the lowest region such that (address % align) == offset. This
+ * can be used to give a virtual mapping the same offset from a large page
+ * boundary as its physical address, so that it can be mapped with large
+ * pages.
+ *
  * @param alloc         Allocator to allocate from.
  * @param size          Size of the region to allocate.
- * @param align         Alignment of the region.
+ * @param align         Alignment of the region (power of 2).
+ * @param offset        Offset from the alignment (less than align).
  * @param _addr         Where to store address of allocated region.
- * @return              Whether there was enough space for the region. */
-bool allocator_alloc(allocator_t *alloc, load_size_t size, load_size_t align, load_ptr_t *_addr) {
+ *
+ * @return              Whether there was enough space for the region.
+ */
+bool allocator_alloc_offset(
+    allocator_t *alloc, load_size_t size, load_size_t align, load_ptr_t offset,
+    load_ptr_t *_addr)
+{
+    allocator_gap_t *gap;
+    load_ptr_t addr;
+
     assert(!(size % PAGE_SIZE));
     assert(!(align % PAGE_SIZE));
+    assert(!(offset % PAGE_SIZE));
     assert(size);
 
     if (!align)
-	align = PAGE_SIZE;
+        align = PAGE_SIZE;
 
-    list_foreach(&alloc->regions, iter) {
-	allocator_region_t *region = list_entry(iter, allocator_region_t, header);
+    assert(is_pow2(align));
+    assert(offset < align);
 
-	if (!region->allocated) {
-		load_ptr_t start = round_up(region->start, align);
+    gap = find_free_gap(alloc->gaps.root, size, align, offset, &addr);
+    if (!gap)
+        return false;
 
-		if (start + size - 1 <= region->start + region->size - 1) {
-			/* Create a new allocated region and insert over this space. */
-			insert_region(alloc, start, size, true, region);
-
-			*_addr = start;
-			return true;
-		    }
-	    }
-    }
+    carve_gap(alloc, gap, addr, addr + size - 1);
+    *_addr = addr;
+    return true;
+}
 
-    return false;
+/** Allocate a region from an allocator.
+ * @param alloc         Allocator to allocate from.
+ * @param size          Size of the region to allocate.
+ * @param align         Alignment of the region.
+ * @param _addr         Where to store address of allocated region.
+ * @return              Whether there was enough space for the region. */
+bool allocator_alloc(allocator_t *alloc, load_size_t size, load_size_t align, load_ptr_t *_addr) {
+    return allocator_alloc_offset(alloc, size, align, 0, _addr);
 }
 
 /**
@@ -182,29 +258,25 @@ bool allocator_alloc(allocator_t *alloc, load_size_t size, load_size_t align, lo
  * @return              Whether successfully inserted.
  */
 bool allocator_insert(allocator_t *alloc, load_ptr_t addr, load_size_t size) {
-    load_ptr_t region_end;
+    load_ptr_t start, end;
+    allocator_gap_t *gap;
 
     assert(!(addr % PAGE_SIZE));
     assert(!(size % PAGE_SIZE));
     assert(size);
 
-    region_end = addr + size - 1;
+    /* Only the part within the allocator can conflict. */
+    start = max(addr, alloc->start);
+    end = min(addr + size - 1, alloc->start + alloc->size - 1);
+    if (end < start)
+        return true;
 
-    /* Check for conflicts with other allocated regions. */
-    list_foreach(&alloc->regions, iter) {
-	allocator_region_t *exist = list_entry(iter, allocator_region_t, header);
-	load_ptr_t exist_end;
+    /* Gaps are never adjacent, so the whole range must be in one gap. */
+    gap = find_gap(alloc, start);
+    if (!gap || end > gap->end)
+        return false;
 
-	if (!exist->allocated)
-	    continue;
-
-	exist_end = exist->start + exist->size - 1;
-
-	if (max(addr, exist->start) <= min(region_end, exist_end))
-	    return false;
-    }
-
-    allocator_reserve(alloc, addr, size);
+    carve_gap(alloc, gap, start, end);
     return true;
 }
 
@@ -219,24 +291,35 @@ bool allocator_insert(allocator_t *alloc, load_ptr_t addr, load_size_t size) {
  * @param size          Size of region to reserve.
  */
 void allocator_reserve(allocator_t *alloc, load_ptr_t addr, load_size_t size) {
-    load_ptr_t region_end, alloc_end, end;
+    avl_tree_node_t *node;
+    allocator_gap_t *gap;
+    load_ptr_t end;
 
     assert(!(addr % PAGE_SIZE));
     assert(!(size % PAGE_SIZE));
     assert(size);
 
-    /* Trim given range to be within the allocator. */
-    region_end = addr + size - 1;
-    alloc_end = alloc->start + alloc->size - 1;
-
-    addr = max(addr, alloc->start);
-    end = min(region_end, alloc_end);
-    if (end < addr)
-	return;
+    end = addr + size - 1;
+
+    /* Find the lowest gap ending at or after the start of the range. */
+    gap = NULL;
+    node = alloc->gaps.root;
+    while (node) {
+        if (gap_entry(node)->end >= addr) {
+            gap = gap_entry(node);
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
 
-    size = min(region_end, alloc_end) - addr + 1;
+    /* Allocate the part of each gap within the range. */
+    while (gap && gap->start <= end) {
+        allocator_gap_t *next = gap_entry(avl_tree_next(&gap->link));
 
-    insert_region(alloc, addr, size, true, NULL);
+        carve_gap(alloc, gap, max(addr, gap->start), min(end, gap->end));
+        gap = next;
+    }
 }
 
 /** Initialize an allocator.
@@ -250,11 +333,11 @@ void allocator_init(allocator_t *alloc, load_ptr_t start, load_size_t size) {
     assert(!(size % PAGE_SIZE));
     assert(start + size > start || start + size == 0);
 
-    list_init(&alloc->regions);
+    avl_tree_init(&alloc->gaps, gap_augment);
 
     alloc->start = start;
     alloc->size = size;
 
-    /* Add a free region covering the entire space. */
-    insert_region(alloc, start, size, false, NULL);
+    /* Add a gap covering the entire space. */
+    insert_gap(alloc, start, start + size - 1);
 }
@@ -0,0 +1,297 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               AVL tree implementation.
+ *
+ * This is an intrusive AVL tree, with nodes embedded in the structures that
+ * they link together. The tree itself does not know about keys: to insert a
+ * node, the caller searches down the tree to find where the node belongs and
+ * passes in the parent node and the link that should point to the new node.
+ * This allows the comparison to be done inline by the user of the tree.
+ *
+ * The tree can be augmented with data that summarises a subtree (e.g. the
+ * largest free range within it, to allow searches to skip subtrees which
+ * cannot satisfy an allocation). The augment callback is called on every node
+ * whose subtree changes, bottom-up, so it only needs to combine the node's own
+ * data with that of its children. If the data that a node contributes
+ * changes, avl_tree_update() must be called on it.
+ */
+
+#include <lib/avl_tree.h>
+#include <lib/utility.h>
+
+/** Get the height of a subtree.
+ * @param node          Root of the subtree (can be NULL).
+ * @return              Height of the subtree. */
+static inline int node_height(avl_tree_node_t *node)
+{
+	return (node) ? node->height : 0;
+}
+
+/** Recompute the height and augmented data of a node.
+ * @param tree          Tree the node is in.
+ * @param node          Node to update. */
+static inline void update_node(avl_tree_t *tree, avl_tree_node_t *node)
+{
+	node->height = max(node_height(node->left), node_height(node->right)) + 1;
+
+	if (tree->augment)
+		tree->augment(node);
+}
+
+/** Replace a child of a node.
+ * @param tree          Tree the nodes are in.
+ * @param parent        Parent node (NULL if the child is the root).
+ * @param old           Old child.
+ * @param new           New child (can be NULL). */
+static void replace_child(avl_tree_t *tree, avl_tree_node_t *parent, avl_tree_node_t *old, avl_tree_node_t *new)
+{
+	if (!parent) {
+		tree->root = new;
+	} else if (parent->left == old) {
+		parent->left = new;
+	} else {
+		parent->right = new;
+	}
+
+	if (new)
+		new->parent = parent;
+}
+
+/** Rotate a subtree to the left.
+ * @param tree          Tree the subtree is in.
+ * @param node          Root of the subtree.
+ * @return              New root of the subtree. */
+static avl_tree_node_t *rotate_left(avl_tree_t *tree, avl_tree_node_t *node)
+{
+	avl_tree_node_t *child = node->right;
+
+	node->right = child->left;
+	if (node->right)
+		node->right->parent = node;
+
+	replace_child(tree, node->parent, node, child);
+	child->left = node;
+	node->parent = child;
+
+	update_node(tree, node);
+	update_node(tree, child);
+	return child;
+}
+
+/** Rotate a subtree to the right.
+ * @param tree          Tree the subtree is in.
+ * @param node          Root of the subtree.
+ * @return              New root of the subtree. */
+static avl_tree_node_t *rotate_right(avl_tree_t *tree, avl_tree_node_t *node)
+{
+	avl_tree_node_t *child = node->left;
+
+	node->left = child->right;
+	if (node->left)
+		node->left->parent = node;
+
+	replace_child(tree, node->parent, node, child);
+	child->right = node;
+	node->parent = child;
+
+	update_node(tree, node);
+	update_node(tree, child);
+	return child;
+}
+
+/** Rebalance the tree from a node up to the root.
+ * @param tree          Tree to rebalance.
+ * @param node          Lowest node whose subtree has changed. */
+static void rebalance(avl_tree_t *tree, avl_tree_node_t *node)
+{
+	while (node) {
+		int balance = node_height(node->right) - node_height(node->left);
+
+		if (balance > 1) {
+			if (node_height(node->right->left) > node_height(node->right->right))
+				rotate_right(tree, node->right);
+
+			node = rotate_left(tree, node);
+		} else if (balance < -1) {
+			if (node_height(node->left->right) > node_height(node->left->left))
+				rotate_left(tree, node->left);
+
+			node = rotate_right(tree, node);
+		} else {
+			update_node(tree, node);
+		}
+
+		node = node->parent;
+	}
+}
+
+/**
+ * Insert a node into an AVL tree.
+ *
+ * Inserts a node into an AVL tree, at a position found by the caller by
+ * searching down from the root. For example, to insert by key:
+ *
+ *   avl_tree_node_t **link = &tree->root, *parent = NULL;
+ *
+ *   while (*link) {
+ *       parent = *link;
+ *       link = (key < entry_key(parent)) ? &parent->left : &parent->right;
+ *   }
+ *
+ *   avl_tree_insert(tree, node, parent, link);
+ *
+ * @param tree          Tree to insert into.
+ * @param node          Node to insert.
+ * @param parent        Parent of the new node (NULL if the tree is empty).
+ * @param link          Link in the parent (or the tree root) to store the node
+ *                      in, which must currently be NULL.
+ */
+void avl_tree_insert(avl_tree_t *tree, avl_tree_node_t *node, avl_tree_node_t *parent, avl_tree_node_t **link)
+{
+	node->parent = parent;
+	node->left = node->right = NULL;
+	node->height = 1;
+	*link = node;
+
+	rebalance(tree, node);
+}
+
+/** Remove a node from an AVL tree.
+ * @param tree          Tree to remove from.
+ * @param node          Node to remove. */
+void avl_tree_remove(avl_tree_t *tree, avl_tree_node_t *node)
+{
+	avl_tree_node_t *start;
+
+	if (node->left && node->right) {
+		avl_tree_node_t *next = node->right;
+
+		/* Replace the node with its successor, which has no left child. */
+		while (next->left)
+			next = next->left;
+
+		if (next->parent == node) {
+			start = next;
+		} else {
+			start = next->parent;
+			replace_child(tree, next->parent, next, next->right);
+			next->right = node->right;
+			next->right->parent = next;
+		}
+
+		next->left = node->left;
+		next->left->parent = next;
+		replace_child(tree, node->parent, node, next);
+	} else {
+		start = node->parent;
+		replace_child(tree, node->parent, node, (node->left) ? node->left : node->right);
+	}
+
+	rebalance(tree, start);
+}
+
+/** Update augmented data after a node's own data changes.
+ * @param tree          Tree the node is in.
+ * @param node          Node that has changed. */
+void avl_tree_update(avl_tree_t *tree, avl_tree_node_t *node)
+{
+	if (!tree->augment)
+		return;
+
+	while (node) {
+		tree->augment(node);
+		node = node->parent;
+	}
+}
+
+/** Get the first (lowest) node in an AVL tree.
+ * @param tree          Tree to get from.
+ * @return              First node, or NULL if the tree is empty. */
+avl_tree_node_t *avl_tree_first(avl_tree_t *tree)
+{
+	avl_tree_node_t *node = tree->root;
+
+	if (node) {
+		while (node->left)
+			node = node->left;
+	}
+
+	return node;
+}
+
+/** Get the last (highest) node in an AVL tree.
+ * @param tree          Tree to get from.
+ * @return              Last node, or NULL if the tree is empty. */
+avl_tree_node_t *avl_tree_last(avl_tree_t *tree)
+{
+	avl_tree_node_t *node = tree->root;
+
+	if (node) {
+		while (node->right)
+			node = node->right;
+	}
+
+	return node;
+}
+
+/** Get the node following another in an AVL tree.
+ * @param node          Current node.
+ * @return              Next node, or NULL if the node is the last. */
+avl_tree_node_t *avl_tree_next(avl_tree_node_t *node)
+{
+	if (node->right) {
+		node = node->right;
+		while (node->left)
+			node = node->left;
+
+		return node;
+	}
+
+	while (node->parent && node == node->parent->right)
+		node = node->parent;
+
+	return node->parent;
+}
+
+/** Get the node preceding another in an AVL tree.
+ * @param node          Current node.
+ * @return              Previous node, or NULL if the node is the first. */
+avl_tree_node_t *avl_tree_prev(avl_tree_node_t *node)
+{
+	if (node->left) {
+		node = node->left;
+		while (node->right)
+			node = node->right;
+
+		return node;
+	}
+
+	while (node->parent && node == node->parent->left)
+		node = node->parent;
+
+	return node->parent;
+}
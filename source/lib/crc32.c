@@ -0,0 +1,145 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               CRC32 and CRC32C calculation.
+ *
+ * This implements the CRC32 used by gzip, GPT and others (polynomial
+ * 0x04c11db7), and CRC32C (Castagnoli, polynomial 0x1edc6f41) as used by ext4
+ * metadata checksums. Both use the bit-reflected form.
+ *
+ * The functions operate on the raw CRC register: the value is not inverted on
+ * entry or exit. The standard CRC of a buffer is ~crc32(~0, buf, size), and a
+ * CRC can be calculated over multiple buffers by passing the result for one as
+ * the initial value for the next. This form is used directly by ext4.
+ *
+ * The portable implementation is slice-by-8, which handles 8 bytes per step
+ * using 8 lookup tables per polynomial. The tables are generated the first
+ * time they are needed. The architecture can provide faster implementations
+ * using CPU instructions, which are tried first and may process all or only
+ * part of the buffer.
+ */
+
+#include <arch/crc32.h>
+
+#include <lib/crc32.h>
+
+#include <endian.h>
+
+/** Reflected polynomials. */
+#define CRC32_POLY              0xedb88320
+#define CRC32C_POLY             0x82f63b78
+
+/** Slice-by-8 lookup table. */
+typedef uint32_t crc_table_t[8][256];
+
+static crc_table_t crc32_table;
+static crc_table_t crc32c_table;
+static bool crc_tables_initialized;
+
+/** Generate a slice-by-8 lookup table.
+ * @param table         Table to fill in.
+ * @param poly          Reflected polynomial. */
+static void init_table(crc_table_t table, uint32_t poly)
+{
+	for (size_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+
+		for (size_t j = 0; j < 8; j++)
+			crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+
+		table[0][i] = crc;
+	}
+
+	/* Entry i of table n gives the effect of byte i followed by n zero
+	 * bytes. */
+	for (size_t i = 0; i < 256; i++) {
+		for (size_t j = 1; j < 8; j++)
+			table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xff];
+	}
+}
+
+/** Calculate a CRC using a slice-by-8 table.
+ * @param table         Lookup table for the polynomial.
+ * @param crc           Initial CRC value.
+ * @param buf           Buffer to calculate over.
+ * @param size          Size of the buffer.
+ * @return              Updated CRC value. */
+static uint32_t crc_slice8(const crc_table_t table, uint32_t crc, const uint8_t *buf, size_t size)
+{
+	if (!crc_tables_initialized) {
+		init_table(crc32_table, CRC32_POLY);
+		init_table(crc32c_table, CRC32C_POLY);
+		crc_tables_initialized = true;
+	}
+
+	while (size && ((ptr_t)buf & 3)) {
+		crc = table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+		size--;
+	}
+
+	while (size >= 8) {
+		uint32_t low = le32_to_cpu(*(const uint32_t *)buf) ^ crc;
+		uint32_t high = le32_to_cpu(*(const uint32_t *)(buf + 4));
+
+		crc =
+			table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^
+			table[5][(low >> 16) & 0xff] ^ table[4][low >> 24] ^
+			table[3][high & 0xff] ^ table[2][(high >> 8) & 0xff] ^
+			table[1][(high >> 16) & 0xff] ^ table[0][high >> 24];
+
+		buf += 8;
+		size -= 8;
+	}
+
+	while (size--)
+		crc = table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+/** Calculate a CRC32 (as used by gzip).
+ * @param crc           Initial CRC register value (~0 for a new CRC).
+ * @param buf           Buffer to calculate over.
+ * @param size          Size of the buffer.
+ * @return              Updated CRC register value (invert to get the CRC). */
+uint32_t crc32(uint32_t crc, const void *buf, size_t size)
+{
+	size_t done = arch_crc32(&crc, buf, size);
+
+	return crc_slice8(crc32_table, crc, buf + done, size - done);
+}
+
+/** Calculate a CRC32C (Castagnoli).
+ * @param crc           Initial CRC register value (~0 for a new CRC).
+ * @param buf           Buffer to calculate over.
+ * @param size          Size of the buffer.
+ * @return              Updated CRC register value (invert to get the CRC). */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t size)
+{
+	size_t done = arch_crc32c(&crc, buf, size);
+
+	return crc_slice8(crc32c_table, crc, buf + done, size - done);
+}
@@ -0,0 +1,179 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               LZ4 block decompression.
+ *
+ * This implements decompression of the LZ4 block format, which is the raw
+ * compressed data contained in the blocks of an LZ4 frame. A block is a
+ * sequence of sequences, each of which is a token byte, a run of literals, and
+ * a match given as a 16-bit offset back into the output and a length. The
+ * last sequence in a block contains only literals.
+ *
+ * Input is untrusted, so every length and offset is checked against the
+ * bounds of the input and output buffers.
+ */
+
+#include <lib/lz4.h>
+#include <lib/string.h>
+
+/** Minimum length of a match. */
+#define LZ4_MIN_MATCH           4
+
+/** Read an extended length value.
+ * @param _src          Pointer to current input position, updated.
+ * @param end           End of input.
+ * @param _len          Length to add the extension to.
+ * @return              Whether the length was read successfully. */
+static inline bool read_length(const uint8_t **_src, const uint8_t *end, size_t *_len)
+{
+	const uint8_t *src = *_src;
+	uint8_t byte;
+
+	do {
+		if (src >= end)
+			return false;
+
+		byte = *src++;
+		*_len += byte;
+	} while (byte == 255);
+
+	*_src = src;
+	return true;
+}
+
+/** Decompress an LZ4 block.
+ * @param _src          Compressed data.
+ * @param src_size      Size of the compressed data.
+ * @param _dest         Buffer to decompress into.
+ * @param prefix_size   Number of bytes immediately before the destination
+ *                      buffer that contain previously decompressed data which
+ *                      matches can refer to (for linked blocks).
+ * @param dest_size     Size of the destination buffer.
+ * @param _size         Where to store the decompressed size.
+ * @return              Whether the data was decompressed successfully. */
+bool lz4_decompress(
+	const void *_src, size_t src_size, void *_dest, size_t prefix_size,
+	size_t dest_size, size_t *_size)
+{
+	const uint8_t *src = _src, *src_end = src + src_size;
+	uint8_t *dest = _dest, *dest_end = dest + dest_size;
+	const uint8_t *base = dest - prefix_size;
+
+	while (src < src_end) {
+		uint8_t token = *src++;
+		size_t len = token >> 4;
+		const uint8_t *match;
+		uint16_t offset;
+
+		/* Copy literals. */
+		if (len == 15 && !read_length(&src, src_end, &len))
+			return false;
+
+		if (len > (size_t)(src_end - src) || len > (size_t)(dest_end - dest))
+			return false;
+
+		memcpy(dest, src, len);
+		src += len;
+		dest += len;
+
+		/* The last sequence ends after the literals. */
+		if (src == src_end)
+			break;
+
+		if (src_end - src < 2)
+			return false;
+
+		offset = src[0] | (src[1] << 8);
+		src += 2;
+
+		if (!offset || offset > (size_t)(dest - base))
+			return false;
+
+		len = token & 0xf;
+		if (len == 15 && !read_length(&src, src_end, &len))
+			return false;
+
+		len += LZ4_MIN_MATCH;
+		if (len > (size_t)(dest_end - dest))
+			return false;
+
+		/* Matches may overlap the output, in which case they repeat the data
+		 * between the match and the current position. */
+		match = dest - offset;
+		if (offset >= len) {
+			memcpy(dest, match, len);
+			dest += len;
+		} else {
+			while (len--)
+				*dest++ = *match++;
+		}
+	}
+
+	*_size = dest - (uint8_t *)_dest;
+	return true;
+}
+
+/** Get the decompressed size of an LZ4 block without decompressing it.
+ * @param _src          Compressed data.
+ * @param src_size      Size of the compressed data.
+ * @param _size         Where to store the decompressed size.
+ * @return              Whether the block was parsed successfully. */
+bool lz4_decompressed_size(const void *_src, size_t src_size, size_t *_size)
+{
+	const uint8_t *src = _src, *src_end = src + src_size;
+	size_t size = 0;
+
+	while (src < src_end) {
+		uint8_t token = *src++;
+		size_t len = token >> 4;
+
+		if (len == 15 && !read_length(&src, src_end, &len))
+			return false;
+
+		if (len > (size_t)(src_end - src))
+			return false;
+
+		src += len;
+		size += len;
+
+		if (src == src_end)
+			break;
+
+		if (src_end - src < 2)
+			return false;
+
+		src += 2;
+
+		len = token & 0xf;
+		if (len == 15 && !read_length(&src, src_end, &len))
+			return false;
+
+		size += len + LZ4_MIN_MATCH;
+	}
+
+	*_size = size;
+	return true;
+}
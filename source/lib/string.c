@@ -72,6 +72,14 @@ void *memcpy(void *__restrict dest, const void *__restrict src, size_t count)
 
 		// unroll the loop if possible
 		while (count >= (sizeof(unsigned long) * 4)) {
+			*nd++ = *ns++;
+			*nd++ = *ns++;
+			*nd++ = *ns++;
+			*nd++ = *ns++;
+			count -= sizeof(unsigned long) * 4;
+		}
+
+		while (count >= sizeof(unsigned long)) {
 			*nd++ = *ns++;
 			count -= sizeof(unsigned long);
 		}
@@ -121,7 +129,7 @@ void *memset(void *dest, int val, size_t count)
 		nd = (unsigned long*)d;
 
 		// compute the value we will write
-		#ifdef __LP64_
+		#ifdef __LP64__
 		nval = c * 0x0101010101010101ul;
 		#else
 		nval = c * 0x01010101ul;
@@ -154,6 +162,8 @@ void *memset(void *dest, int val, size_t count)
 
 #endif /* TARGET_HAS_MEMSET */
 
+#ifndef TARGET_HAS_MEMMOVE
+
 /**
  * Copy overlapping data in memory.
  *
@@ -185,6 +195,8 @@ void *memmove(void *dest, const void *src, size_t count)
 	return dest;
 }
 
+#endif /* TARGET_HAS_MEMMOVE */
+
 /**
  * Compare 2 chunks of memory.
  *
@@ -0,0 +1,114 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               xxHash calculation.
+ *
+ * This implements the 32-bit variant of xxHash, which is used for the header,
+ * block and content checksums of LZ4 frames. Only the one-shot form is
+ * provided, as the loader only hashes small buffers that are already in
+ * memory.
+ */
+
+#include <lib/xxhash.h>
+
+/** xxHash32 primes. */
+#define XXH_PRIME32_1           0x9e3779b1u
+#define XXH_PRIME32_2           0x85ebca77u
+#define XXH_PRIME32_3           0xc2b2ae3du
+#define XXH_PRIME32_4           0x27d4eb2fu
+#define XXH_PRIME32_5           0x165667b1u
+
+/** Rotate a 32-bit value left. */
+static inline uint32_t rotl32(uint32_t value, unsigned count)
+{
+	return (value << count) | (value >> (32 - count));
+}
+
+/** Read an unaligned little-endian 32-bit value. */
+static inline uint32_t read32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/** Mix a 32-bit input value into an accumulator. */
+static inline uint32_t xxh32_round(uint32_t acc, uint32_t input)
+{
+	acc += input * XXH_PRIME32_2;
+	acc = rotl32(acc, 13);
+	return acc * XXH_PRIME32_1;
+}
+
+/** Calculate the xxHash32 of a buffer.
+ * @param buf           Buffer to hash.
+ * @param size          Size of the buffer.
+ * @param seed          Seed value.
+ * @return              Hash of the buffer. */
+uint32_t xxh32(const void *buf, size_t size, uint32_t seed)
+{
+	const uint8_t *p = buf;
+	const uint8_t *end = p + size;
+	uint32_t hash;
+
+	if (size >= 16) {
+		uint32_t v1 = seed + XXH_PRIME32_1 + XXH_PRIME32_2;
+		uint32_t v2 = seed + XXH_PRIME32_2;
+		uint32_t v3 = seed;
+		uint32_t v4 = seed - XXH_PRIME32_1;
+
+		do {
+			v1 = xxh32_round(v1, read32(p));
+			v2 = xxh32_round(v2, read32(p + 4));
+			v3 = xxh32_round(v3, read32(p + 8));
+			v4 = xxh32_round(v4, read32(p + 12));
+			p += 16;
+		} while (end - p >= 16);
+
+		hash = rotl32(v1, 1) + rotl32(v2, 7) + rotl32(v3, 12) + rotl32(v4, 18);
+	} else {
+		hash = seed + XXH_PRIME32_5;
+	}
+
+	hash += (uint32_t)size;
+
+	while (end - p >= 4) {
+		hash += read32(p) * XXH_PRIME32_3;
+		hash = rotl32(hash, 17) * XXH_PRIME32_4;
+		p += 4;
+	}
+
+	while (p < end) {
+		hash += *p * XXH_PRIME32_5;
+		hash = rotl32(hash, 11) * XXH_PRIME32_1;
+		p++;
+	}
+
+	hash ^= hash >> 15;
+	hash *= XXH_PRIME32_2;
+	hash ^= hash >> 13;
+	hash *= XXH_PRIME32_3;
+	hash ^= hash >> 16;
+	return hash;
+}
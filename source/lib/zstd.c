@@ -0,0 +1,1135 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               Zstandard decompression.
+ *
+ * This implements decompression of Zstandard frames, as specified in RFC 8878.
+ * The caller is responsible for reading the frame and block headers and the
+ * block contents, and for providing a buffer holding the window of previous
+ * output immediately before the destination. Dictionaries are not supported.
+ *
+ * Each compressed block contains a literals section, which is either stored
+ * directly or Huffman coded, and a sequences section. The sequences give
+ * literal lengths, match offsets and match lengths, each FSE (tANS) coded,
+ * which are executed against the literals to produce the output. Entropy
+ * tables and repeat offsets can carry over from previous blocks, so these are
+ * kept in a context for the whole frame.
+ *
+ * Passing a NULL destination only determines the decompressed size of a block,
+ * skipping literal decoding and output. The context is still updated, so this
+ * can be used to scan a frame without a content size.
+ *
+ * Input is untrusted, so all lengths, offsets and table descriptions are
+ * checked against the bounds of the buffers and the limits in the format.
+ */
+
+#include <lib/string.h>
+#include <lib/utility.h>
+#include <lib/zstd.h>
+
+#include <endian.h>
+
+/** Literals section block types. */
+#define LITERALS_RAW            0
+#define LITERALS_RLE            1
+#define LITERALS_COMPRESSED     2
+#define LITERALS_TREELESS       3
+
+/** Sequence table compression modes. */
+#define MODE_PREDEFINED         0
+#define MODE_RLE                1
+#define MODE_FSE                2
+#define MODE_REPEAT             3
+
+/** Indices of sequence tables in the context. */
+#define SEQ_LITERAL_LENGTH      0
+#define SEQ_OFFSET              1
+#define SEQ_MATCH_LENGTH        2
+
+/** Properties of a sequence table. */
+typedef struct seq_table_info {
+	unsigned max_symbol;                    /**< Maximum symbol value. */
+	unsigned max_log;                       /**< Maximum accuracy log. */
+	unsigned default_log;                   /**< Accuracy log of predefined table. */
+	const int16_t *default_norm;            /**< Predefined distribution. */
+	unsigned default_count;                 /**< Number of predefined symbols. */
+} seq_table_info_t;
+
+/** Predefined literal length distribution. */
+static const int16_t default_literal_length_norm[] = {
+	4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+	-1, -1, -1, -1,
+};
+
+/** Predefined offset distribution. */
+static const int16_t default_offset_norm[] = {
+	1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1,
+};
+
+/** Predefined match length distribution. */
+static const int16_t default_match_length_norm[] = {
+	1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+	-1, -1, -1, -1, -1,
+};
+
+/** Sequence table properties, indexed by SEQ_*. */
+static const seq_table_info_t seq_table_info[] = {
+	[SEQ_LITERAL_LENGTH] = {
+		35, 9, 6, default_literal_length_norm,
+		array_size(default_literal_length_norm)
+	},
+	[SEQ_OFFSET] = {
+		31, 8, 5, default_offset_norm,
+		array_size(default_offset_norm)
+	},
+	[SEQ_MATCH_LENGTH] = {
+		52, 9, 6, default_match_length_norm,
+		array_size(default_match_length_norm)
+	},
+};
+
+/** Literal length code baselines and extra bits. */
+static const uint32_t literal_length_base[] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+	16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048, 4096,
+	8192, 16384, 32768, 65536,
+};
+static const uint8_t literal_length_bits[] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12,
+	13, 14, 15, 16,
+};
+
+/** Match length code baselines and extra bits. */
+static const uint32_t match_length_base[] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+	19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+	35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027, 2051,
+	4099, 8195, 16387, 32771, 65539,
+};
+static const uint8_t match_length_bits[] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11,
+	12, 13, 14, 15, 16,
+};
+
+/**
+ * Backward bit stream reader.
+ *
+ * Huffman and FSE coded data is written as a bit stream which is read from the
+ * end backwards. The final byte contains a marker bit above the last bits of
+ * data. Bits are read from the top of a 64-bit container, which is refilled
+ * from lower addresses as it is consumed.
+ */
+typedef struct bit_reader {
+	const uint8_t *start;                   /**< Start of the stream. */
+	const uint8_t *ptr;                     /**< Location of the container. */
+	uint64_t container;                     /**< Current bits. */
+	unsigned consumed;                      /**< Bits consumed from the container. */
+} bit_reader_t;
+
+/** Read a little-endian 16-bit value. */
+static inline uint16_t load16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+/** Read a little-endian 32-bit value. */
+static inline uint32_t load32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/** Read a little-endian 64-bit value. */
+static inline uint64_t load64(const uint8_t *p)
+{
+	return load32(p) | ((uint64_t)load32(p + 4) << 32);
+}
+
+/** Initialize a bit reader.
+ * @param br            Reader to initialize.
+ * @param src           Start of the stream.
+ * @param size          Size of the stream.
+ * @return              Whether the stream is valid. */
+static bool bits_init(bit_reader_t *br, const uint8_t *src, size_t size)
+{
+	if (!size || !src[size - 1])
+		return false;
+
+	br->start = src;
+
+	if (size >= sizeof(br->container)) {
+		br->ptr = src + size - sizeof(br->container);
+		br->container = load64(br->ptr);
+		br->consumed = 0;
+	} else {
+		/* Short streams are loaded into the bottom of the container, with the
+		 * missing bytes at the top counted as consumed. */
+		br->ptr = src;
+		br->container = 0;
+		for (size_t i = 0; i < size; i++)
+			br->container |= (uint64_t)src[i] << (i * 8);
+
+		br->consumed = (sizeof(br->container) - size) * 8;
+	}
+
+	/* Skip over padding down to and including the marker bit. */
+	br->consumed += 9 - fls(src[size - 1]);
+	return true;
+}
+
+/** Look at bits from a stream without consuming them.
+ * @param br            Reader to read from.
+ * @param count         Number of bits (at most 56).
+ * @return              Value of the bits. Bits past the start of the stream
+ *                      read as zero. */
+static inline uint32_t bits_peek(bit_reader_t *br, unsigned count)
+{
+	if (!count || br->consumed >= 64)
+		return 0;
+
+	return (br->container << br->consumed) >> (64 - count);
+}
+
+/** Read bits from a stream.
+ * @param br            Reader to read from.
+ * @param count         Number of bits.
+ * @return              Value of the bits. */
+static inline uint32_t bits_read(bit_reader_t *br, unsigned count)
+{
+	uint32_t value = bits_peek(br, count);
+
+	br->consumed += count;
+	return value;
+}
+
+/** Refill the container of a bit reader.
+ * @param br            Reader to refill. */
+static inline void bits_reload(bit_reader_t *br)
+{
+	size_t bytes;
+
+	if (br->consumed > 64 || br->ptr == br->start)
+		return;
+
+	bytes = br->consumed >> 3;
+	if (bytes > (size_t)(br->ptr - br->start))
+		bytes = br->ptr - br->start;
+
+	br->ptr -= bytes;
+	br->consumed -= bytes * 8;
+	br->container = load64(br->ptr);
+}
+
+/** Check whether a bit reader has read past the start of the stream. */
+static inline bool bits_overflow(bit_reader_t *br)
+{
+	return br->consumed > 64;
+}
+
+/** Check whether a bit reader has consumed the stream exactly. */
+static inline bool bits_done(bit_reader_t *br)
+{
+	return br->ptr == br->start && br->consumed == 64;
+}
+
+/** Read bits from a forward (little-endian) bit stream.
+ * @param src           Start of the stream.
+ * @param size          Size of the stream.
+ * @param pos           Bit position to read from.
+ * @param count         Number of bits (at most 24).
+ * @return              Value of the bits. Bits past the end read as zero. */
+static inline uint32_t read_forward(const uint8_t *src, size_t size, size_t pos, unsigned count)
+{
+	size_t byte = pos >> 3;
+	uint32_t value = 0;
+
+	for (unsigned i = 0; i < 4 && byte + i < size; i++)
+		value |= (uint32_t)src[byte + i] << (i * 8);
+
+	return (value >> (pos & 7)) & ((1u << count) - 1);
+}
+
+/** Read an FSE table description.
+ * @param ctx           Context (normalized counts are stored in ctx->norm).
+ * @param src           Start of the description.
+ * @param size          Maximum size of the description.
+ * @param max_symbol    Maximum symbol value allowed.
+ * @param max_log       Maximum accuracy log allowed.
+ * @param _count        Where to store number of symbols.
+ * @param _log          Where to store accuracy log.
+ * @param _consumed     Where to store number of bytes used.
+ * @return              Whether the description is valid. */
+static bool read_fse_description(
+	zstd_context_t *ctx, const uint8_t *src, size_t size, unsigned max_symbol,
+	unsigned max_log, unsigned *_count, unsigned *_log, size_t *_consumed)
+{
+	int remaining, threshold;
+	unsigned log, bits, symbol;
+	bool prev_zero;
+	size_t pos;
+
+	if (!size)
+		return false;
+
+	log = (src[0] & 0xf) + 5;
+	if (log > max_log)
+		return false;
+
+	pos = 4;
+	remaining = (1 << log) + 1;
+	threshold = 1 << log;
+	bits = log + 1;
+	symbol = 0;
+	prev_zero = false;
+
+	while (remaining > 1 && symbol <= max_symbol) {
+		int max, count;
+
+		/* A zero probability is followed by a count of further zeros, in 2-bit
+		 * units which continue while they are all set. */
+		if (prev_zero) {
+			unsigned repeat;
+
+			do {
+				repeat = read_forward(src, size, pos, 2);
+				pos += 2;
+
+				for (unsigned i = 0; i < repeat; i++) {
+					if (symbol > max_symbol)
+						return false;
+
+					ctx->norm[symbol++] = 0;
+				}
+			} while (repeat == 3);
+
+			if (symbol > max_symbol)
+				return false;
+		}
+
+		max = (2 * threshold - 1) - remaining;
+		count = read_forward(src, size, pos, bits - 1);
+		if (count < max) {
+			pos += bits - 1;
+		} else {
+			count = read_forward(src, size, pos, bits);
+			if (count >= threshold)
+				count -= max;
+
+			pos += bits;
+		}
+
+		/* Values are stored plus one, so that -1 (less than one) can be
+		 * represented. Such symbols still take up one state. */
+		count--;
+		remaining -= abs(count);
+		if (remaining < 1)
+			return false;
+
+		ctx->norm[symbol++] = count;
+		prev_zero = !count;
+
+		while (remaining < threshold) {
+			bits--;
+			threshold >>= 1;
+		}
+	}
+
+	if (remaining != 1 || pos > size * 8)
+		return false;
+
+	*_count = symbol;
+	*_log = log;
+	*_consumed = (pos + 7) >> 3;
+	return true;
+}
+
+/** Build an FSE decoding table.
+ * @param ctx           Context (used for working space).
+ * @param table         Table to build.
+ * @param norm          Normalized counts.
+ * @param count         Number of symbols.
+ * @param log           Accuracy log.
+ * @return              Whether the distribution is valid. */
+static bool build_fse_table(
+	zstd_context_t *ctx, zstd_fse_entry_t *table, const int16_t *norm,
+	unsigned count, unsigned log)
+{
+	size_t size = 1 << log, high = size - 1, mask = size - 1, pos = 0;
+	size_t step = (size >> 1) + (size >> 3) + 3;
+
+	/* Symbols with a "less than one" probability are placed at the end of the
+	 * table, with a single state each. */
+	for (unsigned s = 0; s < count; s++) {
+		if (norm[s] == -1) {
+			table[high--].symbol = s;
+			ctx->next[s] = 1;
+		} else {
+			ctx->next[s] = norm[s];
+		}
+	}
+
+	/* Spread the remaining symbols through the table. */
+	for (unsigned s = 0; s < count; s++) {
+		for (int i = 0; i < norm[s]; i++) {
+			table[pos].symbol = s;
+
+			do {
+				pos = (pos + step) & mask;
+			} while (pos > high);
+		}
+	}
+
+	if (pos)
+		return false;
+
+	for (size_t i = 0; i < size; i++) {
+		unsigned next = ctx->next[table[i].symbol]++;
+
+		table[i].bits = log + 1 - fls(next);
+		table[i].base = (next << table[i].bits) - size;
+	}
+
+	return true;
+}
+
+/** Decode a symbol and update the state.
+ * @param table         Decoding table.
+ * @param state         State to update.
+ * @param br            Bit reader.
+ * @return              Decoded symbol. */
+static inline uint8_t fse_decode(const zstd_fse_entry_t *table, unsigned *state, bit_reader_t *br)
+{
+	const zstd_fse_entry_t *entry = &table[*state];
+
+	*state = entry->base + bits_read(br, entry->bits);
+	return entry->symbol;
+}
+
+/** Read a sequence decoding table.
+ * @param ctx           Context.
+ * @param index         Index of the table (SEQ_*).
+ * @param mode          Compression mode of the table.
+ * @param _src          Current input position, updated.
+ * @param end           End of input.
+ * @return              Whether the table is valid. */
+static bool read_seq_table(zstd_context_t *ctx, unsigned index, unsigned mode, const uint8_t **_src, const uint8_t *end)
+{
+	const seq_table_info_t *info = &seq_table_info[index];
+	zstd_fse_entry_t *table = ctx->seq_table[index];
+	unsigned count, log;
+	size_t consumed;
+
+	switch (mode) {
+	case MODE_PREDEFINED:
+		if (!build_fse_table(ctx, table, info->default_norm, info->default_count, info->default_log))
+			return false;
+
+		ctx->seq_log[index] = info->default_log;
+		break;
+	case MODE_RLE:
+		if (*_src >= end || **_src > info->max_symbol)
+			return false;
+
+		table[0].symbol = *(*_src)++;
+		table[0].bits = 0;
+		table[0].base = 0;
+		ctx->seq_log[index] = 0;
+		break;
+	case MODE_FSE:
+		if (!read_fse_description(ctx, *_src, end - *_src, info->max_symbol, info->max_log, &count, &log, &consumed))
+			return false;
+		if (!build_fse_table(ctx, table, ctx->norm, count, log))
+			return false;
+
+		*_src += consumed;
+		ctx->seq_log[index] = log;
+		break;
+	default:
+		/* Repeat the table from the previous block. */
+		if (!ctx->seq_valid[index])
+			return false;
+
+		break;
+	}
+
+	ctx->seq_valid[index] = true;
+	return true;
+}
+
+/** Read the Huffman weights from an FSE-compressed description.
+ * @param ctx           Context.
+ * @param src           Compressed weights.
+ * @param size          Size of the compressed weights.
+ * @param _count        Where to store number of weights.
+ * @return              Whether the weights are valid. */
+static bool read_huffman_weights(zstd_context_t *ctx, const uint8_t *src, size_t size, unsigned *_count)
+{
+	unsigned symbols, log, state1, state2, count;
+	bit_reader_t br;
+	size_t consumed;
+
+	if (!read_fse_description(ctx, src, size, 15, ZSTD_WEIGHT_LOG_MAX, &symbols, &log, &consumed))
+		return false;
+	if (!build_fse_table(ctx, ctx->weight_table, ctx->norm, symbols, log))
+		return false;
+	if (!bits_init(&br, src + consumed, size - consumed))
+		return false;
+
+	/* Two interleaved states are used, decoding stops once the stream has been
+	 * overrun, with a final symbol from the other state. */
+	state1 = bits_read(&br, log);
+	state2 = bits_read(&br, log);
+	bits_reload(&br);
+	count = 0;
+
+	while (true) {
+		if (count > 253)
+			return false;
+
+		ctx->weights[count++] = fse_decode(ctx->weight_table, &state1, &br);
+		bits_reload(&br);
+		if (bits_overflow(&br)) {
+			ctx->weights[count++] = ctx->weight_table[state2].symbol;
+			break;
+		}
+
+		ctx->weights[count++] = fse_decode(ctx->weight_table, &state2, &br);
+		bits_reload(&br);
+		if (bits_overflow(&br)) {
+			ctx->weights[count++] = ctx->weight_table[state1].symbol;
+			break;
+		}
+	}
+
+	*_count = count;
+	return true;
+}
+
+/** Read a Huffman table description and build the decoding table.
+ * @param ctx           Context.
+ * @param src           Start of the description.
+ * @param size          Maximum size of the description.
+ * @param _consumed     Where to store number of bytes used.
+ * @return              Whether the description is valid. */
+static bool read_huffman_table(zstd_context_t *ctx, const uint8_t *src, size_t size, size_t *_consumed)
+{
+	uint32_t total, rest, rank_start[ZSTD_HUFFMAN_LOG_MAX + 2];
+	unsigned count, log;
+
+	if (!size)
+		return false;
+
+	if (src[0] >= 128) {
+		/* Weights are stored directly as 4-bit values. */
+		count = src[0] - 127;
+		*_consumed = 1 + ((count + 1) / 2);
+		if (*_consumed > size)
+			return false;
+
+		for (unsigned i = 0; i < count; i++)
+			ctx->weights[i] = (i & 1) ? src[1 + (i / 2)] & 0xf : src[1 + (i / 2)] >> 4;
+	} else {
+		*_consumed = 1 + src[0];
+		if (*_consumed > size || !read_huffman_weights(ctx, src + 1, src[0], &count))
+			return false;
+	}
+
+	/* The weight of the last symbol is not stored, it is the one which brings
+	 * the total up to the next power of 2. */
+	total = 0;
+	for (unsigned i = 0; i < count; i++) {
+		if (ctx->weights[i] > ZSTD_HUFFMAN_LOG_MAX)
+			return false;
+		if (ctx->weights[i])
+			total += 1 << (ctx->weights[i] - 1);
+	}
+
+	if (!total)
+		return false;
+
+	log = fls(total);
+	if (log > ZSTD_HUFFMAN_LOG_MAX)
+		return false;
+
+	rest = (1 << log) - total;
+	if (!is_pow2(rest))
+		return false;
+
+	ctx->weights[count++] = fls(rest);
+
+	/* Codes are assigned in order of increasing weight, then symbol value. A
+	 * symbol with weight w has a code of (log + 1 - w) bits, which covers
+	 * 2^(w - 1) entries in the table. */
+	memset(rank_start, 0, sizeof(rank_start));
+	for (unsigned i = 0; i < count; i++)
+		rank_start[ctx->weights[i]]++;
+
+	total = 0;
+	for (unsigned w = 1; w <= log; w++) {
+		uint32_t entries = rank_start[w] << (w - 1);
+
+		rank_start[w] = total;
+		total += entries;
+	}
+
+	for (unsigned i = 0; i < count; i++) {
+		unsigned w = ctx->weights[i];
+
+		if (!w)
+			continue;
+
+		for (uint32_t j = 0; j < (1u << (w - 1)); j++) {
+			ctx->huffman_table[rank_start[w] + j].symbol = i;
+			ctx->huffman_table[rank_start[w] + j].bits = log + 1 - w;
+		}
+
+		rank_start[w] += 1 << (w - 1);
+	}
+
+	ctx->huffman_log = log;
+	return true;
+}
+
+/** Decode a Huffman-coded literals stream.
+ * @param ctx           Context.
+ * @param src           Stream data.
+ * @param size          Size of the stream.
+ * @param dest          Destination buffer.
+ * @param count         Number of literals to decode.
+ * @return              Whether the stream was decoded successfully. */
+static bool decode_huffman_stream(zstd_context_t *ctx, const uint8_t *src, size_t size, uint8_t *dest, size_t count)
+{
+	unsigned log = ctx->huffman_log;
+	bit_reader_t br;
+
+	if (!bits_init(&br, src, size))
+		return false;
+
+	for (size_t i = 0; i < count; i++) {
+		const zstd_huffman_entry_t *entry = &ctx->huffman_table[bits_peek(&br, log)];
+
+		dest[i] = entry->symbol;
+		br.consumed += entry->bits;
+		bits_reload(&br);
+	}
+
+	return bits_done(&br);
+}
+
+/** Decode Huffman-coded literals.
+ * @param ctx           Context.
+ * @param src           Literals data (after the table description).
+ * @param size          Size of the data.
+ * @param streams       Number of streams (1 or 4).
+ * @param count         Number of literals to decode.
+ * @return              Whether the literals were decoded successfully. */
+static bool decode_huffman_literals(zstd_context_t *ctx, const uint8_t *src, size_t size, unsigned streams, size_t count)
+{
+	size_t sizes[4], segment;
+	uint8_t *dest;
+
+	if (streams == 1)
+		return decode_huffman_stream(ctx, src, size, ctx->literals, count);
+
+	/* A jump table gives the sizes of the first 3 streams. Each stream decodes
+	 * a quarter of the literals (rounded up), the last gets the rest. */
+	if (size < 6)
+		return false;
+
+	sizes[0] = load16(src);
+	sizes[1] = load16(src + 2);
+	sizes[2] = load16(src + 4);
+	src += 6;
+	size -= 6;
+
+	if (sizes[0] + sizes[1] + sizes[2] > size)
+		return false;
+
+	sizes[3] = size - sizes[0] - sizes[1] - sizes[2];
+
+	segment = (count + 3) / 4;
+	if (segment * 3 > count)
+		return false;
+
+	dest = ctx->literals;
+	for (unsigned i = 0; i < 4; i++) {
+		size_t num = (i < 3) ? segment : count - (segment * 3);
+
+		if (!decode_huffman_stream(ctx, src, sizes[i], dest, num))
+			return false;
+
+		src += sizes[i];
+		dest += num;
+	}
+
+	return true;
+}
+
+/** Decode the literals section of a compressed block.
+ * @param ctx           Context.
+ * @param _src          Current input position, updated.
+ * @param end           End of input.
+ * @param count_only    Whether to only determine the literals size.
+ * @param _literals     Where to store pointer to literals.
+ * @param _size         Where to store number of literals.
+ * @return              Whether the section is valid. */
+static bool decode_literals(
+	zstd_context_t *ctx, const uint8_t **_src, const uint8_t *end, bool count_only,
+	const uint8_t **_literals, size_t *_size)
+{
+	const uint8_t *src = *_src;
+	unsigned type, format, streams;
+	size_t header, size, compressed, consumed;
+	uint64_t value;
+
+	if (src >= end)
+		return false;
+
+	type = src[0] & 3;
+	format = (src[0] >> 2) & 3;
+
+	if (type == LITERALS_RAW || type == LITERALS_RLE) {
+		header = (format == 3) ? 3 : (format == 1) ? 2 : 1;
+		if (header > (size_t)(end - src))
+			return false;
+
+		switch (header) {
+		case 1:
+			size = src[0] >> 3;
+			break;
+		case 2:
+			size = (src[0] >> 4) | (src[1] << 4);
+			break;
+		default:
+			size = (src[0] >> 4) | (src[1] << 4) | (src[2] << 12);
+			break;
+		}
+
+		src += header;
+
+		if (size > ZSTD_BLOCK_MAX)
+			return false;
+
+		if (type == LITERALS_RAW) {
+			if (size > (size_t)(end - src))
+				return false;
+
+			*_literals = src;
+			src += size;
+		} else {
+			if (src >= end)
+				return false;
+
+			if (!count_only)
+				memset(ctx->literals, *src, size);
+
+			*_literals = ctx->literals;
+			src++;
+		}
+	} else {
+		streams = (format == 0) ? 1 : 4;
+		header = (format <= 1) ? 3 : format + 2;
+		if (header > (size_t)(end - src))
+			return false;
+
+		value = load16(src) | (src[2] << 16);
+		if (header >= 4)
+			value |= (uint32_t)src[3] << 24;
+		if (header == 5)
+			value |= (uint64_t)src[4] << 32;
+
+		switch (header) {
+		case 3:
+			size = (value >> 4) & 0x3ff;
+			compressed = (value >> 14) & 0x3ff;
+			break;
+		case 4:
+			size = (value >> 4) & 0x3fff;
+			compressed = (value >> 18) & 0x3fff;
+			break;
+		default:
+			size = (value >> 4) & 0x3ffff;
+			compressed = (value >> 22) & 0x3ffff;
+			break;
+		}
+
+		src += header;
+
+		if (size > ZSTD_BLOCK_MAX || compressed > (size_t)(end - src))
+			return false;
+
+		/* Treeless literals reuse the table from a previous block. */
+		consumed = 0;
+		if (type == LITERALS_COMPRESSED) {
+			if (!read_huffman_table(ctx, src, compressed, &consumed))
+				return false;
+		} else if (!ctx->huffman_log) {
+			return false;
+		}
+
+		if (!count_only) {
+			if (!decode_huffman_literals(ctx, src + consumed, compressed - consumed, streams, size))
+				return false;
+		}
+
+		*_literals = ctx->literals;
+		src += compressed;
+	}
+
+	*_src = src;
+	*_size = size;
+	return true;
+}
+
+/** Decode and execute the sequences section of a compressed block.
+ * @param ctx           Context.
+ * @param src           Start of the sequences section.
+ * @param end           End of the block.
+ * @param literals      Literals for the block.
+ * @param literals_size Number of literals.
+ * @param dest          Destination buffer (NULL to only count size).
+ * @param prefix_size   Size of previous output before the destination.
+ * @param dest_size     Size of the destination buffer.
+ * @param _size         Where to store decompressed size.
+ * @return              Whether the sequences are valid. */
+static bool decode_sequences(
+	zstd_context_t *ctx, const uint8_t *src, const uint8_t *end,
+	const uint8_t *literals, size_t literals_size, uint8_t *dest,
+	size_t prefix_size, size_t dest_size, size_t *_size)
+{
+	unsigned state[3], modes;
+	size_t count, out = 0;
+	bit_reader_t br;
+
+	if (src >= end)
+		return false;
+
+	count = src[0];
+	if (count < 128) {
+		src++;
+	} else if (count < 255) {
+		if (end - src < 2)
+			return false;
+
+		count = ((count - 128) << 8) + src[1];
+		src += 2;
+	} else {
+		if (end - src < 3)
+			return false;
+
+		count = load16(src + 1) + 0x7f00;
+		src += 3;
+	}
+
+	if (count) {
+		if (src >= end)
+			return false;
+
+		modes = *src++;
+		if (modes & 3)
+			return false;
+
+		if (!read_seq_table(ctx, SEQ_LITERAL_LENGTH, modes >> 6, &src, end))
+			return false;
+		if (!read_seq_table(ctx, SEQ_OFFSET, (modes >> 4) & 3, &src, end))
+			return false;
+		if (!read_seq_table(ctx, SEQ_MATCH_LENGTH, (modes >> 2) & 3, &src, end))
+			return false;
+
+		if (!bits_init(&br, src, end - src))
+			return false;
+
+		state[SEQ_LITERAL_LENGTH] = bits_read(&br, ctx->seq_log[SEQ_LITERAL_LENGTH]);
+		state[SEQ_OFFSET] = bits_read(&br, ctx->seq_log[SEQ_OFFSET]);
+		state[SEQ_MATCH_LENGTH] = bits_read(&br, ctx->seq_log[SEQ_MATCH_LENGTH]);
+		bits_reload(&br);
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		unsigned ll_code, of_code, ml_code;
+		uint32_t offset, ll, ml;
+
+		ll_code = ctx->seq_table[SEQ_LITERAL_LENGTH][state[SEQ_LITERAL_LENGTH]].symbol;
+		of_code = ctx->seq_table[SEQ_OFFSET][state[SEQ_OFFSET]].symbol;
+		ml_code = ctx->seq_table[SEQ_MATCH_LENGTH][state[SEQ_MATCH_LENGTH]].symbol;
+
+		/* Extra bits are read for the offset, match length and then literal
+		 * length. */
+		offset = (1u << of_code) + bits_read(&br, of_code);
+		bits_reload(&br);
+		ml = match_length_base[ml_code] + bits_read(&br, match_length_bits[ml_code]);
+		ll = literal_length_base[ll_code] + bits_read(&br, literal_length_bits[ll_code]);
+		bits_reload(&br);
+
+		/* States are not updated after the last sequence. */
+		if (i + 1 < count) {
+			fse_decode(ctx->seq_table[SEQ_LITERAL_LENGTH], &state[SEQ_LITERAL_LENGTH], &br);
+			fse_decode(ctx->seq_table[SEQ_MATCH_LENGTH], &state[SEQ_MATCH_LENGTH], &br);
+			fse_decode(ctx->seq_table[SEQ_OFFSET], &state[SEQ_OFFSET], &br);
+			bits_reload(&br);
+		}
+
+		if (bits_overflow(&br))
+			return false;
+
+		/* Offset values 1-3 refer to recent offsets, shifted by one if there
+		 * are no literals. */
+		if (offset > 3) {
+			offset -= 3;
+			ctx->rep[2] = ctx->rep[1];
+			ctx->rep[1] = ctx->rep[0];
+			ctx->rep[0] = offset;
+		} else {
+			unsigned index = offset - 1 + !ll;
+
+			if (index) {
+				offset = (index == 3) ? ctx->rep[0] - 1 : ctx->rep[index];
+				if (index != 1)
+					ctx->rep[2] = ctx->rep[1];
+
+				ctx->rep[1] = ctx->rep[0];
+				ctx->rep[0] = offset;
+			} else {
+				offset = ctx->rep[0];
+			}
+		}
+
+		if (ll > literals_size || ll + ml > dest_size - out)
+			return false;
+
+		if (dest) {
+			const uint8_t *match;
+			uint8_t *op;
+
+			memcpy(dest + out, literals, ll);
+			out += ll;
+
+			if (!offset || offset > prefix_size + out)
+				return false;
+
+			/* Matches may overlap the output, in which case they repeat the
+			 * data between the match and the current position. */
+			op = dest + out;
+			match = op - offset;
+			if (offset >= ml) {
+				memcpy(op, match, ml);
+			} else {
+				for (uint32_t j = 0; j < ml; j++)
+					op[j] = match[j];
+			}
+
+			out += ml;
+		} else {
+			out += ll + ml;
+		}
+
+		literals += ll;
+		literals_size -= ll;
+	}
+
+	if (count && !bits_done(&br))
+		return false;
+
+	/* Copy remaining literals. */
+	if (literals_size > dest_size - out)
+		return false;
+
+	if (dest)
+		memcpy(dest + out, literals, literals_size);
+
+	*_size = out + literals_size;
+	return true;
+}
+
+/** Parse a frame header.
+ * @param buf           Start of the frame.
+ * @param size          Size of the data in the buffer.
+ * @param frame         Where to store frame information.
+ * @return              Whether the header is valid. */
+bool zstd_frame_header(const void *buf, size_t size, zstd_frame_t *frame)
+{
+	static const uint8_t dict_sizes[] = { 0, 1, 2, 4 };
+	const uint8_t *src = buf;
+	unsigned desc, fcs_size;
+	size_t pos;
+
+	if (size < 5 || load32(src) != ZSTD_MAGIC)
+		return false;
+
+	/* Bit 3 is reserved. */
+	desc = src[4];
+	if (desc & (1 << 3))
+		return false;
+
+	pos = 5;
+	frame->window_size = 0;
+
+	/* Single segment frames have no window descriptor, the window is the
+	 * content size. */
+	if (!(desc & (1 << 5))) {
+		uint64_t base;
+
+		if (pos >= size)
+			return false;
+
+		base = 1ull << (10 + (src[pos] >> 3));
+		frame->window_size = base + ((base / 8) * (src[pos] & 7));
+		pos++;
+	}
+
+	switch (desc >> 6) {
+	case 0:
+		fcs_size = (desc & (1 << 5)) ? 1 : 0;
+		break;
+	case 1:
+		fcs_size = 2;
+		break;
+	case 2:
+		fcs_size = 4;
+		break;
+	default:
+		fcs_size = 8;
+		break;
+	}
+
+	if (pos + dict_sizes[desc & 3] + fcs_size > size)
+		return false;
+
+	frame->dict_id = 0;
+	for (unsigned i = 0; i < dict_sizes[desc & 3]; i++)
+		frame->dict_id |= (uint32_t)src[pos++] << (i * 8);
+
+	switch (fcs_size) {
+	case 0:
+		frame->content_size = ZSTD_CONTENT_SIZE_UNKNOWN;
+		break;
+	case 1:
+		frame->content_size = src[pos];
+		break;
+	case 2:
+		frame->content_size = load16(src + pos) + 256;
+		break;
+	case 4:
+		frame->content_size = load32(src + pos);
+		break;
+	default:
+		frame->content_size = load64(src + pos);
+		break;
+	}
+
+	if (desc & (1 << 5))
+		frame->window_size = frame->content_size;
+
+	frame->header_size = pos + fcs_size;
+	frame->checksum = desc & (1 << 2);
+	return true;
+}
+
+/** Parse a block header.
+ * @param buf           Block header (ZSTD_BLOCK_HEADER_SIZE bytes).
+ * @param block         Where to store block information.
+ * @return              Whether the header is valid. */
+bool zstd_block_header(const void *buf, zstd_block_t *block)
+{
+	const uint8_t *src = buf;
+	uint32_t value = load16(src) | (src[2] << 16);
+
+	block->last = value & 1;
+	block->type = (value >> 1) & 3;
+	block->size = value >> 3;
+
+	return block->type <= ZSTD_BLOCK_COMPRESSED && block->size <= ZSTD_BLOCK_MAX;
+}
+
+/** Initialize a context for the start of a frame.
+ * @param ctx           Context to initialize. */
+void zstd_init(zstd_context_t *ctx)
+{
+	ctx->rep[0] = 1;
+	ctx->rep[1] = 4;
+	ctx->rep[2] = 8;
+	ctx->huffman_log = 0;
+
+	for (unsigned i = 0; i < array_size(ctx->seq_valid); i++)
+		ctx->seq_valid[i] = false;
+}
+
+/** Decompress a block.
+ * @param ctx           Context for the frame.
+ * @param block         Block header.
+ * @param src           Block contents.
+ * @param dest          Buffer to decompress into, or NULL to only determine
+ *                      the decompressed size.
+ * @param prefix_size   Number of bytes immediately before the destination
+ *                      buffer that contain previous output of the frame.
+ * @param dest_size     Size of the destination buffer.
+ * @param _size         Where to store the decompressed size.
+ * @return              Whether the block was decompressed successfully. */
+bool zstd_decompress_block(
+	zstd_context_t *ctx, const zstd_block_t *block, const void *src,
+	void *dest, size_t prefix_size, size_t dest_size, size_t *_size)
+{
+	const uint8_t *pos = src, *literals, *end;
+	size_t literals_size;
+
+	if (dest && block->type != ZSTD_BLOCK_COMPRESSED && block->size > dest_size)
+		return false;
+
+	switch (block->type) {
+	case ZSTD_BLOCK_RAW:
+		if (dest)
+			memcpy(dest, src, block->size);
+
+		*_size = block->size;
+		return true;
+	case ZSTD_BLOCK_RLE:
+		if (dest)
+			memset(dest, *pos, block->size);
+
+		*_size = block->size;
+		return true;
+	case ZSTD_BLOCK_COMPRESSED:
+		end = pos + block->size;
+
+		if (!decode_literals(ctx, &pos, end, !dest, &literals, &literals_size))
+			return false;
+
+		if (!dest)
+			dest_size = ZSTD_BLOCK_MAX;
+
+		return decode_sequences(
+			ctx, pos, end, literals, literals_size, dest, prefix_size,
+			min(dest_size, ZSTD_BLOCK_MAX), _size);
+	default:
+		return false;
+	}
+}
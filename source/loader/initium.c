@@ -40,6 +40,7 @@
 #include <device.h>
 #include <loader.h>
 #include <memory.h>
+#include <numa.h>
 #include <video.h>
 
 #include "initium_elf.h"
@@ -137,28 +138,25 @@ static bool check_mapping(initium_loader_t *loader, initium_vaddr_t addr, initiu
  * @param size          Size of the mapping.
  * @param phys          Physical address. */
 static void add_mapping(initium_loader_t *loader, load_ptr_t start, load_size_t size, phys_ptr_t phys) {
+  avl_tree_node_t **link = &loader->mappings.root, *parent = NULL;
   initium_mapping_t *mapping;
 
   /* All virtual memory tags should be provided together in the tag list,
    * sorted in address order. To do this, we must maintain mapping info
    * separately in sorted order, then add it all to the tag list at once. */
-  mapping = malloc(sizeof(*mapping));
+  mapping = arena_alloc(loader->arena, sizeof(*mapping));
   mapping->start = start;
   mapping->size = size;
   mapping->phys = (phys == ~(phys_ptr_t)0) ? ~(initium_paddr_t)0 : phys;
 
-  list_init(&mapping->header);
+  while (*link) {
+    initium_mapping_t *other = avl_tree_entry(*link, initium_mapping_t, link);
 
-  list_foreach(&loader->mappings, iter) {
-    initium_mapping_t *other = list_entry(iter, initium_mapping_t, header);
-
-    if (mapping->start <= other->start) {
-      list_add_before(&other->header, &mapping->header);
-      return;
-    }
+    parent = *link;
+    link = (mapping->start <= other->start) ? &parent->left : &parent->right;
   }
 
-  list_append(&loader->mappings, &mapping->header);
+  avl_tree_insert(&loader->mappings, &mapping->link, parent, link);
 }
 
 /** Allocate virtual address space.
@@ -168,11 +166,20 @@ static void add_mapping(initium_loader_t *loader, load_ptr_t start, load_size_t
  * @return              Virtual address of mapping. */
 initium_vaddr_t initium_alloc_virtual(initium_loader_t *loader, initium_paddr_t phys, initium_vaddr_t size) {
   load_ptr_t addr;
+  bool allocated = false;
 
   if (!check_mapping(loader, ~(initium_vaddr_t)0, phys, size))
     boot_error("Invalid virtual mapping (physical 0x%" PRIx64 ")", phys);
 
-  if (!allocator_alloc(&loader->allocator, size, 0, &addr))
+  /* If the mapping is big enough, try to give it the same offset from a large
+   * page boundary as its physical address so that it can use large pages. */
+  if (phys != ~(initium_paddr_t)0 && loader->large_page_size && size >= loader->large_page_size) {
+    load_size_t align = loader->large_page_size;
+
+    allocated = allocator_alloc_offset(&loader->allocator, size, align, phys % align, &addr);
+  }
+
+  if (!allocated && !allocator_alloc(&loader->allocator, size, 0, &addr))
     boot_error("Insufficient address space available (allocating %" PRIuLOAD " bytes)", size);
 
   if (phys != ~(initium_paddr_t)0) {
@@ -276,6 +283,33 @@ static bool check_virt_map_params(initium_loader_t *loader, initium_itag_load_t
   return true;
 }
 
+/**
+ * Allocate physical memory for data that the kernel may map.
+ *
+ * Allocations of at least the large page size are aligned to it if possible,
+ * so that the kernel is able to map them with large pages. If there is not
+ * enough memory to do so, falls back to page alignment.
+ *
+ * @param loader        Loader internal data.
+ * @param size          Size of the allocation (multiple of PAGE_SIZE).
+ * @param type          Type of the allocation.
+ * @param _phys         Where to store physical address of allocation.
+ *
+ * @return              Loader mapping of allocated memory.
+ */
+static void *alloc_large_aligned(initium_loader_t *loader, load_size_t size, uint8_t type, phys_ptr_t *_phys) {
+  if (loader->large_page_size && size >= loader->large_page_size) {
+    void *ret = memory_alloc(
+      size, loader->large_page_size, 0, 0, type,
+      MEMORY_ALLOC_HIGH | MEMORY_ALLOC_CAN_FAIL, _phys);
+
+    if (ret)
+      return ret;
+  }
+
+  return memory_alloc(size, 0, 0, 0, type, MEMORY_ALLOC_HIGH, _phys);
+}
+
 /** Load kernel modules.
  * @param loader        Loader internal data. */
 static void load_modules(initium_loader_t *loader) {
@@ -289,7 +323,7 @@ static void load_modules(initium_loader_t *loader) {
 
     /* Allocate a chunk of memory to load to. */
     size = round_up(module->handle->size, PAGE_SIZE);
-    dest = memory_alloc(size, 0, 0, 0, MEMORY_TYPE_MODULES, MEMORY_ALLOC_HIGH, &phys);
+    dest = alloc_large_aligned(loader, size, MEMORY_TYPE_MODULES, &phys);
 
     dprintf(
       "initium: loading module '%s' to 0x%" PRIxPHYS " (size: %" PRIu64 ")\n",
@@ -588,8 +622,8 @@ static void add_memory_tags(initium_loader_t *loader) {
 static void add_vmem_tags(initium_loader_t *loader) {
   dprintf("initium: final virtual memory map:\n");
 
-  list_foreach(&loader->mappings, iter) {
-    initium_mapping_t *mapping = list_entry(iter, initium_mapping_t, header);
+  for (avl_tree_node_t *node = avl_tree_first(&loader->mappings); node; node = avl_tree_next(node)) {
+    initium_mapping_t *mapping = avl_tree_entry(node, initium_mapping_t, link);
     initium_tag_vmem_t *tag = initium_alloc_tag(loader, INITIUM_TAG_VMEM, sizeof(*tag));
 
     tag->start = mapping->start;
@@ -600,6 +634,83 @@ static void add_vmem_tags(initium_loader_t *loader) {
   }
 }
 
+/** Add NUMA memory affinity information to the tag list.
+ * @param loader        Loader internal data. */
+static void add_numa_tag(initium_loader_t *loader) {
+  const numa_range_t *ranges;
+  initium_tag_numa_t *tag;
+  size_t count;
+
+  count = numa_get_ranges(&ranges);
+  if (!count)
+    return;
+
+  tag = initium_alloc_tag(loader, INITIUM_TAG_NUMA, sizeof(*tag) + (count * sizeof(tag->ranges[0])));
+  tag->boot_node = numa_boot_node();
+  tag->num_ranges = count;
+
+  for (size_t i = 0; i < count; i++) {
+    tag->ranges[i].start = ranges[i].start;
+    tag->ranges[i].size = ranges[i].size;
+    tag->ranges[i].node = ranges[i].node;
+    tag->ranges[i]._pad = 0;
+  }
+}
+
+/** Map all physical memory at the base requested by the kernel, if any.
+ * @param loader        Loader internal data. */
+static void map_physical_memory(initium_loader_t *loader) {
+  initium_itag_physmap_t *physmap;
+  phys_ptr_t start = 0, end = 0, limit;
+  list_t map;
+
+  physmap = initium_find_itag(loader, INITIUM_ITAG_PHYSMAP);
+  if (!physmap)
+    return;
+
+  if (physmap->base % PAGE_SIZE)
+    boot_error("Invalid physical memory map base 0x%" PRIx64, physmap->base);
+
+  /* A 32-bit kernel can only map memory up to the end of its address space. */
+  if (loader->mode == LOAD_MODE_32BIT && physmap->base >= 0x100000000ull)
+    boot_error("Physical memory map base 0x%" PRIx64 " is outside the 32-bit address space", physmap->base);
+
+  limit = (loader->mode == LOAD_MODE_32BIT) ? 0x100000000ull - physmap->base : ~(phys_ptr_t)0;
+
+  /* Map each run of contiguous memory with a single mapping so that it can use
+   * the largest pages possible. Memory allocated after this point comes from
+   * ranges that are already in the map, so it will still be covered. */
+  memory_snapshot(&map);
+
+  list_foreach(&map, iter) {
+    memory_range_t *range = list_entry(iter, memory_range_t, header);
+
+    if (range->start >= limit)
+      break;
+
+    if (range->start != end) {
+      if (end != start)
+        initium_map_virtual(loader, physmap->base + start, start, end - start);
+
+      start = range->start;
+    }
+
+    end = min(range->start + range->size, limit);
+  }
+
+  if (end != start)
+    initium_map_virtual(loader, physmap->base + start, start, end - start);
+
+  memory_map_free(&map);
+
+  /* Keep the holes between ranges out of the allocator too, so that the whole
+   * region can be treated as a direct map. */
+  if (end)
+    allocator_reserve(&loader->allocator, physmap->base, end);
+
+  dprintf("initium: mapped physical memory up to 0x%" PRIxPHYS " at 0x%" PRIx64 "\n", end, physmap->base);
+}
+
 /** Load a Initium kernel.
  * @param _loader       Pointer to loader internal data. */
 static __noreturn void initium_loader_load(void *_loader) {
@@ -625,7 +736,7 @@ static __noreturn void initium_loader_load(void *_loader) {
       boot_error("Invalid kernel virtual map range");
   } else {
     /* No load tag, create one and initialize everything to zero. */
-    loader->load = malloc(sizeof(*loader->load));
+    loader->load = arena_alloc(loader->arena, sizeof(*loader->load));
     memset(loader->load, 0, sizeof(*loader->load));
   }
 
@@ -651,6 +762,9 @@ static __noreturn void initium_loader_load(void *_loader) {
     }
   }
 
+  /* Build the direct physical memory map if requested. */
+  map_physical_memory(loader);
+
   /* Perform architecture setup. */
   initium_arch_setup(loader);
 
@@ -683,6 +797,7 @@ static __noreturn void initium_loader_load(void *_loader) {
   add_bootdev_tag(loader);
   add_memory_tags(loader);
   add_vmem_tags(loader);
+  add_numa_tag(loader);
 
   dprintf(
     "initium: entry point at 0x%" PRIxLOAD " stack at 0x%" PRIx64 "\n",
@@ -818,6 +933,10 @@ static bool add_image_tag(initium_loader_t *loader, elf_note_t *note, void *desc
     size = sizeof(initium_itag_mapping_t);
     can_duplicate = true;
     break;
+  case INITIUM_ITAG_PHYSMAP:
+    size = sizeof(initium_itag_physmap_t);
+    can_duplicate = false;
+    break;
   default:
     config_error("'%s' has unrecognized image tag type %" PRIu32, loader->path, note->n_type);
     return false;
@@ -834,7 +953,7 @@ static bool add_image_tag(initium_loader_t *loader, elf_note_t *note, void *desc
   /* May be extra data following the tag header. */
   size = max(size, note->n_descsz);
 
-  tag = malloc(sizeof(initium_itag_t) + size);
+  tag = arena_alloc(loader->arena, sizeof(initium_itag_t) + size);
   tag->type = note->n_type;
   memcpy(tag->data, desc, size);
 
@@ -923,6 +1042,16 @@ static void init_video(initium_loader_t *loader) {
 
 #endif /* CONFIG_TARGET_HAS_VIDEO */
 
+/** Duplicate a string into a loader's arena.
+ * @param loader        Loader internal data.
+ * @param str           String to duplicate.
+ * @return              Pointer to the new string. */
+static char *loader_strdup(initium_loader_t *loader, const char *str) {
+  size_t len = strlen(str) + 1;
+
+  return memcpy(arena_alloc(loader->arena, len), str, len);
+}
+
 /**
  * Add a module list.
  *
@@ -937,22 +1066,16 @@ static bool add_module_list(initium_loader_t *loader, const value_list_t *list)
     char *name;
     status_t ret;
 
-    module = malloc(sizeof(*module));
+    module = arena_alloc(loader->arena, sizeof(*module));
 
     ret = fs_open(path, NULL, FILE_TYPE_REGULAR, &module->handle);
     if (ret != STATUS_SUCCESS) {
       config_error("Error opening module '%s': %pS", path, ret);
-      free(module);
       return false;
     }
 
     name = strrchr(path, '/');
-    if (name) {
-      module->name = strdup(name + 1);
-    } else {
-      module->name = list->values[i].string;
-      list->values[i].string = NULL;
-    }
+    module->name = loader_strdup(loader, (name) ? name + 1 : path);
 
     list_init(&module->header);
     list_append(&loader->modules, &module->header);
@@ -970,22 +1093,56 @@ static bool add_module_dir_cb(const fs_entry_t *entry, void *_loader) {
   initium_module_t *module;
   status_t ret;
 
-  module = malloc(sizeof(*module));
+  module = arena_alloc(loader->arena, sizeof(*module));
 
   ret = fs_open_entry(entry, FILE_TYPE_NONE, &module->handle);
   if (ret != STATUS_SUCCESS) {
     config_error("Error opening module '%s': %pS", entry->name, ret);
-    free(module);
     loader->success = false;
     return false;
   } else if (module->handle->type == FILE_TYPE_DIR) {
-    /* Ignore directories. */
+    /* Ignore directories. The module structure is wasted, but small. */
+    fs_close(module->handle);
+    return true;
+  }
+
+  module->name = loader_strdup(loader, entry->name);
+
+  list_init(&module->header);
+  list_append(&loader->modules, &module->header);
+
+  return true;
+}
+
+/** Size of the buffer used to read module directories. */
+#define MODULE_DIR_BUF_SIZE     4096
+
+/** Add a module from a directory record.
+ * @param loader        Loader internal data.
+ * @param handle        Handle to the module directory.
+ * @param record        Record for the module.
+ * @return              Whether successful. */
+static bool add_module_record(initium_loader_t *loader, fs_handle_t *handle, const fs_dir_record_t *record) {
+  initium_module_t *module;
+  status_t ret;
+
+  /* Ignore directories. If the type isn't known we have to open it to find
+   * out. */
+  if (record->type == FILE_TYPE_DIR)
+    return true;
+
+  module = arena_alloc(loader->arena, sizeof(*module));
+
+  ret = fs_open_cookie(handle, record, FILE_TYPE_NONE, &module->handle);
+  if (ret != STATUS_SUCCESS) {
+    config_error("Error opening module '%s': %pS", record->name, ret);
+    return false;
+  } else if (module->handle->type == FILE_TYPE_DIR) {
     fs_close(module->handle);
-    free(module);
     return true;
   }
 
-  module->name = strdup(entry->name);
+  module->name = loader_strdup(loader, record->name);
 
   list_init(&module->header);
   list_append(&loader->modules, &module->header);
@@ -998,7 +1155,10 @@ static bool add_module_dir_cb(const fs_entry_t *entry, void *_loader) {
  * @param path          Path to module directory.
  * @return              Whether successful. */
 static bool add_module_dir(initium_loader_t *loader, const char *path) {
-  fs_handle_t *handle;
+  fs_handle_t *handle __cleanup_close = NULL;
+  void *buf __cleanup_free = NULL;
+  offset_t cursor;
+  size_t count;
   status_t ret;
 
   ret = fs_open(path, NULL, FILE_TYPE_DIR, &handle);
@@ -1007,16 +1167,40 @@ static bool add_module_dir(initium_loader_t *loader, const char *path) {
     return false;
   }
 
-  loader->success = true;
+  /* Read the directory in batches where supported, this avoids a round trip
+   * through the filesystem for every entry in large module directories. */
+  buf = malloc(MODULE_DIR_BUF_SIZE);
+  cursor = 0;
+  while (true) {
+    fs_dir_record_t *record;
+
+    ret = fs_read_dir(handle, &cursor, buf, MODULE_DIR_BUF_SIZE, &count);
+    if (ret != STATUS_SUCCESS || !count)
+      break;
+
+    record = buf;
+    for (size_t i = 0; i < count; i++) {
+      if (!add_module_record(loader, handle, record))
+        return false;
+
+      record = fs_dir_record_next(record);
+    }
+  }
+
+  if (ret == STATUS_NOT_SUPPORTED) {
+    loader->success = true;
+
+    ret = fs_iterate(handle, add_module_dir_cb, loader);
+    if (ret == STATUS_SUCCESS && !loader->success)
+      return false;
+  }
 
-  ret = fs_iterate(handle, add_module_dir_cb, loader);
-  fs_close(handle);
   if (ret != STATUS_SUCCESS) {
     config_error("Error iterating '%s': %pS", path, ret);
     return false;
   }
 
-  return loader->success;
+  return true;
 }
 
 /** Load a Initium kernel.
@@ -1025,6 +1209,7 @@ static bool add_module_dir(initium_loader_t *loader, const char *path) {
 static bool config_cmd_initium(value_list_t *args) {
   initium_loader_t *loader;
   const value_t *value;
+  arena_t *arena;
   status_t ret;
 
   if (!check_args(args)) {
@@ -1032,10 +1217,16 @@ static bool config_cmd_initium(value_list_t *args) {
     return false;
   }
 
-  loader = malloc(sizeof(*loader));
+  /* Loader data lives as long as the environment, so allocate it from the
+   * environment's arena if it has one. Otherwise use our own so that it can
+   * all be freed at once if we fail. */
+  arena = (current_environ->arena) ? current_environ->arena : arena_create();
+
+  loader = arena_alloc(arena, sizeof(*loader));
+  loader->arena = arena;
   list_init(&loader->modules);
   list_init(&loader->itags);
-  list_init(&loader->mappings);
+  avl_tree_init(&loader->mappings, NULL);
   loader->path = args->values[0].string;
 
   /* Open the kernel image. */
@@ -1062,31 +1253,31 @@ static bool config_cmd_initium(value_list_t *args) {
   ret = initium_elf_iterate_notes(loader, add_image_tag);
   if (ret != STATUS_SUCCESS) {
     config_error("Error loading image tags from '%s': %pS", loader->path, ret);
-    goto err_itags;
+    goto err_close;
   } else if (!loader->success) {
-    goto err_itags;
+    goto err_close;
   }
 
   /* Check if we have a valid image tag. */
   loader->image = initium_find_itag(loader, INITIUM_ITAG_IMAGE);
   if (!loader->image) {
     config_error("'%s' is not a Initium kernel", loader->path);
-    goto err_itags;
+    goto err_close;
   } else if (loader->image->version != INITIUM_VERSION) {
     config_error("'%s' has unsupported Initium version %" PRIu32, loader->path, loader->image->version);
-    goto err_itags;
+    goto err_close;
   }
 
   /* Add options to the environment. */
   if (!add_options(loader))
-    goto err_itags;
+    goto err_close;
 
   /* Look for a root device option. */
   value = environ_lookup(current_environ, "root_device");
   if (value) {
     if (value->type != VALUE_TYPE_STRING) {
       config_error("'root_device' option should be a string");
-      goto err_itags;
+      goto err_close;
     }
 
     /* We can pass a UUID to the kernel without knowing the actual device.
@@ -1094,7 +1285,7 @@ static bool config_cmd_initium(value_list_t *args) {
     if (strncmp(value->string, "other:", 6) != 0 && strncmp(value->string, "uuid:", 5) != 0) {
       if (!device_lookup(value->string)) {
         config_error("Root device '%s' not found", value->string);
-        goto err_itags;
+        goto err_close;
       }
     }
   }
@@ -1119,31 +1310,20 @@ static bool config_cmd_initium(value_list_t *args) {
   return true;
 
 err_modules:
-  while (!list_empty(&loader->modules)) {
-    initium_module_t *module = list_first(&loader->modules, initium_module_t, header);
+  list_foreach(&loader->modules, iter) {
+    initium_module_t *module = list_entry(iter, initium_module_t, header);
 
-    list_remove(&module->header);
     fs_close(module->handle);
-    free(module->name);
-    free(module);
-  }
-
-err_itags:
-  while (!list_empty(&loader->itags)) {
-    initium_itag_t *itag = list_first(&loader->itags, initium_itag_t, header);
-
-    list_remove(&itag->header);
-    free(itag);
   }
 
-  free(loader->phdrs);
-  free(loader->ehdr);
-
 err_close:
   fs_close(loader->handle);
 
 err_free:
-  free(loader);
+  /* Everything else is freed along with the arena. */
+  if (arena != current_environ->arena)
+    arena_destroy(arena);
+
   return false;
 }
 
@@ -42,20 +42,27 @@ typedef bool (*initium_note_cb_t)(initium_loader_t *loader, elf_note_t *note, vo
  * @param virt_end      Virtual end address.
  * @return              Loader mapping of allocated memory. */
 static void *allocate_kernel(initium_loader_t *loader, load_ptr_t virt_base, load_ptr_t virt_end) {
-  load_size_t size;
+  load_size_t size, align, min_align;
   void *dest;
   phys_ptr_t phys;
-  size_t align;
 
   if (virt_base % PAGE_SIZE)
     boot_error("Kernel load address is not page aligned");
 
   size = round_up(virt_end - virt_base, PAGE_SIZE);
 
-  /* Iterate down in powers of 2 until we reach the minimum allowed alignment. */
   align = (loader->load->alignment) ? loader->load->alignment : PAGE_SIZE;
+  min_align = max(loader->load->min_alignment, PAGE_SIZE);
+
+  /* If the kernel's virtual base is large page aligned, try to align the
+   * physical address to match so that the bulk of the image is mapped with
+   * large pages. Any larger alignment is also a multiple of the requested one. */
+  if (loader->large_page_size && size >= loader->large_page_size && !(virt_base % loader->large_page_size))
+    align = max(align, loader->large_page_size);
+
+  /* Iterate down in powers of 2 until we reach the minimum allowed alignment. */
   dest = NULL;
-  while (align >= loader->load->min_alignment) {
+  while (align >= min_align) {
     dest = memory_alloc(
              size, align, 0, 0, MEMORY_TYPE_ALLOCATED,
              MEMORY_ALLOC_HIGH | MEMORY_ALLOC_CAN_FAIL, &phys);
@@ -69,9 +76,9 @@ static void *allocate_kernel(initium_loader_t *loader, load_ptr_t virt_base, loa
     boot_error("Insufficient memory available (allocating %" PRIuLOAD " bytes)", size);
 
   dprintf(
-    "initium: loading kernel to 0x%" PRIxPHYS " (alignment: 0x%" PRIx64 ", "
+    "initium: loading kernel to 0x%" PRIxPHYS " (alignment: 0x%" PRIxLOAD ", "
     "min_alignment: 0x%" PRIx64 ", base: 0x%" PRIxLOAD ", size: 0x%" PRIxLOAD ")\n",
-    phys, loader->load->alignment, loader->load->min_alignment, virt_base, size);
+    phys, align, loader->load->min_alignment, virt_base, size);
 
   initium_map_virtual(loader, virt_base, phys, size);
 
@@ -104,6 +111,30 @@ static void *allocate_segment(initium_loader_t *loader, load_ptr_t virt, phys_pt
   return dest;
 }
 
+/** Maximum amount of image data to buffer for loading sections. */
+#define SECTION_BUF_MAX (16 * 1024 * 1024)
+
+/** Get data for sections from the kernel image.
+ * @param loader        Loader internal data.
+ * @param buf           Buffer to read into.
+ * @param size          Size of the data.
+ * @param offset        Offset of the data in the image.
+ * @param ranges        Array to add a range to if the image was not buffered
+ *                      by load_kernel(), to be read with fs_read_ranges().
+ * @param _count        Number of entries in the array, updated if a range is
+ *                      added. */
+static void read_section_data(initium_loader_t *loader, void *buf, size_t size, offset_t offset, fs_read_range_t *ranges, size_t *_count) {
+  if (loader->image_ranges) {
+    if (!fs_copy_from_ranges(loader->image_ranges, loader->image_range_count, buf, size, offset))
+      boot_error("Kernel section data is outside the image");
+  } else {
+    ranges[*_count].buf = buf;
+    ranges[*_count].count = size;
+    ranges[*_count].offset = offset;
+    (*_count)++;
+  }
+}
+
 #if CONFIG_TARGET_HAS_INITIUM32
   #define INITIUM_LOAD_ELF32
   #include "initium_elfxx.h"
@@ -127,7 +158,7 @@ static status_t initium_elf_identify(initium_loader_t *loader) {
    * ELF64 header then it's probably invalid, so just use the maximum of the
    * two sizes. */
   size = max(sizeof(Elf32_Ehdr), sizeof(Elf64_Ehdr));
-  loader->ehdr = malloc(size);
+  loader->ehdr = arena_alloc(loader->arena, size);
 
   ret = fs_read(loader->handle, loader->ehdr, size, 0);
   if (ret == STATUS_SUCCESS) {
@@ -147,7 +178,6 @@ static status_t initium_elf_identify(initium_loader_t *loader) {
     ret = STATUS_UNKNOWN_IMAGE;
   }
 
-  free(loader->ehdr);
   return ret;
 }
 
@@ -47,71 +47,79 @@
 static status_t FUNC(identify)(initium_loader_t * loader) {
 	initium_elf_ehdr_t *ehdr = loader->ehdr;
 	size_t size;
-	status_t ret;
 
 	if (ehdr->e_phentsize != sizeof(initium_elf_phdr_t))
 		return STATUS_MALFORMED_IMAGE;
 
 	size = ehdr->e_phnum * ehdr->e_phentsize;
-	loader->phdrs = malloc(size);
-
-	ret = fs_read(loader->handle, loader->phdrs, size, ehdr->e_phoff);
-	if (ret != STATUS_SUCCESS) {
-		free(loader->phdrs);
-		free(loader->ehdr);
-	}
-
-	return ret;
+	loader->phdrs = arena_alloc(loader->arena, size);
+	return fs_read(loader->handle, loader->phdrs, size, ehdr->e_phoff);
 }
 
 /** Iterate over note sections in an ELF file. */
 static status_t FUNC(iterate_notes)(initium_loader_t * loader, initium_note_cb_t cb) {
 	initium_elf_ehdr_t *ehdr = loader->ehdr;
 	initium_elf_phdr_t *phdrs = loader->phdrs;
+	fs_read_range_t *ranges __cleanup_free;
+	size_t count;
+	bool more;
+	status_t ret;
 
+	/* Read in all the note segments together, in a single pass over the file. */
+	ranges = malloc((ehdr->e_phnum + 1) * sizeof(*ranges));
+	count = 0;
 	for (size_t i = 0; i < ehdr->e_phnum; i++) {
-		char *buf __cleanup_free = NULL;
-		size_t offset;
-		status_t ret;
-
-		if (phdrs[i].p_type != ELF_PT_NOTE)
+		if (phdrs[i].p_type != ELF_PT_NOTE || !phdrs[i].p_filesz)
 			continue;
 
-		buf = malloc(phdrs[i].p_filesz);
+		ranges[count].buf = malloc(phdrs[i].p_filesz);
+		ranges[count].count = phdrs[i].p_filesz;
+		ranges[count].offset = phdrs[i].p_offset;
+		count++;
+	}
+
+	ret = fs_read_ranges(loader->handle, ranges, count);
 
-		ret = fs_read(loader->handle, buf, phdrs[i].p_filesz, phdrs[i].p_offset);
-		if (ret != STATUS_SUCCESS)
-			return ret;
+	more = true;
+	for (size_t i = 0; i < count && more && ret == STATUS_SUCCESS; i++) {
+		char *buf = ranges[i].buf;
+		size_t offset = 0;
 
-		offset = 0;
-		while (offset < phdrs[i].p_filesz) {
+		while (more && offset < ranges[i].count) {
 			elf_note_t *note;
 			const char *name;
 			void *desc;
 
 			note = (elf_note_t*)(buf + offset);
 			offset += sizeof(elf_note_t);
-			if (offset >= phdrs[i].p_filesz)
-				return STATUS_MALFORMED_IMAGE;
+			if (offset >= ranges[i].count) {
+				ret = STATUS_MALFORMED_IMAGE;
+				break;
+			}
 
 			name = (const char*)(buf + offset);
 			offset += round_up(note->n_namesz, 4);
-			if (offset > phdrs[i].p_filesz)
-				return STATUS_MALFORMED_IMAGE;
+			if (offset > ranges[i].count) {
+				ret = STATUS_MALFORMED_IMAGE;
+				break;
+			}
 
 			desc = buf + offset;
 			offset += round_up(note->n_descsz, 4);
-			if (offset > phdrs[i].p_filesz)
-				return STATUS_MALFORMED_IMAGE;
-
-			if (strcmp(name, INITIUM_NOTE_NAME) == 0) {
-				if (!cb(loader, note, desc))
-					return STATUS_SUCCESS;
+			if (offset > ranges[i].count) {
+				ret = STATUS_MALFORMED_IMAGE;
+				break;
 			}
+
+			if (strcmp(name, INITIUM_NOTE_NAME) == 0)
+				more = cb(loader, note, desc);
 		}
 	}
 
-	return STATUS_SUCCESS;
+	for (size_t i = 0; i < count; i++)
+		free(ranges[i].buf);
+
+	return ret;
 }
 
 /** Load the kernel image. */
@@ -119,7 +127,10 @@ static void FUNC(load_kernel)(initium_loader_t * loader) {
 	initium_elf_ehdr_t *ehdr = loader->ehdr;
 	initium_elf_phdr_t *phdrs = loader->phdrs;
 	initium_elf_addr_t virt_base, virt_end;
+	fs_read_range_t *ranges;
 	void *load_base;
+	size_t count;
+	status_t ret;
 
 	/* Unless the kernel has a fixed load address, we allocate a single block of
 	 * physical memory to load at. This means that the offsets between segments
@@ -139,11 +150,15 @@ static void FUNC(load_kernel)(initium_loader_t * loader) {
 		load_base = allocate_kernel(loader, virt_base, virt_end);
 	}
 
-	/* Load in the image data. */
+	/* Allocate space for each segment and work out what needs to be read. The
+	 * data is read afterwards in order of file offset, so that a compressed
+	 * image only needs to be decompressed once. Leave space for a range for
+	 * each gap between the segments as well. */
+	ranges = malloc(((ehdr->e_phnum * 2) + 1) * sizeof(*ranges));
+	count = 0;
 	for (size_t i = 0; i < ehdr->e_phnum; i++) {
 		if (phdrs[i].p_type == ELF_PT_LOAD) {
 			void *dest;
-			status_t ret;
 
 			// ignore empty segments
 			if (!phdrs[i].p_memsz) {
@@ -158,10 +173,10 @@ static void FUNC(load_kernel)(initium_loader_t * loader) {
 			}
 
 			if (phdrs[i].p_filesz) {
-				ret = fs_read(loader->handle, dest, phdrs[i].p_filesz, phdrs[i].p_offset);
-				if (ret != STATUS_SUCCESS) {
-					boot_error("Error reading kernel image: %pS", ret);
-				}
+				ranges[count].buf = dest;
+				ranges[count].count = phdrs[i].p_filesz;
+				ranges[count].offset = phdrs[i].p_offset;
+				count++;
 			}
 
 			// Clear zero-initialized sections.
@@ -169,6 +184,42 @@ static void FUNC(load_kernel)(initium_loader_t * loader) {
 		}
 	}
 
+	/* Which sections load_sections() needs is not known until the section
+	 * headers have been read, and they are normally at the end of the image
+	 * after the section data. So that the image is still read in one pass,
+	 * everything that is not part of a segment is read into a temporary
+	 * buffer as well, and load_sections() copies what it needs out of the
+	 * ranges afterwards. This is skipped if the buffer would be unreasonably
+	 * large (e.g. an unstripped kernel) or cannot be allocated, in which case
+	 * load_sections() reads what it needs itself. */
+	loader->image_ranges = NULL;
+	loader->section_buf = NULL;
+	loader->section_buf_size = 0;
+	if (loader->image->flags & INITIUM_IMAGE_SECTIONS && ehdr->e_shnum) {
+		size_t size = fs_add_gap_ranges(ranges, &count, loader->handle->size, NULL);
+
+		if (size && size <= SECTION_BUF_MAX) {
+			loader->section_buf = memory_alloc(
+				round_up(size, PAGE_SIZE), 0, 0, 0, MEMORY_TYPE_INTERNAL,
+				MEMORY_ALLOC_HIGH | MEMORY_ALLOC_CAN_FAIL, NULL);
+		}
+
+		if (!size || loader->section_buf) {
+			loader->section_buf_size = size;
+			fs_add_gap_ranges(ranges, &count, loader->handle->size, loader->section_buf);
+
+			loader->image_ranges = ranges;
+			loader->image_range_count = count;
+		}
+	}
+
+	ret = fs_read_ranges(loader->handle, ranges, count);
+	if (ret != STATUS_SUCCESS)
+		boot_error("Error reading kernel image: %pS", ret);
+
+	if (!loader->image_ranges)
+		free(ranges);
+
 	loader->entry = ehdr->e_entry;
 }
 
@@ -176,7 +227,8 @@ static void FUNC(load_kernel)(initium_loader_t * loader) {
 static void FUNC(load_sections)(initium_loader_t * loader) {
 	initium_elf_ehdr_t *ehdr = loader->ehdr;
 	initium_tag_sections_t *tag;
-	size_t size;
+	fs_read_range_t *ranges __cleanup_free = NULL;
+	size_t size, count;
 	status_t ret;
 
 	size = ehdr->e_shnum * ehdr->e_shentsize;
@@ -186,12 +238,19 @@ static void FUNC(load_sections)(initium_loader_t * loader) {
 	tag->entsize = ehdr->e_shentsize;
 	tag->shstrndx = ehdr->e_shstrndx;
 
-	/* Read the section headers into the tag. */
-	ret = fs_read(loader->handle, tag->sections, size, ehdr->e_shoff);
+	/* Normally the whole image has already been read by load_kernel(),
+	 * otherwise read the headers, then the data in order of offset. */
+	if (!loader->image_ranges)
+		ranges = malloc((ehdr->e_shnum + 1) * sizeof(*ranges));
+
+	count = 0;
+	read_section_data(loader, tag->sections, size, ehdr->e_shoff, ranges, &count);
+	ret = fs_read_ranges(loader->handle, ranges, count);
 	if (ret != STATUS_SUCCESS)
 		boot_error("Error reading kernel sections: %pS", ret);
 
 	/* Iterate through the headers and load in additional loadable sections. */
+	count = 0;
 	for (size_t i = 0; i < ehdr->e_shnum; i++) {
 		initium_elf_shdr_t *shdr = (initium_elf_shdr_t*)&tag->sections[i * ehdr->e_shentsize];
 		size_t align;
@@ -223,11 +282,21 @@ static void FUNC(load_sections)(initium_loader_t * loader) {
 		if (shdr->sh_type == ELF_SHT_NOBITS) {
 			memset(dest, 0, shdr->sh_size);
 		} else {
-			ret = fs_read(loader->handle, dest, shdr->sh_size, shdr->sh_offset);
-			if (ret != STATUS_SUCCESS)
-				boot_error("Error reading kernel sections: %pS", ret);
+			read_section_data(loader, dest, shdr->sh_size, shdr->sh_offset, ranges, &count);
 		}
 	}
+
+	ret = fs_read_ranges(loader->handle, ranges, count);
+	if (ret != STATUS_SUCCESS)
+		boot_error("Error reading kernel sections: %pS", ret);
+
+	if (loader->section_buf) {
+		memory_free(loader->section_buf, round_up(loader->section_buf_size, PAGE_SIZE));
+		loader->section_buf = NULL;
+	}
+
+	free(loader->image_ranges);
+	loader->image_ranges = NULL;
 }
 
 #undef initium_elf_ehdr_t
@@ -27,6 +27,7 @@
  * @brief               Memory management functions.
  */
 
+#include <lib/avl_tree.h>
 #include <lib/list.h>
 #include <lib/printf.h>
 #include <lib/string.h>
@@ -36,88 +37,715 @@
 #include <config.h>
 #include <loader.h>
 #include <memory.h>
+#include <mmu.h>
+#include <numa.h>
+
+/*
+ * The heap is a segregated-fit allocator. Free chunks are kept on size class
+ * lists, with two levels of classes: the first level is the power of 2 below
+ * the size, and the second level divides each of these into HEAP_SL_COUNT
+ * linear steps. A bitmap of non-empty lists allows a suitable free chunk to be
+ * found without searching. Every chunk has a boundary tag recording the size of
+ * the previous chunk, so that free() can coalesce with both neighbours in
+ * constant time.
+ *
+ * Small allocations, which make up most of the loader's allocations (list
+ * entries, values, names, etc.), are instead made from slabs of fixed size
+ * objects. Slabs are themselves allocated from the heap, aligned to their
+ * size, and a map of what each HEAP_SLOT_SIZE part of the heap is used for
+ * lets free() tell whether an address is a slab object. Blocks used by
+ * arena allocators (see arena_create()) are recorded in the same way.
+ *
+ * The heap starts out as a small static area, which is enough to get the
+ * memory manager going. Once memory_alloc() is usable, further areas are
+ * allocated from it as internal memory, so they are reclaimed along with the
+ * rest of the loader's memory by memory_finalize(). Area sizes grow
+ * geometrically to keep the number of areas low.
+ */
 
-/** Structure representing an area on the heap. */
+/** Header for a chunk on the heap. */
 typedef struct heap_chunk {
-	list_t header;                  /**< Link to chunk list. */
-	size_t size;                    /**< Size of chunk including struct. */
-	bool allocated;                 /**< Whether the chunk is allocated. */
+	size_t prev_size;               /**< Size of previous chunk (0 if first). */
+	size_t size;                    /**< Size of chunk including header, and flags. */
 } heap_chunk_t;
 
-/** Size of the heap (128KB). */
-#define HEAP_SIZE       131072
+/** Flag set in the chunk size if the chunk is allocated. */
+#define HEAP_CHUNK_ALLOCATED    (1<<0)
+
+/** Structure of a free chunk. */
+typedef struct heap_free_chunk {
+	heap_chunk_t chunk;             /**< Chunk header. */
+	list_t header;                  /**< Link to size class list. */
+} heap_free_chunk_t;
+
+/** Heap area header. */
+typedef struct heap_area {
+	list_t header;                  /**< Link to area list. */
+	size_t size;                    /**< Total size of the area. */
+	uint8_t slots[];                /**< Type of each slot in the area. */
+} heap_area_t;
+
+/** Heap slot types. */
+#define HEAP_SLOT_CHUNK         0       /**< Ordinary chunks. */
+#define HEAP_SLOT_SLAB          1       /**< Slab objects. */
+#define HEAP_SLOT_ARENA         2       /**< Arena allocator block. */
+
+/** Arena allocator block header. */
+typedef struct arena_block {
+	list_t header;                  /**< Link to the arena's block list. */
+	size_t size;                    /**< Total size of the block. */
+	size_t offset;                  /**< Offset of free space in the block. */
+} arena_block_t;
+
+/** Arena allocator. */
+struct arena {
+	list_t blocks;                  /**< List of blocks, current block last. */
+};
+
+/** Heap allocation call site statistics. */
+typedef struct heap_site {
+	void *addr;                     /**< Return address of the caller. */
+	unsigned count;                 /**< Number of allocations made. */
+	size_t size;                    /**< Total bytes requested. */
+} heap_site_t;
+
+/** Heap slab header. */
+typedef struct heap_slab {
+	list_t header;                  /**< Link to partial slab list. */
+	uint64_t free;                  /**< Bitmap of free objects. */
+	uint8_t cache;                  /**< Index of the cache the slab belongs to. */
+} heap_slab_t;
+
+/** Size of the initial static heap area (32KB). */
+#define HEAP_INITIAL_SIZE       32768
+
+/** Minimum size of areas added to the heap (64KB). */
+#define HEAP_AREA_MIN           65536
+
+/**
+ * Amount of free space to keep on the heap.
+ *
+ * The heap is grown before it runs out completely, because memory_alloc()
+ * itself needs heap space (the EFI implementation reads in the whole firmware
+ * memory map). Allocations made while growing, or while the physical memory
+ * map is being modified, come from this reserve.
+ */
+#define HEAP_RESERVE            16384
+
+/** Alignment of heap allocations. */
+#define HEAP_ALIGN              8
+
+/** Minimum size of a chunk (enough to hold free chunk information). */
+#define HEAP_MIN_CHUNK          round_up(sizeof(heap_free_chunk_t), HEAP_ALIGN)
+
+/** Size class list counts. */
+#define HEAP_FL_COUNT           32
+#define HEAP_SL_SHIFT           2
+#define HEAP_SL_COUNT           (1 << HEAP_SL_SHIFT)
+
+/** Granularity of the slot map. */
+#define HEAP_SLOT_SIZE          1024
+
+/** Slab parameters. */
+#define HEAP_SLAB_SIZE          HEAP_SLOT_SIZE
+#define HEAP_SLAB_MAX           64
+#define HEAP_SLAB_STEP          16
+#define HEAP_SLAB_CACHES        (HEAP_SLAB_MAX / HEAP_SLAB_STEP)
+#define HEAP_SLAB_OFFSET        round_up(sizeof(heap_slab_t), HEAP_SLAB_STEP)
+
+/** Statically allocated initial heap area. */
+static uint8_t heap_initial[HEAP_INITIAL_SIZE] __aligned(PAGE_SIZE);
+static LIST_DECLARE(heap_areas);
+
+/** Heap size tracking. */
+static size_t heap_total_size;
+static size_t heap_free_size;
+
+/** Heap statistics (see print_heap_stats()). */
+static size_t heap_peak_size;
+static size_t heap_chunk_count;
+static unsigned heap_area_count;
+static unsigned heap_malloc_count;
+static unsigned heap_realloc_count;
+static unsigned heap_free_count;
 
-/** Statically allocated heap. */
-static uint8_t heap[HEAP_SIZE] __aligned(PAGE_SIZE);
-static LIST_DECLARE(heap_chunks);
+#ifdef CONFIG_DEBUG
+
+/** Number of malloc() call sites to record statistics for. */
+#define HEAP_SITE_COUNT         32
+
+/** Per-call site statistics, plus a catch-all for when the table is full. */
+static heap_site_t heap_sites[HEAP_SITE_COUNT];
+static heap_site_t heap_other_sites;
+
+#endif
+
+/** Growth state. */
+static unsigned heap_grow_blocked;
+static bool heap_finalized;
+
+/** Size class lists. */
+static list_t heap_lists[HEAP_FL_COUNT][HEAP_SL_COUNT];
+static uint32_t heap_fl_bitmap;
+static uint8_t heap_sl_bitmap[HEAP_FL_COUNT];
+
+/** Slab caches. */
+static list_t heap_slab_caches[HEAP_SLAB_CACHES];
+
+/** Size of arena blocks (the minimum, larger allocations get larger blocks). */
+#define ARENA_BLOCK_SIZE        4096
+
+/** Size of the header before each arena allocation (holds the size). */
+#define ARENA_HEADER_SIZE       round_up(sizeof(size_t), HEAP_ALIGN)
+
+/** Arena that malloc() currently allocates from. */
+static arena_t *current_arena;
+
+static void print_heap_stats(printf_t func);
+
+/** Physical allocation statistics. */
+static phys_size_t memory_type_size[MEMORY_TYPE_INTERNAL + 1];
+static phys_size_t memory_alloc_size;
+static phys_size_t memory_peak_size;
+static unsigned memory_alloc_count;
+static unsigned memory_free_count;
 
 #ifndef TARGET_HAS_MM
 
 /** List of physical memory ranges. */
 static LIST_DECLARE(memory_ranges);
 
+static void memory_tree_augment(avl_tree_node_t *node);
+
+/** Tree of physical memory ranges, indexing the list by address. */
+static AVL_TREE_DECLARE(memory_tree, memory_tree_augment);
+
 #endif /* TARGET_HAS_MM */
 
 /**
  * Heap allocator.
  */
 
-/**
- * Allocate memory from the heap.
- *
- * Allocates temporary memory from the heap. This memory will never reach the
- * kernel. An internal error will be raised if the heap is full.
- *
- * @param size          Size of allocation to make.
+/** Get the size of a heap chunk.
+ * @param chunk         Chunk to get size of.
+ * @return              Size of the chunk. */
+static inline size_t heap_chunk_size(heap_chunk_t *chunk)
+{
+	return chunk->size & ~(size_t)(HEAP_ALIGN - 1);
+}
+
+/** Get the chunk following a heap chunk.
+ * @param chunk         Chunk to get the next chunk of.
+ * @return              Following chunk. */
+static inline heap_chunk_t *heap_chunk_next(heap_chunk_t *chunk)
+{
+	return (heap_chunk_t *)((char *)chunk + heap_chunk_size(chunk));
+}
+
+/** Get the index of the highest bit set in a size.
+ * @param size          Size (must be non-zero).
+ * @return              Index of highest bit set. */
+static inline unsigned heap_highbit(size_t size)
+{
+	return (sizeof(long) * 8) - 1 - __builtin_clzl(size);
+}
+
+/** Get the size class lists for a chunk size.
+ * @param size          Size of the chunk.
+ * @param _fl           Where to store first level index.
+ * @param _sl           Where to store second level index. */
+static inline void heap_size_class(size_t size, unsigned *_fl, unsigned *_sl)
+{
+	unsigned fl = heap_highbit(size);
+
+	*_sl = (size >> (fl - HEAP_SL_SHIFT)) & (HEAP_SL_COUNT - 1);
+	*_fl = min(fl, HEAP_FL_COUNT - 1);
+}
+
+/** Add a chunk to its size class list.
+ * @param chunk         Chunk to add (must not be adjacent to other free chunks). */
+static void heap_insert_free(heap_chunk_t *chunk)
+{
+	heap_free_chunk_t *entry = (heap_free_chunk_t *)chunk;
+	unsigned fl, sl;
+
+	heap_size_class(heap_chunk_size(chunk), &fl, &sl);
+
+	list_init(&entry->header);
+	list_append(&heap_lists[fl][sl], &entry->header);
+	heap_free_size += heap_chunk_size(chunk);
+	heap_fl_bitmap |= (1u << fl);
+	heap_sl_bitmap[fl] |= (1 << sl);
+}
+
+/** Remove a chunk from its size class list.
+ * @param chunk         Chunk to remove. */
+static void heap_remove_free(heap_chunk_t *chunk)
+{
+	heap_free_chunk_t *entry = (heap_free_chunk_t *)chunk;
+	unsigned fl, sl;
+
+	list_remove(&entry->header);
+	heap_free_size -= heap_chunk_size(chunk);
+
+	heap_size_class(heap_chunk_size(chunk), &fl, &sl);
+	if (list_empty(&heap_lists[fl][sl])) {
+		heap_sl_bitmap[fl] &= ~(1 << sl);
+		if (!heap_sl_bitmap[fl])
+			heap_fl_bitmap &= ~(1u << fl);
+	}
+}
+
+/** Free a chunk, coalescing it with adjacent free chunks.
+ * @param chunk         Chunk to free (must not be marked as allocated). */
+static void heap_release(heap_chunk_t *chunk)
+{
+	heap_chunk_t *adj;
+	size_t size;
+
+	size = heap_chunk_size(chunk);
+
+	adj = heap_chunk_next(chunk);
+	if (!(adj->size & HEAP_CHUNK_ALLOCATED)) {
+		heap_remove_free(adj);
+		size += heap_chunk_size(adj);
+	}
+
+	if (chunk->prev_size) {
+		adj = (heap_chunk_t *)((char *)chunk - chunk->prev_size);
+		if (!(adj->size & HEAP_CHUNK_ALLOCATED)) {
+			heap_remove_free(adj);
+			size += heap_chunk_size(adj);
+			chunk = adj;
+		}
+	}
+
+	chunk->size = size;
+	heap_chunk_next(chunk)->prev_size = size;
+	heap_insert_free(chunk);
+}
+
+/** Free an allocated chunk.
+ * @param chunk         Chunk to free. */
+static void heap_free_chunk(heap_chunk_t *chunk)
+{
+	chunk->size &= ~HEAP_CHUNK_ALLOCATED;
+	heap_chunk_count--;
+	heap_release(chunk);
+}
+
+/** Shrink a chunk, freeing the remainder if large enough.
+ * @param chunk         Chunk to shrink.
+ * @param total         New total size of the chunk. */
+static void heap_shrink(heap_chunk_t *chunk, size_t total)
+{
+	size_t size = heap_chunk_size(chunk);
+	heap_chunk_t *rem;
+
+	if (size - total < HEAP_MIN_CHUNK)
+		return;
+
+	rem = (heap_chunk_t *)((char *)chunk + total);
+	rem->prev_size = total;
+	rem->size = size - total;
+	heap_chunk_next(rem)->prev_size = rem->size;
+	chunk->size = total | (chunk->size & HEAP_CHUNK_ALLOCATED);
+
+	heap_release(rem);
+}
+
+/** Find a free chunk of at least the given size.
+ * @param size          Required chunk size.
+ * @return              Pointer to chunk, or NULL if none found. */
+static heap_chunk_t *heap_find_free(size_t size)
+{
+	unsigned fl, sl;
+	uint32_t map;
+
+	/* Look in the lists for the next size class up, which contain only
+	 * chunks that are large enough. */
+	heap_size_class(size + ((size_t)1 << (heap_highbit(size) - HEAP_SL_SHIFT)) - 1, &fl, &sl);
+	map = heap_sl_bitmap[fl] & (~0u << sl);
+	if (!map && fl + 1 < HEAP_FL_COUNT) {
+		map = heap_fl_bitmap & (~0u << (fl + 1));
+		if (map) {
+			fl = __builtin_ctz(map);
+			map = heap_sl_bitmap[fl];
+		}
+	}
+
+	if (map) {
+		sl = __builtin_ctz(map);
+		return &list_first(&heap_lists[fl][sl], heap_free_chunk_t, header)->chunk;
+	}
+
+	/* The size's own class may still contain a chunk large enough. This only
+	 * needs checking when the heap is almost full. */
+	heap_size_class(size, &fl, &sl);
+	list_foreach(&heap_lists[fl][sl], iter) {
+		heap_free_chunk_t *entry = list_entry(iter, heap_free_chunk_t, header);
+
+		if (heap_chunk_size(&entry->chunk) >= size)
+			return &entry->chunk;
+	}
+
+	return NULL;
+}
+
+/** Allocate a chunk from the heap.
+ * @param total         Total size of the chunk, including header.
+ * @param align         Alignment of the chunk data, or 0 for HEAP_ALIGN.
+ * @return              Pointer to allocated chunk, or NULL if heap is full. */
+static heap_chunk_t *heap_alloc_chunk(size_t total, size_t align)
+{
+	heap_chunk_t *chunk;
+
+	chunk = heap_find_free((align) ? total + align + HEAP_MIN_CHUNK : total);
+	if (!chunk)
+		return NULL;
+
+	heap_remove_free(chunk);
+	chunk->size |= HEAP_CHUNK_ALLOCATED;
+
+	/* Split off any space before the aligned address as a separate chunk. */
+	if (align) {
+		ptr_t data = (ptr_t)(chunk + 1);
+		ptr_t aligned = round_up(data, align);
+
+		if (aligned != data) {
+			heap_chunk_t *lead = chunk;
+
+			if (aligned - data < HEAP_MIN_CHUNK)
+				aligned += align;
+
+			chunk = (heap_chunk_t *)aligned - 1;
+			chunk->prev_size = aligned - data;
+			chunk->size = (heap_chunk_size(lead) - chunk->prev_size) | HEAP_CHUNK_ALLOCATED;
+			heap_chunk_next(chunk)->prev_size = heap_chunk_size(chunk);
+			lead->size = chunk->prev_size;
+			heap_insert_free(lead);
+		}
+	}
+
+	heap_shrink(chunk, total);
+
+	heap_chunk_count++;
+	heap_peak_size = max(heap_peak_size, heap_total_size - heap_free_size);
+	return chunk;
+}
+
+/** Find the heap area containing an address.
+ * @param addr          Address to look up.
+ * @return              Area containing the address, or NULL if not found. */
+static heap_area_t *heap_find_area(const void *addr)
+{
+	/* Most recently added areas are the largest, so check them first. */
+	list_foreach_reverse(&heap_areas, iter) {
+		heap_area_t *area = list_entry(iter, heap_area_t, header);
+
+		if ((uint8_t *)addr >= (uint8_t *)area && (uint8_t *)addr < (uint8_t *)area + area->size)
+			return area;
+	}
+
+	return NULL;
+}
+
+/** Get the slot type of an address.
+ * @param addr          Address to check.
+ * @return              Slot type (HEAP_SLOT_CHUNK if not on the heap). */
+static inline uint8_t heap_slot_type(const void *addr)
+{
+	heap_area_t *area = heap_find_area(addr);
+
+	if (!area)
+		return HEAP_SLOT_CHUNK;
+
+	return area->slots[((uint8_t *)addr - (uint8_t *)area) / HEAP_SLOT_SIZE];
+}
+
+/** Set the slot type for a range of the heap.
+ * @param addr          Start of the range (aligned to HEAP_SLOT_SIZE).
+ * @param size          Size of the range (multiple of HEAP_SLOT_SIZE).
+ * @param type          Type to set. */
+static void heap_set_slots(void *addr, size_t size, uint8_t type)
+{
+	heap_area_t *area = heap_find_area(addr);
+	size_t index = ((uint8_t *)addr - (uint8_t *)area) / HEAP_SLOT_SIZE;
+
+	memset(&area->slots[index], type, size / HEAP_SLOT_SIZE);
+}
+
+/** Allocate an object from a slab cache.
+ * @param size          Size of the allocation (at most HEAP_SLAB_MAX).
+ * @return              Pointer to allocation, or NULL if heap is full. */
+static void *heap_slab_alloc(size_t size)
+{
+	unsigned cache = (size - 1) / HEAP_SLAB_STEP;
+	size_t obj_size = (cache + 1) * HEAP_SLAB_STEP;
+	heap_slab_t *slab;
+	unsigned index;
+
+	if (list_empty(&heap_slab_caches[cache])) {
+		heap_chunk_t *chunk;
+		size_t count;
+
+		chunk = heap_alloc_chunk(HEAP_SLAB_SIZE + sizeof(heap_chunk_t), HEAP_SLAB_SIZE);
+		if (!chunk)
+			return NULL;
+
+		slab = (heap_slab_t *)(chunk + 1);
+		count = (HEAP_SLAB_SIZE - HEAP_SLAB_OFFSET) / obj_size;
+		slab->free = (count < 64) ? ((uint64_t)1 << count) - 1 : ~(uint64_t)0;
+		slab->cache = cache;
+		list_init(&slab->header);
+		list_append(&heap_slab_caches[cache], &slab->header);
+		heap_set_slots(slab, HEAP_SLAB_SIZE, HEAP_SLOT_SLAB);
+	} else {
+		slab = list_first(&heap_slab_caches[cache], heap_slab_t, header);
+	}
+
+	/* Avoid __builtin_ctzll(), it needs libgcc on 32-bit. */
+	index = ((uint32_t)slab->free)
+		? __builtin_ctz((uint32_t)slab->free)
+		: 32 + __builtin_ctz((uint32_t)(slab->free >> 32));
+	slab->free &= ~((uint64_t)1 << index);
+
+	/* Full slabs are not kept on the list. */
+	if (!slab->free)
+		list_remove(&slab->header);
+
+	return (uint8_t *)slab + HEAP_SLAB_OFFSET + (index * obj_size);
+}
+
+/** Free an object to its slab cache.
+ * @param addr          Address of the object. */
+static void heap_slab_free(void *addr)
+{
+	heap_slab_t *slab = (heap_slab_t *)round_down((ptr_t)addr, HEAP_SLAB_SIZE);
+	size_t obj_size = (slab->cache + 1) * HEAP_SLAB_STEP;
+	size_t offset = (uint8_t *)addr - (uint8_t *)slab - HEAP_SLAB_OFFSET;
+	size_t count = (HEAP_SLAB_SIZE - HEAP_SLAB_OFFSET) / obj_size;
+	uint64_t bit = (uint64_t)1 << (offset / obj_size);
+	uint64_t all = (count < 64) ? ((uint64_t)1 << count) - 1 : ~(uint64_t)0;
+
+	if (slab->free & bit)
+		internal_error("Double free on address %p", addr);
+
+	if (!slab->free)
+		list_append(&heap_slab_caches[slab->cache], &slab->header);
+
+	slab->free |= bit;
+
+	/* Return empty slabs to the heap, unless it is the only partial slab for
+	 * this cache, to avoid repeatedly creating and destroying a slab. */
+	if (slab->free == all && !list_is_singular(&heap_slab_caches[slab->cache])) {
+		heap_chunk_t *chunk = (heap_chunk_t *)slab - 1;
+
+		list_remove(&slab->header);
+		heap_set_slots(slab, HEAP_SLAB_SIZE, HEAP_SLOT_CHUNK);
+		heap_free_chunk(chunk);
+	}
+}
+
+/** Add an area to the heap.
+ * @param base          Base of the area (page-aligned).
+ * @param size          Size of the area (multiple of PAGE_SIZE). */
+static void heap_add_area(void *base, size_t size)
+{
+	heap_area_t *area = base;
+	heap_chunk_t *chunk, *end;
+	size_t offset;
+
+	memset(area->slots, HEAP_SLOT_CHUNK, size / HEAP_SLOT_SIZE);
+	area->size = size;
+	list_init(&area->header);
+	list_append(&heap_areas, &area->header);
+
+	/* Create the initial free chunk, and an allocated chunk at the end to stop
+	 * coalescing from going past the end of the area. */
+	offset = round_up(sizeof(*area) + (size / HEAP_SLOT_SIZE), HEAP_ALIGN);
+	chunk = (heap_chunk_t *)((uint8_t *)base + offset);
+	chunk->prev_size = 0;
+	chunk->size = size - offset - sizeof(heap_chunk_t);
+
+	end = heap_chunk_next(chunk);
+	end->prev_size = chunk->size;
+	end->size = HEAP_CHUNK_ALLOCATED;
+
+	heap_insert_free(chunk);
+	heap_total_size += size;
+	heap_area_count++;
+}
+
+/** Initialize the heap. */
+static void heap_init(void)
+{
+	for (size_t i = 0; i < HEAP_FL_COUNT; i++) {
+		for (size_t j = 0; j < HEAP_SL_COUNT; j++)
+			list_init(&heap_lists[i][j]);
+	}
+
+	for (size_t i = 0; i < HEAP_SLAB_CACHES; i++)
+		list_init(&heap_slab_caches[i]);
+
+	heap_add_area(heap_initial, HEAP_INITIAL_SIZE);
+}
+
+/** Try to add a new area to the heap.
+ * @param size          Size of the allocation that the area must be able to
+ *                      satisfy (0 if growing to maintain the reserve).
+ * @return              Whether the heap was grown. */
+static bool heap_grow(size_t size)
+{
+	size_t area_size;
+	arena_t *arena;
+	void *base;
+
+	if (heap_grow_blocked || heap_finalized)
+		return false;
+
+	/* Leave plenty of space for the area header and size class rounding. */
+	area_size = max(heap_total_size, HEAP_AREA_MIN);
+	area_size = round_up(max(area_size, (size * 2) + PAGE_SIZE), PAGE_SIZE);
+
+	/* This can fail before the memory manager is initialized, in which case
+	 * we must make do with what we have. Allocate high to keep the memory
+	 * that kernels are likely to want to be loaded at clear. The memory
+	 * manager's own bookkeeping must come from the heap even if an arena is
+	 * current, as it outlives the arena. */
+	heap_grow_blocked++;
+	arena = arena_set_current(NULL);
+	base = memory_alloc(
+		area_size, 0, 0, 0, MEMORY_TYPE_INTERNAL,
+		MEMORY_ALLOC_HIGH | MEMORY_ALLOC_CAN_FAIL, NULL);
+	arena_set_current(arena);
+	heap_grow_blocked--;
+
+	if (!base)
+		return false;
+
+	heap_add_area(base, area_size);
+	return true;
+}
+
+/** Check whether an address is the base of a heap area.
+ * @param addr          Address to check.
+ * @return              Whether the address is the base of a heap area. */
+bool heap_is_area(const void *addr)
+{
+	return heap_find_area(addr) == addr;
+}
+
+/** Stop the heap from growing any further.
  *
- * @return              Address of allocation.
+ * Called when the memory map is finalized: areas allocated after that would
+ * not be reflected in the final memory map, and on EFI, boot services are
+ * about to go away.
  */
-void *malloc(size_t size)
+void heap_finalize(void)
 {
-	heap_chunk_t *chunk = NULL, *new;
-	size_t total;
+	if (!heap_finalized) {
+		dprintf("memory: allocation statistics:\n");
+		print_heap_stats(dprintf);
+	}
 
-	if (size == 0)
-		internal_error("Zero-sized allocation!");
+	heap_finalized = true;
+}
 
-	/* Align all allocations to 8 bytes. */
-	size = round_up(size, 8);
-	total = size + sizeof(heap_chunk_t);
-
-	/* Create the initial free segment if necessary. */
-	if (list_empty(&heap_chunks)) {
-		chunk = (heap_chunk_t*)heap;
-		chunk->size = HEAP_SIZE;
-		chunk->allocated = false;
-		list_init(&chunk->header);
-		list_append(&heap_chunks, &chunk->header);
-	} else {
-		/* Search for a free chunk. */
-		list_foreach(&heap_chunks, iter) {
-			chunk = list_entry(iter, heap_chunk_t, header);
-			if (!chunk->allocated && chunk->size >= total)
-				break;
-			else
-				chunk = NULL;
+/** Get the total chunk size needed for an allocation.
+ * @param size          Size of the allocation.
+ * @return              Total chunk size. */
+static inline size_t heap_chunk_total(size_t size)
+{
+	return max(round_up(size, HEAP_ALIGN) + sizeof(heap_chunk_t), HEAP_MIN_CHUNK);
+}
+
+/** Prepare the heap for an allocation. */
+static inline void heap_prepare(void)
+{
+	if (list_empty(&heap_areas))
+		heap_init();
+
+	if (heap_free_size < HEAP_RESERVE)
+		heap_grow(0);
+}
+
+/** Allocate from the heap, growing it if necessary.
+ * @param size          Size of allocation to make.
+ * @return              Address of allocation. */
+static void *heap_alloc(size_t size)
+{
+	void *ret;
+
+	heap_prepare();
+
+	while (true) {
+		if (size <= HEAP_SLAB_MAX) {
+			ret = heap_slab_alloc(size);
+		} else {
+			heap_chunk_t *chunk = heap_alloc_chunk(heap_chunk_total(size), 0);
+			ret = (chunk) ? chunk + 1 : NULL;
 		}
 
-		if (!chunk)
+		if (ret)
+			return ret;
+
+		if (!heap_grow(max(size, HEAP_SLAB_SIZE * 2)))
 			internal_error("Exhausted heap space (want %zu bytes)", size);
 	}
+}
 
-	/* Resize the segment if it is too big. There must be space for a second
-	 * chunk header afterwards. */
-	if (chunk->size >= (total + sizeof(heap_chunk_t))) {
-		new = (heap_chunk_t*)((char*)chunk + total);
-		new->size = chunk->size - total;
-		new->allocated = false;
-		list_init(&new->header);
-		list_add_after(&chunk->header, &new->header);
-		chunk->size = total;
+/** Record an allocation against its call site.
+ * @param size          Size of allocation.
+ * @param site          Return address of the caller. */
+static void heap_record_site(size_t size, void *site)
+{
+#ifdef CONFIG_DEBUG
+	heap_site_t *entry = &heap_other_sites;
+
+	for (size_t i = 0; i < HEAP_SITE_COUNT; i++) {
+		if (heap_sites[i].addr == site || !heap_sites[i].addr) {
+			entry = &heap_sites[i];
+			entry->addr = site;
+			break;
+		}
 	}
 
-	chunk->allocated = true;
-	return (char*)chunk + sizeof(heap_chunk_t);
+	entry->count++;
+	entry->size += size;
+#endif
+}
+
+/** Allocate memory from the current arena or the heap.
+ * @param size          Size of allocation to make.
+ * @param site          Return address of the caller.
+ * @return              Address of allocation. */
+static void *heap_malloc(size_t size, void *site)
+{
+	if (size == 0)
+		internal_error("Zero-sized allocation!");
+
+	heap_malloc_count++;
+	heap_record_site(size, site);
+
+	return (current_arena) ? arena_alloc(current_arena, size) : heap_alloc(size);
+}
+
+/**
+ * Allocate memory from the heap.
+ *
+ * Allocates temporary memory from the heap. This memory will never reach the
+ * kernel. An internal error will be raised if the heap is full. If an arena
+ * has been made current with arena_set_current(), the memory is allocated
+ * from that instead.
+ *
+ * @param size          Size of allocation to make.
+ *
+ * @return              Address of allocation.
+ */
+void *malloc(size_t size)
+{
+	return heap_malloc(size, __builtin_return_address(0));
 }
 
 /** Resize a memory allocation.
@@ -126,70 +754,372 @@ void *malloc(size_t size)
  * @return              Address of new allocation, or NULL if size is 0. */
 void *realloc(void *addr, size_t size)
 {
-	heap_chunk_t *chunk;
+	heap_chunk_t *chunk, *next;
+	size_t total, old_size;
 	void *new;
 
 	if (size == 0) {
 		free(addr);
 		return NULL;
-	} else {
-		size = round_up(size, 8);
+	} else if (!addr) {
+		return heap_malloc(size, __builtin_return_address(0));
+	}
 
-		if (addr) {
-			chunk = (heap_chunk_t*)((char*)addr - sizeof(heap_chunk_t));
-			if (chunk->size - sizeof(heap_chunk_t) == size)
-				return addr;
+	heap_realloc_count++;
+
+	switch (heap_slot_type(addr)) {
+	case HEAP_SLOT_SLAB:
+		old_size = (((heap_slab_t *)round_down((ptr_t)addr, HEAP_SLAB_SIZE))->cache + 1) * HEAP_SLAB_STEP;
+		if (size <= old_size)
+			return addr;
+
+		break;
+	case HEAP_SLOT_ARENA:
+		old_size = *(size_t *)((uint8_t *)addr - ARENA_HEADER_SIZE);
+		if (size <= old_size)
+			return addr;
+
+		break;
+	default:
+		chunk = (heap_chunk_t *)addr - 1;
+		total = heap_chunk_total(size);
+		old_size = heap_chunk_size(chunk) - sizeof(heap_chunk_t);
+
+		/* Resize in place if shrinking or if the following chunk is free
+		 * and large enough to grow into. */
+		if (total <= heap_chunk_size(chunk)) {
+			heap_shrink(chunk, total);
+			return addr;
 		}
 
-		new = malloc(size);
-
-		if (addr) {
-			memcpy(new, addr, min(chunk->size - sizeof(heap_chunk_t), size));
-			free(addr);
+		next = heap_chunk_next(chunk);
+		if (!(next->size & HEAP_CHUNK_ALLOCATED) && heap_chunk_size(chunk) + heap_chunk_size(next) >= total) {
+			heap_remove_free(next);
+			chunk->size += heap_chunk_size(next);
+			heap_chunk_next(chunk)->prev_size = heap_chunk_size(chunk);
+			heap_shrink(chunk, total);
+			return addr;
 		}
 
-		return new;
+		break;
 	}
+
+	new = heap_malloc(size, __builtin_return_address(0));
+	memcpy(new, addr, min(old_size, size));
+	free(addr);
+	return new;
 }
 
-/** Free memory allocated with free().
- * @param addr          Address of allocation. */
+/**
+ * Free memory allocated with malloc().
+ *
+ * Frees memory allocated with malloc(). Memory that was allocated from an
+ * arena is left alone, it is freed when the arena is reset or destroyed. This
+ * means that data structures allocated in an arena can still be cleaned up
+ * with the usual functions, which will free anything allocated outside of the
+ * arena.
+ *
+ * @param addr          Address of allocation.
+ */
 void free(void *addr)
 {
-	heap_chunk_t *chunk, *adj;
+	heap_chunk_t *chunk;
 
 	if (!addr)
 		return;
 
-	/* Get the chunk and free it. */
-	chunk = (heap_chunk_t*)((char*)addr - sizeof(heap_chunk_t));
-	if (!chunk->allocated)
+	heap_free_count++;
+
+	switch (heap_slot_type(addr)) {
+	case HEAP_SLOT_SLAB:
+		heap_slab_free(addr);
+		return;
+	case HEAP_SLOT_ARENA:
+		return;
+	}
+
+	chunk = (heap_chunk_t *)addr - 1;
+	if (!(chunk->size & HEAP_CHUNK_ALLOCATED))
 		internal_error("Double free on address %p", addr);
-	chunk->allocated = false;
-
-	/* Coalesce adjacent free segments. */
-	if (chunk != list_last(&heap_chunks, heap_chunk_t, header)) {
-		adj = list_next(chunk, header);
-		if (!adj->allocated) {
-			assert(adj == (heap_chunk_t*)((char*)chunk + chunk->size));
-			chunk->size += adj->size;
-			list_remove(&adj->header);
-		}
+
+	heap_free_chunk(chunk);
+}
+
+/**
+ * Arena allocator.
+ */
+
+/** Add a block to an arena.
+ * @param arena         Arena to add to (NULL if creating the arena).
+ * @param size          Space required in the block.
+ * @return              Pointer to the block. */
+static arena_block_t *arena_add_block(arena_t *arena, size_t size)
+{
+	arena_block_t *block;
+	heap_chunk_t *chunk;
+
+	size = round_up(max(size + sizeof(*block), ARENA_BLOCK_SIZE), HEAP_SLOT_SIZE);
+
+	/* Blocks are slot-aligned so that free() can identify them. */
+	heap_prepare();
+	while (!(chunk = heap_alloc_chunk(size + sizeof(*chunk), HEAP_SLOT_SIZE))) {
+		if (!heap_grow(size + HEAP_SLOT_SIZE))
+			internal_error("Exhausted heap space (want %zu bytes)", size);
 	}
-	if (chunk != list_first(&heap_chunks, heap_chunk_t, header)) {
-		adj = list_prev(chunk, header);
-		if (!adj->allocated) {
-			assert(chunk == (heap_chunk_t*)((char*)adj + adj->size));
-			adj->size += chunk->size;
-			list_remove(&chunk->header);
-		}
+
+	block = (arena_block_t *)(chunk + 1);
+	block->size = size;
+	block->offset = sizeof(*block);
+	heap_set_slots(block, size, HEAP_SLOT_ARENA);
+
+	if (arena) {
+		list_init(&block->header);
+		list_append(&arena->blocks, &block->header);
 	}
+
+	return block;
+}
+
+/** Free an arena block.
+ * @param block         Block to free. */
+static void arena_free_block(arena_block_t *block)
+{
+	heap_chunk_t *chunk = (heap_chunk_t *)block - 1;
+
+	heap_set_slots(block, block->size, HEAP_SLOT_CHUNK);
+	heap_free_chunk(chunk);
+}
+
+/**
+ * Create an arena allocator.
+ *
+ * Creates an arena, from which many allocations can be made cheaply and then
+ * all released at once with arena_reset() or arena_destroy(). Use this for
+ * groups of allocations that share a lifetime.
+ *
+ * @return              Pointer to created arena.
+ */
+arena_t *arena_create(void)
+{
+	arena_block_t *block;
+	arena_t *arena;
+
+	/* The arena structure lives at the start of its first block. */
+	block = arena_add_block(NULL, sizeof(*arena));
+	arena = (arena_t *)((uint8_t *)block + block->offset);
+	block->offset += round_up(sizeof(*arena), HEAP_ALIGN);
+
+	list_init(&arena->blocks);
+	list_init(&block->header);
+	list_append(&arena->blocks, &block->header);
+	return arena;
+}
+
+/** Allocate memory from an arena.
+ * @param arena         Arena to allocate from.
+ * @param size          Size of allocation to make.
+ * @return              Address of allocation. */
+void *arena_alloc(arena_t *arena, size_t size)
+{
+	arena_block_t *block;
+	size_t total;
+	uint8_t *ret;
+
+	if (size == 0)
+		internal_error("Zero-sized allocation!");
+
+	total = round_up(size, HEAP_ALIGN) + ARENA_HEADER_SIZE;
+
+	block = list_last(&arena->blocks, arena_block_t, header);
+	if (block->size - block->offset < total)
+		block = arena_add_block(arena, total);
+
+	ret = (uint8_t *)block + block->offset;
+	block->offset += total;
+
+	*(size_t *)ret = size;
+	return ret + ARENA_HEADER_SIZE;
+}
+
+/** Free all allocations made from an arena.
+ * @param arena         Arena to reset. */
+void arena_reset(arena_t *arena)
+{
+	arena_block_t *first = list_first(&arena->blocks, arena_block_t, header);
+
+	while (!list_is_singular(&arena->blocks)) {
+		arena_block_t *block = list_last(&arena->blocks, arena_block_t, header);
+
+		list_remove(&block->header);
+		arena_free_block(block);
+	}
+
+	first->offset = sizeof(*first) + round_up(sizeof(*arena), HEAP_ALIGN);
+}
+
+/** Destroy an arena, freeing all allocations made from it.
+ * @param arena         Arena to destroy. */
+void arena_destroy(arena_t *arena)
+{
+	assert(arena != current_arena);
+
+	/* The last block to go contains the arena itself. */
+	while (!list_empty(&arena->blocks)) {
+		arena_block_t *block = list_last(&arena->blocks, arena_block_t, header);
+
+		list_remove(&block->header);
+		arena_free_block(block);
+	}
+}
+
+/**
+ * Set the arena that malloc() allocates from.
+ *
+ * While an arena is current, malloc() allocates from it rather than the heap.
+ * This allows an arena to be used with code that allocates through malloc(),
+ * but only use it around code whose allocations do not outlive the arena.
+ *
+ * @param arena         Arena to make current, or NULL to use the heap.
+ *
+ * @return              Previously current arena.
+ */
+arena_t *arena_set_current(arena_t *arena)
+{
+	arena_t *prev = current_arena;
+
+	current_arena = arena;
+	return prev;
 }
 
 /**
  * Physical memory manager.
+ *
+ * The memory map is a list of ranges sorted by address. The physical memory
+ * manager's own map (memory_ranges) is additionally indexed by an AVL tree
+ * keyed on the start address, and each node records the largest free range in
+ * its subtree. This lets memory_map_insert() find its place in the list, and
+ * memory_alloc() find the lowest or highest free range large enough for an
+ * allocation, without scanning the whole map. The tree is kept in sync with
+ * the list by the functions below, which do nothing for other maps.
  */
 
+#ifndef TARGET_HAS_MM
+
+/** Recompute the largest free range in a subtree of the range tree.
+ * @param node          Node to update. */
+static void memory_tree_augment(avl_tree_node_t *node)
+{
+	memory_range_t *range = avl_tree_entry(node, memory_range_t, tree_link);
+	memory_range_t *child;
+
+	range->max_free = (range->type == MEMORY_TYPE_FREE) ? range->size : 0;
+
+	child = avl_tree_entry(node->left, memory_range_t, tree_link);
+	if (child)
+		range->max_free = max(range->max_free, child->max_free);
+
+	child = avl_tree_entry(node->right, memory_range_t, tree_link);
+	if (child)
+		range->max_free = max(range->max_free, child->max_free);
+}
+
+#endif /* TARGET_HAS_MM */
+
+/** Get the range tree for a memory map.
+ * @param map           Memory map.
+ * @return              Tree indexing the map, or NULL if it is not indexed. */
+static inline avl_tree_t *map_tree(list_t *map)
+{
+	#ifndef TARGET_HAS_MM
+	if (map == &memory_ranges)
+		return &memory_tree;
+	#endif
+
+	return NULL;
+}
+
+/** Find the first range in a map starting at or after an address.
+ * @param map           Memory map to search.
+ * @param start         Address to search for.
+ * @return              Range found, or NULL if all ranges start before the
+ *                      address. */
+static memory_range_t *map_lower_bound(list_t *map, phys_ptr_t start)
+{
+	avl_tree_t *tree = map_tree(map);
+	memory_range_t *ret = NULL;
+
+	if (tree) {
+		avl_tree_node_t *node = tree->root;
+
+		while (node) {
+			memory_range_t *range = avl_tree_entry(node, memory_range_t, tree_link);
+
+			if (start <= range->start) {
+				ret = range;
+				node = node->left;
+			} else {
+				node = node->right;
+			}
+		}
+	} else {
+		list_foreach(map, iter) {
+			memory_range_t *range = list_entry(iter, memory_range_t, header);
+
+			if (start <= range->start)
+				return range;
+		}
+	}
+
+	return ret;
+}
+
+/** Add a range to a memory map's tree after inserting it in the list.
+ * @param map           Memory map.
+ * @param range         Range that has been inserted. */
+static void map_link(list_t *map, memory_range_t *range)
+{
+	avl_tree_t *tree = map_tree(map);
+	avl_tree_node_t **link, *parent = NULL;
+
+	if (!tree)
+		return;
+
+	link = &tree->root;
+	while (*link) {
+		parent = *link;
+		link = (range->start <= avl_tree_entry(parent, memory_range_t, tree_link)->start)
+			? &parent->left
+			: &parent->right;
+	}
+
+	avl_tree_insert(tree, &range->tree_link, parent, link);
+}
+
+/** Remove a range from a memory map and free it.
+ * @param map           Memory map.
+ * @param range         Range to remove. */
+static void map_unlink(list_t *map, memory_range_t *range)
+{
+	avl_tree_t *tree = map_tree(map);
+
+	if (tree)
+		avl_tree_remove(tree, &range->tree_link);
+
+	list_remove(&range->header);
+	free(range);
+}
+
+/** Update a memory map's tree after changing the size or type of a range.
+ * @param map           Memory map.
+ * @param range         Range that has changed. */
+static inline void map_changed(list_t *map, memory_range_t *range)
+{
+	avl_tree_t *tree = map_tree(map);
+
+	if (tree)
+		avl_tree_update(tree, &range->tree_link);
+}
+
 /** Merge adjacent ranges.
  * @param map           Memory map to add to.
  * @param range         Range to merge. */
@@ -205,8 +1135,8 @@ static inline void merge_ranges(list_t *maps, memory_range_t *range)
 		if (end == range->start && other->type == range->type) {
 			range->start = other->start;
 			range->size += other->size;
-			list_remove(&other->header);
-			free(other);
+			map_unlink(maps, other);
+			map_changed(maps, range);
 		}
 	}
 
@@ -216,8 +1146,8 @@ static inline void merge_ranges(list_t *maps, memory_range_t *range)
 
 		if (other->start == end && other->type == range->type) {
 			range->size += other->size;
-			list_remove(&other->header);
-			free(other);
+			map_unlink(maps, other);
+			map_changed(maps, range);
 		}
 	}
 }
@@ -236,6 +1166,10 @@ void memory_map_insert(list_t *map, phys_ptr_t start, phys_size_t size, uint8_t
 	assert(!(size % PAGE_SIZE));
 	assert(size);
 
+	/* The map may be inconsistent while it is being modified, so don't let
+	 * the heap try to grow (see heap_grow()). */
+	heap_grow_blocked++;
+
 	range = malloc(sizeof(*range));
 	list_init(&range->header);
 	range->start = start;
@@ -244,18 +1178,16 @@ void memory_map_insert(list_t *map, phys_ptr_t start, phys_size_t size, uint8_t
 
 	range_end = start + size - 1;
 
-	/* Try to find where to insert the region in the list. */
-	list_foreach(map, iter) {
-		other = list_entry(iter, memory_range_t, header);
-		if (start <= other->start) {
-			list_add_before(&other->header, &range->header);
-			break;
-		}
+	/* Find where to insert the region in the list. If it is not before any
+	 * existing range, it goes at the end of the list. */
+	other = map_lower_bound(map, start);
+	if (other) {
+		list_add_before(&other->header, &range->header);
+	} else {
+		list_append(map, &range->header);
 	}
 
-	/* Not before any existing range, goes at the end of the list. */
-	if (list_empty(&range->header))
-		list_append(map, &range->header);
+	map_link(map, range);
 
 	/* Check if the new range has overlapped part of the previous range. */
 	if (range != list_first(map, memory_range_t, header)) {
@@ -271,9 +1203,11 @@ void memory_map_insert(list_t *map, phys_ptr_t start, phys_size_t size, uint8_t
 				split->size = other_end - range_end;
 				split->type = other->type;
 				list_add_after(&range->header, &split->header);
+				map_link(map, split);
 			}
 
 			other->size = range->start - other->start;
+			map_changed(map, other);
 		}
 	}
 
@@ -291,16 +1225,43 @@ void memory_map_insert(list_t *map, phys_ptr_t start, phys_size_t size, uint8_t
 			/* Resize the range and finish. */
 			other->start = range_end + 1;
 			other->size = other_end - range_end;
+			map_changed(map, other);
 			break;
 		} else {
 			/* Completely remove the range. */
-			list_remove(&other->header);
-			free(other);
+			map_unlink(map, other);
 		}
 	}
 
 	/* Finally, merge the region with adjacent ranges of the same type. */
 	merge_ranges(map, range);
+
+	heap_grow_blocked--;
+}
+
+/** Get the name of a memory type.
+ * @param type          Type to get name of.
+ * @return              Name of the type. */
+static const char *memory_type_name(uint8_t type)
+{
+	switch (type) {
+	case MEMORY_TYPE_FREE:
+		return "Free";
+	case MEMORY_TYPE_ALLOCATED:
+		return "Allocated";
+	case MEMORY_TYPE_RECLAIMABLE:
+		return "Reclaimable";
+	case MEMORY_TYPE_PAGETABLES:
+		return "Pagetables";
+	case MEMORY_TYPE_STACK:
+		return "Stack";
+	case MEMORY_TYPE_MODULES:
+		return "Modules";
+	case MEMORY_TYPE_INTERNAL:
+		return "Internal";
+	default:
+		return "Unknown";
+	}
 }
 
 /**
@@ -310,7 +1271,7 @@ void memory_map_insert(list_t *map, phys_ptr_t start, phys_size_t size, uint8_t
  * @param func   Print function to use.
  * @param indent Indentation level.
  */
-void print_memory_map(list_t *map, printf_t func, size_t indent)
+static void print_memory_map(list_t *map, printf_t func, size_t indent)
 {
 	memory_range_t *range;
 
@@ -321,29 +1282,7 @@ void print_memory_map(list_t *map, printf_t func, size_t indent)
 			"%-*s0x%016" PRIxPHYS "-0x%016" PRIxPHYS " (%" PRIu64 " KiB) -> ",
 			indent, "", range->start, range->start + range->size, range->size / 1024);
 
-		switch (range->type) {
-		case MEMORY_TYPE_FREE:
-			func("Free\n");
-			break;
-		case MEMORY_TYPE_ALLOCATED:
-			func("Allocated\n");
-			break;
-		case MEMORY_TYPE_RECLAIMABLE:
-			func("Reclaimable\n");
-			break;
-		case MEMORY_TYPE_PAGETABLES:
-			func("Pagetables\n");
-			break;
-		case MEMORY_TYPE_STACK:
-			func("Stack\n");
-			break;
-		case MEMORY_TYPE_MODULES:
-			func("Modules\n");
-			break;
-		case MEMORY_TYPE_INTERNAL:
-			func("Internal\n");
-			break;
-		}
+		func("%s\n", memory_type_name(range->type));
 	}
 }
 
@@ -413,6 +1352,113 @@ static bool is_suitable_range(
 	return true;
 }
 
+/**
+ * Find a free range to satisfy an allocation.
+ *
+ * Searches a subtree of the range tree for the lowest (or highest, if
+ * MEMORY_ALLOC_HIGH is set) free range that can satisfy an allocation.
+ * Subtrees with no free range large enough, or that are entirely outside the
+ * allowed address range, are skipped.
+ *
+ * @param node          Root of the subtree to search.
+ * @param size          Size of the allocation.
+ * @param align         Alignment of the allocation.
+ * @param min_addr      Minimum address for the start of the allocated range.
+ * @param max_addr      Maximum address of the end of the allocated range.
+ * @param flags         Behaviour flags.
+ * @param _phys         Where to store address for allocation.
+ *
+ * @return              Range found, or NULL if none suitable.
+ */
+static memory_range_t *find_free_range(
+	avl_tree_node_t *node, phys_size_t size, phys_size_t align,
+	phys_ptr_t min_addr, phys_ptr_t max_addr, unsigned flags, phys_ptr_t *_phys)
+{
+	memory_range_t *range, *ret;
+	avl_tree_node_t *first, *second;
+	bool first_ok, second_ok;
+
+	range = avl_tree_entry(node, memory_range_t, tree_link);
+	if (!range || range->max_free < size)
+		return NULL;
+
+	/* Ranges in the left subtree are all below this one, and in the right
+	 * subtree all above. Search from the end that we prefer. */
+	if (flags & MEMORY_ALLOC_HIGH) {
+		first = node->right;
+		first_ok = max_addr > range->start + range->size - 1;
+		second = node->left;
+		second_ok = min_addr < range->start;
+	} else {
+		first = node->left;
+		first_ok = min_addr < range->start;
+		second = node->right;
+		second_ok = max_addr > range->start + range->size - 1;
+	}
+
+	if (first_ok) {
+		ret = find_free_range(first, size, align, min_addr, max_addr, flags, _phys);
+		if (ret)
+			return ret;
+	}
+
+	if (is_suitable_range(range, size, align, min_addr, max_addr, flags, _phys))
+		return range;
+
+	return (second_ok) ? find_free_range(second, size, align, min_addr, max_addr, flags, _phys) : NULL;
+}
+
+/** Find a free range, preferring the preferred NUMA node.
+ * @param size          Size of the range.
+ * @param align         Alignment of the range.
+ * @param min_addr      Minimum address for the start of the range.
+ * @param max_addr      Maximum address of the last byte of the range.
+ * @param flags         Behaviour flags.
+ * @param _phys         Where to store address of the range.
+ * @return              Range containing the allocation, or NULL if none. */
+static memory_range_t *find_preferred_range(
+	phys_size_t size, phys_size_t align, phys_ptr_t min_addr, phys_ptr_t max_addr,
+	unsigned flags, phys_ptr_t *_phys)
+{
+	phys_ptr_t node_start, node_end;
+	memory_range_t *range;
+
+	for (size_t i = 0; numa_preferred_range(i, flags, &node_start, &node_end); i++) {
+		node_start = max(node_start, min_addr);
+		node_end = min(node_end, max_addr);
+
+		if (node_end > node_start && node_end - node_start >= size - 1) {
+			range = find_free_range(memory_tree.root, size, align, node_start, node_end, flags, _phys);
+			if (range)
+				return range;
+		}
+	}
+
+	return find_free_range(memory_tree.root, size, align, min_addr, max_addr, flags, _phys);
+}
+
+/** Find the range containing an address.
+ * @param addr          Address to find.
+ * @return              Range containing the address, or NULL if none. */
+static memory_range_t *find_range(phys_ptr_t addr)
+{
+	avl_tree_node_t *node = memory_tree.root;
+
+	while (node) {
+		memory_range_t *range = avl_tree_entry(node, memory_range_t, tree_link);
+
+		if (addr < range->start) {
+			node = node->left;
+		} else if (addr > range->start + range->size - 1) {
+			node = node->right;
+		} else {
+			return range;
+		}
+	}
+
+	return NULL;
+}
+
 /**
  * Allocate a range of physical memory.
  *
@@ -440,7 +1486,7 @@ void *memory_alloc(
 	phys_size_t size, phys_size_t align, phys_ptr_t min_addr, phys_ptr_t max_addr,
 	uint8_t type, unsigned flags, phys_ptr_t *_phys)
 {
-	list_t *iter;
+	phys_ptr_t start;
 
 	assert(!(size % PAGE_SIZE));
 	assert(!(align % PAGE_SIZE));
@@ -459,26 +1505,19 @@ void *memory_alloc(
 	assert((max_addr - min_addr) >= (size - 1));
 
 	/* Find a free range that is large enough to hold the new range. */
-	iter = (flags & MEMORY_ALLOC_HIGH) ? memory_ranges.prev : memory_ranges.next;
-	while (iter != &memory_ranges) {
-		memory_range_t *range = list_entry(iter, memory_range_t, header);
-		phys_ptr_t start;
-
-		if (is_suitable_range(range, size, align, min_addr, max_addr, flags, &start)) {
-			/* Insert a new range over the top of the allocation. */
-			memory_map_insert(&memory_ranges, start, size, type);
+	if (find_preferred_range(size, align, min_addr, max_addr, flags, &start)) {
+		/* Insert a new range over the top of the allocation. */
+		memory_map_insert(&memory_ranges, start, size, type);
+		memory_stats_alloc(size, type);
 
-			dprintf(
-				"memory: allocated 0x%" PRIxPHYS "-0x%" PRIxPHYS " (align: 0x%" PRIxPHYS ", type: %u)\n",
-				start, start + size, align, type);
+		dprintf(
+			"memory: allocated 0x%" PRIxPHYS "-0x%" PRIxPHYS " (align: 0x%" PRIxPHYS ", type: %u)\n",
+			start, start + size, align, type);
 
-			if (_phys)
-				*_phys = start;
+		if (_phys)
+			*_phys = start;
 
-			return (void*)phys_to_virt(start);
-		}
-
-		iter = (flags & MEMORY_ALLOC_HIGH) ? range->header.prev : range->header.next;
+		return (void*)phys_to_virt(start);
 	}
 
 	if (flags & MEMORY_ALLOC_CAN_FAIL)
@@ -489,22 +1528,21 @@ void *memory_alloc(
 
 /** Free a range of physical memory.
  * @param addr          Virtual address of allocation.
- * @param size          Size of range to free. */
+ * @param size          Size of range to free (may be part of an allocation). */
 void memory_free(void *addr, phys_size_t size)
 {
 	phys_ptr_t phys = virt_to_phys((ptr_t)addr);
+	memory_range_t *range;
 
 	assert(!(phys % PAGE_SIZE));
 	assert(!(size % PAGE_SIZE));
 
-	list_foreach(&memory_ranges, iter) {
-		memory_range_t *range = list_entry(iter, memory_range_t, header);
-
-		if (range->type != MEMORY_TYPE_FREE) {
-			if (phys >= range->start && (phys + size - 1) <= (range->start + range->size - 1)) {
-				memory_map_insert(&memory_ranges, phys, size, MEMORY_TYPE_FREE);
-				return;
-			}
+	range = find_range(phys);
+	if (range && range->type != MEMORY_TYPE_FREE) {
+		if ((phys + size - 1) <= (range->start + range->size - 1)) {
+			memory_stats_free(size, range->type);
+			memory_map_insert(&memory_ranges, phys, size, MEMORY_TYPE_FREE);
+			return;
 		}
 	}
 
@@ -538,16 +1576,10 @@ void memory_protect(phys_ptr_t start, phys_size_t size)
 	start = round_down(start, PAGE_SIZE);
 	end = round_up(start + size, PAGE_SIZE) - 1;
 
-	list_foreach_safe(&memory_ranges, iter) {
-		range = list_entry(iter, memory_range_t, header);
-		if (range->type != MEMORY_TYPE_FREE)
-			continue;
-
-		match_start = max(start, range->start);
+	/* Each free range overlapping the area is replaced, so look up the lowest
+	 * remaining one until there are none left. */
+	while ((range = find_free_range(memory_tree.root, PAGE_SIZE, PAGE_SIZE, start, end, 0, &match_start))) {
 		match_end = min(end, range->start + range->size - 1);
-		if (match_end <= match_start)
-			continue;
-
 		memory_map_insert(&memory_ranges, match_start, match_end - match_start + 1, MEMORY_TYPE_INTERNAL);
 	}
 }
@@ -582,6 +1614,8 @@ void memory_snapshot(list_t *map)
 {
 	list_init(map);
 
+	heap_grow_blocked++;
+
 	list_foreach(&memory_ranges, iter) {
 		memory_range_t *range = list_entry(iter, memory_range_t, header);
 		memory_range_t *dup = memdup(range, sizeof(memory_range_t));
@@ -589,6 +1623,8 @@ void memory_snapshot(list_t *map)
 		list_init(&dup->header);
 		list_append(map, &dup->header);
 	}
+
+	heap_grow_blocked--;
 }
 
 /**
@@ -603,12 +1639,16 @@ void memory_snapshot(list_t *map)
  */
 void memory_finalize(list_t *map)
 {
+	mmu_finalize();
+	heap_finalize();
+
 	/* Reclaim all internal memory ranges. */
 	list_foreach(&memory_ranges, iter) {
 		memory_range_t *range = list_entry(iter, memory_range_t, header);
 
 		if (range->type == MEMORY_TYPE_INTERNAL) {
 			range->type = MEMORY_TYPE_FREE;
+			map_changed(&memory_ranges, range);
 			merge_ranges(&memory_ranges, range);
 		}
 	}
@@ -619,6 +1659,123 @@ void memory_finalize(list_t *map)
 
 #endif /* TARGET_HAS_MM */
 
+/**
+ * Allocation statistics.
+ */
+
+/** Record a physical memory allocation.
+ * @param size          Size of the allocation.
+ * @param type          Type of the allocation. */
+void memory_stats_alloc(phys_size_t size, uint8_t type)
+{
+	memory_alloc_count++;
+	memory_alloc_size += size;
+	memory_peak_size = max(memory_peak_size, memory_alloc_size);
+
+	if (type < array_size(memory_type_size))
+		memory_type_size[type] += size;
+}
+
+/** Record a physical memory allocation being freed.
+ * @param size          Size of the allocation.
+ * @param type          Type of the allocation. */
+void memory_stats_free(phys_size_t size, uint8_t type)
+{
+	memory_free_count++;
+	memory_alloc_size -= size;
+
+	if (type < array_size(memory_type_size))
+		memory_type_size[type] -= size;
+}
+
+/** Get the size of the largest free heap chunk.
+ * @return              Size of the largest free chunk. */
+static size_t heap_largest_free(void)
+{
+	size_t largest = 0;
+	unsigned fl, sl;
+
+	if (!heap_fl_bitmap)
+		return 0;
+
+	/* Only the highest non-empty size class needs to be searched. */
+	fl = heap_highbit(heap_fl_bitmap);
+	sl = heap_highbit(heap_sl_bitmap[fl]);
+
+	list_foreach(&heap_lists[fl][sl], iter) {
+		heap_free_chunk_t *entry = list_entry(iter, heap_free_chunk_t, header);
+
+		largest = max(largest, heap_chunk_size(&entry->chunk));
+	}
+
+	return largest;
+}
+
+/**
+ * Print heap and physical allocation statistics.
+ *
+ * Fragmentation is the proportion of free heap space that is not in the
+ * largest free chunk. In debug builds, the malloc() call sites that have made
+ * the most allocations are also listed.
+ *
+ * @param func          Print function to use.
+ */
+static void print_heap_stats(printf_t func)
+{
+	size_t largest = heap_largest_free();
+	unsigned frag;
+
+	frag = (heap_free_size) ? 100 - (largest / ((heap_free_size + 99) / 100)) : 0;
+
+	func("Heap:\n");
+	func("  Size:       %zu KiB in %u areas\n", heap_total_size / 1024, heap_area_count);
+	func("  In use:     %zu KiB (peak %zu KiB)\n",
+		(heap_total_size - heap_free_size) / 1024, heap_peak_size / 1024);
+	func("  Chunks:     %zu allocated\n", heap_chunk_count);
+	func("  Free:       %zu KiB (largest chunk %zu KiB, %u%% fragmented)\n",
+		heap_free_size / 1024, largest / 1024, frag);
+	func("  Calls:      %u malloc, %u realloc, %u free\n",
+		heap_malloc_count, heap_realloc_count, heap_free_count);
+
+	func("Physical memory:\n");
+	func("  Allocated:  %" PRIuPHYS " KiB (peak %" PRIuPHYS " KiB)\n",
+		memory_alloc_size / 1024, memory_peak_size / 1024);
+	func("  Calls:      %u alloc, %u free\n", memory_alloc_count, memory_free_count);
+
+	for (uint8_t i = 0; i < array_size(memory_type_size); i++) {
+		if (memory_type_size[i])
+			func("  %-11s %" PRIuPHYS " KiB\n", memory_type_name(i), memory_type_size[i] / 1024);
+	}
+
+#ifdef CONFIG_DEBUG
+	size_t count = 0;
+
+	/* Sort by allocation count, most first. This can be done in place, as the
+	 * order of the table does not matter to heap_record_site(). */
+	while (count < HEAP_SITE_COUNT && heap_sites[count].addr) {
+		heap_site_t site = heap_sites[count];
+		size_t j = count++;
+
+		while (j > 0 && heap_sites[j - 1].count < site.count) {
+			heap_sites[j] = heap_sites[j - 1];
+			j--;
+		}
+
+		heap_sites[j] = site;
+	}
+
+	func("Allocation sites:\n");
+
+	for (size_t i = 0; i < count; i++) {
+		func("  %p: %u allocations, %zu bytes\n",
+			heap_sites[i].addr, heap_sites[i].count, heap_sites[i].size);
+	}
+
+	if (heap_other_sites.count)
+		func("  Others: %u allocations, %zu bytes\n", heap_other_sites.count, heap_other_sites.size);
+#endif
+}
+
 /**
  * Configuration commands.
  */
@@ -645,3 +1802,22 @@ static bool config_cmd_lsmemory(value_list_t *args)
 }
 
 BUILTIN_COMMAND("lsmemory", "List known memory ranges", config_cmd_lsmemory);
+
+/**
+ * Show heap and memory allocation statistics.
+ *
+ * @param args          Argument list.
+ * @return              Whether successful.
+ */
+static bool config_cmd_lsheap(value_list_t *args)
+{
+	if (args->count != 0) {
+		config_error("Invalid arguments");
+		return false;
+	}
+
+	print_heap_stats(printf);
+	return true;
+}
+
+BUILTIN_COMMAND("lsheap", "Show heap and memory allocation statistics", config_cmd_lsheap);
@@ -46,6 +46,7 @@ typedef struct menu_entry {
   list_t header;                      /**< Link to menu entries list. */
   char *name;                         /**< Name of the entry. */
   environ_t *env;                     /**< Environment for the entry. */
+  arena_t *arena;                     /**< Arena for the environment. */
   char *error;                        /**< If an error occured, the . */
 } menu_entry_t;
 
@@ -73,7 +74,7 @@ static void menu_entry_help(ui_entry_t *_entry) {
 
   ui_print_action('\n', "Select");
 
-  if (entry->env->loader->configure)
+  if (!entry->error && entry->env->loader->configure)
     ui_print_action(CONSOLE_KEY_F1, "Configure");
 
   ui_print_action(CONSOLE_KEY_F2, "Shell");
@@ -152,6 +153,16 @@ static ui_entry_type_t menu_entry_type = {
   .input = menu_entry_input,
 };
 
+/** Release the memory used by a menu entry's environment.
+ * @param entry         Entry to release. */
+static void release_entry_env(menu_entry_t *entry) {
+  environ_destroy(entry->env);
+  arena_destroy(entry->arena);
+
+  entry->env = NULL;
+  entry->arena = NULL;
+}
+
 /** Get the default menu entry.
  * @return              Default menu entry. */
 static menu_entry_t *get_default_entry(void) {
@@ -257,6 +268,14 @@ environ_t *menu_display(void) {
   if (selected_menu_entry) {
     dprintf("menu: booting menu entry '%s'\n", selected_menu_entry->name);
 
+    /* Other entries will not be used now, free their environments. */
+    list_foreach(&menu_entries, iter) {
+      menu_entry_t *entry = list_entry(iter, menu_entry_t, header);
+
+      if (entry != selected_menu_entry && entry->env)
+        release_entry_env(entry);
+    }
+
     if (selected_menu_entry->error) {
       boot_error("%s", selected_menu_entry->error);
     } else {
@@ -308,7 +327,8 @@ static bool config_cmd_entry(value_list_t *args) {
   entry->entry.type = &menu_entry_type;
   entry->name = args->values[0].string;
   args->values[0].string = NULL;
-  entry->env = environ_create(current_environ);
+  entry->arena = arena_create();
+  entry->env = environ_create(current_environ, entry->arena);
   entry->error = NULL;
 
   executing_menu_entry = entry;
@@ -317,9 +337,11 @@ static bool config_cmd_entry(value_list_t *args) {
   /* Execute the command list. */
   if (!command_list_exec(args->values[1].cmds, entry->env)) {
     /* We don't return an error here. We store the error string, and will
-       * display it when the user attempts to boot the failed entry.
+       * display it when the user attempts to boot the failed entry. The
+       * environment can never be booted so free it now.
        */
     assert(entry->error);
+    release_entry_env(entry);
   }
 
   config_set_error_handler(prev_handler);
@@ -0,0 +1,229 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               NUMA topology functions.
+ *
+ * Memory affinity is obtained from the ACPI SRAT, which gives the proximity
+ * domain (node) of each range of physical memory and of each CPU. The memory
+ * manager uses this to prefer allocating memory on a particular node: by
+ * default the node of the boot CPU, which can be overridden by setting the
+ * "numa_node" environment variable, e.g. for a particular menu entry.
+ */
+
+#include <acpi.h>
+#include <config.h>
+#include <loader.h>
+#include <memory.h>
+#include <numa.h>
+
+/** Maximum number of memory ranges recorded. */
+#define NUMA_RANGES_MAX         64
+
+/** Memory affinity ranges, sorted by address. */
+static numa_range_t numa_ranges[NUMA_RANGES_MAX];
+static size_t numa_range_count;
+
+/** Whether there is more than one memory node. */
+static bool numa_multi_node;
+
+/** Node of the boot CPU. */
+static uint32_t boot_node;
+
+/** Whether the SRAT has been parsed. */
+static bool numa_probed;
+
+/** Parse the SRAT, if there is one. */
+static void numa_probe(void) {
+    acpi_srat_t *srat;
+    uint32_t cpu_id;
+    size_t length, offset, i;
+
+    numa_probed = true;
+
+    srat = acpi_find_table(ACPI_SRAT_SIGNATURE);
+    if (!srat || srat->header.length < sizeof(*srat))
+        return;
+
+    cpu_id = arch_cpu_id();
+    length = srat->header.length - sizeof(*srat);
+
+    for (offset = 0; offset + sizeof(acpi_srat_entry_t) <= length; ) {
+        acpi_srat_entry_t *entry = (acpi_srat_entry_t *)&srat->entries[offset];
+
+        if (entry->length < sizeof(*entry) || offset + entry->length > length)
+            break;
+
+        offset += entry->length;
+
+        switch (entry->type) {
+        case ACPI_SRAT_CPU:
+        {
+            acpi_srat_cpu_t *cpu = (acpi_srat_cpu_t *)entry;
+
+            if (entry->length < sizeof(*cpu) || !(cpu->flags & ACPI_SRAT_ENABLED))
+                break;
+
+            if (cpu->apic_id == cpu_id) {
+                boot_node = cpu->domain_low
+                    | ((uint32_t)cpu->domain_high[0] << 8)
+                    | ((uint32_t)cpu->domain_high[1] << 16)
+                    | ((uint32_t)cpu->domain_high[2] << 24);
+            }
+
+            break;
+        }
+        case ACPI_SRAT_X2APIC:
+        {
+            acpi_srat_x2apic_t *cpu = (acpi_srat_x2apic_t *)entry;
+
+            if (entry->length < sizeof(*cpu) || !(cpu->flags & ACPI_SRAT_ENABLED))
+                break;
+
+            if (cpu->x2apic_id == cpu_id)
+                boot_node = cpu->domain;
+
+            break;
+        }
+        case ACPI_SRAT_MEMORY:
+        {
+            acpi_srat_memory_t *memory = (acpi_srat_memory_t *)entry;
+
+            if (entry->length < sizeof(*memory) || !(memory->flags & ACPI_SRAT_ENABLED) || !memory->length)
+                break;
+
+            if (numa_range_count == NUMA_RANGES_MAX) {
+                dprintf("numa: too many memory affinity ranges, ignoring some\n");
+                break;
+            }
+
+            /* Keep the ranges sorted by address. */
+            i = numa_range_count++;
+            while (i > 0 && numa_ranges[i - 1].start > memory->base) {
+                numa_ranges[i] = numa_ranges[i - 1];
+                i--;
+            }
+
+            numa_ranges[i].start = memory->base;
+            numa_ranges[i].size = memory->length;
+            numa_ranges[i].node = memory->domain;
+            break;
+        }
+        }
+    }
+
+    dprintf("numa: %zu memory affinity ranges, boot CPU %" PRIu32 " is on node %" PRIu32 "\n",
+        numa_range_count, cpu_id, boot_node);
+
+    for (i = 0; i < numa_range_count; i++) {
+        if (numa_ranges[i].node != numa_ranges[0].node)
+            numa_multi_node = true;
+
+        dprintf(" 0x%016" PRIxPHYS "-0x%016" PRIxPHYS " -> node %" PRIu32 "\n",
+            numa_ranges[i].start, numa_ranges[i].start + numa_ranges[i].size, numa_ranges[i].node);
+    }
+}
+
+/**
+ * Get the memory affinity ranges.
+ *
+ * @param _ranges       Where to store pointer to array of ranges.
+ *
+ * @return              Number of ranges (0 if no NUMA information).
+ */
+size_t numa_get_ranges(const numa_range_t **_ranges) {
+    if (!numa_probed)
+        numa_probe();
+
+    *_ranges = numa_ranges;
+    return numa_range_count;
+}
+
+/** Get the node of the boot CPU.
+ * @return              Node of the boot CPU (0 if no NUMA information). */
+uint32_t numa_boot_node(void) {
+    if (!numa_probed)
+        numa_probe();
+
+    return boot_node;
+}
+
+/** Get the node that allocations should be made from.
+ * @return              Preferred node. */
+static uint32_t preferred_node(void) {
+    value_t *value;
+
+    if (current_environ) {
+        value = environ_lookup(current_environ, "numa_node");
+        if (value && value->type == VALUE_TYPE_INTEGER)
+            return value->integer;
+    }
+
+    return boot_node;
+}
+
+/**
+ * Get a memory range on the preferred node.
+ *
+ * Used by memory_alloc() implementations to try to allocate from the preferred
+ * node before falling back to any memory. Ranges are returned in address
+ * order, or reverse address order if MEMORY_ALLOC_HIGH is set.
+ *
+ * @param index         Index of the range to get.
+ * @param flags         Allocation behaviour flags.
+ * @param _start        Where to store start of the range.
+ * @param _end          Where to store last address in the range.
+ *
+ * @return              Whether a range was returned. False once there are no
+ *                      more ranges, or immediately if there is only one node.
+ */
+bool numa_preferred_range(size_t index, unsigned flags, phys_ptr_t *_start, phys_ptr_t *_end) {
+    uint32_t node;
+    size_t i;
+
+    if (!numa_probed)
+        numa_probe();
+
+    /* Placement preference is only useful with more than one node. */
+    if (!numa_multi_node)
+        return false;
+
+    node = preferred_node();
+
+    for (size_t n = 0; n < numa_range_count; n++) {
+        i = (flags & MEMORY_ALLOC_HIGH) ? numa_range_count - n - 1 : n;
+
+        if (numa_ranges[i].node != node)
+            continue;
+
+        if (index-- == 0) {
+            *_start = numa_ranges[i].start;
+            *_end = numa_ranges[i].start + numa_ranges[i].size - 1;
+            return true;
+        }
+    }
+
+    return false;
+}
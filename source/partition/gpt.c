@@ -19,7 +19,11 @@
  * @brief               GPT partition table support.
  */
 
+#include <arch/page.h>
+
+#include <lib/crc32.h>
 #include <lib/string.h>
+#include <lib/utility.h>
 
 #include <partition/gpt.h>
 #include <partition/mbr.h>
@@ -29,9 +33,100 @@
 #include <loader.h>
 #include <memory.h>
 
+/** Size of the header fields defined by revision 1.0 of the GPT format. */
+#define GPT_HEADER_MIN_SIZE     92
+
+/** Maximum size of a partition entry array that we will read. */
+#define GPT_MAX_ENTRIES_SIZE    (1024 * 1024)
+
 /** Zero GUID (for easy comparison). */
 static gpt_guid_t zero_guid;
 
+/** Read and validate a GPT header and its partition entry array.
+ * @param disk          Disk to read from.
+ * @param lba           LBA of the header.
+ * @param header        Buffer to read the header into (one block in size).
+ * @param _entries      Where to store pointer to the entry array, which should
+ *                      be freed with memory_free().
+ * @param _size         Where to store the allocated size of the entry array.
+ * @return              Whether the header and entry array are valid. */
+static bool read_gpt(
+    disk_device_t *disk, uint64_t lba, gpt_header_t *header, void **_entries,
+    size_t *_size)
+{
+    uint32_t header_size, header_crc, num_entries, entry_size;
+    uint64_t size;
+    size_t alloc_size;
+    void *entries;
+
+    if (device_read(&disk->device, header, disk->block_size, lba * disk->block_size) != STATUS_SUCCESS) {
+        return false;
+    } else if (le64_to_cpu(header->signature) != GPT_HEADER_SIGNATURE) {
+        return false;
+    }
+
+    /* The CRC covers the header with the CRC field zeroed. */
+    header_size = le32_to_cpu(header->header_size);
+    if (header_size < GPT_HEADER_MIN_SIZE || header_size > disk->block_size) {
+        dprintf("gpt: warning: GPT header at LBA %" PRIu64 " has invalid size\n", lba);
+        return false;
+    }
+
+    header_crc = header->header_crc32;
+    header->header_crc32 = 0;
+    if (~crc32(0xffffffff, header, header_size) != le32_to_cpu(header_crc)) {
+        dprintf("gpt: warning: GPT header at LBA %" PRIu64 " has incorrect CRC\n", lba);
+        return false;
+    }
+
+    header->header_crc32 = header_crc;
+
+    if (le64_to_cpu(header->my_lba) != lba) {
+        dprintf("gpt: warning: GPT header at LBA %" PRIu64 " has incorrect location\n", lba);
+        return false;
+    }
+
+    num_entries = le32_to_cpu(header->num_partition_entries);
+    entry_size = le32_to_cpu(header->partition_entry_size);
+    if (entry_size < sizeof(gpt_partition_entry_t)) {
+        dprintf("gpt: warning: GPT header at LBA %" PRIu64 " has invalid entry size\n", lba);
+        return false;
+    }
+
+    /* The entry array is usually 16KB, which is a lot to take from the heap,
+     * so read it into physical memory. */
+    size = (uint64_t)num_entries * entry_size;
+    if (!size || size > GPT_MAX_ENTRIES_SIZE) {
+        dprintf("gpt: warning: GPT header at LBA %" PRIu64 " has invalid entry count\n", lba);
+        return false;
+    }
+
+    alloc_size = round_up(size, PAGE_SIZE);
+    entries = memory_alloc(
+        alloc_size, 0, 0, 0, MEMORY_TYPE_INTERNAL, MEMORY_ALLOC_HIGH | MEMORY_ALLOC_CAN_FAIL,
+        NULL);
+    if (!entries)
+        return false;
+
+    if (device_read(
+            &disk->device, entries, size,
+            le64_to_cpu(header->partition_entry_lba) * disk->block_size) != STATUS_SUCCESS)
+    {
+        memory_free(entries, alloc_size);
+        return false;
+    }
+
+    if (~crc32(0xffffffff, entries, size) != le32_to_cpu(header->partition_entry_crc32)) {
+        dprintf("gpt: warning: GPT partition entries for LBA %" PRIu64 " have incorrect CRC\n", lba);
+        memory_free(entries, alloc_size);
+        return false;
+    }
+
+    *_entries = entries;
+    *_size = alloc_size;
+    return true;
+}
+
 /** Iterate over the partitions on a device.
  * @param disk          Disk to iterate over.
  * @param cb            Callback function.
@@ -40,7 +135,8 @@ static bool gpt_partition_iterate(disk_device_t *disk, partition_iterate_cb_t cb
     void *buf __cleanup_free = NULL;
     mbr_t *mbr;
     gpt_header_t *header;
-    uint64_t offset;
+    void *entries;
+    size_t size;
     uint32_t num_entries, entry_size;
 
     /* Allocate a temporary buffer. */
@@ -59,31 +155,28 @@ static bool gpt_partition_iterate(disk_device_t *disk, partition_iterate_cb_t cb
         return false;
     }
 
-    /* Read in the GPT header (second block). At most one block in size. */
+    /* Read in the GPT header (second block). At most one block in size. If it
+     * or its entry array is damaged, fall back to the backup header in the
+     * last block. */
     mbr = NULL;
     header = buf;
-    if (device_read(&disk->device, header, disk->block_size, disk->block_size) != STATUS_SUCCESS) {
-        return false;
-    } else if (le64_to_cpu(header->signature) != GPT_HEADER_SIGNATURE) {
-        return false;
+    if (!read_gpt(disk, 1, header, &entries, &size)) {
+        if (!read_gpt(disk, disk->blocks - 1, header, &entries, &size))
+            return false;
+
+        dprintf("gpt: warning: using backup GPT on %s\n", disk->device.name);
     }
 
     /* Pull needed information out of the header. */
-    offset = le64_to_cpu(header->partition_entry_lba) * disk->block_size;
     num_entries = le32_to_cpu(header->num_partition_entries);
     entry_size = le32_to_cpu(header->partition_entry_size);
     header = NULL;
 
     /* Iterate over partition entries. */
-    for (uint32_t i = 0; i < num_entries; i++, offset += entry_size) {
-        gpt_partition_entry_t *entry = buf;
+    for (uint32_t i = 0; i < num_entries; i++) {
+        gpt_partition_entry_t *entry = entries + (i * entry_size);
         uint64_t lba, count;
 
-        if (device_read(&disk->device, buf, entry_size, offset) != STATUS_SUCCESS) {
-            dprintf("gpt: failed to read GPT partition entry at %" PRIu64 "\n", offset);
-            return false;
-        }
-
         /* Ignore unused entries. */
         if (memcmp(&entry->type_guid, &zero_guid, sizeof(entry->type_guid)) == 0)
             continue;
@@ -99,6 +192,7 @@ static bool gpt_partition_iterate(disk_device_t *disk, partition_iterate_cb_t cb
         cb(disk, i, lba, count);
     }
 
+    memory_free(entries, size);
     return true;
 }
 
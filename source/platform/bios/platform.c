@@ -29,6 +29,8 @@
 
 #include <arch/io.h>
 
+#include <lib/string.h>
+
 #include <x86/cpu.h>
 #include <x86/descriptor.h>
 
@@ -39,6 +41,7 @@
 #include <bios/multiboot.h>
 #include <bios/video.h>
 
+#include <acpi.h>
 #include <console.h>
 #include <device.h>
 #include <loader.h>
@@ -87,6 +90,27 @@ __noreturn void bios_main(void)
     loader_main();
 }
 
+/**
+ * Get the ACPI RSDP.
+ *
+ * @return              Pointer to RSDP, or NULL if not found.
+ */
+acpi_rsdp_t *target_acpi_rsdp(void) {
+    acpi_rsdp_t *rsdp;
+    uint16_t ebda;
+
+    /* Search the first 1KB of the EBDA, whose segment is in the BDA. */
+    memcpy(&ebda, (void *)phys_to_virt(0x40e), sizeof(ebda));
+    if (ebda) {
+        rsdp = acpi_scan_rsdp((phys_ptr_t)ebda << 4, 1024);
+        if (rsdp)
+            return rsdp;
+    }
+
+    /* Then the BIOS ROM area. */
+    return acpi_scan_rsdp(0xe0000, 0x20000);
+}
+
 /**
  * Detect and register all devices.
  */
@@ -1157,6 +1157,14 @@ typedef struct efi_runtime_services {
 /** EFI runtime services table signature. */
 #define EFI_RUNTIME_SERVICES_SIGNATURE      0x56524553544e5552ll
 
+/** ACPI 2.0 RSDP configuration table GUID. */
+#define EFI_ACPI_20_TABLE_GUID \
+	{ 0x8868e871, 0xe4f1, 0x11d3, 0xbc, 0x22, 0x00, 0x80, 0xc7, 0x3c, 0x88, 0x81 }
+
+/** ACPI 1.0 RSDP configuration table GUID. */
+#define EFI_ACPI_TABLE_GUID \
+	{ 0xeb9d2d30, 0x2d88, 0x11d3, 0x9a, 0x16, 0x00, 0x90, 0x27, 0x3f, 0xc1, 0x4d }
+
 /** EFI configuration table. */
 typedef struct efi_configuration_table {
 	efi_guid_t vendor_guid;
@@ -92,9 +92,14 @@ static __noreturn void efi_loader_load(void *_loader)
 
 	fs_close(loader->handle);
 
-	/* Convert the arguments to UTF-16. FIXME: UTF-8 internally? */
+	/* Convert the arguments to UTF-16. FIXME: UTF-8 internally? These are
+	 * allocated from the firmware pool, as our own memory (including the heap)
+	 * is released before the image is started. */
 	str_size = (strlen(loader->args.string) + 1) * sizeof(*str);
-	str = malloc(str_size);
+	status = efi_allocate_pool(EFI_LOADER_DATA, str_size, (void **)&str);
+	if (status != EFI_SUCCESS)
+		boot_error("Failed to allocate load options (0x%zx)", status);
+
 	for (size_t i = 0; i < str_size / sizeof(*str); i++)
 		str[i] = loader->args.string[i];
 
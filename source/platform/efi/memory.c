@@ -35,9 +35,16 @@
  *
  * The AllocatePages boot service cannot provide all the functionality of
  * memory_alloc() (no alignment or minimum address constraints). Therefore,
- * we implement memory_alloc() by getting the current memory map each time it
- * is called and scanning it for a suitable range, and then allocating an exact
- * range with AllocatePages.
+ * we implement memory_alloc() by scanning the memory map for a suitable range,
+ * and then allocating an exact range with AllocatePages.
+ *
+ * Getting the memory map from the firmware requires allocating a buffer and
+ * sorting the result, which is too expensive to do on every allocation. We
+ * instead keep a sorted copy of the free ranges in the map, which we update
+ * ourself after each allocation and free. The firmware can also allocate
+ * memory behind our back, so the copy is refreshed from the firmware's map
+ * if AllocatePages fails on a range that we think is free, or if no suitable
+ * range can be found.
  *
  * There is a widespread bug which prevents the use of user-defined memory type
  * values, which causes the firmware to crash if a value outside of the pre-
@@ -57,12 +64,34 @@
  #include <config.h>
  #include <loader.h>
  #include <memory.h>
+ #include <numa.h>
+
+/** Free range in the shadow memory map. */
+typedef struct efi_free_range {
+	phys_ptr_t start;               /**< Start of the range. */
+	phys_size_t size;               /**< Size of the range. */
+} efi_free_range_t;
+
+/** Maximum number of ranges in the shadow memory map. */
+#define EFI_FREE_RANGES_MAX     256
 
 /** List of allocated memory ranges. */
 static LIST_DECLARE(efi_memory_ranges);
 
+/**
+ * Shadow copy of the free ranges in the memory map, sorted by address.
+ *
+ * This is a fixed size array as it is used while allocating memory for the
+ * heap. If it fills up, the smallest ranges are forgotten about until the
+ * next refresh, which is safe since it only means we won't allocate from
+ * them.
+ */
+static efi_free_range_t efi_free_ranges[EFI_FREE_RANGES_MAX];
+static size_t efi_free_count;
+static bool efi_free_valid;
+
 /** Check whether a range can satisfy an allocation.
- * @param range         Memory descriptor for range to check.
+ * @param range         Free range to check.
  * @param size          Size of the allocation.
  * @param align         Alignment of the allocation.
  * @param min_addr      Minimum address for the start of the allocated range.
@@ -71,19 +100,16 @@ static LIST_DECLARE(efi_memory_ranges);
  * @param _phys         Where to store address for allocation.
  * @return              Whether the range can satisfy the allocation. */
 static bool is_suitable_range(
-	efi_memory_descriptor_t *range, phys_size_t size, phys_size_t align,
+	efi_free_range_t *range, phys_size_t size, phys_size_t align,
 	phys_ptr_t min_addr, phys_ptr_t max_addr, unsigned flags,
 	efi_physical_address_t *_phys)
 {
 	phys_ptr_t start, range_end, match_start, match_end;
 
-	if (range->type != EFI_CONVENTIONAL_MEMORY)
-		return false;
-
-	range_end = range->physical_start + (range->num_pages * EFI_PAGE_SIZE) - 1;
+	range_end = range->start + range->size - 1;
 
 	/* Check if this range contains addresses in the requested range. */
-	match_start = max(min_addr, range->physical_start);
+	match_start = max(min_addr, range->start);
 	match_end = min(max_addr, range_end);
 	if (match_end <= match_start)
 		return false;
@@ -104,7 +130,7 @@ static bool is_suitable_range(
 }
 
 /** Sort comparison function for the EFI memory map. */
-static int forward_sort_compare(const void *a, const void *b)
+static int sort_compare(const void *a, const void *b)
 {
 	const efi_memory_descriptor_t *first = a;
 	const efi_memory_descriptor_t *second = b;
@@ -117,18 +143,244 @@ static int forward_sort_compare(const void *a, const void *b)
 		return 0;
 }
 
-/** Reverse sort comparison function for the EFI memory map. */
-static int reverse_sort_compare(const void *a, const void *b)
+/** Find the first range in the shadow map starting after an address.
+ * @param addr          Address to search for.
+ * @return              Index of the range (efi_free_count if none). */
+static size_t find_free_index(phys_ptr_t addr)
 {
-	const efi_memory_descriptor_t *first = a;
-	const efi_memory_descriptor_t *second = b;
+	size_t low = 0, high = efi_free_count;
 
-	if (second->physical_start > first->physical_start)
-		return 1;
-	else if (second->physical_start < first->physical_start)
-		return -1;
-	else
-		return 0;
+	while (low < high) {
+		size_t mid = low + ((high - low) / 2);
+
+		if (efi_free_ranges[mid].start <= addr) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return low;
+}
+
+/** Remove a range from the shadow map.
+ * @param index         Index of the range to remove. */
+static void remove_free_range(size_t index)
+{
+	memmove(
+		&efi_free_ranges[index], &efi_free_ranges[index + 1],
+		(efi_free_count - index - 1) * sizeof(*efi_free_ranges));
+	efi_free_count--;
+}
+
+/** Insert a range into the shadow map.
+ * @param index         Index to insert at.
+ * @param start         Start of the range.
+ * @param size          Size of the range. */
+static void insert_free_range(size_t index, phys_ptr_t start, phys_size_t size)
+{
+	if (efi_free_count == EFI_FREE_RANGES_MAX) {
+		size_t smallest = 0;
+
+		/* Make room by forgetting about the smallest range. */
+		for (size_t i = 1; i < efi_free_count; i++) {
+			if (efi_free_ranges[i].size < efi_free_ranges[smallest].size)
+				smallest = i;
+		}
+
+		if (efi_free_ranges[smallest].size >= size)
+			return;
+
+		remove_free_range(smallest);
+		if (smallest < index)
+			index--;
+	}
+
+	memmove(
+		&efi_free_ranges[index + 1], &efi_free_ranges[index],
+		(efi_free_count - index) * sizeof(*efi_free_ranges));
+	efi_free_ranges[index].start = start;
+	efi_free_ranges[index].size = size;
+	efi_free_count++;
+}
+
+/** Rebuild the shadow map from the firmware's memory map. */
+static void refresh_free_ranges(void)
+{
+	efi_memory_descriptor_t *memory_map __cleanup_free = NULL;
+	efi_uintn_t num_entries, map_key;
+	efi_status_t ret;
+
+	ret = efi_get_memory_map(&memory_map, &num_entries, &map_key);
+	if (ret != EFI_SUCCESS)
+		internal_error("Failed to get memory map (0x%zx)", ret);
+
+	/* EFI does not specify that the memory map is sorted, so make sure it is. */
+	qsort(memory_map, num_entries, sizeof(*memory_map), sort_compare);
+
+	efi_free_count = 0;
+	for (efi_uintn_t i = 0; i < num_entries; i++) {
+		phys_ptr_t start = memory_map[i].physical_start;
+		phys_size_t size = memory_map[i].num_pages * EFI_PAGE_SIZE;
+		efi_free_range_t *prev = (efi_free_count) ? &efi_free_ranges[efi_free_count - 1] : NULL;
+
+		if (memory_map[i].type != EFI_CONVENTIONAL_MEMORY)
+			continue;
+
+		if (prev && prev->start + prev->size == start) {
+			prev->size += size;
+		} else {
+			insert_free_range(efi_free_count, start, size);
+		}
+	}
+
+	efi_free_valid = true;
+}
+
+/** Remove an allocated range from the shadow map.
+ * @param start         Start of the allocated range.
+ * @param size          Size of the allocated range. */
+static void carve_free_range(phys_ptr_t start, phys_size_t size)
+{
+	size_t index = find_free_index(start);
+	efi_free_range_t *range;
+	phys_size_t before, after;
+
+	/* The range may not be present if it was forgotten about. */
+	if (!index)
+		return;
+
+	range = &efi_free_ranges[index - 1];
+	if (start + size > range->start + range->size)
+		return;
+
+	before = start - range->start;
+	after = (range->start + range->size) - (start + size);
+
+	if (!before && !after) {
+		remove_free_range(index - 1);
+	} else if (!before) {
+		range->start += size;
+		range->size -= size;
+	} else {
+		range->size = before;
+		if (after)
+			insert_free_range(index, start + size, after);
+	}
+}
+
+/** Add a freed range to the shadow map.
+ * @param start         Start of the freed range.
+ * @param size          Size of the freed range. */
+static void add_free_range(phys_ptr_t start, phys_size_t size)
+{
+	size_t index = find_free_index(start);
+	efi_free_range_t *prev = (index) ? &efi_free_ranges[index - 1] : NULL;
+	efi_free_range_t *next = (index < efi_free_count) ? &efi_free_ranges[index] : NULL;
+
+	if (prev && prev->start + prev->size == start) {
+		prev->size += size;
+
+		if (next && start + size == next->start) {
+			prev->size += next->size;
+			remove_free_range(index);
+		}
+	} else if (next && start + size == next->start) {
+		next->start = start;
+		next->size += size;
+	} else {
+		insert_free_range(index, start, size);
+	}
+}
+
+/** Find a range in the shadow map that can satisfy an allocation.
+ * @param size          Size of the allocation.
+ * @param align         Alignment of the allocation.
+ * @param min_addr      Minimum address for the start of the allocated range.
+ * @param max_addr      Maximum address of the end of the allocated range.
+ * @param flags         Behaviour flags.
+ * @param _phys         Where to store address for allocation.
+ * @return              Whether a suitable range was found. */
+static bool find_free_range(
+	phys_size_t size, phys_size_t align, phys_ptr_t min_addr, phys_ptr_t max_addr,
+	unsigned flags, efi_physical_address_t *_phys)
+{
+	size_t i;
+
+	if (flags & MEMORY_ALLOC_HIGH) {
+		/* Search down from the last range starting below the maximum. */
+		for (i = find_free_index(max_addr); i > 0; i--) {
+			efi_free_range_t *range = &efi_free_ranges[i - 1];
+
+			if (range->start + range->size - 1 < min_addr)
+				break;
+
+			if (is_suitable_range(range, size, align, min_addr, max_addr, flags, _phys))
+				return true;
+		}
+	} else {
+		/* Search up from the range containing the minimum. */
+		i = find_free_index(min_addr);
+		for (i = (i) ? i - 1 : 0; i < efi_free_count; i++) {
+			efi_free_range_t *range = &efi_free_ranges[i];
+
+			if (range->start > max_addr)
+				break;
+
+			if (is_suitable_range(range, size, align, min_addr, max_addr, flags, _phys))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+/** Allocate an exact range from the firmware.
+ * @param start         Start of the range.
+ * @param size          Size of the range.
+ * @return              Whether successful. Fails if the range is not free. */
+static bool allocate_range(efi_physical_address_t start, phys_size_t size)
+{
+	efi_status_t ret;
+
+	ret = efi_call(
+		efi_boot_services->allocate_pages,
+		EFI_ALLOCATE_ADDRESS, EFI_LOADER_DATA, size / EFI_PAGE_SIZE, &start);
+	if (ret == EFI_NOT_FOUND) {
+		return false;
+	} else if (ret != EFI_SUCCESS) {
+		internal_error("Failed to allocate memory (0x%zx)", ret);
+	}
+
+	carve_free_range(start, size);
+	return true;
+}
+
+/** Find and allocate a free range, preferring the preferred NUMA node.
+ * @param size          Size of the range.
+ * @param align         Alignment of the range.
+ * @param min_addr      Minimum address for the start of the range.
+ * @param max_addr      Maximum address of the last byte of the range.
+ * @param flags         Behaviour flags.
+ * @param _phys         Where to store address of the range.
+ * @return              Whether successful. */
+static bool allocate_free_range(
+	phys_size_t size, phys_size_t align, phys_ptr_t min_addr, phys_ptr_t max_addr,
+	unsigned flags, efi_physical_address_t *_phys)
+{
+	phys_ptr_t node_start, node_end;
+
+	for (size_t i = 0; numa_preferred_range(i, flags, &node_start, &node_end); i++) {
+		node_start = max(node_start, min_addr);
+		node_end = min(node_end, max_addr);
+
+		if (node_end > node_start && node_end - node_start >= size - 1) {
+			if (find_free_range(size, align, node_start, node_end, flags, _phys) && allocate_range(*_phys, size))
+				return true;
+		}
+	}
+
+	return find_free_range(size, align, min_addr, max_addr, flags, _phys) && allocate_range(*_phys, size);
 }
 
 /** Allocate a range of physical memory.
@@ -144,9 +396,9 @@ void *memory_alloc(
 	phys_size_t size, phys_size_t align, phys_ptr_t min_addr, phys_ptr_t max_addr,
 	uint8_t type, unsigned flags, phys_ptr_t *_phys)
 {
-	efi_memory_descriptor_t *memory_map __cleanup_free = NULL;
-	efi_uintn_t num_entries, map_key;
-	efi_status_t ret;
+	efi_physical_address_t start;
+	memory_range_t *range;
+	bool refreshed = false;
 
 	assert(!(size % PAGE_SIZE));
 	assert(!(align % PAGE_SIZE));
@@ -159,59 +411,43 @@ void *memory_alloc(
 	if (!max_addr || max_addr > TARGET_PHYS_MAX)
 		max_addr = TARGET_PHYS_MAX;
 
-	assert(!(size % PAGE_SIZE));
 	assert((max_addr - min_addr) >= (size - 1));
-	assert(type != MEMORY_TYPE_FREE);
 
-	/* Get the current memory map. */
-	ret = efi_get_memory_map(&memory_map, &num_entries, &map_key);
-	if (ret != EFI_SUCCESS)
-		internal_error("Failed to get memory map (0x%zx)", ret);
-
-	/* EFI does not specify that the memory map is sorted, so make sure it is.
-	 * Sort in forward or reverse order depending on whether we want to allocate
-	 * highest possible address first. */
-	qsort(memory_map, num_entries, sizeof(*memory_map),
-	      (flags & MEMORY_ALLOC_HIGH) ? reverse_sort_compare : forward_sort_compare);
-
-	/* Find a free range that is large enough to hold the new range. */
-	for (efi_uintn_t i = 0; i < num_entries; i++) {
-		efi_physical_address_t start;
-		memory_range_t *range;
-
-		if (is_suitable_range(&memory_map[i], size, align, min_addr, max_addr, flags, &start)) {
-			/* Ask the firmware to allocate this exact address. Should succeed
-			 * as it is marked in the memory map as free, so raise an error if
-			 * this fails. */
-			ret = efi_call(
-				efi_boot_services->allocate_pages,
-				EFI_ALLOCATE_ADDRESS, EFI_LOADER_DATA, size / EFI_PAGE_SIZE, &start);
-			if (ret != STATUS_SUCCESS)
-				internal_error("Failed to allocate memory (0x%zx)", ret);
-
-			/* Add a structure to track the allocation type (see comment at top). */
-			range = malloc(sizeof(*range));
-			range->start = start;
-			range->size = size;
-			range->type = type;
-			list_init(&range->header);
-			list_append(&efi_memory_ranges, &range->header);
-
-			dprintf(
-				"memory: allocated 0x%" PRIxPHYS "-0x%" PRIxPHYS " (align: 0x%" PRIxPHYS ", type: %u)\n",
-				start, start + size, align, type);
-
-			if (_phys)
-				*_phys = start;
-
-			return (void*)phys_to_virt(start);
+	if (!efi_free_valid)
+		refresh_free_ranges();
+
+	/* Find a free range that is large enough to hold the new range, and ask
+	 * the firmware to allocate this exact address. If either fails, our copy
+	 * of the memory map may be out of date, so get a new one and try again. */
+	while (!allocate_free_range(size, align, min_addr, max_addr, flags, &start)) {
+		if (refreshed) {
+			if (flags & MEMORY_ALLOC_CAN_FAIL)
+				return NULL;
+			else
+				boot_error("Insufficient memory available (allocating %" PRIuPHYS " bytes)", size);
 		}
+
+		refresh_free_ranges();
+		refreshed = true;
 	}
 
-	if (flags & MEMORY_ALLOC_CAN_FAIL)
-		return NULL;
-	else
-		boot_error("Insufficient memory available (allocating %" PRIuPHYS " bytes)", size);
+	/* Add a structure to track the allocation type (see comment at top). */
+	range = malloc(sizeof(*range));
+	range->start = start;
+	range->size = size;
+	range->type = type;
+	list_init(&range->header);
+	list_append(&efi_memory_ranges, &range->header);
+	memory_stats_alloc(size, type);
+
+	dprintf(
+		"memory: allocated 0x%" PRIxPHYS "-0x%" PRIxPHYS " (align: 0x%" PRIxPHYS ", type: %u)\n",
+		start, start + size, align, type);
+
+	if (_phys)
+		*_phys = start;
+
+	return (void*)phys_to_virt(start);
 }
 
 /** Free a range of physical memory.
@@ -240,6 +476,8 @@ void memory_free(void *addr, phys_size_t size)
 			if (ret != EFI_SUCCESS)
 				internal_error("Failed to free EFI memory (0x%zx)", ret);
 
+			add_free_range(phys, size);
+			memory_stats_free(size, range->type);
 			list_remove(&range->header);
 			free(range);
 			return;
@@ -311,6 +549,7 @@ void memory_snapshot(list_t *map)
  */
 void memory_finalize(list_t *map)
 {
+	heap_finalize();
 	get_memory_map(map, true);
 }
 
@@ -342,18 +581,45 @@ void efi_memory_init(void)
 	}
 }
 
+/** Return a range to the firmware.
+ * @param start         Start of the range.
+ * @param size          Size of the range. */
+static void release_range(phys_ptr_t start, phys_size_t size)
+{
+	efi_status_t ret;
+
+	ret = efi_call(efi_boot_services->free_pages, start, size / EFI_PAGE_SIZE);
+	if (ret != EFI_SUCCESS)
+		internal_error("Failed to free EFI memory (0x%zx)", ret);
+}
+
 /** Release all allocated memory. */
 void efi_memory_cleanup(void)
 {
+	/* The heap is still in use here (the tracking structures are on it), so
+	 * free everything else first. */
 	list_foreach_safe(&efi_memory_ranges, iter) {
 		memory_range_t *range = list_entry(iter, memory_range_t, header);
-		efi_status_t ret;
 
-		ret = efi_call(efi_boot_services->free_pages, range->start, range->size / EFI_PAGE_SIZE);
-		if (ret != EFI_SUCCESS)
-			internal_error("Failed to free EFI memory (0x%zx)", ret);
+		if (heap_is_area((void *)phys_to_virt(range->start)))
+			continue;
 
+		release_range(range->start, range->size);
 		list_remove(&range->header);
 		free(range);
 	}
+
+	/* Now free the heap areas, newest first. The structure tracking an area
+	 * was allocated before the area was added to the heap, so it is always in
+	 * an older area (or the static initial one), which is still there. */
+	while (!list_empty(&efi_memory_ranges)) {
+		memory_range_t *range = list_last(&efi_memory_ranges, memory_range_t, header);
+		phys_ptr_t start = range->start;
+		phys_size_t size = range->size;
+
+		list_remove(&range->header);
+		release_range(start, size);
+	}
+
+	efi_free_valid = false;
 }
@@ -36,6 +36,7 @@
 
 #include <lib/string.h>
 
+#include <acpi.h>
 #include <device.h>
 #include <loader.h>
 #include <screen.h>
@@ -102,6 +103,31 @@ __noreturn void efi_main(efi_handle_t image_handle, efi_system_table_t *system_t
 	loader_main();
 }
 
+/**
+ * Get the ACPI RSDP.
+ *
+ * @return              Pointer to RSDP, or NULL if not available.
+ */
+acpi_rsdp_t *target_acpi_rsdp(void)
+{
+	static efi_guid_t acpi_20_guid = EFI_ACPI_20_TABLE_GUID;
+	static efi_guid_t acpi_guid = EFI_ACPI_TABLE_GUID;
+	acpi_rsdp_t *rsdp = NULL;
+
+	/* Prefer the ACPI 2.0 table, which gives the XSDT. */
+	for (efi_uintn_t i = 0; i < efi_system_table->num_table_entries; i++) {
+		efi_configuration_table_t *table = &efi_system_table->config_table[i];
+
+		if (memcmp(&table->vendor_guid, &acpi_20_guid, sizeof(acpi_20_guid)) == 0) {
+			return table->vendor_table;
+		} else if (memcmp(&table->vendor_guid, &acpi_guid, sizeof(acpi_guid)) == 0) {
+			rsdp = table->vendor_table;
+		}
+	}
+
+	return rsdp;
+}
+
 /**
  * Detect and register all devices.
  */
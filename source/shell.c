@@ -104,7 +104,7 @@ __noreturn void shell_main(void) {
     target_reboot();
   }
 
-  current_environ = environ_create(root_environ);
+  current_environ = environ_create(root_environ, NULL);
 
   prev_handler = config_set_error_handler(shell_error_handler);
 
@@ -118,7 +118,7 @@ __noreturn void shell_main(void) {
     shell_line = NULL;
     shell_line_offset = shell_line_len = 0;
 
-    list = config_parse("<shell>", shell_input_helper);
+    list = config_parse("<shell>", shell_input_helper, NULL);
     if (list) {
       command_list_exec(list, current_environ);
       command_list_destroy(list);
@@ -0,0 +1,108 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               File-backed disk device.
+ *
+ * This implements a disk device on top of a disk image file, so that the
+ * partition and filesystem code can be run unmodified on the host. All block
+ * reads are counted, which gives a measure of the I/O an operation would
+ * cause on real hardware that does not depend on the host's page cache.
+ */
+
+#include <lib/string.h>
+
+#include <host.h>
+#include <host_disk.h>
+#include <memory.h>
+
+/** Accumulated I/O statistics for all file-backed disks. */
+host_disk_stats_t host_disk_stats;
+
+/** Read blocks from a file-backed disk.
+ * @param disk          Disk device being read from.
+ * @param buf           Buffer to read into.
+ * @param count         Number of blocks to read.
+ * @param lba           Block number to start reading from.
+ * @return              Status code describing the result of the operation. */
+static status_t host_disk_read_blocks(disk_device_t *disk, void *buf, size_t count, uint64_t lba) {
+  host_disk_t *host = (host_disk_t *)disk;
+
+  host_disk_stats.reads++;
+  host_disk_stats.blocks += count;
+  host_disk_stats.bytes += count * disk->block_size;
+  if (lba != host->next_lba)
+    host_disk_stats.seeks++;
+
+  host->next_lba = lba + count;
+
+  if (host_file_read(host->fd, buf, count * disk->block_size, lba * disk->block_size) != 0)
+    return STATUS_DEVICE_ERROR;
+
+  return STATUS_SUCCESS;
+}
+
+/** Get file-backed disk identification information.
+ * @param disk          Disk to identify.
+ * @param type          Type of the information to get.
+ * @param buf           Where to store identification string.
+ * @param size          Size of the buffer. */
+static void host_disk_identify(disk_device_t *disk, device_identify_t type, char *buf, size_t size) {
+  if (type == DEVICE_IDENTIFY_SHORT)
+    snprintf(buf, size, "File-backed disk");
+}
+
+/** Operations for a file-backed disk. */
+static disk_ops_t host_disk_ops = {
+  .read_blocks = host_disk_read_blocks,
+  .identify = host_disk_identify,
+};
+
+/** Open an image file and register it as a disk.
+ * @param path          Path to the image file.
+ * @param type          Type of the disk.
+ * @param block_size    Block size to present.
+ * @return              Pointer to disk, or NULL if the file could not be
+ *                      opened. */
+host_disk_t *host_disk_open(const char *path, disk_type_t type, size_t block_size) {
+  unsigned long long size;
+  host_disk_t *host;
+  int fd;
+
+  fd = host_file_open(path, &size);
+  if (fd < 0)
+    return NULL;
+
+  host = malloc(sizeof(*host));
+  host->fd = fd;
+  host->next_lba = 0;
+  host->disk.type = type;
+  host->disk.ops = &host_disk_ops;
+  host->disk.block_size = block_size;
+  host->disk.blocks = size / block_size;
+
+  disk_device_register(&host->disk, true);
+  return host;
+}
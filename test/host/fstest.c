@@ -0,0 +1,380 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               Hosted filesystem test and benchmark harness.
+ *
+ * This runs the loader's disk, partition and filesystem code on top of a disk
+ * image file and reports, for each operation, the number of block reads
+ * issued, how many of those were not contiguous with the previous read, the
+ * number of bytes transferred and the wall time taken.
+ *
+ * Usage: fstest [-v] [-c] [-b <block size>] <image> [<path>[=<checksum>]...]
+ *
+ * Each path is looked up and then, if it is a directory, listed (and each
+ * entry opened both by cookie and by name, checking that they agree), or if it
+ * is a regular file, read sequentially and at random offsets. If a checksum is
+ * given (FNV-1a of the file contents, in hex) the sequential read is checked
+ * against it, and the harness exits with a failure status on any mismatch or
+ * error so it can also be used as a test.
+ *
+ * Regular files are first read in one go, as modules are loaded, and that
+ * read is checked against the checksum as well.
+ */
+
+#include <lib/string.h>
+#include <lib/utility.h>
+
+#include <fs.h>
+#include <host.h>
+#include <host_disk.h>
+#include <loader.h>
+#include <memory.h>
+
+/** Size of each sequential read (matches what the loader uses for modules). */
+#define SEQ_READ_SIZE           (64 * 1024)
+
+/** Size and number of random reads. */
+#define RANDOM_READ_SIZE        4096
+#define RANDOM_READ_COUNT       64
+
+/** Size of the buffer for batched directory reads. */
+#define DIR_BUF_SIZE            4096
+
+/** Whether to print debug output. */
+bool host_verbose;
+
+/** Whether any operation has failed. */
+static bool failed;
+
+/** Measurement state for an operation. */
+typedef struct measure {
+  const char *op;                     /**< Name of the operation. */
+  const char *path;                   /**< Path operated on. */
+  uint64_t start;                     /**< Start time. */
+} measure_t;
+
+/** Begin measuring an operation.
+ * @param measure       Measurement state.
+ * @param op            Name of the operation.
+ * @param path          Path operated on. */
+static void measure_begin(measure_t *measure, const char *op, const char *path) {
+  memset(&host_disk_stats, 0, sizeof(host_disk_stats));
+  measure->op = op;
+  measure->path = path;
+  measure->start = host_time_usec();
+}
+
+/** Finish measuring an operation and print the results.
+ * @param measure       Measurement state.
+ * @param items         Number of items processed (entries/reads).
+ * @param ret           Result of the operation. */
+static void measure_end(measure_t *measure, uint64_t items, status_t ret) {
+  uint64_t usec = host_time_usec() - measure->start;
+
+  printf(
+    "%-8s %-28s %6" PRIu64 " %7" PRIu64 " %6" PRIu64 " %10" PRIu64 " %9" PRIu64 "  %pS\n",
+    measure->op, measure->path, items, host_disk_stats.reads, host_disk_stats.seeks,
+    host_disk_stats.bytes, usec, ret);
+
+  if (ret != STATUS_SUCCESS)
+    failed = true;
+}
+
+/** Update an FNV-1a checksum.
+ * @param hash          Current hash value.
+ * @param buf           Data to add.
+ * @param size          Size of data.
+ * @return              New hash value. */
+static uint32_t fnv1a(uint32_t hash, const uint8_t *buf, size_t size) {
+  while (size--)
+    hash = (hash ^ *buf++) * 16777619;
+
+  return hash;
+}
+
+/** Directory iteration callback to count entries.
+ * @param entry         Entry that was found.
+ * @param _count        Pointer to count.
+ * @return              Whether to continue iteration. */
+static bool count_entries_cb(const fs_entry_t *entry, void *_count) {
+  (*(uint64_t *)_count)++;
+  return true;
+}
+
+/** Check that records open the same entries by cookie as by name.
+ * @param handle        Handle to the directory.
+ * @param path          Path to the directory.
+ * @param record        First record in the batch.
+ * @param count         Number of records in the batch.
+ * @return              Status code describing the result of the operation. */
+static status_t check_records(fs_handle_t *handle, const char *path, fs_dir_record_t *record, size_t count) {
+  for (size_t i = 0; i < count; i++, record = fs_dir_record_next(record)) {
+    fs_handle_t *by_cookie __cleanup_close = NULL;
+    fs_handle_t *by_name __cleanup_close = NULL;
+    status_t ret;
+
+    ret = fs_open_cookie(handle, record, FILE_TYPE_NONE, &by_cookie);
+    if (ret != STATUS_SUCCESS)
+      return ret;
+
+    ret = fs_open(record->name, handle, FILE_TYPE_NONE, &by_name);
+    if (ret != STATUS_SUCCESS)
+      return ret;
+
+    if (by_cookie->type != by_name->type || by_cookie->size != by_name->size) {
+      printf(
+        "%-8s %-28s %s: cookie opened type %u size %" PRIu64 ", name opened type %u size %" PRIu64 "\n",
+        "cookie", path, record->name, by_cookie->type, by_cookie->size, by_name->type, by_name->size);
+      failed = true;
+    }
+  }
+
+  return STATUS_SUCCESS;
+}
+
+/** List a directory.
+ * @param handle        Handle to the directory.
+ * @param path          Path to the directory. */
+static void test_dir(fs_handle_t *handle, const char *path) {
+  void *buf __cleanup_free = NULL;
+  offset_t cursor = 0;
+  measure_t measure;
+  uint64_t count = 0;
+  status_t ret;
+
+  measure_begin(&measure, "iterate", path);
+  ret = fs_iterate(handle, count_entries_cb, &count);
+  measure_end(&measure, count, ret);
+
+  buf = malloc(DIR_BUF_SIZE);
+  count = 0;
+
+  measure_begin(&measure, "readdir", path);
+  while (true) {
+    size_t batch;
+
+    ret = fs_read_dir(handle, &cursor, buf, DIR_BUF_SIZE, &batch);
+    if (ret != STATUS_SUCCESS || !batch)
+      break;
+
+    count += batch;
+  }
+
+  /* Not all filesystems support batched reads, that is not a failure. */
+  if (ret == STATUS_NOT_SUPPORTED)
+    return;
+
+  measure_end(&measure, count, ret);
+
+  cursor = 0;
+  count = 0;
+
+  measure_begin(&measure, "cookie", path);
+  while (true) {
+    size_t batch;
+
+    ret = fs_read_dir(handle, &cursor, buf, DIR_BUF_SIZE, &batch);
+    if (ret != STATUS_SUCCESS || !batch)
+      break;
+
+    ret = check_records(handle, path, buf, batch);
+    if (ret != STATUS_SUCCESS)
+      break;
+
+    count += batch;
+  }
+
+  measure_end(&measure, count, ret);
+}
+
+/** Check a file checksum.
+ * @param path          Path to the file.
+ * @param checksum      Expected checksum, or NULL to not check.
+ * @param hash          Actual checksum. */
+static void check_checksum(const char *path, const char *checksum, uint32_t hash) {
+  if (checksum && strtoul(checksum, NULL, 16) != hash) {
+    printf("%-8s %-28s expected %s, got %08x\n", "checksum", path, checksum, hash);
+    failed = true;
+  }
+}
+
+/** Read a file in one go, sequentially and at random offsets.
+ * @param handle        Handle to the file.
+ * @param path          Path to the file.
+ * @param checksum      Expected checksum, or NULL to not check. */
+static void test_file(fs_handle_t *handle, const char *path, const char *checksum) {
+  uint8_t *buf __cleanup_free = NULL;
+  measure_t measure;
+  offset_t offset;
+  uint64_t count;
+  uint32_t hash, seed;
+  status_t ret = STATUS_SUCCESS;
+
+  buf = malloc(max(handle->size, SEQ_READ_SIZE));
+
+  measure_begin(&measure, "fullread", path);
+  ret = fs_read(handle, buf, handle->size, 0);
+  measure_end(&measure, 1, ret);
+
+  if (ret == STATUS_SUCCESS)
+    check_checksum(path, checksum, fnv1a(2166136261u, buf, handle->size));
+
+  measure_begin(&measure, "seqread", path);
+  hash = 2166136261u;
+  for (offset = 0, count = 0; offset < handle->size; offset += SEQ_READ_SIZE, count++) {
+    size_t size = min(handle->size - offset, SEQ_READ_SIZE);
+
+    ret = fs_read(handle, buf, size, offset);
+    if (ret != STATUS_SUCCESS)
+      break;
+
+    hash = fnv1a(hash, buf, size);
+  }
+
+  measure_end(&measure, count, ret);
+
+  if (ret == STATUS_SUCCESS)
+    check_checksum(path, checksum, hash);
+
+  if (handle->size < RANDOM_READ_SIZE)
+    return;
+
+  /* Use a fixed seed so that runs are comparable. */
+  seed = 1;
+
+  measure_begin(&measure, "randread", path);
+  for (count = 0; count < RANDOM_READ_COUNT; count++) {
+    seed = (seed * 1103515245) + 12345;
+    offset = ((offset_t)seed << 16) % (handle->size - RANDOM_READ_SIZE + 1);
+
+    ret = fs_read(handle, buf, RANDOM_READ_SIZE, offset);
+    if (ret != STATUS_SUCCESS)
+      break;
+  }
+
+  measure_end(&measure, count, ret);
+}
+
+/** Test a path.
+ * @param arg           Path argument, optionally followed by =<checksum>. */
+static void test_path(char *arg) {
+  fs_handle_t *handle;
+  measure_t measure;
+  char *path;
+  status_t ret;
+
+  path = strsep(&arg, "=");
+
+  measure_begin(&measure, "lookup", path);
+  ret = fs_open(path, NULL, FILE_TYPE_NONE, &handle);
+  measure_end(&measure, 1, ret);
+
+  if (ret != STATUS_SUCCESS)
+    return;
+
+  if (handle->type == FILE_TYPE_DIR) {
+    test_dir(handle, path);
+  } else {
+    test_file(handle, path, arg);
+  }
+
+  fs_close(handle);
+}
+
+/** Find a mounted filesystem on a disk.
+ * @param disk          Disk to search.
+ * @return              Device with a filesystem, or NULL if none found. */
+static device_t *find_mount(disk_device_t *disk) {
+  if (disk->device.mount)
+    return &disk->device;
+
+  list_foreach(&disk->raw.partitions, iter) {
+    disk_device_t *partition = list_entry(iter, disk_device_t, partition.link);
+
+    if (partition->device.mount)
+      return &partition->device;
+  }
+
+  return NULL;
+}
+
+/** Print usage information and exit. */
+static __noreturn void usage(void) {
+  printf("Usage: fstest [-v] [-c] [-b <block size>] <image> [<path>[=<checksum>]...]\n");
+  host_exit(2);
+}
+
+/** Main function of the harness.
+ * @param argc          Argument count.
+ * @param argv          Argument array.
+ * @return              0 on success, 1 if any operation failed. */
+int main(int argc, char **argv) {
+  disk_type_t type = DISK_TYPE_HD;
+  size_t block_size = 512;
+  host_disk_t *disk;
+  measure_t measure;
+  int i;
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+    if (strcmp(argv[i], "-v") == 0) {
+      host_verbose = true;
+    } else if (strcmp(argv[i], "-c") == 0) {
+      type = DISK_TYPE_CDROM;
+      block_size = 2048;
+    } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+      block_size = strtoul(argv[++i], NULL, 0);
+    } else {
+      usage();
+    }
+  }
+
+  if (i >= argc || !block_size)
+    usage();
+
+  printf("%-8s %-28s %6s %7s %6s %10s %9s\n", "op", "path", "items", "reads", "seeks", "bytes", "usec");
+
+  measure_begin(&measure, "mount", argv[i]);
+  disk = host_disk_open(argv[i], type, block_size);
+  if (disk) {
+    boot_device = find_mount(&disk->disk);
+    if (boot_device) {
+      measure_end(&measure, 1, STATUS_SUCCESS);
+      printf("%-8s %-28s %s\n", "fs", boot_device->name, boot_device->mount->ops->name);
+    } else {
+      measure_end(&measure, 0, STATUS_UNKNOWN_FS);
+    }
+  } else {
+    measure_end(&measure, 0, STATUS_NOT_FOUND);
+  }
+
+  if (!boot_device)
+    return 1;
+
+  for (i++; i < argc; i++)
+    test_path(argv[i]);
+
+  return (failed) ? 1 : 0;
+}
@@ -0,0 +1,136 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               Hosted loader heap tests.
+ *
+ * This checks the interaction between the heap, arenas and the memory
+ * manager. The memory manager allocates its bookkeeping with malloc(), so
+ * when the heap grows while an arena is current, that bookkeeping must still
+ * come from the heap: it has to outlive the arena.
+ *
+ * Usage: heaptest
+ *
+ * Each test prints a line giving its name and result. The exit status is 0
+ * if all tests passed, and 1 otherwise.
+ */
+
+#include <lib/string.h>
+#include <lib/utility.h>
+
+#include <host.h>
+#include <loader.h>
+#include <memory.h>
+
+/** Number of allocations made from the arena (enough to grow the heap). */
+#define ARENA_ALLOCS            256
+
+/** Size of each arena allocation. */
+#define ARENA_ALLOC_SIZE        4096
+
+/** Number of heap allocations made to reuse the memory of a freed arena. */
+#define REUSE_ALLOCS            512
+
+/** Fill pattern used to overwrite reused memory. */
+#define REUSE_PATTERN           0xa5
+
+/** Whether to print debug output (always off). */
+bool host_verbose;
+
+/** Check that the memory manager's view of its ranges is intact.
+ * @return              Number of ranges, or 0 if the map is corrupt. */
+static size_t check_memory_map(void) {
+  size_t count = 0;
+  list_t map;
+
+  memory_snapshot(&map);
+
+  list_foreach(&map, iter) {
+    memory_range_t *range = list_entry(iter, memory_range_t, header);
+
+    if (!range->size || range->size % PAGE_SIZE || range->start % PAGE_SIZE || range->type != MEMORY_TYPE_INTERNAL) {
+      printf(
+        "  bad range 0x%" PRIxPHYS "-0x%" PRIxPHYS " (type %u)\n",
+        range->start, range->start + range->size, range->type);
+      count = 0;
+      break;
+    }
+
+    count++;
+  }
+
+  memory_map_free(&map);
+  return count;
+}
+
+/** Grow the heap while an arena is current, then destroy the arena.
+ * @return              Whether the test passed. */
+static bool test_arena_heap_grow(void) {
+  void *reuse[REUSE_ALLOCS];
+  arena_t *arena, *prev;
+  size_t before, after;
+
+  before = check_memory_map();
+
+  arena = arena_create();
+  prev = arena_set_current(arena);
+
+  for (size_t i = 0; i < ARENA_ALLOCS; i++)
+    memset(malloc(ARENA_ALLOC_SIZE), 0, ARENA_ALLOC_SIZE);
+
+  arena_set_current(prev);
+  arena_destroy(arena);
+
+  /* Overwrite the memory that the arena used. */
+  for (size_t i = 0; i < REUSE_ALLOCS; i++) {
+    reuse[i] = malloc(ARENA_ALLOC_SIZE / 2);
+    memset(reuse[i], REUSE_PATTERN, ARENA_ALLOC_SIZE / 2);
+  }
+
+  after = check_memory_map();
+
+  for (size_t i = 0; i < REUSE_ALLOCS; i++)
+    free(reuse[i]);
+
+  if (after <= before) {
+    printf("  heap did not grow (%zu ranges before, %zu after)\n", before, after);
+    return false;
+  }
+
+  return true;
+}
+
+/** Main function of the heap tests.
+ * @param argc          Argument count.
+ * @param argv          Argument array.
+ * @return              0 if all tests passed, 1 otherwise. */
+int main(int argc, char **argv) {
+  bool passed;
+
+  passed = test_arena_heap_grow();
+  printf("arena-heap-grow: %s\n", (passed) ? "ok" : "FAILED");
+
+  return (passed) ? 0 : 1;
+}
@@ -0,0 +1,51 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               Hosted test harness system interface.
+ *
+ * The loader sources are built freestanding against the loader's own headers,
+ * so they cannot include the host C library headers. This interface is the
+ * only point of contact between the two: it is implemented in posix.c, which
+ * is built against the host headers, and only uses types common to both.
+ */
+
+#ifndef __HOST_H
+#define __HOST_H
+
+#include <stddef.h>
+
+extern int host_file_open(const char *path, unsigned long long *_size);
+extern void host_file_close(int fd);
+extern int host_file_read(int fd, void *buf, size_t count, unsigned long long offset);
+
+extern void *host_alloc(size_t size, size_t align);
+extern void host_free(void *addr);
+
+extern void host_write(int fd, const char *buf, size_t count);
+extern unsigned long long host_time_usec(void);
+extern void host_exit(int status) __attribute__((noreturn));
+
+#endif /* __HOST_H */
@@ -0,0 +1,55 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               File-backed disk device.
+ */
+
+#ifndef __HOST_DISK_H
+#define __HOST_DISK_H
+
+#include <disk.h>
+
+/** I/O statistics for file-backed disks. */
+typedef struct host_disk_stats {
+  uint64_t reads;                     /**< Number of read_blocks() calls. */
+  uint64_t seeks;                     /**< Reads not following on from the last. */
+  uint64_t blocks;                    /**< Number of blocks read. */
+  uint64_t bytes;                     /**< Number of bytes read. */
+} host_disk_stats_t;
+
+/** File-backed disk device structure. */
+typedef struct host_disk {
+  disk_device_t disk;                 /**< Disk device header. */
+
+  int fd;                             /**< Backing file descriptor. */
+  uint64_t next_lba;                  /**< Block following the last read. */
+} host_disk_t;
+
+extern host_disk_stats_t host_disk_stats;
+
+extern host_disk_t *host_disk_open(const char *path, disk_type_t type, size_t block_size);
+
+#endif /* __HOST_DISK_H */
@@ -0,0 +1,510 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * @file
+ * @brief               Hosted loader library benchmarks.
+ *
+ * This times the hot paths of the loader's library code built for the host:
+ * memory copies and fills, printf formatting, the heap, the virtual address
+ * allocator, qsort and the inflate core used for gzip decompression. Each
+ * benchmark is run several times and the fastest run is reported, which
+ * filters out most of the noise from the rest of the system.
+ *
+ * Usage: libbench [-r <runs>] [<gzip file>...]
+ *
+ * Each gzip file (e.g. a real kernel or initrd) is decompressed in one go to
+ * measure inflate throughput. One line is printed per benchmark giving its
+ * name, the number of operations in each run, the time per operation in
+ * nanoseconds and, for benchmarks that process data, the throughput in MB/s.
+ * The SConscript compares the time per operation against a saved baseline.
+ */
+
+#include <lib/allocator.h>
+#include <lib/string.h>
+#include <lib/tinfl.h>
+#include <lib/utility.h>
+
+#include <x86/string.h>
+
+#include <host.h>
+#include <loader.h>
+#include <memory.h>
+
+/** Default number of runs of each benchmark. */
+#define DEFAULT_RUNS            5
+
+/** Size of the buffers used by the string benchmarks. */
+#define STRING_BUF_SIZE         (4 * 1024 * 1024)
+
+/** Number of bytes processed by each run of a string benchmark. */
+#define STRING_RUN_BYTES        (256 * 1024 * 1024)
+
+/** Maximum number of operations in each run of a string benchmark. */
+#define STRING_MAX_OPS          (4 * 1024 * 1024)
+
+/** Heap benchmark parameters. */
+#define HEAP_SLOTS              1024
+#define HEAP_OPS                (1024 * 1024)
+
+/** Number of ranges used by the allocator benchmarks. */
+#define ALLOCATOR_RANGES        4096
+
+/** Number of formatting operations per printf benchmark run. */
+#define PRINTF_OPS              (256 * 1024)
+
+/** Number of entries sorted by the qsort benchmark. */
+#define QSORT_ENTRIES           (64 * 1024)
+
+/** gzip header flags. */
+#define GZIP_FHCRC              (1<<1)
+#define GZIP_FEXTRA             (1<<2)
+#define GZIP_FNAME              (1<<3)
+#define GZIP_FCOMMENT           (1<<4)
+
+/** Benchmark function type.
+ * @param data          Data for the benchmark.
+ * @param ops           Number of operations to perform. */
+typedef void (*bench_func_t)(void *data, uint64_t ops);
+
+/** Whether to print debug output. */
+bool host_verbose;
+
+/** Number of runs of each benchmark. */
+static unsigned bench_runs = DEFAULT_RUNS;
+
+/** Buffers for the string benchmarks. These are global so that the compiler
+ * cannot decide that writes to them are unused. */
+uint8_t *bench_src;
+uint8_t *bench_dest;
+
+/** State of the pseudo-random number generator. */
+static uint32_t bench_seed;
+
+/** Get a pseudo-random number (xorshift32).
+ * @return              Pseudo-random number. */
+static uint32_t bench_random(void) {
+  bench_seed ^= bench_seed << 13;
+  bench_seed ^= bench_seed >> 17;
+  bench_seed ^= bench_seed << 5;
+  return bench_seed;
+}
+
+/** Run a benchmark and print the result.
+ * @param name          Name of the benchmark.
+ * @param func          Function to run.
+ * @param data          Data for the function.
+ * @param ops           Number of operations in each run.
+ * @param bytes         Bytes processed by each operation (0 if not relevant). */
+static void bench_run(const char *name, bench_func_t func, void *data, uint64_t ops, uint64_t bytes) {
+  uint64_t best = ~(uint64_t)0;
+  uint64_t centi_ns;
+
+  for (unsigned i = 0; i < bench_runs; i++) {
+    uint64_t start;
+
+    /* Each run sees the same random sequence. */
+    bench_seed = 0x2545f491;
+
+    start = host_time_usec();
+    func(data, ops);
+    best = min(best, host_time_usec() - start);
+  }
+
+  best = max(best, (uint64_t)1);
+  centi_ns = (best * 100000) / ops;
+
+  printf("%-24s %10" PRIu64 " %9" PRIu64 ".%02" PRIu64, name, ops, centi_ns / 100, centi_ns % 100);
+
+  /* Bytes per microsecond is (decimal) megabytes per second. */
+  if (bytes) {
+    printf(" %8" PRIu64 "\n", (bytes * ops) / best);
+  } else {
+    printf(" %8s\n", "-");
+  }
+}
+
+/**
+ * String benchmarks.
+ */
+
+/** Copy benchmark. */
+static void bench_memcpy(void *data, uint64_t ops) {
+  size_t size = *(size_t *)data;
+
+  while (ops--)
+    memcpy(bench_dest, bench_src, size);
+}
+
+/** Forward overlapping move benchmark (as when scrolling the console). */
+static void bench_memmove_forward(void *data, uint64_t ops) {
+  size_t size = *(size_t *)data;
+
+  while (ops--)
+    memmove(bench_dest, bench_dest + 64, size);
+}
+
+/** Backward overlapping move benchmark. */
+static void bench_memmove_backward(void *data, uint64_t ops) {
+  size_t size = *(size_t *)data;
+
+  while (ops--)
+    memmove(bench_dest + 64, bench_dest, size);
+}
+
+/** Fill benchmark. */
+static void bench_memset(void *data, uint64_t ops) {
+  size_t size = *(size_t *)data;
+
+  while (ops--)
+    memset(bench_dest, (uint8_t)ops, size);
+}
+
+/** Run a string benchmark over a range of sizes.
+ * @param name          Base name of the benchmark.
+ * @param func          Function to run.
+ * @param sizes         Array of sizes (0 terminated). */
+static void run_string_bench(const char *name, bench_func_t func, const size_t *sizes) {
+  char buf[32];
+
+  for (size_t i = 0; sizes[i]; i++) {
+    size_t size = sizes[i];
+
+    if (size >= 1024 * 1024) {
+      snprintf(buf, sizeof(buf), "%s-%zuM", name, size / (1024 * 1024));
+    } else if (size >= 1024) {
+      snprintf(buf, sizeof(buf), "%s-%zuK", name, size / 1024);
+    } else {
+      snprintf(buf, sizeof(buf), "%s-%zu", name, size);
+    }
+
+    bench_run(buf, func, &size, min(STRING_RUN_BYTES / size, STRING_MAX_OPS), size);
+  }
+}
+
+/**
+ * printf benchmark.
+ */
+
+/** Format typical debug log lines. */
+static void bench_printf(void *data, uint64_t ops) {
+  char buf[128];
+
+  while (ops--) {
+    snprintf(
+      buf, sizeof(buf), "memory: allocated 0x%" PRIx64 "-0x%" PRIx64 " (align: 0x%" PRIx64 ", type: %u)\n",
+      ops * PAGE_SIZE, (ops + 16) * PAGE_SIZE, (uint64_t)PAGE_SIZE, (unsigned)(ops & 7));
+    snprintf(
+      buf, sizeof(buf), "initium: loading %s (%zu bytes) at %p, %d modules\n",
+      "/boot/kernel", (size_t)ops, buf, (int)(ops & 63));
+  }
+}
+
+/**
+ * Heap benchmark.
+ */
+
+/** Randomly allocate and free blocks of mostly small sizes. */
+static void bench_heap(void *data, uint64_t ops) {
+  void **slots = data;
+
+  while (ops--) {
+    uint32_t rand = bench_random();
+    size_t slot = rand % HEAP_SLOTS;
+
+    if (slots[slot]) {
+      free(slots[slot]);
+      slots[slot] = NULL;
+    } else {
+      /* Mostly small allocations, with a tail of larger ones. */
+      size_t size = (rand >> 16) & ((rand & (1 << 10)) ? 4095 : 127);
+      slots[slot] = malloc(size + 1);
+    }
+  }
+
+  for (size_t i = 0; i < HEAP_SLOTS; i++) {
+    free(slots[i]);
+    slots[i] = NULL;
+  }
+}
+
+/**
+ * Allocator benchmarks. The allocator has no way to destroy it, so each run
+ * leaks its tracking structures; the amount is small enough not to matter.
+ */
+
+/** Insert single pages at random, leaving a gap between each. */
+static void bench_allocator_insert(void *data, uint64_t ops) {
+  uint32_t *order = data;
+  allocator_t alloc;
+
+  allocator_init(&alloc, 0x100000000ull, (load_size_t)ops * 2 * PAGE_SIZE);
+
+  for (uint64_t i = 0; i < ops; i++)
+    allocator_insert(&alloc, 0x100000000ull + ((load_ptr_t)order[i] * 2 * PAGE_SIZE), PAGE_SIZE);
+}
+
+/** Allocate ranges of varying size and alignment. */
+static void bench_allocator_alloc(void *data, uint64_t ops) {
+  allocator_t alloc;
+  load_ptr_t addr;
+
+  allocator_init(&alloc, 0x100000000ull, 0x100000000ull);
+
+  while (ops--) {
+    uint32_t rand = bench_random();
+    load_size_t size = ((rand % 16) + 1) * PAGE_SIZE;
+    load_size_t align = (rand & (1 << 8)) ? 0x10000 : 0;
+
+    allocator_alloc(&alloc, size, align, &addr);
+  }
+}
+
+/**
+ * qsort benchmark.
+ */
+
+/** Compare two 32-bit integers.
+ * @param a             First integer.
+ * @param b             Second integer.
+ * @return              Comparison result. */
+static int compare_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+/** Sort random integers. */
+static void bench_qsort(void *data, uint64_t ops) {
+  uint32_t *array = data;
+
+  while (ops--) {
+    for (size_t i = 0; i < QSORT_ENTRIES; i++)
+      array[i] = bench_random();
+
+    qsort(array, QSORT_ENTRIES, sizeof(*array), compare_u32);
+  }
+}
+
+/**
+ * Inflate benchmark.
+ */
+
+/** gzip file being decompressed. */
+typedef struct inflate_file {
+  tinfl_decompressor decompressor;    /**< Decompression state. */
+  const uint8_t *data;                /**< Deflate stream. */
+  size_t size;                        /**< Size of the deflate stream. */
+  uint8_t *out;                       /**< Output buffer. */
+  size_t out_size;                    /**< Decompressed size. */
+  bool failed;                        /**< Whether decompression failed. */
+} inflate_file_t;
+
+/** Decompress a whole file into a buffer large enough to hold it. */
+static void bench_inflate(void *data, uint64_t ops) {
+  inflate_file_t *file = data;
+
+  while (ops--) {
+    size_t in_size = file->size;
+    size_t out_size = file->out_size;
+    tinfl_status status;
+
+    tinfl_init(&file->decompressor);
+    status = tinfl_decompress(
+      &file->decompressor, file->data, &in_size, file->out, file->out, &out_size,
+      TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
+    if (status != TINFL_STATUS_DONE || out_size != file->out_size)
+      file->failed = true;
+  }
+}
+
+/** Get the size of a gzip header.
+ * @param buf           File data.
+ * @param size          Size of the file.
+ * @return              Size of the header, or 0 if not a valid gzip file. */
+static size_t gzip_header_size(const uint8_t *buf, size_t size) {
+  size_t offset = 10;
+  uint8_t flags;
+
+  /* Need at least the header and the 8 byte trailer. */
+  if (size < 18 || buf[0] != 0x1f || buf[1] != 0x8b || buf[2] != 8)
+    return 0;
+
+  flags = buf[3];
+
+  if (flags & GZIP_FEXTRA)
+    offset += 2 + (buf[offset] | (buf[offset + 1] << 8));
+  if (flags & GZIP_FNAME) {
+    while (offset < size && buf[offset++])
+      ;
+  }
+  if (flags & GZIP_FCOMMENT) {
+    while (offset < size && buf[offset++])
+      ;
+  }
+  if (flags & GZIP_FHCRC)
+    offset += 2;
+
+  return (offset + 8 <= size) ? offset : 0;
+}
+
+/** Benchmark decompression of a gzip file.
+ * @param path          Path to the file.
+ * @return              Whether successful. */
+static bool run_inflate_bench(const char *path) {
+  unsigned long long size;
+  inflate_file_t *file;
+  const uint8_t *trailer;
+  const char *base;
+  uint8_t *buf;
+  size_t header;
+  char name[32];
+  int fd;
+
+  fd = host_file_open(path, &size);
+  if (fd < 0) {
+    printf("%s: cannot open\n", path);
+    return false;
+  }
+
+  buf = host_alloc(size, 16);
+  if (!buf || host_file_read(fd, buf, size, 0) != 0) {
+    printf("%s: cannot read\n", path);
+    host_free(buf);
+    host_file_close(fd);
+    return false;
+  }
+
+  host_file_close(fd);
+
+  header = gzip_header_size(buf, size);
+  if (!header) {
+    printf("%s: not a gzip file\n", path);
+    host_free(buf);
+    return false;
+  }
+
+  /* The trailer gives the decompressed size (modulo 4GB). */
+  trailer = buf + size - 4;
+  file = malloc(sizeof(*file));
+  file->data = buf + header;
+  file->size = size - header - 8;
+  file->out_size = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((uint32_t)trailer[3] << 24);
+  file->out = host_alloc(max(file->out_size, (size_t)1), 16);
+  file->failed = false;
+
+  base = strrchr(path, '/');
+  snprintf(name, sizeof(name), "inflate-%s", (base) ? base + 1 : path);
+
+  bench_run(name, bench_inflate, file, 1, file->out_size);
+
+  host_free(file->out);
+  host_free(buf);
+
+  if (file->failed) {
+    printf("%s: decompression failed (multi-member files are not supported)\n", path);
+    free(file);
+    return false;
+  }
+
+  free(file);
+  return true;
+}
+
+/** Print usage information and exit. */
+static __noreturn void usage(void) {
+  printf("Usage: libbench [-r <runs>] [<gzip file>...]\n");
+  host_exit(2);
+}
+
+/** Main function of the benchmarks.
+ * @param argc          Argument count.
+ * @param argv          Argument array.
+ * @return              0 on success, 1 if any benchmark failed. */
+int main(int argc, char **argv) {
+  static const size_t copy_sizes[] = { 16, 64, 256, 4096, 64 * 1024, 1024 * 1024, 4 * 1024 * 1024, 0 };
+  static const size_t move_sizes[] = { 256, 4096, 1024 * 1024, 0 };
+  static const size_t set_sizes[] = { 64, 4096, 1024 * 1024, 4 * 1024 * 1024, 0 };
+  bool failed = false;
+  void **slots;
+  uint32_t *array;
+  int i;
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+    if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      bench_runs = strtoul(argv[++i], NULL, 0);
+    } else {
+      usage();
+    }
+  }
+
+  if (!bench_runs)
+    usage();
+
+  /* Use the same implementations as the loader would on this CPU. */
+  x86_string_init();
+
+  bench_src = host_alloc(STRING_BUF_SIZE + PAGE_SIZE, PAGE_SIZE);
+  bench_dest = host_alloc(STRING_BUF_SIZE + PAGE_SIZE, PAGE_SIZE);
+  memset(bench_src, 0x5a, STRING_BUF_SIZE + PAGE_SIZE);
+  memset(bench_dest, 0xa5, STRING_BUF_SIZE + PAGE_SIZE);
+
+  printf("%-24s %10s %12s %8s\n", "benchmark", "ops", "ns/op", "MB/s");
+
+  run_string_bench("memcpy", bench_memcpy, copy_sizes);
+  run_string_bench("memmove-fwd", bench_memmove_forward, move_sizes);
+  run_string_bench("memmove-back", bench_memmove_backward, move_sizes);
+  run_string_bench("memset", bench_memset, set_sizes);
+
+  bench_run("printf", bench_printf, NULL, PRINTF_OPS, 0);
+
+  slots = malloc(HEAP_SLOTS * sizeof(*slots));
+  memset(slots, 0, HEAP_SLOTS * sizeof(*slots));
+  bench_run("heap-churn", bench_heap, slots, HEAP_OPS, 0);
+  free(slots);
+
+  /* Insert in a random order. */
+  array = malloc(max(ALLOCATOR_RANGES, QSORT_ENTRIES) * sizeof(*array));
+  for (uint32_t j = 0; j < ALLOCATOR_RANGES; j++)
+    array[j] = j;
+  bench_seed = 1;
+  for (uint32_t j = ALLOCATOR_RANGES - 1; j > 0; j--) {
+    uint32_t k = bench_random() % (j + 1);
+    swap(array[j], array[k]);
+  }
+
+  bench_run("allocator-insert", bench_allocator_insert, array, ALLOCATOR_RANGES, 0);
+  bench_run("allocator-alloc", bench_allocator_alloc, NULL, ALLOCATOR_RANGES, 0);
+  bench_run("qsort-64K", bench_qsort, array, 1, 0);
+  free(array);
+
+  for (; i < argc; i++) {
+    if (!run_inflate_bench(argv[i]))
+      failed = true;
+  }
+
+  return (failed) ? 1 : 0;
+}
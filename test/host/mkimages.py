@@ -0,0 +1,446 @@
+#
+# The MIT License (MIT)
+#
+# Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+#
+
+#
+# Generate disk images for the hosted filesystem test harness.
+#
+# Usage: mkimages.py <output directory>
+#
+# Each image contains the same tree, scaled to fit the image:
+#
+#   /boot/config            Small text file.
+#   /boot/kernel            Random (incompressible) data.
+#   /boot/initrd.gz         Gzip-compressed data.
+#   /boot/initrd.lz4        LZ4 frame, linked blocks with a content size.
+#   /boot/initrd-ind.lz4    LZ4 frame, independent blocks without a content
+#                           size, including some blocks stored uncompressed.
+#   /boot/initrd.zst        Zstandard frame with a content size.
+#   /boot/initrd-nosize.zst Zstandard frame without a content size, with a
+#                           content checksum.
+#   /boot/modules/modNNN    Many small files, for directory listing.
+#
+# The "-mbr" and "-gpt" variants place the filesystem in a partition on a
+# disk with an MBR or GPT partition table. The "-frag" variants interleave the kernel's blocks with filler files that
+# are then deleted, so that it is split into many extents/runs. The images
+# that can be generated depend on which tools are installed: e2fsprogs for
+# ext2/ext4, dosfstools and mtools for FAT, and xorriso, genisoimage or mkisofs
+# for ISO9660. Images that cannot be generated are skipped. The Zstandard files
+# are only included if libzstd can be loaded.
+#
+# A manifest, images.txt, is written with a line for each image giving the
+# arguments to pass to fstest, including expected checksums of each file.
+#
+
+from __future__ import print_function
+
+import ctypes, ctypes.util, gzip, hashlib, io, os, shutil, struct, subprocess, sys, tempfile, uuid, zlib
+
+# Size of each image in MB, kernel size and number of modules. FAT12 has to be
+# small to stay under the FAT12 cluster limit.
+images = [
+    # Name          Type        Size    Kernel      Modules Fragment
+    ('ext2',        'ext2',     32,     4 << 20,    256,    False),
+    ('ext2-frag',   'ext2',     32,     4 << 20,    256,    True),
+    ('ext2-mbr',    'ext2',     32,     4 << 20,    64,     False),
+    ('ext4',        'ext4',     32,     4 << 20,    256,    False),
+    ('ext4-frag',   'ext4',     32,     4 << 20,    256,    True),
+    ('ext4-gpt',    'ext4',     32,     4 << 20,    64,     False),
+    ('fat12',       'fat12',    2,      256 << 10,  32,     False),
+    ('fat16',       'fat16',    32,     4 << 20,    256,    False),
+    ('fat32',       'fat32',    64,     4 << 20,    256,    False),
+    ('fat32-frag',  'fat32',    64,     4 << 20,    256,    True),
+    ('iso9660',     'iso9660',  0,      4 << 20,    256,    False),
+]
+
+# Size of each module and number of filler files used to fragment.
+module_size = 8 << 10
+filler_count = 64
+
+def which(program):
+    for path in os.environ['PATH'].split(os.pathsep):
+        exe = os.path.join(path.strip('"'), program)
+        if os.path.isfile(exe) and os.access(exe, os.X_OK):
+            return exe
+    return None
+
+def run(*args):
+    with open(os.devnull, 'w') as null:
+        subprocess.check_call(list(args), stdout = null, stderr = null)
+
+# Generate deterministic pseudo-random data.
+def random_data(seed, size):
+    out = io.BytesIO()
+    i = 0
+    while out.tell() < size:
+        out.write(hashlib.sha256(('%s:%d' % (seed, i)).encode()).digest())
+        i += 1
+    return out.getvalue()[:size]
+
+# Generate compressible data.
+def text_data(size):
+    out = io.BytesIO()
+    i = 0
+    while out.tell() < size:
+        out.write(('line %d of the initrd, padded with some text\n' % (i)).encode())
+        i += 1
+    return out.getvalue()[:size]
+
+# FNV-1a checksum, as computed by fstest.
+def fnv1a(data):
+    h = 2166136261
+    for b in bytearray(data):
+        h = ((h ^ b) * 16777619) & 0xffffffff
+    return '%08x' % (h)
+
+def gzip_data(data):
+    out = io.BytesIO()
+    f = gzip.GzipFile(filename = '', mode = 'wb', fileobj = out, mtime = 0)
+    f.write(data)
+    f.close()
+    return out.getvalue()
+
+# xxHash32, needed for the LZ4 frame header checksum.
+def xxh32(data, seed = 0):
+    p1, p2, p3, p4, p5 = 2654435761, 2246822519, 3266489917, 668265263, 374761393
+    mask = 0xffffffff
+    rotl = lambda x, r: ((x << r) | (x >> (32 - r))) & mask
+    data = bytearray(data)
+    i = 0
+    if len(data) >= 16:
+        v = [(seed + p1 + p2) & mask, (seed + p2) & mask, seed, (seed - p1) & mask]
+        while i + 16 <= len(data):
+            for j in range(0, 4):
+                lane = struct.unpack_from('<I', data, i + (j * 4))[0]
+                v[j] = (rotl((v[j] + lane * p2) & mask, 13) * p1) & mask
+            i += 16
+        h = (rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18)) & mask
+    else:
+        h = (seed + p5) & mask
+    h = (h + len(data)) & mask
+    while i + 4 <= len(data):
+        h = (rotl((h + struct.unpack_from('<I', data, i)[0] * p3) & mask, 17) * p4) & mask
+        i += 4
+    while i < len(data):
+        h = (rotl((h + data[i] * p5) & mask, 11) * p1) & mask
+        i += 1
+    h = ((h ^ (h >> 15)) * p2) & mask
+    h = ((h ^ (h >> 13)) * p3) & mask
+    return h ^ (h >> 16)
+
+def lz4_length(out, length):
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+# Compress one LZ4 block with a simple greedy matcher. Matches can refer back
+# to base (the start of the block for independent blocks, or the start of the
+# data for linked ones), within the 64K window.
+def lz4_block(data, start, end, base, table):
+    out = bytearray()
+    i = anchor = start
+    while i < end - 12:
+        key = data[i:i + 4]
+        j = table.get(key)
+        table[key] = i
+        if j is None or j < base or i - j > 65535:
+            i += 1
+            continue
+
+        # Extend the match in chunks, then a byte at a time.
+        length = 4
+        limit = end - 5 - i
+        for step in (256, 16, 1):
+            while length + step <= limit and data[i + length:i + length + step] == data[j + length:j + length + step]:
+                length += step
+
+        literals = i - anchor
+        out.append((min(literals, 15) << 4) | min(length - 4, 15))
+        if literals >= 15:
+            lz4_length(out, literals - 15)
+        out += data[anchor:i]
+        out += struct.pack('<H', i - j)
+        if length - 4 >= 15:
+            lz4_length(out, length - 4 - 15)
+        i = anchor = i + length
+
+    literals = end - anchor
+    out.append(min(literals, 15) << 4)
+    if literals >= 15:
+        lz4_length(out, literals - 15)
+    out += data[anchor:end]
+    return out
+
+# Generate an LZ4 frame. block_id gives the maximum block size (4 = 64K,
+# 5 = 256K, 6 = 1M, 7 = 4M).
+def lz4_data(data, block_id, linked, content_size):
+    block_size = 1 << (8 + (2 * block_id))
+    desc = bytearray([0x40 | (0 if linked else 0x20) | (0x08 if content_size else 0), block_id << 4])
+    if content_size:
+        desc += struct.pack('<Q', len(data))
+    out = bytearray(struct.pack('<I', 0x184d2204)) + desc
+    out.append((xxh32(desc) >> 8) & 0xff)
+
+    table = {}
+    for start in range(0, len(data), block_size):
+        end = min(start + block_size, len(data))
+        if not linked:
+            table = {}
+        block = lz4_block(data, start, end, 0 if linked else start, table)
+        if len(block) >= end - start:
+            out += struct.pack('<I', 0x80000000 | (end - start)) + data[start:end]
+        else:
+            out += struct.pack('<I', len(block)) + block
+    out += struct.pack('<I', 0)
+    return bytes(out)
+
+# Compress data with libzstd, or return None if it is not available.
+def zstd_data(data, level, content_size, checksum):
+    name = ctypes.util.find_library('zstd')
+    if not name:
+        return None
+    lib = ctypes.CDLL(name)
+    lib.ZSTD_createCCtx.restype = ctypes.c_void_p
+    lib.ZSTD_compressBound.restype = ctypes.c_size_t
+    lib.ZSTD_compress2.restype = ctypes.c_size_t
+    lib.ZSTD_isError.restype = ctypes.c_uint
+
+    # Parameter IDs from zstd.h.
+    ZSTD_c_compressionLevel = 100
+    ZSTD_c_contentSizeFlag = 200
+    ZSTD_c_checksumFlag = 201
+
+    cctx = ctypes.c_void_p(lib.ZSTD_createCCtx())
+    lib.ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level)
+    lib.ZSTD_CCtx_setParameter(cctx, ZSTD_c_contentSizeFlag, int(content_size))
+    lib.ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, int(checksum))
+    bound = lib.ZSTD_compressBound(ctypes.c_size_t(len(data)))
+    out = ctypes.create_string_buffer(bound)
+    size = lib.ZSTD_compress2(cctx, out, ctypes.c_size_t(bound), data, ctypes.c_size_t(len(data)))
+    lib.ZSTD_freeCCtx(cctx)
+    if lib.ZSTD_isError(ctypes.c_size_t(size)):
+        return None
+    return out.raw[:size]
+
+# Generate the file tree for an image. Returns a list of (path, data, checksum)
+# tuples, in the order that they should be written. Trees are cached, as
+# compressing the initrds is slow.
+tree_cache = {}
+
+def make_tree(kernel_size, modules):
+    if (kernel_size, modules) not in tree_cache:
+        tree_cache[(kernel_size, modules)] = generate_tree(kernel_size, modules)
+    return tree_cache[(kernel_size, modules)]
+
+def generate_tree(kernel_size, modules):
+    initrd = text_data(kernel_size * 4)
+    mixed = text_data(kernel_size) + random_data('initrd', 512 << 10) + bytes(bytearray(64 << 10)) + text_data(kernel_size)
+    files = [
+        ('boot/config', b'kernel /boot/kernel\nmodule /boot/initrd.gz\n'),
+        ('boot/kernel', random_data('kernel', kernel_size)),
+        ('boot/initrd.gz', gzip_data(initrd)),
+        ('boot/initrd.lz4', lz4_data(initrd, 4, True, True)),
+        ('boot/initrd-ind.lz4', lz4_data(mixed, 5, False, False)),
+        ('boot/initrd.zst', zstd_data(initrd, 3, True, False)),
+        ('boot/initrd-nosize.zst', zstd_data(mixed, 19, False, True)),
+    ]
+    files = [(p, d) for (p, d) in files if d is not None]
+    for i in range(0, modules):
+        files.append(('boot/modules/mod%03d' % (i), random_data('mod%d' % (i), module_size)))
+    checksums = {
+        'boot/initrd.gz': fnv1a(initrd),
+        'boot/initrd.lz4': fnv1a(initrd),
+        'boot/initrd-ind.lz4': fnv1a(mixed),
+        'boot/initrd.zst': fnv1a(initrd),
+        'boot/initrd-nosize.zst': fnv1a(mixed),
+    }
+    return [(p, d, checksums.get(p, None) or fnv1a(d)) for (p, d) in files]
+
+# Write the tree out to a staging directory. The image generation functions
+# are given the parent of this, which they can use for temporary files.
+def stage_tree(tree, dir):
+    os.makedirs(os.path.join(dir, 'boot', 'modules'))
+    for (path, data, checksum) in tree:
+        with open(os.path.join(dir, path), 'wb') as f:
+            f.write(data)
+
+def make_blank(path, size):
+    with open(path, 'wb') as f:
+        f.truncate(size << 20)
+
+def make_ext(path, type, size, tree, stage, fragment):
+    if not which('mke2fs') or not which('debugfs'):
+        return 'e2fsprogs not found'
+
+    make_blank(path, size)
+    run('mke2fs', '-q', '-F', '-t', type, '-b', '1024', path)
+
+    # Build a debugfs command script to populate the image.
+    cmds = ['mkdir boot', 'mkdir boot/modules']
+    if fragment:
+        filler = os.path.join(stage, 'filler')
+        with open(filler, 'wb') as f:
+            f.write(random_data('filler', 1024))
+        cmds += ['mkdir fill']
+        cmds += ['write %s fill/%d' % (filler, i) for i in range(0, filler_count * 2)]
+        cmds += ['rm fill/%d' % (i) for i in range(0, filler_count * 2, 2)]
+    for (file, data, checksum) in tree:
+        cmds.append('write %s %s' % (os.path.join(stage, 'tree', file), file))
+
+    script = os.path.join(stage, 'debugfs.cmds')
+    with open(script, 'w') as f:
+        f.write('\n'.join(cmds) + '\n')
+    run('debugfs', '-w', '-f', script, path)
+    return None
+
+def make_fat(path, type, size, tree, stage, fragment):
+    if not which('mkfs.fat') or not which('mcopy'):
+        return 'dosfstools/mtools not found'
+
+    make_blank(path, size)
+    run('mkfs.fat', '-F', type[3:], '-s', '1', path)
+
+    os.environ['MTOOLS_SKIP_CHECK'] = '1'
+    run('mmd', '-i', path, '::/boot', '::/boot/modules')
+    if fragment:
+        filler = os.path.join(stage, 'filler')
+        with open(filler, 'wb') as f:
+            f.write(random_data('filler', 512))
+        run('mmd', '-i', path, '::/fill')
+        for i in range(0, filler_count * 2):
+            run('mcopy', '-i', path, filler, '::/fill/%d' % (i))
+        for i in range(0, filler_count * 2, 2):
+            run('mdel', '-i', path, '::/fill/%d' % (i))
+    for (file, data, checksum) in tree:
+        run('mcopy', '-i', path, os.path.join(stage, 'tree', file), '::/' + file)
+    return None
+
+def make_iso(path, type, size, tree, stage, fragment):
+    if which('xorriso'):
+        cmd = ['xorriso', '-as', 'mkisofs']
+    elif which('genisoimage'):
+        cmd = ['genisoimage']
+    elif which('mkisofs'):
+        cmd = ['mkisofs']
+    else:
+        return 'xorriso/genisoimage/mkisofs not found'
+
+    run(*(cmd + ['-J', '-R', '-o', path, os.path.join(stage, 'tree')]))
+    return None
+
+# Wrap a filesystem image in an MBR partition table, starting at 1MB.
+def make_mbr(path):
+    with open(path, 'rb') as f:
+        fs = f.read()
+    blocks = len(fs) // 512
+    mbr = bytearray(512)
+    mbr[446:462] = struct.pack('<BBBBBBBBII', 0x80, 0, 2, 0, 0x83, 0, 0, 0, 2048, blocks)
+    mbr[510:512] = b'\x55\xaa'
+    with open(path, 'wb') as f:
+        f.write(mbr)
+        f.write(bytearray((2048 - 1) * 512))
+        f.write(fs)
+
+# Wrap a filesystem image in a GPT partition table, starting at 1MB.
+def make_gpt(path):
+    with open(path, 'rb') as f:
+        fs = f.read()
+    blocks = len(fs) // 512
+    entry_count = 128
+    entry_blocks = (entry_count * 128) // 512
+    total = 2048 + blocks + entry_blocks + 1
+
+    entries = bytearray(entry_count * 128)
+    entries[0:128] = struct.pack('<16s16sQQQ72s',
+        uuid.UUID('0fc63daf-8483-4772-8e79-3d69d8477de4').bytes_le,
+        uuid.uuid5(uuid.NAMESPACE_URL, path).bytes_le,
+        2048, 2048 + blocks - 1, 0, 'boot'.encode('utf-16-le'))
+    entries_crc = zlib.crc32(bytes(entries)) & 0xffffffff
+
+    def header(lba, alternate, entry_lba):
+        fields = [b'EFI PART', 0x10000, 92, 0, 0, lba, alternate, 2 + entry_blocks,
+            total - entry_blocks - 2, uuid.uuid5(uuid.NAMESPACE_DNS, path).bytes_le,
+            entry_lba, entry_count, 128, entries_crc]
+        data = struct.pack('<8sIIIIQQQQ16sQIII', *fields)
+        fields[3] = zlib.crc32(data) & 0xffffffff
+        return struct.pack('<8sIIIIQQQQ16sQIII', *fields).ljust(512, b'\0')
+
+    mbr = bytearray(512)
+    mbr[446:462] = struct.pack('<BBBBBBBBII', 0, 0, 2, 0, 0xee, 0xff, 0xff, 0xff, 1, min(total - 1, 0xffffffff))
+    mbr[510:512] = b'\x55\xaa'
+    with open(path, 'wb') as f:
+        f.write(mbr)
+        f.write(header(1, total - 1, 2))
+        f.write(entries)
+        f.write(bytearray((2048 - 2 - entry_blocks) * 512))
+        f.write(fs)
+        f.write(entries)
+        f.write(header(total - 1, 1, total - 1 - entry_blocks))
+
+def main():
+    if len(sys.argv) != 2:
+        print('Usage: %s <output directory>' % (sys.argv[0]))
+        sys.exit(2)
+
+    outdir = sys.argv[1]
+    if not os.path.isdir(outdir):
+        os.makedirs(outdir)
+
+    manifest = []
+    for (name, type, size, kernel_size, modules, fragment) in images:
+        path = os.path.join(outdir, name + '.img')
+        tree = make_tree(kernel_size, modules)
+        stage = tempfile.mkdtemp()
+        try:
+            stage_tree(tree, os.path.join(stage, 'tree'))
+            if type.startswith('ext'):
+                error = make_ext(path, type, size, tree, stage, fragment)
+            elif type.startswith('fat'):
+                error = make_fat(path, type, size, tree, stage, fragment)
+            else:
+                error = make_iso(path, type, size, tree, stage, fragment)
+        finally:
+            shutil.rmtree(stage)
+
+        if error:
+            print('Skipping %s: %s' % (name, error))
+            continue
+        if name.endswith('-mbr'):
+            make_mbr(path)
+        elif name.endswith('-gpt'):
+            make_gpt(path)
+
+        # Test the directories, and a selection of files.
+        args = ['-c'] if type == 'iso9660' else []
+        args += [path, '/boot', '/boot/modules']
+        for (file, data, checksum) in tree:
+            if not file.startswith('boot/modules/') or file.endswith('/mod007'):
+                args.append('/%s=%s' % (file, checksum))
+        manifest.append(' '.join(args))
+
+    with open(os.path.join(outdir, 'images.txt'), 'w') as f:
+        f.write('\n'.join(manifest) + '\n')
+
+if __name__ == '__main__':
+    main()
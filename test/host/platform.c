@@ -0,0 +1,312 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               Hosted test harness platform functions.
+ *
+ * This provides the console, error handling and configuration functions that
+ * the loader sources built into the harness expect from the rest of the
+ * loader. The configuration commands defined by those sources are never run
+ * in the harness, so the environment functions they use are just stubs.
+ */
+
+#include <lib/printf.h>
+#include <lib/utility.h>
+
+#include <config.h>
+#include <device.h>
+#include <host.h>
+#include <loader.h>
+#include <memory.h>
+
+/** Size of the output buffer. */
+#define OUTPUT_BUF_SIZE         256
+
+/** Output buffer state. */
+typedef struct output_buf {
+  int fd;                             /**< File descriptor to write to. */
+  size_t length;                      /**< Current buffer length. */
+  char buf[OUTPUT_BUF_SIZE];          /**< Buffered characters. */
+} output_buf_t;
+
+extern bool host_verbose;
+
+/** Ranges allocated with memory_alloc(). */
+static LIST_DECLARE(host_memory_ranges);
+
+/** Root and current environments (never created in the harness). */
+environ_t *root_environ;
+environ_t *current_environ;
+
+/** Helper for the printf() family to write to an output buffer.
+ * @param ch            Character to write.
+ * @param _output       Output buffer.
+ * @param total         Pointer to total character count. */
+static void output_helper(char ch, void *_output, int *total) {
+  output_buf_t *output = _output;
+
+  output->buf[output->length++] = ch;
+  if (ch == '\n' || output->length == OUTPUT_BUF_SIZE) {
+    host_write(output->fd, output->buf, output->length);
+    output->length = 0;
+  }
+
+  *total = *total + 1;
+}
+
+/** Write a formatted message to a file descriptor.
+ * @param fd            File descriptor to write to.
+ * @param fmt           Format string.
+ * @param args          Arguments to substitute into format.
+ * @return              Number of characters written. */
+static int output_vprintf(int fd, const char *fmt, va_list args) {
+  output_buf_t output;
+  int ret;
+
+  output.fd = fd;
+  output.length = 0;
+
+  ret = do_vprintf(output_helper, &output, fmt, args);
+  host_write(fd, output.buf, output.length);
+  return ret;
+}
+
+/** Output a formatted message to standard output.
+ * @param fmt           Format string used to create the message.
+ * @param args          Arguments to substitute into format.
+ * @return              Number of characters printed. */
+int vprintf(const char *fmt, va_list args) {
+  return output_vprintf(1, fmt, args);
+}
+
+/** Output a formatted message to standard output.
+ * @param fmt           Format string used to create the message.
+ * @param ...           Arguments to substitute into format.
+ * @return              Number of characters printed. */
+int printf(const char *fmt, ...) {
+  va_list args;
+  int ret;
+
+  va_start(args, fmt);
+  ret = vprintf(fmt, args);
+  va_end(args);
+
+  return ret;
+}
+
+/** Output a formatted message to standard error if verbose output is enabled.
+ * @param fmt           Format string used to create the message.
+ * @param args          Arguments to substitute into format.
+ * @return              Number of characters printed. */
+int dvprintf(const char *fmt, va_list args) {
+  return (host_verbose) ? output_vprintf(2, fmt, args) : 0;
+}
+
+/** Output a formatted message to standard error if verbose output is enabled.
+ * @param fmt           Format string used to create the message.
+ * @param ...           Arguments to substitute into format.
+ * @return              Number of characters printed. */
+int dprintf(const char *fmt, ...) {
+  va_list args;
+  int ret;
+
+  va_start(args, fmt);
+  ret = dvprintf(fmt, args);
+  va_end(args);
+
+  return ret;
+}
+
+/** Print a formatted message to standard error.
+ * @param fmt           Format string used to create the message.
+ * @param ...           Arguments to substitute into format. */
+static void error_printf(const char *fmt, ...) {
+  va_list args;
+
+  va_start(args, fmt);
+  output_vprintf(2, fmt, args);
+  va_end(args);
+}
+
+/** Raise an internal error.
+ * @param fmt           Error format string.
+ * @param ...           Values to substitute into format. */
+void internal_error(const char *fmt, ...) {
+  va_list args;
+
+  error_printf("Internal Error: ");
+
+  va_start(args, fmt);
+  output_vprintf(2, fmt, args);
+  va_end(args);
+
+  error_printf("\n");
+  host_exit(3);
+}
+
+/** Raise a boot error.
+ * @param fmt           Error format string.
+ * @param ...           Values to substitute into format. */
+void boot_error(const char *fmt, ...) {
+  va_list args;
+
+  error_printf("Boot Error: ");
+
+  va_start(args, fmt);
+  output_vprintf(2, fmt, args);
+  va_end(args);
+
+  error_printf("\n");
+  host_exit(3);
+}
+
+/** Raise a configuration error.
+ * @param fmt           Error format string.
+ * @param ...           Values to substitute into format. */
+void config_error(const char *fmt, ...) {
+  va_list args;
+
+  error_printf("Config Error: ");
+
+  va_start(args, fmt);
+  output_vprintf(2, fmt, args);
+  va_end(args);
+
+  error_printf("\n");
+}
+
+/**
+ * Allocate a range of "physical" memory.
+ *
+ * Allocations are tracked with a structure from malloc(), as the real memory
+ * managers do, so that the heap's own use of memory_alloc() is exercised in
+ * the same way as on the target.
+ *
+ * @param size          Size of the range (multiple of PAGE_SIZE).
+ * @param align         Alignment of the range (power of 2, at least PAGE_SIZE).
+ * @param min_addr      Minimum start address of the range (ignored).
+ * @param max_addr      Maximum end address of the range (ignored).
+ * @param type          Type to give the allocated range.
+ * @param flags         Behaviour flags.
+ * @param _phys         Where to store physical address of allocation.
+ *
+ * @return              Pointer to the allocated memory, or NULL on failure.
+ */
+void *memory_alloc(
+  phys_size_t size, phys_size_t align, phys_ptr_t min_addr, phys_ptr_t max_addr,
+  uint8_t type, unsigned flags, phys_ptr_t *_phys) {
+  memory_range_t *range;
+  void *addr;
+
+  addr = host_alloc(size, max(align, PAGE_SIZE));
+  if (!addr) {
+    if (flags & MEMORY_ALLOC_CAN_FAIL)
+      return NULL;
+
+    boot_error("Insufficient memory available (allocating %" PRIuPHYS " bytes)", size);
+  }
+
+  range = malloc(sizeof(*range));
+  range->start = (ptr_t)addr;
+  range->size = size;
+  range->type = type;
+  list_init(&range->header);
+  list_append(&host_memory_ranges, &range->header);
+
+  if (_phys)
+    *_phys = (ptr_t)addr;
+
+  return addr;
+}
+
+/** Free a range of "physical" memory.
+ * @param addr          Address of the range.
+ * @param size          Size of the range. */
+void memory_free(void *addr, phys_size_t size) {
+  list_foreach(&host_memory_ranges, iter) {
+    memory_range_t *range = list_entry(iter, memory_range_t, header);
+
+    if (range->start == (ptr_t)addr) {
+      if (range->size != size) {
+        internal_error(
+          "Bad memory_free size 0x%" PRIxPHYS " (expected 0x%" PRIxPHYS ")",
+          size, range->size);
+      }
+
+      list_remove(&range->header);
+      free(range);
+      host_free(addr);
+      return;
+    }
+  }
+
+  internal_error("Bad memory_free address %p", addr);
+}
+
+/** Get a copy of the ranges allocated with memory_alloc().
+ * @param map           List to place the copy into. */
+void memory_snapshot(list_t *map) {
+  list_init(map);
+
+  list_foreach(&host_memory_ranges, iter) {
+    memory_range_t *range = list_entry(iter, memory_range_t, header);
+    memory_range_t *dup = malloc(sizeof(*dup));
+
+    dup->start = range->start;
+    dup->size = range->size;
+    dup->type = range->type;
+    list_init(&dup->header);
+    list_append(map, &dup->header);
+  }
+}
+
+/** Insert a value into an environment (unused in the harness). */
+value_t *environ_insert(environ_t *env, const char *name, const value_t *value) {
+  internal_error("environ_insert() is not supported");
+}
+
+/** Remove a value from an environment (unused in the harness). */
+void environ_remove(environ_t *env, const char *name) {
+  internal_error("environ_remove() is not supported");
+}
+
+/** Detect and register all devices (disks are registered by main()). */
+void target_device_probe(void) {
+}
+
+/** Halt the harness. */
+void target_halt(void) {
+  host_exit(3);
+}
+
+/** Reboot the system (exits the harness). */
+void target_reboot(void) {
+  host_exit(3);
+}
+
+/** Exit the loader. */
+void target_exit(void) {
+  host_exit(0);
+}
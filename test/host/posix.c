@@ -0,0 +1,136 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Gil Mendes <gil00mendes@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief               Hosted test harness system interface.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "host.h"
+
+/** Open a file for reading.
+ * @param path          Path to the file.
+ * @param _size         Where to store the size of the file.
+ * @return              File descriptor, or -1 on failure. */
+int host_file_open(const char *path, unsigned long long *_size) {
+  struct stat st;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  *_size = st.st_size;
+  return fd;
+}
+
+/** Close a file.
+ * @param fd            File descriptor to close. */
+void host_file_close(int fd) {
+  close(fd);
+}
+
+/** Read from a file.
+ * @param fd            File descriptor to read from.
+ * @param buf           Buffer to read into.
+ * @param count         Number of bytes to read.
+ * @param offset        Offset in the file to read from.
+ * @return              0 on success, -1 on failure or short read. */
+int host_file_read(int fd, void *buf, size_t count, unsigned long long offset) {
+  while (count) {
+    ssize_t ret = pread(fd, buf, count, offset);
+
+    if (ret <= 0)
+      return -1;
+
+    buf = (char *)buf + ret;
+    count -= ret;
+    offset += ret;
+  }
+
+  return 0;
+}
+
+/** Allocate aligned memory.
+ * @param size          Size to allocate.
+ * @param align         Alignment of the allocation.
+ * @return              Pointer to allocation, or NULL on failure. */
+void *host_alloc(size_t size, size_t align) {
+  void *addr;
+
+  if (posix_memalign(&addr, align, size) != 0)
+    return NULL;
+
+  return addr;
+}
+
+/** Free memory allocated with host_alloc().
+ * @param addr          Address to free. */
+void host_free(void *addr) {
+  free(addr);
+}
+
+/** Write to a file descriptor.
+ * @param fd            File descriptor to write to.
+ * @param buf           Data to write.
+ * @param count         Number of bytes to write. */
+void host_write(int fd, const char *buf, size_t count) {
+  while (count) {
+    ssize_t ret = write(fd, buf, count);
+
+    if (ret <= 0)
+      return;
+
+    buf += ret;
+    count -= ret;
+  }
+}
+
+/** Get the current monotonic time.
+ * @return              Time in microseconds. */
+unsigned long long host_time_usec(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((unsigned long long)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/** Exit the process.
+ * @param status        Exit status. */
+void host_exit(int status) {
+  exit(status);
+}